@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Allocation checks of the capture display loop, only built with ALLOC_CHECK=1.
+ * @file alloc_check.c
+ *
+ * The interposed functions are defined by the executable so every library resolves them here first,
+ * the C library allocator is reached through its __libc_ entry points and the mappings through
+ * the system calls. Nothing in a hook allocates, calls made while a hook runs, such as the first
+ * backtrace() loading the unwinder, are forwarded without being counted.
+ *
+ * A call in the armed frame loop is attributed to the first frame of its backtrace outside the C library,
+ * so an application strdup() or fopen() is the application's. Only calls attributed to the executable are
+ * violations, the GLES driver allocating behind a GL call is counted per library for information.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "options.h"
+#include "capture.h"
+#include "alloc_check.h"
+#include "log.h"
+
+/* C library allocator behind the interposed functions. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+
+/** Frames of the backtrace inside alloc_check.c, record_violation() and alloc_enter(). */
+#define ALLOC_CHECK_SKIP_FRAMES 2
+/** First frame of the backtrace outside alloc_check.c, past the interposed function. */
+#define ALLOC_CHECK_CALLER_FRAME (ALLOC_CHECK_SKIP_FRAMES + 1)
+
+/**
+ * Interposed function families counted per thread.
+ */
+enum alloc_function {
+	ALLOC_MALLOC,
+	ALLOC_CALLOC,
+	ALLOC_REALLOC,
+	ALLOC_FREE,
+	/** memalign, posix_memalign, aligned_alloc and valloc. */
+	ALLOC_MEMALIGN,
+	ALLOC_MMAP,
+	ALLOC_MUNMAP,
+	ALLOC_MREMAP,
+	/** Number of counted functions. */
+	ALLOC_FUNCTIONS,
+};
+
+static const char * const alloc_names[ALLOC_FUNCTIONS] = {
+	"malloc", "calloc", "realloc", "free", "memalign", "mmap", "munmap", "mremap",
+};
+
+/**
+ * Allocation counts of one thread.
+ * Counters are updated atomically, the last slot is shared once every slot was claimed.
+ */
+struct alloc_thread {
+	/** Name given by alloc_check_thread(), NULL for threads that never registered. */
+	const char *name;
+	/** Kernel thread id of the first thread using the slot. */
+	pid_t tid;
+	/** The thread runs the frame loop, its calls while armed are violations. */
+	bool watched;
+	/** Calls per function, see enum alloc_function. */
+	uint64_t calls[ALLOC_FUNCTIONS];
+	/** Bytes requested by the allocating calls. */
+	uint64_t bytes;
+	/** Calls made by the executable while the frame loop was armed. */
+	uint64_t violations;
+	/** Calls made by libraries while the frame loop was armed, not violations. */
+	uint64_t library_calls;
+};
+
+/**
+ * Library allocating in the armed frame loop.
+ */
+struct alloc_library {
+	/** Load address of the library, NULL while the slot is free. */
+	void *base;
+	/** Path of the library, copied since a driver may be unloaded before the report. */
+	char path[ALLOC_CHECK_PATH];
+	/** Calls attributed to the library. */
+	uint64_t calls;
+};
+
+/**
+ * Call made by a frame loop thread while armed.
+ */
+struct alloc_violation {
+	/** Function called, see enum alloc_function. */
+	int function;
+	/** Bytes requested, 0 for releases. */
+	size_t size;
+	/** Thread making the call. */
+	struct alloc_thread *thread;
+	/** Number of valid return addresses in stack. */
+	int depth;
+	/** Return addresses from the interposed function outwards. */
+	void *stack[ALLOC_CHECK_FRAMES];
+};
+
+static struct alloc_thread g_threads[ALLOC_CHECK_THREADS];
+static unsigned int g_num_threads;
+static struct alloc_violation g_violations[ALLOC_CHECK_VIOLATIONS];
+static unsigned int g_num_violations;
+static struct alloc_library g_libraries[ALLOC_CHECK_LIBRARIES];
+/** Load address of the executable, calls attributed to it are violations. */
+static void *g_executable;
+/** Load address of the C library, its frames are skipped to find the code a call was made for. */
+static void *g_libc;
+static bool g_armed;
+/** Set once the loop was armed, a check that never armed verified nothing. */
+static bool g_was_armed;
+
+/** Counters of the calling thread, claimed on its first call. */
+static __thread struct alloc_thread *t_thread;
+/** A hook is running on the calling thread, nested calls are forwarded without counting. */
+static __thread bool t_in_hook;
+
+/**
+ * Counters of the calling thread.
+ * @return slot of the thread, the shared last slot when every slot was claimed.
+ */
+static struct alloc_thread *current_thread(void)
+{
+	unsigned int slot;
+
+	if (t_thread) return t_thread;
+	slot = __atomic_fetch_add(&g_num_threads, 1, __ATOMIC_RELAXED);
+	if (slot >= ALLOC_CHECK_THREADS) slot = ALLOC_CHECK_THREADS - 1;
+	else g_threads[slot].tid = syscall(SYS_gettid);
+	t_thread = &g_threads[slot];
+	return t_thread;
+}
+
+/**
+ * Find the object a call was made for, the first frame outside the C library.
+ * @param stack return addresses from the caller of the interposed function outwards.
+ * @param depth number of return addresses.
+ * @param info returns the object of the frame, the C library when every frame is in it.
+ * @return true when the call was made by the executable.
+ */
+static bool called_by_executable(void **stack, int depth, Dl_info *info)
+{
+	for (int i = 0; i < depth; i++)
+	{
+		/* Code outside any object, such as JIT compiled shaders, is skipped like the C library. */
+		if (!dladdr(stack[i], info) || info->dli_fbase == g_libc) continue;
+		return info->dli_fbase == g_executable;
+	}
+	info->dli_fbase = g_libc;
+	info->dli_fname = "the C library";
+	return false;
+}
+
+/**
+ * Count a library call made inside the armed frame loop.
+ * @param info object the call was attributed to.
+ */
+static void count_library_call(const Dl_info *info)
+{
+	for (int i = 0; i < ALLOC_CHECK_LIBRARIES; i++)
+	{
+		struct alloc_library *library = &g_libraries[i];
+		void *expected = NULL;
+
+		if (__atomic_compare_exchange_n(&library->base, &expected, info->dli_fbase, false,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			strncpy(library->path, info->dli_fname ? info->dli_fname : "unknown code", sizeof(library->path) - 1);
+		}
+		else if (expected != info->dli_fbase && i < ALLOC_CHECK_LIBRARIES - 1)
+		{
+			continue;
+		}
+		__atomic_add_fetch(&library->calls, 1, __ATOMIC_RELAXED);
+		return;
+	}
+}
+
+/**
+ * Attribute a call made inside the armed frame loop, keeping the backtrace of a violation.
+ * @param thread counters of the calling thread.
+ * @param function interposed function called.
+ * @param size bytes requested.
+ */
+static __attribute__((noinline)) void record_violation(struct alloc_thread *thread, int function, size_t size)
+{
+	struct alloc_violation *violation;
+	void *stack[ALLOC_CHECK_FRAMES];
+	unsigned int slot;
+	Dl_info info;
+	int depth;
+
+	depth = backtrace(stack, ALLOC_CHECK_FRAMES);
+	if (depth > ALLOC_CHECK_CALLER_FRAME &&
+		!called_by_executable(stack + ALLOC_CHECK_CALLER_FRAME, depth - ALLOC_CHECK_CALLER_FRAME, &info))
+	{
+		__atomic_add_fetch(&thread->library_calls, 1, __ATOMIC_RELAXED);
+		count_library_call(&info);
+		return;
+	}
+
+	__atomic_add_fetch(&thread->violations, 1, __ATOMIC_RELAXED);
+	slot = __atomic_fetch_add(&g_num_violations, 1, __ATOMIC_RELAXED);
+	if (slot >= ALLOC_CHECK_VIOLATIONS) return;
+
+	violation = &g_violations[slot];
+	violation->function = function;
+	violation->size = size;
+	violation->thread = thread;
+	violation->depth = depth;
+	memcpy(violation->stack, stack, depth * sizeof(stack[0]));
+}
+
+/**
+ * Count a call of an interposed function and check it against the frame loop.
+ * @param function interposed function called.
+ * @param size bytes requested.
+ */
+static __attribute__((noinline)) void alloc_enter(int function, size_t size)
+{
+	struct alloc_thread *thread;
+
+	if (t_in_hook) return;
+	t_in_hook = true;
+	thread = current_thread();
+	__atomic_add_fetch(&thread->calls[function], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&thread->bytes, size, __ATOMIC_RELAXED);
+	if (thread->watched && __atomic_load_n(&g_armed, __ATOMIC_RELAXED))
+		record_violation(thread, function, size);
+	t_in_hook = false;
+}
+
+void *malloc(size_t size)
+{
+	alloc_enter(ALLOC_MALLOC, size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	alloc_enter(ALLOC_CALLOC, count * size);
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	alloc_enter(ALLOC_REALLOC, size);
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	if (!ptr) return;
+	alloc_enter(ALLOC_FREE, 0);
+	__libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	alloc_enter(ALLOC_MEMALIGN, size);
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	alloc_enter(ALLOC_MEMALIGN, size);
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	void *mem;
+
+	if (alignment % sizeof(void *) || (alignment & (alignment - 1))) return EINVAL;
+	alloc_enter(ALLOC_MEMALIGN, size);
+	mem = __libc_memalign(alignment, size);
+	if (!mem) return ENOMEM;
+	*ptr = mem;
+	return 0;
+}
+
+void *valloc(size_t size)
+{
+	alloc_enter(ALLOC_MEMALIGN, size);
+	return __libc_valloc(size);
+}
+
+/**
+ * Map memory with the system call, the C library wrapper is the function being replaced.
+ * @return mapped address or MAP_FAILED with errno set.
+ */
+static void *mmap_syscall(void *addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+#ifdef SYS_mmap2
+	return (void *)syscall(SYS_mmap2, addr, length, prot, flags, fd, (unsigned long)(offset >> 12));
+#else
+	return (void *)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+#endif
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	alloc_enter(ALLOC_MMAP, length);
+	return mmap_syscall(addr, length, prot, flags, fd, offset);
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+	alloc_enter(ALLOC_MMAP, length);
+	return mmap_syscall(addr, length, prot, flags, fd, offset);
+}
+
+int munmap(void *addr, size_t length)
+{
+	alloc_enter(ALLOC_MUNMAP, 0);
+	return syscall(SYS_munmap, addr, length);
+}
+
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...)
+{
+	void *new_address = NULL;
+	va_list args;
+
+	if (flags & MREMAP_FIXED)
+	{
+		va_start(args, flags);
+		new_address = va_arg(args, void *);
+		va_end(args);
+	}
+	alloc_enter(ALLOC_MREMAP, new_size);
+	return (void *)syscall(SYS_mremap, old_address, old_size, new_size, flags, new_address);
+}
+
+void alloc_check_arm(bool armed)
+{
+	if (armed) g_was_armed = true;
+	__atomic_store_n(&g_armed, armed, __ATOMIC_RELAXED);
+}
+
+void alloc_check_thread(const char *name)
+{
+	struct alloc_thread *thread = current_thread();
+
+	thread->name = name;
+	thread->watched = true;
+}
+
+unsigned int alloc_check_report(void)
+{
+	unsigned int threads = __atomic_load_n(&g_num_threads, __ATOMIC_RELAXED);
+	unsigned int violations = __atomic_load_n(&g_num_violations, __ATOMIC_RELAXED);
+	struct alloc_thread *thread;
+
+	if (threads > ALLOC_CHECK_THREADS) threads = ALLOC_CHECK_THREADS;
+	LOGS_INF("Allocations per thread:");
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		thread = &g_threads[i];
+		LOGS_INF("%-10s tid %-6d %llu malloc %llu calloc %llu realloc %llu free %llu memalign "
+			"%llu mmap %llu munmap %llu mremap, %llu bytes, %llu in the frame loop, %llu by libraries in the frame loop",
+			thread->name ? thread->name : "-", (int)thread->tid,
+			(unsigned long long)thread->calls[ALLOC_MALLOC], (unsigned long long)thread->calls[ALLOC_CALLOC],
+			(unsigned long long)thread->calls[ALLOC_REALLOC], (unsigned long long)thread->calls[ALLOC_FREE],
+			(unsigned long long)thread->calls[ALLOC_MEMALIGN], (unsigned long long)thread->calls[ALLOC_MMAP],
+			(unsigned long long)thread->calls[ALLOC_MUNMAP], (unsigned long long)thread->calls[ALLOC_MREMAP],
+			(unsigned long long)thread->bytes, (unsigned long long)thread->violations,
+			(unsigned long long)thread->library_calls);
+	}
+
+	for (int i = 0; i < ALLOC_CHECK_LIBRARIES; i++)
+	{
+		struct alloc_library *library = &g_libraries[i];
+		if (!__atomic_load_n(&library->base, __ATOMIC_ACQUIRE)) break;
+		LOGS_INF("%llu calls by %s%s in the frame loop, not checked",
+			(unsigned long long)__atomic_load_n(&library->calls, __ATOMIC_RELAXED), library->path,
+			i == ALLOC_CHECK_LIBRARIES - 1 ? " and later libraries" : "");
+	}
+
+	/* The backtraces are written straight to stdout, queued messages go first. */
+	for (unsigned int i = 0; i < violations && i < ALLOC_CHECK_VIOLATIONS; i++)
+	{
+		struct alloc_violation *violation = &g_violations[i];
+		int skip = violation->depth > ALLOC_CHECK_SKIP_FRAMES ? ALLOC_CHECK_SKIP_FRAMES : 0;
+
+		if (violation->size)
+		{
+			LOGS_ERR("%s of %zu bytes by the %s thread in the frame loop:", alloc_names[violation->function],
+				violation->size, violation->thread->name);
+		}
+		else
+		{
+			LOGS_ERR("%s by the %s thread in the frame loop:", alloc_names[violation->function],
+				violation->thread->name);
+		}
+		log_flush();
+		backtrace_symbols_fd(violation->stack + skip, violation->depth - skip, STDOUT_FILENO);
+	}
+	if (violations > ALLOC_CHECK_VIOLATIONS)
+		LOGS_ERR("%u more calls in the frame loop without backtrace", violations - ALLOC_CHECK_VIOLATIONS);
+	return violations;
+}
+
+/**
+ * Run the capture display loop for the -n count of steady state frames and fail on any allocation.
+ * The loop is armed once every buffer was displayed, the first pass imports and sizes per buffer resources.
+ * @param cap_ctx Capture data management structure with V4L2 buffer mapping.
+ * @param disp_ctx Display data management sturcture with OpenGL refernces.
+ * @param opt User selected progam configuration options.
+ * @return 0 when the loop made no allocation, negative on error or violation.
+ */
+static int alloc_check_capture(void *cap_ctx, void *disp_ctx, struct options *opt)
+{
+	struct capture_context *cap = cap_ctx;
+	unsigned int violations;
+	int ret;
+
+	cap->frame_limit = opt->capture_count;
+	ret = capture_and_display(cap_ctx, disp_ctx, opt);
+	violations = alloc_check_report();
+	if (ret) return ret;
+	if (!g_was_armed)
+	{
+		LOGS_ERR("Capture ended before every buffer was displayed, nothing was checked");
+		return -1;
+	}
+	if (violations)
+	{
+		LOGS_ERR("%u allocating calls in %d frames of the frame loop", violations, opt->capture_count);
+		return -1;
+	}
+	LOGS_INF("No allocating call in %d frames of the frame loop", opt->capture_count);
+	return 0;
+}
+
+static struct usage alloc_check_usage = {
+	.name = "ALLOC_CHECK",
+	.description = "Run the capture display loop for -n frames and fail if it allocates",
+	.function = alloc_check_capture,
+};
+
+/**
+ * Add the allocation check usage, load the unwinder and find the executable and C library before any thread is armed.
+ * @note The contstructor attribute is a GCC extension.
+ */
+__attribute__((constructor (PRIORITY_NEW_USAGE))) void add_alloc_check_usage(void)
+{
+	void *stack[1];
+	Dl_info info;
+
+	insert_usage(&alloc_check_usage, false);
+	backtrace(stack, 1);
+	if (dladdr((void *)add_alloc_check_usage, &info)) g_executable = info.dli_fbase;
+	if (dladdr((void *)__libc_malloc, &info)) g_libc = info.dli_fbase;
+}
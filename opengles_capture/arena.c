@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Contiguous memory arena for user allocated video buffers.
+ * @file arena.c
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "log.h"
+
+int arena_create(struct arena *arena, size_t size)
+{
+	void *base;
+	size_t map_size;
+
+	memset(arena, 0, sizeof(*arena));
+	size = (size + ARENA_HUGE_PAGE_SIZE - 1) & ~((size_t)ARENA_HUGE_PAGE_SIZE - 1);
+
+	/* Explicit huge pages only succeed when the administrator reserved a pool. */
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	if (base != MAP_FAILED)
+	{
+		arena->backing = ARENA_HUGETLB;
+	}
+	else
+	{
+		LOGS_DBG("MAP_HUGETLB unavailable %d - %s", errno, strerror(errno));
+
+		/*
+		 * Over allocate by one huge page and trim the mapping so the arena starts on a
+		 * huge page boundary, otherwise the kernel cannot back the start with a huge page.
+		 */
+		map_size = size + ARENA_HUGE_PAGE_SIZE;
+		base = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+		{
+			LOGS_ERR("Unable to map arena of %zu bytes %d - %s", size, errno, strerror(errno));
+			return -errno;
+		}
+		uintptr_t start = ((uintptr_t)base + ARENA_HUGE_PAGE_SIZE - 1) & ~((uintptr_t)ARENA_HUGE_PAGE_SIZE - 1);
+		if (start != (uintptr_t)base)
+			munmap(base, start - (uintptr_t)base);
+		if ((uintptr_t)base + map_size != start + size)
+			munmap((void*)(start + size), (uintptr_t)base + map_size - (start + size));
+		base = (void*)start;
+
+		if (madvise(base, size, MADV_HUGEPAGE) < 0)
+			LOGS_WRN("Transparent huge pages unavailable %d - %s", errno, strerror(errno));
+		arena->backing = ARENA_THP;
+
+		/* Prefault every page now so the first frames don't take page faults. */
+		memset(base, 0, size);
+	}
+	arena->base = base;
+	arena->size = size;
+
+	/* Keep the buffers resident, a failure usually means RLIMIT_MEMLOCK is too small. */
+	if (mlock(base, size) < 0)
+	{
+		LOGS_WRN("Unable to lock arena of %zu bytes %d - %s", size, errno, strerror(errno));
+	}
+	else
+	{
+		arena->locked = true;
+	}
+
+	LOGS_INF("Arena of %zu bytes backed by %s%s", size,
+		arena_backing_name(arena->backing), arena->locked ? ", locked" : "");
+	return 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size, size_t align)
+{
+	size_t offset;
+
+	if (align < ARENA_CACHE_LINE) align = ARENA_CACHE_LINE;
+	offset = (arena->used + align - 1) & ~(align - 1);
+	if (offset + size > arena->size)
+	{
+		LOGS_ERR("Arena exhausted, %zu of %zu bytes used, %zu requested", arena->used, arena->size, size);
+		return NULL;
+	}
+	arena->used = offset + size;
+	return (uint8_t*)arena->base + offset;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	if (arena->base)
+	{
+		if (arena->locked) munlock(arena->base, arena->size);
+		munmap(arena->base, arena->size);
+	}
+	memset(arena, 0, sizeof(*arena));
+}
+
+const char *arena_backing_name(enum arena_backing backing)
+{
+	switch (backing)
+	{
+		case ARENA_HUGETLB: return "hugetlb pages";
+		case ARENA_THP: return "transparent huge pages";
+		default: return "no memory";
+	}
+}
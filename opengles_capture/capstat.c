@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Live view of the metrics published by the capture application.
+ * @file capstat.c
+ *
+ * Attaches read-only to the shared memory segment and either refreshes a top style view
+ * or prints one JSON object and exits. Reading never blocks or slows the capture loop.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "options.h"
+#include "metrics.h"
+
+/** Refresh period of the live view in milliseconds. */
+#define DEFAULT_INTERVAL_MS 1000
+
+/** Name of each latency stage, in the order of enum latency_stage. */
+static const char * const stage_names[METRICS_LATENCY_STAGES] = {
+	"capture to dqbuf",
+	"dqbuf to upload",
+	"upload to swap",
+	"capture to present",
+};
+
+/** JSON key of each latency stage. */
+static const char * const stage_keys[METRICS_LATENCY_STAGES] = {
+	"dequeue",
+	"upload",
+	"present",
+	"total",
+};
+
+/**
+ * Read the monotonic clock, the clock of every metrics timestamp.
+ * @return current monotonic time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Map the metrics segment read-only and check its layout.
+ * @param name POSIX shared memory name.
+ * @param metrics returns the mapped block.
+ * @return 0 on success, negative error when the segment is missing or incompatible.
+ */
+static int attach(const char *name, const struct capture_metrics **metrics)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) return -errno;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(**metrics))
+	{
+		close(fd);
+		return -EPROTO;
+	}
+	addr = mmap(NULL, sizeof(**metrics), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) return -errno;
+
+	*metrics = addr;
+	if (__atomic_load_n(&(*metrics)->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC ||
+		(*metrics)->version != METRICS_VERSION || (*metrics)->size < sizeof(**metrics))
+	{
+		munmap(addr, sizeof(**metrics));
+		*metrics = NULL;
+		return -EPROTO;
+	}
+	return 0;
+}
+
+/**
+ * Unmap the metrics segment.
+ * @param metrics mapped block, may be NULL.
+ */
+static void detach(const struct capture_metrics *metrics)
+{
+	if (metrics) munmap((void*)metrics, sizeof(*metrics));
+}
+
+/**
+ * Check whether the writer of a block is still running.
+ * @param copy consistent copy of the block.
+ * @return true while the capture process exists.
+ */
+static bool writer_alive(const struct capture_metrics *copy)
+{
+	return kill(copy->pid, 0) == 0 || errno == EPERM;
+}
+
+/**
+ * Print one consistent copy as a JSON object.
+ * @param copy consistent copy of the block.
+ */
+static void print_json(const struct capture_metrics *copy)
+{
+	uint64_t now = monotonic_ns();
+
+	printf("{\"version\": %u, \"pid\": %u, \"running\": %s, \"width\": %u, \"height\": %u, "
+		"\"interval_ns\": %llu, \"uptime_ns\": %llu, \"age_ns\": %llu, \"fps\": %.3f, "
+		"\"captured\": %llu, \"displayed\": %llu, \"dropped\": %llu, \"errors\": %llu, \"stale\": %llu, "
+		"\"last_sequence\": %u, \"driver_queued\": %u, \"display_queued\": %u, \"latency_ns\": {",
+		copy->version, copy->pid, writer_alive(copy) ? "true" : "false", copy->width, copy->height,
+		(unsigned long long)copy->interval_ns, (unsigned long long)(now - copy->start_ns),
+		(unsigned long long)(copy->update_ns ? now - copy->update_ns : 0), copy->fps_milli / 1000.0,
+		(unsigned long long)copy->captured, (unsigned long long)copy->displayed,
+		(unsigned long long)copy->dropped, (unsigned long long)copy->errors, (unsigned long long)copy->stale,
+		copy->last_sequence, copy->driver_queued, copy->display_queued);
+	for (int i = 0; i < METRICS_LATENCY_STAGES; i++)
+	{
+		const struct metrics_latency *lat = &copy->latency[i];
+		printf("%s\"%s\": {\"last\": %llu, \"p50\": %llu, \"p99\": %llu, \"max\": %llu}", i ? ", " : "",
+			stage_keys[i], (unsigned long long)lat->last_ns, (unsigned long long)lat->p50_ns,
+			(unsigned long long)lat->p99_ns, (unsigned long long)lat->max_ns);
+	}
+	printf("}}\n");
+}
+
+/**
+ * Redraw the live view.
+ * @param name POSIX shared memory name.
+ * @param copy consistent copy of the block.
+ * @param previous copy shown at the last refresh, zeroed before the first.
+ * @param elapsed_ns time since the last refresh.
+ */
+static void print_view(const char *name, const struct capture_metrics *copy,
+	const struct capture_metrics *previous, uint64_t elapsed_ns)
+{
+	uint64_t now = monotonic_ns();
+	double capture_fps = 0.0;
+
+	if (previous->pid == copy->pid && previous->captured && elapsed_ns)
+		capture_fps = (copy->captured - previous->captured) * 1e9 / elapsed_ns;
+
+	printf("\033[H\033[2J");
+	printf("capstat %s  pid %u %s  %ux%u  up %.0f s\n\n", name, copy->pid,
+		writer_alive(copy) ? "running" : "exited", copy->width, copy->height, (now - copy->start_ns) / 1e9);
+	printf("%-20s %10.2f fps  (nominal %.2f)\n", "captured", capture_fps,
+		copy->interval_ns ? 1e9 / copy->interval_ns : 0.0);
+	printf("%-20s %10.2f fps\n", "displayed", copy->fps_milli / 1000.0);
+	printf("%-20s %10llu\n", "frames captured", (unsigned long long)copy->captured);
+	printf("%-20s %10llu\n", "frames displayed", (unsigned long long)copy->displayed);
+	printf("%-20s %10llu\n", "dropped", (unsigned long long)copy->dropped);
+	printf("%-20s %10llu\n", "errors", (unsigned long long)copy->errors);
+	printf("%-20s %10llu\n", "stale", (unsigned long long)copy->stale);
+	printf("%-20s %10u\n", "driver queued", copy->driver_queued);
+	printf("%-20s %10u\n", "display queued", copy->display_queued);
+	printf("%-20s %10u\n\n", "last sequence", copy->last_sequence);
+	printf("%-20s %10s %10s %10s %10s\n", "latency ms", "last", "p50", "p99", "max");
+	for (int i = 0; i < METRICS_LATENCY_STAGES; i++)
+	{
+		const struct metrics_latency *lat = &copy->latency[i];
+		printf("%-20s %10.3f %10.3f %10.3f %10.3f\n", stage_names[i], lat->last_ns / 1e6,
+			lat->p50_ns / 1e6, lat->p99_ns / 1e6, lat->max_ns / 1e6);
+	}
+	fflush(stdout);
+}
+
+/**
+ * Print the command line options.
+ * @param argv command line arguments.
+ */
+static void usage(char * const argv[])
+{
+	printf("Usage: %s [options]\n", argv[0]);
+	printf("-x NAME,  --metrics NAME shared memory segment of the capture metrics (default %s)\n",
+		DEFAULT_METRICS);
+	printf("-j, --json print one JSON object and exit\n");
+	printf("-i MS,  --interval MS refresh period of the live view (default %d)\n", DEFAULT_INTERVAL_MS);
+	printf("-h, --help\n");
+}
+
+int main(int argc, char * const argv[])
+{
+	static struct option long_options[] = {
+		{"metrics",		required_argument,	0, 'x' },
+		{"json",		no_argument,		0, 'j' },
+		{"interval",	required_argument,	0, 'i' },
+		{"help",		no_argument,		0, 'h' },
+		{0},
+	};
+	const char *name = DEFAULT_METRICS;
+	const struct capture_metrics *metrics = NULL;
+	struct capture_metrics copy;
+	struct capture_metrics previous;
+	struct timespec period;
+	uint64_t shown_ns = 0;
+	int interval_ms = DEFAULT_INTERVAL_MS;
+	bool json = false;
+	int ret;
+	int o;
+
+	while ((o = getopt_long(argc, argv, "x:ji:h", long_options, NULL)) != -1)
+	{
+		switch (o)
+		{
+			case 'x':
+				name = optarg;
+				break;
+			case 'j':
+				json = true;
+				break;
+			case 'i':
+				interval_ms = atoi(optarg);
+				if (interval_ms <= 0)
+				{
+					printf("unknown interval %s\n", optarg);
+					usage(argv);
+					return 1;
+				}
+				break;
+			case 'h':
+				usage(argv);
+				return 0;
+			default:
+				usage(argv);
+				return 1;
+		}
+	}
+
+	if (json)
+	{
+		ret = attach(name, &metrics);
+		if (!ret) ret = metrics_read(metrics, &copy);
+		if (ret)
+		{
+			fprintf(stderr, "Unable to read metrics %s: %s\n", name, strerror(-ret));
+			return 1;
+		}
+		print_json(&copy);
+		detach(metrics);
+		return 0;
+	}
+
+	memset(&previous, 0, sizeof(previous));
+	period.tv_sec = interval_ms / 1000;
+	period.tv_nsec = (interval_ms % 1000) * 1000000l;
+	while (1)
+	{
+		/* Keep showing the last values of an exited capture until a new one replaces the segment. */
+		if (metrics && metrics_read(metrics, &copy) == 0 && !writer_alive(&copy))
+		{
+			const struct capture_metrics *next;
+			if (attach(name, &next) == 0)
+			{
+				detach(metrics);
+				metrics = next;
+			}
+		}
+		if (!metrics)
+		{
+			ret = attach(name, &metrics);
+			if (ret)
+			{
+				printf("\033[H\033[2Jcapstat %s: waiting for capture (%s)\n", name, strerror(-ret));
+				fflush(stdout);
+				nanosleep(&period, NULL);
+				continue;
+			}
+		}
+		if (metrics_read(metrics, &copy) == 0)
+		{
+			uint64_t now = monotonic_ns();
+			print_view(name, &copy, &previous, now - shown_ns);
+			previous = copy;
+			shown_ns = now;
+		}
+		nanosleep(&period, NULL);
+	}
+	return 0;
+}
@@ -35,27 +35,111 @@
 #include <getopt.h>
 #include <errno.h>
 #include <signal.h>
+#include <poll.h>
+#include <pthread.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include <linux/videodev2.h>
 #include <linux/v4l2-controls.h>
+#include <linux/dma-buf.h>
 
 #include "options.h"
 #include "capture.h"
 #include "display.h"
+#include "frame.h"
+#include "media_pipeline.h"
+#include "trace.h"
+#include "probes.h"
+#include "startup.h"
+#include "event_loop.h"
+#include "alloc_check.h"
+#include "capture_source.h"
 #include "log.h"
 
+/** Number of frames between capture thread timing reports. */
+#define TIMING_REPORT_FRAMES 300
+/** Interval between frame rate and render timing reports in milliseconds. */
+#define STATS_INTERVAL_MS 5000
+
+/**
+ * Accumulated duration of one stage of the frame loop.
+ */
+struct stage_timing {
+	/** Name printed in the timing report. */
+	const char *name;
+	/** Number of samples since the last report. */
+	uint64_t count;
+	/** Sum of the samples since the last report in nanoseconds. */
+	uint64_t total_ns;
+	/** Largest sample since the last report in nanoseconds. */
+	uint64_t max_ns;
+};
+
+/**
+ * State shared between the capture thread and the render thread.
+ * Buffer ownership moves between the threads through the two rings,
+ * an index is only touched by the thread that popped it last.
+ */
+struct capture_thread_context {
+	/** Capture data management structure with V4L2 buffer mapping. */
+	struct capture_context *cap;
+	/** Consumers receiving every frame dequeued by the capture thread. */
+	struct frame_fanout *fanout;
+	/** eventfd signalled when a released frame was requeued, the device may be polled again. */
+	int release_event;
+	/** Set by either thread to end both loops. */
+	volatile int stop;
+	/** Error status of the capture thread. Value 0 when no error occured. */
+	int error;
+};
+
 /**
- * Exit signal control to free kernel buffers.
- * volatile to ensure that the variable is not optimized out.
- * Read and write occur in separate execution threads.
+ * State of the capture display event loop shared by the event handlers.
  */
-static volatile int signal_quit = 0;
+struct display_loop {
+	/** Capture data management structure with V4L2 buffer mapping. */
+	struct capture_context *cap;
+	/** Display Data management structure with GPU handles. */
+	struct display_context *disp;
+	/** Event loop waiting on the capture, display, signal and timer file descriptors. */
+	struct event_loop events;
+	/** Capture thread handoff, NULL when buffers are dequeued by the event loop itself. */
+	struct capture_thread_context *thread;
+	/** Consumers receiving every dequeued frame, the display is the first. */
+	struct frame_fanout fanout;
+	/** Queue of frames waiting for display. */
+	struct frame_consumer display;
+	/** Displayed frame whose imported buffer may still be read by the GPU, NULL when none. */
+	struct frame *held;
+	/** Buffer used to dequeue from the driver. */
+	struct v4l2_buffer buf;
+	/** Plane descriptors of the dequeued buffer. */
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	/** Frames displayed since the last stats report. */
+	uint64_t frames;
+	/** Frames displayed since the loop started. */
+	uint64_t displayed;
+	/** Monotonic time of the last stats report. */
+	uint64_t stats_ns;
+	/** Monotonic time when the last render completed. */
+	uint64_t idle_ns;
+	/** Time between the end of a render and the start of the next one. */
+	struct stage_timing wait;
+	/** Time spent in the render function. */
+	struct stage_timing render;
+	/** Snapshot of the latency histograms at the last stats report. */
+	struct histogram latency_reported[LATENCY_STAGES];
+	/** Monotonic time the loop started waiting for frames. */
+	uint64_t start_ns;
+};
 
 
 /**
@@ -87,17 +171,6 @@ void print_v4l2_buffer(struct v4l2_buffer *buf, uint32_t type)
 	}
 }
 
-/**
- * Exit signal control to free kernel buffers.
- * The kernel driver doesn't free outstanding buffers when the device is closed.
- * The signal will catch a ctrl-C exit and request that the appliction loop terminates.
- */
-static void signal_exit(int signal)
-{
-	(void)signal;
-	signal_quit = true;
-}
-
 /**
  * Release memory map of buffer planes and close DMA export buffers.
  * @param cap Capture data management structure with V4L2 buffer mapping.
@@ -113,19 +186,23 @@ int unmap_buffers(struct capture_context *cap)
 	{
 		for (int p = 0; p < cap->num_planes; p++)
 		{
-			if (cap->buffers && cap->buffers[i].dma_buf_fd[p] >= 0)
+			if (cap->buffers[i].dma_buf_fd[p] >= 0)
 			{
-				/* Close assigned DMA file descriptors and set them to an invalid number. */
-				close(cap->buffers[i].dma_buf_fd[p]);
+				/*
+				 * Close exported DMA file descriptors and set them to an invalid number.
+				 * Imported DMA buffers belong to the pool and stay open for the next stream.
+				 */
+				if (cap->memory == V4L2_MEMORY_MMAP) close(cap->buffers[i].dma_buf_fd[p]);
 				cap->buffers[i].dma_buf_fd[p] = -1;
 			}
-			if (cap->buffers &&
+			if (cap->memory == V4L2_MEMORY_MMAP &&
 				cap->buffers[i].addr[p] != 0 &&
 				cap->buffers[i].addr[p] != MAP_FAILED)
 			{
 				/* Unmap any buffers with a valid address */
 				ret = munmap(cap->buffers[i].addr[p], cap->buffers[i].length[p]);
 			}
+			cap->buffers[i].addr[p] = 0;
 		}
 	}
 
@@ -141,182 +218,1113 @@ int unmap_buffers(struct capture_context *cap)
 	req.memory = cap->memory;
 	// free buffers
 	ret = ioctl(cap->v4l2_fd, VIDIOC_REQBUFS, &req);
+
+	/* User pointer planes are only released once the driver no longer references them. */
+	arena_destroy(&cap->arena);
+	return ret;
+}
+
+/**
+ * Carve every plane of every buffer from one contiguous arena for user pointer capture.
+ * Each plane is page aligned and sized from the format negotiated with the driver.
+ * @param cap Capture data management structue with V4L2 buffer mapping.
+ * @return error status of the allocation. Value 0 is returned on success.
+ */
+int map_userptr_buffers(struct capture_context *cap)
+{
+	struct v4l2_buffer *buf;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t total = 0;
+	int ret;
+
+	for (int p = 0; p < cap->num_planes; p++)
+		total += cap->num_buf * ((cap->plane_size[p] + page_size - 1) & ~(page_size - 1));
+
+	ret = arena_create(&cap->arena, total);
+	if (ret) return ret;
+
+	for (int i = 0; i < cap->num_buf; i++)
+	{
+		buf = &cap->buffers[i].v4l2buf;
+		buf->m.planes = cap->buffers[i].v4l2planes;
+		buf->length = cap->num_planes;
+		buf->type = cap->type;
+		buf->memory = cap->memory;
+		buf->index = i;
+
+		for (int p = 0; p < cap->num_planes; p++)
+		{
+			cap->buffers[i].addr[p] = arena_alloc(&cap->arena, cap->plane_size[p], page_size);
+			if (!cap->buffers[i].addr[p]) return -ENOMEM;
+			cap->buffers[i].length[p] = cap->plane_size[p];
+			buf->m.planes[p].m.userptr = (unsigned long)cap->buffers[i].addr[p];
+			buf->m.planes[p].length = cap->plane_size[p];
+		}
+		print_v4l2_buffer(buf, cap->memory);
+	}
+	return 0;
+}
+
+/**
+ * Attach the application owned DMA buffer pool to the V4L2 buffers for DMA buffer import.
+ * The pool is allocated on first use and kept when the negotiated plane sizes still fit.
+ * @param cap Capture data management structue with V4L2 buffer mapping.
+ * @return error status of the allocation. Value 0 is returned on success.
+ */
+int map_dmabuf_buffers(struct capture_context *cap)
+{
+	struct v4l2_buffer *buf;
+	int ret;
+
+	ret = dmabuf_pool_alloc(&cap->pool, cap->num_buf, cap->num_planes, cap->plane_size);
+	if (ret) return ret;
+
+	for (int i = 0; i < cap->num_buf; i++)
+	{
+		buf = &cap->buffers[i].v4l2buf;
+		buf->m.planes = cap->buffers[i].v4l2planes;
+		buf->length = cap->num_planes;
+		buf->type = cap->type;
+		buf->memory = cap->memory;
+		buf->index = i;
+
+		for (int p = 0; p < cap->num_planes; p++)
+		{
+			/* Queue the buffers by file descriptor, the CPU mapping is kept for the copy render path. */
+			cap->buffers[i].addr[p] = cap->pool.addr[i][p];
+			cap->buffers[i].length[p] = cap->pool.size[p];
+			cap->buffers[i].dma_buf_fd[p] = cap->pool.fd[i][p];
+			buf->m.planes[p].m.fd = cap->pool.fd[i][p];
+			buf->m.planes[p].length = cap->pool.size[p];
+		}
+		print_v4l2_buffer(buf, cap->memory);
+	}
+	return 0;
+}
+
+/**
+ * Map each video plane to user space buffers. Optionally export DMA file descriptors.
+ * @param cap Capture data management structue with V4L2 buffer mapping.
+ * @param dma_export Flag to request that DMA exports for each plane are performed.
+ * @return error status of the map. Value 0 is returned on success.
+ */
+int map_buffers(struct capture_context *cap, bool dma_export)
+{
+	struct v4l2_buffer *buf;
+	struct v4l2_exportbuffer dma_buf;
+	int ret = 0;
+
+	for (int i = 0; i < cap->num_buf; i++)
+	{
+		/** For each allocated buffer, request the v4l2 information */
+		buf = &cap->buffers[i].v4l2buf;
+		buf->m.planes = cap->buffers[i].v4l2planes;
+		buf->length = cap->num_planes;
+		buf->type = cap->type;
+		buf->memory = cap->memory;
+		buf->index = i;
+
+		ret = ioctl(cap->v4l2_fd, VIDIOC_QUERYBUF, buf);
+		if (ret < 0)
+		{
+			LOGS_ERR("Unable to query buffer %s", strerror(ret));
+			return ret;
+		}
+
+		print_v4l2_buffer(buf, cap->memory);
+		for (int p = 0; p < cap->num_planes; p++)
+		{
+			/* Separately memory map each plane to its own user space address */
+			cap->buffers[i].length[p] = buf->m.planes[p].length;
+			cap->buffers[i].addr[p] = mmap(NULL, buf->m.planes[p].length,
+				PROT_READ | PROT_WRITE, MAP_SHARED,
+				cap->v4l2_fd, buf->m.planes[p].m.mem_offset);
+			if (cap->buffers[i].addr[p] == MAP_FAILED)
+			{
+				LOGS_ERR("Unable to mmap buffer. Error #%d: %s", errno, strerror(errno));
+				return -errno;
+			}
+
+			if (dma_export)
+			{
+				/* Export a DMA file descriptor for each plane when requested */
+				dma_buf.type = cap->type;
+				dma_buf.index = i;
+				dma_buf.plane = p;
+				ret = ioctl(cap->v4l2_fd, VIDIOC_EXPBUF, &dma_buf);
+				if (ret < 0)
+				{
+					LOGS_ERR("Unable to export dma buffer. Error #%d: %s", errno, strerror(errno));
+					return -errno;
+				}
+
+				cap->buffers[i].dma_buf_fd[p] = dma_buf.fd;
+			}
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Queue all allocated V4L2 buffers in the driver to prepare for capture.
+ * @param fd file descriptor for the V4L2 device.
+ * @param count number of buffers in the array to queue.
+ * @param buffers array of v4l2 buffer to queue.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+int queue_buffers(int fd, int count, struct video_buf_map buffers[])
+{
+	int ret = 0;
+	for (int i = 0; i < count; i++)
+	{
+		ret = ioctl(fd, VIDIOC_QBUF, &buffers[i].v4l2buf);
+		if (ret < 0)
+		{
+			LOGS_ERR("Unable to queue buffer %d", errno);
+			break;
+		}
+	}
+	return ret;
+}
+
+/**
+ * Start the v4l2 video stream.
+ * @param fd file descriptor for the V4L2 device.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+int start_stream(int fd)
+{
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	return ioctl(fd, VIDIOC_STREAMON, &type);
+}
+
+/**
+ * Stop the v4l2 video stream.
+ * @param fd file descriptor for the V4L2 device.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+int stop_stream(int fd)
+{
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	return ioctl(fd, VIDIOC_STREAMOFF, &type);
+}
+
+/**
+ * Dequeue a filled buffer from the V4L2 device or the emulated source without waiting.
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param buf buffer to fill, type, memory, length and m.planes must be set.
+ * @return 0 on success, -EAGAIN when no buffer is filled, otherwise the negative errno of the failure.
+ */
+static int capture_dequeue(struct capture_context *cap, struct v4l2_buffer *buf)
+{
+	if (cap->source) return source_dequeue(cap, buf);
+	return ioctl(cap->v4l2_fd, VIDIOC_DQBUF, buf) < 0 ? -errno : 0;
+}
+
+/**
+ * Queue a buffer back in the V4L2 device or the emulated source.
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param buf buffer to queue.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int capture_queue(struct capture_context *cap, struct v4l2_buffer *buf)
+{
+	if (cap->source) return source_queue(cap, buf);
+	return ioctl(cap->v4l2_fd, VIDIOC_QBUF, buf) < 0 ? -errno : 0;
+}
+
+/**
+ * Read the monotonic clock.
+ * @return current monotonic time in nanoseconds.
+ */
+static inline uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Add a duration sample to a stage timing.
+ * @param timing stage timing to update.
+ * @param start_ns monotonic time when the stage started.
+ * @param end_ns monotonic time when the stage completed.
+ */
+static void stage_timing_add(struct stage_timing *timing, uint64_t start_ns, uint64_t end_ns)
+{
+	uint64_t duration = end_ns - start_ns;
+	timing->count++;
+	timing->total_ns += duration;
+	if (duration > timing->max_ns) timing->max_ns = duration;
+}
+
+/**
+ * Log the average and maximum of the collected samples and start a new period.
+ * @param timing stage timing to report.
+ */
+static void stage_timing_report(struct stage_timing *timing)
+{
+	if (!timing->count) return;
+	LOGS_INF("%-16s avg %8.3f ms max %8.3f ms over %lu frames", timing->name,
+		timing->total_ns / (double)timing->count / 1e6, timing->max_ns / 1e6,
+		(unsigned long)timing->count);
+	timing->count = 0;
+	timing->total_ns = 0;
+	timing->max_ns = 0;
+}
+
+/**
+ * Convert a driver timestamp to nanoseconds.
+ * @param tv timestamp of a buffer.
+ * @return timestamp in nanoseconds.
+ */
+static inline uint64_t timeval_ns(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000000ull + tv->tv_usec * 1000ull;
+}
+
+/**
+ * Driver timestamp of a dequeued buffer.
+ * @param buf dequeued buffer.
+ * @return timestamp in nanoseconds.
+ */
+static inline uint64_t buffer_timestamp_ns(const struct v4l2_buffer *buf)
+{
+	return timeval_ns(&buf->timestamp);
+}
+
+/** Name of each latency stage in the reports, indexed by enum latency_stage. */
+static const char * const latency_names[LATENCY_STAGES] = {
+	"capture to dqbuf",
+	"dqbuf to upload",
+	"upload to swap",
+	"capture to present",
+};
+
+/**
+ * Check whether a buffer timestamp comes from the monotonic clock and may be compared with it.
+ * @param flags V4L2 buffer flags.
+ * @return true when the timestamp is monotonic.
+ */
+static inline bool monotonic_timestamp(uint32_t flags)
+{
+	return (flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+}
+
+/**
+ * Record a stage duration in a latency histogram, stages ending before they started are skipped.
+ * @param hist stage histogram.
+ * @param start_ns monotonic time when the stage started.
+ * @param end_ns monotonic time when the stage completed.
+ * @return recorded duration in nanoseconds, 0 when skipped.
+ */
+static inline uint64_t latency_record(struct histogram *hist, uint64_t start_ns, uint64_t end_ns)
+{
+	if (!start_ns || end_ns < start_ns) return 0;
+	histogram_record(hist, end_ns - start_ns);
+	return end_ns - start_ns;
+}
+
+/**
+ * Requeue a buffer the driver dequeued with V4L2_BUF_FLAG_ERROR, its content is not displayed.
+ * The frame accounting counts the error and the stream goes on like after a dropped frame.
+ *
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param buf dequeued buffer flagged with an error.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int requeue_error_buffer(struct capture_context *cap, struct v4l2_buffer *buf)
+{
+	int ret;
+
+	accounting_frame(&cap->accounting, buf->sequence, buffer_timestamp_ns(buf), buf->flags);
+	ret = capture_queue(cap, buf);
+	if (ret)
+	{
+		LOGS_ERR("QBUF: %d - %s", -ret, strerror(-ret));
+		return ret;
+	}
+	__atomic_add_fetch(&cap->queued, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Replace a dequeued buffer with the newest filled buffer waiting in the driver.
+ * Each older buffer is requeued right away without being displayed and counted as stale.
+ * The device is opened non-blocking, this never waits for a new frame.
+ *
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param buf dequeued buffer, replaced by the newest dequeued buffer on return.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int dequeue_latest(struct capture_context *cap, struct v4l2_buffer *buf)
+{
+	struct v4l2_buffer next;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_plane *buf_planes = buf->m.planes;
+	int ret;
+
+	while (1)
+	{
+		memset(&next, 0, sizeof(next));
+		next.type = cap->type;
+		next.memory = cap->memory;
+		next.length = cap->num_planes;
+		next.m.planes = planes;
+		ret = capture_dequeue(cap, &next);
+		if (ret)
+		{
+			if (ret == -EAGAIN || ret == -EINTR) break;
+			LOGS_ERR("DQBUF: %d - %s", -ret, strerror(-ret));
+			return ret;
+		}
+
+		/* A newer frame is ready, the older one goes straight back to the driver. */
+		accounting_frame(&cap->accounting, buf->sequence, buffer_timestamp_ns(buf), buf->flags);
+		ret = capture_queue(cap, buf);
+		if (ret)
+		{
+			LOGS_ERR("QBUF: %d - %s", -ret, strerror(-ret));
+			return ret;
+		}
+		cap->stale_frames++;
+
+		memcpy(buf_planes, planes, sizeof(planes[0]) * cap->num_planes);
+		*buf = next;
+		buf->m.planes = buf_planes;
+	}
+	return 0;
+}
+
+/**
+ * Signal an eventfd, waking a thread waiting on it.
+ * @param fd eventfd file descriptor.
+ */
+static void event_signal(int fd)
+{
+	uint64_t value = 1;
+	if (write(fd, &value, sizeof(value)) < 0)
+		LOGS_ERR("Unable to signal event %d - %s", errno, strerror(errno));
+}
+
+/**
+ * Frame release function, queue the buffer back in the driver once every consumer put the frame.
+ * Runs on the thread putting the last reference and wakes the capture thread when one is waiting.
+ * @param frame released frame.
+ * @param context capture data management structure.
+ */
+static void requeue_frame(struct frame *frame, void *context)
+{
+	struct capture_context *cap = context;
+	uint64_t span = trace_begin();
+	int err;
+
+	err = capture_queue(cap, &cap->buffers[frame->index].v4l2buf);
+	if (err)
+	{
+		LOGS_ERR("QBUF: %d - %s", -err, strerror(-err));
+		__atomic_store_n(&cap->requeue_error, err, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		__atomic_add_fetch(&cap->queued, 1, __ATOMIC_RELEASE);
+	}
+	trace_end("qbuf", span, frame->sequence);
+	PROBE2(qbuf, frame->index, frame->sequence);
+	if (cap->requeue_event >= 0) event_signal(cap->requeue_event);
+}
+
+/**
+ * Wrap every buffer in a frame handle sharing the buffer planes.
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ */
+static void init_frames(struct capture_context *cap)
+{
+	for (int i = 0; i < cap->num_buf; i++)
+	{
+		struct frame *frame = &cap->frames[i];
+		memset(frame, 0, sizeof(*frame));
+		frame->index = i;
+		frame->num_planes = cap->num_planes;
+		for (int p = 0; p < cap->num_planes; p++)
+		{
+			frame->addr[p] = cap->buffers[i].addr[p];
+			frame->dma_buf_fd[p] = cap->buffers[i].dma_buf_fd[p];
+		}
+		frame->release = requeue_frame;
+		frame->release_context = cap;
+	}
+	cap->requeue_event = -1;
+	cap->requeue_error = 0;
+}
+
+/**
+ * Record the metadata of a dequeued buffer in its frame handle.
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param buf dequeued buffer.
+ * @return frame handle of the buffer, holding no reference.
+ */
+static struct frame *dequeued_frame(struct capture_context *cap, struct v4l2_buffer *buf)
+{
+	struct frame *frame = &cap->frames[buf->index];
+
+	accounting_frame(&cap->accounting, buf->sequence, buffer_timestamp_ns(buf), buf->flags);
+	frame->sequence = buf->sequence;
+	frame->flags = buf->flags;
+	frame->timestamp = buf->timestamp;
+	frame->dequeue_ns = monotonic_ns();
+	PROBE3(dqbuf, buf->index, buf->sequence, buffer_timestamp_ns(buf));
+	if (monotonic_timestamp(buf->flags))
+		latency_record(&cap->latency[LATENCY_DEQUEUE], buffer_timestamp_ns(buf), frame->dequeue_ns);
+	for (int p = 0; p < cap->num_planes; p++)
+		frame->bytesused[p] = buf->m.planes[p].bytesused;
+	return frame;
+}
+
+/**
+ * Capture thread, only dequeues V4L2 buffers.
+ * Dequeued frames are published to every consumer of the fan-out.
+ * Buffers are requeued by whichever consumer puts the last frame reference,
+ * the release event wakes this thread to poll the device again.
+ *
+ * @param arg capture_thread_context shared with the render thread.
+ * @return NULL, the error status is saved in the context.
+ */
+static void *capture_thread(void *arg)
+{
+	struct capture_thread_context *ctx = arg;
+	struct capture_context *cap = ctx->cap;
+	struct stage_timing dequeue = { .name = "capture dequeue" };
+	struct v4l2_buffer buf;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct pollfd fds[2];
+	uint64_t value;
+	uint64_t start;
+	uint64_t span;
+	int ret;
+
+	trace_thread_name("capture");
+	alloc_check_thread("capture");
+	log_thread_init();
+	while (!ctx->stop)
+	{
+		/*
+		 * Wait for a filled buffer or a released buffer.
+		 * The V4L2 device is only polled while the driver owns at least one buffer.
+		 */
+		fds[0].fd = __atomic_load_n(&cap->queued, __ATOMIC_ACQUIRE) ? cap->v4l2_fd : -1;
+		fds[0].events = POLLIN;
+		fds[1].fd = ctx->release_event;
+		fds[1].events = POLLIN;
+		span = trace_begin();
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+			LOGS_ERR("Capture poll: %d - %s", errno, strerror(errno));
+			ctx->error = -errno;
+			break;
+		}
+
+		/* Released frames were already requeued by the consumer putting them. */
+		if (fds[1].revents & POLLIN)
+		{
+			if (read(ctx->release_event, &value, sizeof(value)) < 0 && errno != EAGAIN)
+				LOGS_ERR("Release event: %d - %s", errno, strerror(errno));
+		}
+		if (__atomic_load_n(&cap->requeue_error, __ATOMIC_ACQUIRE))
+		{
+			ctx->error = cap->requeue_error;
+			break;
+		}
+
+		if (!(fds[0].revents & POLLIN)) continue;
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = cap->type;
+		buf.memory = cap->memory;
+		buf.length = cap->num_planes;
+		buf.m.planes = planes;
+		start = monotonic_ns();
+		ret = capture_dequeue(cap, &buf);
+		if (ret)
+		{
+			if (ret == -EAGAIN || ret == -EINTR) continue;
+			LOGS_ERR("DQBUF: %d - %s", -ret, strerror(-ret));
+			ctx->error = ret;
+			break;
+		}
+		stage_timing_add(&dequeue, start, monotonic_ns());
+		if (span)
+		{
+			trace_record("dqbuf wait", span, start, buf.sequence);
+			trace_end("dqbuf", start, buf.sequence);
+		}
+		__atomic_sub_fetch(&cap->queued, 1, __ATOMIC_RELAXED);
+		if (buf.flags & V4L2_BUF_FLAG_ERROR)
+		{
+			ret = requeue_error_buffer(cap, &buf);
+			if (ret)
+			{
+				ctx->error = ret;
+				break;
+			}
+			continue;
+		}
+
+		/* Every consumer receives the frame zero-copy, a consumer with a full queue applies its policy. */
+		frame_fanout_publish(ctx->fanout, dequeued_frame(cap, &buf));
+
+		if (dequeue.count >= TIMING_REPORT_FRAMES)
+			stage_timing_report(&dequeue);
+	}
+
+	/* Wake every consumer so it notices the end of capture. */
+	ctx->stop = true;
+	for (int i = 0; i < ctx->fanout->count; i++)
+		frame_consumer_close(ctx->fanout->consumers[i]);
+	return NULL;
+}
+
+/**
+ * Create the release event and start the capture thread.
+ * @param ctx capture thread context to initialize.
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param fanout consumers receiving every dequeued frame.
+ * @param thread returns the started thread.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int capture_thread_start(struct capture_thread_context *ctx, struct capture_context *cap,
+	struct frame_fanout *fanout, pthread_t *thread)
+{
+	int ret;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->cap = cap;
+	ctx->fanout = fanout;
+	ctx->release_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ctx->release_event < 0)
+	{
+		LOGS_ERR("Unable to create release event %d - %s", errno, strerror(errno));
+		return -errno;
+	}
+	cap->requeue_event = ctx->release_event;
+
+	ret = pthread_create(thread, NULL, capture_thread, ctx);
+	if (ret)
+	{
+		LOGS_ERR("Unable to start capture thread %d - %s", ret, strerror(ret));
+		return -ret;
+	}
+	return 0;
+}
+
+/**
+ * Stop and wake the capture thread, then wait for it to finish.
+ * @param ctx capture thread context.
+ * @param thread thread returned by capture_thread_start().
+ * @return error status of the capture thread. Value 0 is returned when no error occured.
+ */
+static int capture_thread_stop(struct capture_thread_context *ctx, pthread_t thread)
+{
+	ctx->stop = true;
+	event_signal(ctx->release_event);
+	pthread_join(thread, NULL);
+	return ctx->error;
+}
+
+/**
+ * Assign the planes of a captured buffer to the render context.
+ * Single plane NV12 holds chroma directly after the luma lines in the same buffer,
+ * it is presented to the display as two planes sharing one memory block and DMA buffer.
+ *
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param render_ctx render context to fill.
+ * @param index V4L2 buffer index to display.
+ */
+static void set_render_planes(struct capture_context *cap, struct render_context *render_ctx, int index)
+{
+	struct video_buf_map *buffer = &cap->buffers[index];
+
+	render_ctx->num_buffers = 2;
+	render_ctx->index = index;
+	render_ctx->width = cap->mode.width;
+	render_ctx->height = cap->mode.height;
+	for (int i = 0; i < cap->num_planes; i++)
+	{
+		render_ctx->buffers[i] = buffer->addr[i];
+		render_ctx->dma_buf_fd[i] = buffer->dma_buf_fd[i];
+		render_ctx->stride[i] = cap->bytesperline[i];
+		render_ctx->offset[i] = 0;
+	}
+	if (cap->num_planes == 1)
+	{
+		uint32_t chroma = cap->bytesperline[0] * cap->mode.height;
+		render_ctx->buffers[1] = buffer->addr[0] ? (uint8_t*)buffer->addr[0] + chroma : NULL;
+		render_ctx->dma_buf_fd[1] = buffer->dma_buf_fd[0];
+		render_ctx->stride[1] = cap->bytesperline[0];
+		render_ctx->offset[1] = chroma;
+	}
+}
+
+/**
+ * Record the stage latencies of a displayed frame and publish them with the live metrics.
+ * Runs on the display thread, the only writer of the metrics block, and makes no system call.
+ * @param loop capture display loop state.
+ * @param frame displayed frame.
+ */
+static void displayed_frame(struct display_loop *loop, struct frame *frame)
+{
+	struct capture_context *cap = loop->cap;
+	struct render_context *render_ctx = &loop->disp->render_ctx;
+	struct capture_metrics *metrics = cap->metrics;
+	uint64_t captured_ns = monotonic_timestamp(frame->flags) ? timeval_ns(&frame->timestamp) : 0;
+	uint64_t latency[LATENCY_STAGES];
+
+	latency[LATENCY_DEQUEUE] = captured_ns && frame->dequeue_ns >= captured_ns ? frame->dequeue_ns - captured_ns : 0;
+	latency[LATENCY_UPLOAD] = latency_record(&cap->latency[LATENCY_UPLOAD], frame->dequeue_ns, render_ctx->upload_ns);
+	latency[LATENCY_PRESENT] = latency_record(&cap->latency[LATENCY_PRESENT], render_ctx->upload_ns, render_ctx->present_ns);
+	latency[LATENCY_TOTAL] = latency_record(&cap->latency[LATENCY_TOTAL], captured_ns, render_ctx->present_ns);
+	if (!g_startup.reported)
+	{
+		startup_end("first frame", loop->start_ns);
+		startup_report(render_ctx->present_ns);
+	}
+	if (!metrics) return;
+
+	metrics_write_begin(metrics);
+	metrics->update_ns = render_ctx->present_ns;
+	metrics->last_sequence = frame->sequence;
+	metrics->displayed++;
+	metrics->captured = __atomic_load_n(&cap->accounting.frames, __ATOMIC_RELAXED);
+	metrics->dropped = __atomic_load_n(&cap->accounting.dropped, __ATOMIC_RELAXED);
+	metrics->errors = __atomic_load_n(&cap->accounting.errors, __ATOMIC_RELAXED);
+	metrics->stale = cap->stale_frames + __atomic_load_n(&loop->display.dropped, __ATOMIC_RELAXED);
+	metrics->driver_queued = __atomic_load_n(&cap->queued, __ATOMIC_RELAXED);
+	metrics->display_queued = spsc_ring_count(&loop->display.ring);
+	for (int i = 0; i < LATENCY_STAGES; i++)
+		metrics->latency[i].last_ns = latency[i];
+	metrics_write_end(metrics);
+}
+
+/**
+ * Stamp the sequence and capture time of a frame into its planes before the render reads them.
+ * Planes exported as DMA buffers are bracketed for CPU writes so the GPU import sees the stamp.
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param render_ctx render inputs holding the planes of the frame.
+ * @param frame frame to stamp.
+ */
+static void stamp_watermark(struct capture_context *cap, struct render_context *render_ctx, struct frame *frame)
+{
+	uint64_t capture_ns = monotonic_timestamp(frame->flags) ? timeval_ns(&frame->timestamp) : frame->dequeue_ns;
+	int *dma_buf_fd = cap->buffers[frame->index].dma_buf_fd;
+
+	if (!render_ctx->buffers[0] || !render_ctx->buffers[1]) return;
+	for (int i = 0; i < cap->num_planes; i++)
+		if (dma_buf_fd[i] >= 0) dmabuf_sync(dma_buf_fd[i], DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+	watermark_stamp(render_ctx->buffers[0], render_ctx->stride[0], render_ctx->buffers[1], render_ctx->stride[1],
+		render_ctx->width, render_ctx->height, frame->sequence, capture_ns);
+	for (int i = 0; i < cap->num_planes; i++)
+		if (dma_buf_fd[i] >= 0) dmabuf_sync(dma_buf_fd[i], DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+}
+
+/**
+ * Display a captured frame.
+ * @param loop capture display loop state.
+ * @param frame frame to display.
+ * @return result of the render function.
+ */
+static int render_buffer(struct display_loop *loop, struct frame *frame)
+{
+	struct capture_context *cap = loop->cap;
+	struct display_context *disp = loop->disp;
+	int index = frame->index;
+	uint64_t start;
+	int cpu_access;
+	int ret;
+
+	/* use the buffer index to select the memory map planes for rendering */
+	set_render_planes(cap, &disp->render_ctx, index);
+	disp->render_ctx.sequence = frame->sequence;
+	disp->render_ctx.upload_ns = 0;
+	disp->render_ctx.present_ns = 0;
+
+	/* CPU reads of imported DMA buffers must be bracketed for cache coherency with the device. */
+	cpu_access = cap->memory == V4L2_MEMORY_DMABUF && disp->render_method == RENDER_COPY;
+
+	start = monotonic_ns();
+	stage_timing_add(&loop->wait, loop->idle_ns, start);
+	if (disp->watermark.enabled) stamp_watermark(cap, &disp->render_ctx, frame);
+	if (cpu_access)
+		for (int i = 0; i < cap->num_planes; i++)
+			dmabuf_sync(cap->buffers[index].dma_buf_fd[i], DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+	ret = disp->render_func(disp);
+	if (cpu_access)
+		for (int i = 0; i < cap->num_planes; i++)
+			dmabuf_sync(cap->buffers[index].dma_buf_fd[i], DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+	loop->idle_ns = monotonic_ns();
+	stage_timing_add(&loop->render, start, loop->idle_ns);
+	if (g_trace.enabled) trace_record("render", start, loop->idle_ns, frame->sequence);
+	loop->frames++;
+	loop->displayed++;
+
+	if (!ret && disp->render_ctx.present_ns)
+		displayed_frame(loop, frame);
+
+	if (ret < 0)
+		LOGS_ERR("Error during display aborting capture");
+	return ret;
+}
+
+/**
+ * Event handler for the V4L2 device, dequeue a filled buffer and publish it to every consumer.
+ * @param fd V4L2 capture device.
+ * @param events epoll event flags.
+ * @param context capture display loop state.
+ * @return 0 to continue, negative on error.
+ */
+static int on_capture_ready(int fd, uint32_t events, void *context)
+{
+	struct display_loop *loop = context;
+	struct capture_context *cap = loop->cap;
+	struct v4l2_buffer *buf = &loop->buf;
+	uint64_t span = trace_begin();
+	int ret;
+	(void)fd;
+	(void)events;
+
+	memset(buf, 0, sizeof(*buf));
+	buf->type = cap->type;
+	buf->memory = cap->memory;
+	buf->length = cap->num_planes;
+	buf->m.planes = loop->planes;
+	ret = capture_dequeue(cap, buf);
+	if (ret)
+	{
+		if (ret == -EAGAIN) return 0;
+		LOGS_ERR("DQBUF: %d - %s", -ret, strerror(-ret));
+		return ret;
+	}
+	if (span)
+	{
+		trace_record("dqbuf wait", loop->idle_ns, span, buf->sequence);
+		trace_end("dqbuf", span, buf->sequence);
+	}
+	__atomic_sub_fetch(&cap->queued, 1, __ATOMIC_RELAXED);
+
+	/* Skip ahead to the newest frame already captured when latency matters more than every frame. */
+	if (cap->present_policy == PRESENT_MAILBOX)
+	{
+		ret = dequeue_latest(cap, buf);
+		if (ret) return ret;
+	}
+	if (buf->flags & V4L2_BUF_FLAG_ERROR) return requeue_error_buffer(cap, buf);
+
+	/* The buffer is requeued when the last consumer puts the frame. */
+	frame_fanout_publish(&loop->fanout, dequeued_frame(cap, buf));
+	return __atomic_load_n(&cap->requeue_error, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Put the frame held since its render once the GPU finished reading its buffer.
+ * @param loop capture display loop state.
+ */
+static void put_held_frame(struct display_loop *loop)
+{
+	if (!loop->held) return;
+	display_fence_wait(loop->disp);
+	frame_put(loop->held);
+	loop->held = NULL;
+}
+
+/**
+ * Event handler for frames queued for display.
+ * Displays one frame and puts it, the buffer is requeued once no other consumer holds it.
+ * @param fd eventfd of the display consumer.
+ * @param events epoll event flags.
+ * @param context capture display loop state.
+ * @return 0 to continue, positive when capture stopped, negative on error.
+ */
+static int on_display_frame(int fd, uint32_t events, void *context)
+{
+	struct display_loop *loop = context;
+	struct capture_context *cap = loop->cap;
+	struct capture_thread_context *ctx = loop->thread;
+	struct frame *frame;
+	uint64_t value;
+	int ret;
+	(void)events;
+
+	if (read(fd, &value, sizeof(value)) < 0) return 0;
+	if (ctx && ctx->stop) return ctx->error ? ctx->error : 1;
+
+	/* Frames dropped by the mailbox policy leave extra wakeups behind, an empty queue is expected. */
+	frame = frame_consumer_pop(&loop->display, false);
+	if (!frame) return 0;
+
+	/* The fence of the previous frame normally signaled during the frame interval, its buffer is requeued first. */
+	put_held_frame(loop);
+	ret = render_buffer(loop, frame);
+	if (loop->disp->render_fence != EGL_NO_SYNC_KHR) loop->held = frame;
+	else frame_put(frame);
+	if (!ret) ret = __atomic_load_n(&cap->requeue_error, __ATOMIC_ACQUIRE);
+
+	/* Every buffer was displayed once, per buffer resources exist and the loop reached its steady state. */
+	if (loop->displayed == (uint64_t)cap->num_buf) alloc_check_arm(true);
+	if (!ret && cap->frame_limit && loop->displayed == cap->num_buf + cap->frame_limit)
+	{
+		LOGS_INF("Displayed %llu frames, stopping", (unsigned long long)loop->displayed);
+		ret = 1;
+	}
 	return ret;
 }
 
 /**
- * Map each video plane to user space buffers. Optionally export DMA file descriptors.
- * @param cap Capture data management structue with V4L2 buffer mapping.
- * @param dma_export Flag to request that DMA exports for each plane are performed.
- * @return error status of the map. Value 0 is returned on success.
+ * Event handler for the native display connection.
+ * @param fd display connection.
+ * @param events epoll event flags.
+ * @param context capture display loop state.
+ * @return 0 to continue, 1 when the user requested an exit.
  */
-int map_buffers(struct capture_context *cap, bool dma_export)
+static int on_display_event(int fd, uint32_t events, void *context)
 {
-	struct v4l2_buffer *buf;
-	struct v4l2_exportbuffer dma_buf;
-	int ret = 0;
+	struct display_loop *loop = context;
+	uint64_t span = trace_begin();
+	int ret;
+	(void)fd;
+	(void)events;
 
-	for (int i = 0; i < cap->num_buf; i++)
+	ret = x11_process_pending_events(loop->disp);
+	trace_end("x11 events", span, TRACE_NO_SEQUENCE);
+	if (ret)
 	{
-		/** For each allocated buffer, request the v4l2 information */
-		buf = &cap->buffers[i].v4l2buf;
-		buf->m.planes = cap->buffers[i].v4l2planes;
-		buf->length = cap->num_buf;
-		buf->type = cap->type;
-		buf->memory = cap->memory;
-		buf->index = i;
-
-		ret = ioctl(cap->v4l2_fd, VIDIOC_QUERYBUF, buf);
-		if (ret < 0)
-		{
-			LOGS_ERR("Unable to query buffer %s", strerror(ret));
-			return ret;
-		}
-
-		print_v4l2_buffer(buf, cap->type);
-		for (int p = 0; p < cap->num_planes; p++)
-		{
-			/* Separately memory map each plane to its own user space address */
-			cap->buffers[i].length[p] = buf->m.planes[p].length;
-			cap->buffers[i].addr[p] = mmap(NULL, buf->m.planes[p].length,
-				PROT_READ | PROT_WRITE, MAP_SHARED,
-				cap->v4l2_fd, buf->m.planes[p].m.mem_offset);
-			if (cap->buffers[i].addr[p] == MAP_FAILED)
-			{
-				LOGS_ERR("Unable to mmap buffer. Error #%d: %s", errno, strerror(errno));
-				return -errno;
-			}
+		LOGS_INF("Exiting display loop normally");
+		return 1;
+	}
+	return 0;
+}
 
-			if (dma_export)
-			{
-				/* Export a DMA file descriptor for each plane when requested */
-				dma_buf.type = cap->type;
-				dma_buf.index = i;
-				dma_buf.plane = p;
-				ret = ioctl(cap->v4l2_fd, VIDIOC_EXPBUF, &dma_buf);
-				if (ret < 0)
-				{
-					LOGS_ERR("Unable to export dma buffer. Error #%d: %s", errno, strerror(errno));
-					return -errno;
-				}
+/**
+ * Drain display events Xlib queued during rendering before the event loop sleeps.
+ * @param fd unused.
+ * @param events unused.
+ * @param context capture display loop state.
+ * @return 0 to continue, 1 when the user requested an exit.
+ */
+static int on_display_prepare(int fd, uint32_t events, void *context)
+{
+	struct display_loop *loop = context;
+	uint64_t span = trace_begin();
+	int ret;
+	(void)fd;
+	(void)events;
 
-				cap->buffers[i].dma_buf_fd[p] = dma_buf.fd;
-			}
-		}
+	ret = x11_process_queued_events(loop->disp);
+	trace_end("x11 queued events", span, TRACE_NO_SEQUENCE);
+	if (ret)
+	{
+		LOGS_INF("Exiting display loop normally");
+		return 1;
 	}
 	return 0;
 }
 
+/**
+ * Event handler for exit signals.
+ * The kernel driver doesn't free outstanding buffers when the device is closed.
+ * The signal ends the loop so the buffers are released before the application exits.
+ * @param fd signalfd.
+ * @param events epoll event flags.
+ * @param context capture display loop state.
+ * @return 1 to stop the loop.
+ */
+static int on_signal(int fd, uint32_t events, void *context)
+{
+	struct signalfd_siginfo info;
+	(void)events;
+	(void)context;
+
+	if (read(fd, &info, sizeof(info)) != sizeof(info)) return 0;
+	LOGS_INF("Caught signal %u, exiting", info.ssi_signo);
+	return 1;
+}
 
 /**
- * Queue all allocated V4L2 buffers in the driver to prepare for capture.
- * @param fd file descriptor for the V4L2 device.
- * @param count number of buffers in the array to queue.
- * @param buffers array of v4l2 buffer to queue.
- * @return error status of the function. Value 0 is returned on success.
+ * Log the latency percentiles of the frames displayed since the last report.
+ * @param loop capture display loop state.
  */
-int queue_buffers(int fd, int count, struct video_buf_map buffers[])
+static void latency_report(struct display_loop *loop)
 {
-	int ret = 0;
-	for (int i = 0; i < count; i++)
+	struct capture_metrics *metrics = loop->cap->metrics;
+	struct histogram now;
+	struct histogram interval;
+
+	for (int i = 0; i < LATENCY_STAGES; i++)
 	{
-		ret = ioctl(fd, VIDIOC_QBUF, &buffers[i].v4l2buf);
-		if (ret < 0)
+		histogram_snapshot(&loop->cap->latency[i], &now);
+		histogram_interval(&interval, &now, &loop->latency_reported[i]);
+		histogram_report(&interval);
+		loop->latency_reported[i] = now;
+		if (metrics)
 		{
-			LOGS_ERR("Unable to queue buffer %d", errno);
-			break;
+			metrics_write_begin(metrics);
+			metrics->latency[i].p50_ns = histogram_percentile(&interval, 50.0);
+			metrics->latency[i].p99_ns = histogram_percentile(&interval, 99.0);
+			metrics->latency[i].max_ns = interval.max;
+			metrics_write_end(metrics);
 		}
 	}
-	return ret;
 }
 
 /**
- * Start the v4l2 video stream.
- * @param fd file descriptor for the V4L2 device.
- * @return error status of the function. Value 0 is returned on success.
+ * Event handler for the periodic statistics timer.
+ * @param fd timerfd.
+ * @param events epoll event flags.
+ * @param context capture display loop state.
+ * @return 0 to continue.
  */
-int start_stream(int fd)
+static int on_stats_timer(int fd, uint32_t events, void *context)
 {
-	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	return ioctl(fd, VIDIOC_STREAMON, &type);
-}
+	struct display_loop *loop = context;
+	uint64_t now = monotonic_ns();
+	(void)events;
 
-/**
- * Stop the v4l2 video stream.
- * @param fd file descriptor for the V4L2 device.
- * @return error status of the function. Value 0 is returned on success.
- */
-int stop_stream(int fd)
-{
-	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	return ioctl(fd, VIDIOC_STREAMOFF, &type);
+	event_loop_timer_read(fd);
+	LOGS_INF("Displayed %.1f fps, %llu stale frames",
+		loop->frames * 1e9 / (double)(now - loop->stats_ns),
+		(unsigned long long)(loop->cap->stale_frames + loop->display.dropped));
+	if (loop->cap->metrics)
+	{
+		metrics_write_begin(loop->cap->metrics);
+		loop->cap->metrics->fps_milli = loop->frames * 1000000000000ull / (now - loop->stats_ns);
+		metrics_write_end(loop->cap->metrics);
+	}
+	accounting_report(&loop->cap->accounting);
+	stage_timing_report(&loop->wait);
+	stage_timing_report(&loop->render);
+	gpu_timer_report(&loop->disp->gpu_timer);
+	latency_report(loop);
+	watermark_report(&loop->disp->watermark);
+	loop->frames = 0;
+	loop->stats_ns = now;
+	return 0;
 }
 
 /**
  * Video capture and display loop.
- * Dequeue v4l2 buffers, send the mapped buffers to render then re-queue the buffer.
+ * A single epoll loop waits on the V4L2 device, the display connection, exit signals and a stats timer.
+ * Filled buffers are dequeued as soon as the device is readable and published to the frame consumers,
+ * the display consumer renders them from the same loop and the last consumer requeues each buffer.
+ * In threaded mode frames are dequeued and published by the capture thread instead.
+ *
  * @param cap Capture data management structure with V4L2 buffer mapping.
- * @param disp Display Data management structure with GPU handles.
+ * @param disp Display Data management structure with GPU handles, initialized by display_init().
  * @return error status of the function. Value 0 is returned on success.
  */
 int capture_display_yuv(struct capture_context *cap, struct display_context *disp)
 {
+	struct display_loop loop;
+	struct capture_thread_context thread_ctx;
+	pthread_t thread;
+	sigset_t signals;
+	uint64_t begin;
 	int ret = 0;
-	struct v4l2_buffer buf;
-	struct v4l2_plane planes[VIDEO_MAX_PLANES];
-	memset(&buf, 0, sizeof(buf));
-	/* initilize the buffer type reference to hold the dequeued buffer info. */
-	buf.type = cap->type;
-	buf.memory = cap->memory;
-	buf.length = cap->num_planes;
-	buf.m.planes = planes;
-
-	/* Select an empty buffer for priming the video display */
-	disp->render_ctx.num_buffers = cap->num_planes;
-	for (int i = 0; i < cap->num_planes; i++)
-	{
-		disp->render_ctx.buffers[i] = cap->buffers[0].addr[i];
-	}
 
-	/* Setup the OpenGL display, disp->render will be assigned for future display calls */
-	ret = camera_nv12m_setup(disp, &disp->render_ctx);
+	memset(&thread_ctx, 0, sizeof(thread_ctx));
+	thread_ctx.release_event = -1;
+
+	/* Select an empty buffer for priming the video display, it also carries the frame size */
+	set_render_planes(cap, &disp->render_ctx, 0);
+
+	/* Size the textures for the negotiated frames, disp->render will be assigned for future display calls */
+	begin = startup_begin();
+	ret = display_frame_setup(disp, &disp->render_ctx);
 	if (ret)
 	{
 		LOGS_ERR("Error setting up display aborting capture");
+		display_close(disp);
 		return -1;
 	}
+	startup_end("textures", begin);
+
+	memset(&loop, 0, sizeof(loop));
+	loop.cap = cap;
+	loop.disp = disp;
+	loop.wait.name = "render wait";
+	loop.render.name = "render";
+	loop.display.event_fd = -1;
+	trace_thread_name("display");
+	alloc_check_thread("display");
+	ret = event_loop_init(&loop.events);
+	if (ret) goto cleanup;
+
+	/*
+	 * The display is the first consumer of every frame.
+	 * Mailbox keeps only the newest waiting frame, fifo has room for every buffer so it never blocks capture.
+	 */
+	if (cap->present_policy == PRESENT_MAILBOX)
+		ret = frame_consumer_init(&loop.display, "display", FRAME_DROP_OLDEST, 1);
+	else
+		ret = frame_consumer_init(&loop.display, "display", FRAME_BLOCK, cap->num_buf);
+	if (!ret) ret = frame_fanout_add(&loop.fanout, &loop.display);
+	if (!ret) ret = event_loop_add(&loop.events, loop.display.event_fd, EPOLLIN, on_display_frame, &loop);
+	if (ret) goto cleanup;
+
+	/* Signals are blocked and received on a signalfd, this must happen before the capture thread starts. */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	ret = event_loop_add_signals(&loop.events, &signals, on_signal, &loop);
+	if (ret) goto cleanup;
 
-	/* Continue until an error occurs or external signal requests an exit */
-	while(!ret && !signal_quit)
+	/* The offscreen backend has no display events, the loop ends on a signal or the frame limit. */
+	if (x11_connection_fd(disp) >= 0)
 	{
-		ret = ioctl(cap->v4l2_fd, VIDIOC_DQBUF, &buf);
-		if (ret < 0) {
-			LOGS_ERR("DQBUF: %d - %s", errno, strerror(errno));
-			return errno;
-		}
-		/* use the buffer index returned from dequeue to select the memory map planes for rendering */
-		disp->render_ctx.num_buffers = cap->num_planes;
-		for (int i = 0; i < cap->num_planes; i++)
-		{
-			disp->render_ctx.buffers[i] = cap->buffers[buf.index].addr[i];
-		}
-		/*
-		 * Render the planes to the display.
-		 * Return value inidcates error or request to exit the capture-display loop.
-		 */
-		ret = disp->render_func(disp);
-		if (ret < 0) {
-			LOGS_ERR("Error during display aborting capture");
-			return errno;
-		} if (ret > 0) {
-			LOGS_INF("Exiting display loop normally");
-			break;
-		}
+		ret = event_loop_add(&loop.events, x11_connection_fd(disp), EPOLLIN, on_display_event, &loop);
+		if (ret) goto cleanup;
+		event_loop_set_prepare(&loop.events, on_display_prepare, &loop);
+	}
 
-		/* Requeue the last buffer, the memory should be duplicated in the GPU and no longer needed. */
-		ret = ioctl(cap->v4l2_fd, VIDIOC_QBUF, &buf);
+	ret = event_loop_add_timer(&loop.events, STATS_INTERVAL_MS, on_stats_timer, &loop);
+	if (ret) goto cleanup;
+
+	/* Frames either come from the capture thread or straight from the device. */
+	if (cap->threaded)
+	{
+		ret = capture_thread_start(&thread_ctx, cap, &loop.fanout, &thread);
+		if (ret) goto cleanup;
+		loop.thread = &thread_ctx;
 	}
-	return 0;
+	else
+	{
+		ret = event_loop_add(&loop.events, cap->v4l2_fd, EPOLLIN, on_capture_ready, &loop);
+	}
+
+	/* Continue until an error occurs or a handler requests an exit */
+	if (!ret)
+	{
+		loop.stats_ns = loop.idle_ns = loop.start_ns = monotonic_ns();
+		ret = event_loop_run(&loop.events);
+		alloc_check_arm(false);
+		if (ret > 0) ret = 0;
+	}
+
+	if (loop.thread)
+	{
+		int thread_ret = capture_thread_stop(&thread_ctx, thread);
+		if (!ret) ret = thread_ret;
+	}
+
+cleanup:
+	/* Frames still waiting for display go back to the driver before the buffers are unmapped. */
+	put_held_frame(&loop);
+	frame_consumer_destroy(&loop.display);
+	cap->stale_frames += loop.display.dropped;
+	cap->requeue_event = -1;
+	if (thread_ctx.release_event >= 0) close(thread_ctx.release_event);
+	event_loop_close(&loop.events);
+	display_close(disp);
+	return ret;
 }
 
 /**
@@ -347,7 +1355,8 @@ int get_device(const char* device)
 {
 	int fd;
 	struct v4l2_capability cap;
-	fd = open(device, O_RDWR);
+	/* Non-blocking, buffers are only dequeued once the event loop reports the device readable. */
+	fd = open(device, O_RDWR | O_NONBLOCK);
 	if (fd < 0) {
 		LOGS_ERR("Unable to open device %s: %s", device, strerror(errno));
 		return -1;
@@ -377,10 +1386,70 @@ int get_device(const char* device)
  */
 int capture_shutdown(struct capture_context *cap)
 {
+	if (cap->source)
+	{
+		source_close(cap);
+		return 0;
+	}
 	stop_stream(cap->v4l2_fd);
 	return unmap_buffers(cap);
 }
 
+/** Number of passes over every buffer when measuring the CPU read bandwidth. */
+#define BANDWIDTH_PASSES 4
+
+/**
+ * Name of a V4L2 memory type for log messages.
+ * @param memory V4L2 buffer memory type.
+ * @return constant string naming the memory type.
+ */
+static const char *memory_name(enum v4l2_memory memory)
+{
+	switch (memory)
+	{
+		case V4L2_MEMORY_MMAP: return "mmap";
+		case V4L2_MEMORY_USERPTR: return "userptr";
+		case V4L2_MEMORY_DMABUF: return "dmabuf";
+		default: return "unknown";
+	}
+}
+
+/**
+ * Measure how fast the CPU reads the capture buffers.
+ * Every plane of every buffer is summed BANDWIDTH_PASSES times.
+ * Driver allocated buffers may be mapped uncached which shows up here as a much lower rate.
+ *
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ */
+static void measure_read_bandwidth(struct capture_context *cap)
+{
+	uint64_t sum = 0;
+	uint64_t bytes = 0;
+	uint64_t start;
+	uint64_t end;
+
+	start = monotonic_ns();
+	for (int pass = 0; pass < BANDWIDTH_PASSES; pass++)
+	{
+		for (int i = 0; i < cap->num_buf; i++)
+		{
+			for (int p = 0; p < cap->num_planes; p++)
+			{
+				const volatile uint64_t *words = cap->buffers[i].addr[p];
+				size_t count = cap->buffers[i].length[p] / sizeof(uint64_t);
+				for (size_t w = 0; w < count; w++)
+					sum += words[w];
+				bytes += count * sizeof(uint64_t);
+			}
+		}
+	}
+	end = monotonic_ns();
+
+	LOGS_INF("CPU read bandwidth of %s buffers %.1f MB/s, %llu bytes in %.3f ms (checksum %llx)",
+		memory_name(cap->memory), bytes * 1e3 / (double)(end - start),
+		(unsigned long long)bytes, (end - start) / 1e6, (unsigned long long)sum);
+}
+
 /**
  * Setup V4L2 capture device for streaming and allocate buffers.
  *
@@ -391,35 +1460,73 @@ int capture_shutdown(struct capture_context *cap)
 int capture_setup(struct capture_context *cap, struct options *opt)
 {
 	int ret = 0;
+	int cached;
 	struct v4l2_requestbuffers req;
 	struct v4l2_format fmt = {0};
+	struct mode_request request = {
+		.width = opt->width,
+		.height = opt->height,
+		.fps = opt->fps,
+		.policy = opt->format_policy };
+	uint64_t begin;
 
 	/*
 	 * MPLANE API is used by the application.
-	 * NV12 is used by the render routine which has two planes.
-	 * First plane is luma, second plane is chroma at 1/4 resolution.
+	 * NV12 is used by the render routine, as two planes with NV12M or one plane with NV12.
+	 * Luma is first, chroma follows at 1/4 resolution.
 	 */
 	cap->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	cap->memory = V4L2_MEMORY_MMAP;
-	cap->num_planes = 2;
+	cap->memory = opt->memory;
+
+	/* Only emulated sources deliver frames as fast as they are consumed. */
+	if (!opt->fps)
+	{
+		LOGS_ERR("%s requires a frame rate, -F max only applies to emulated sources", opt->dev_name);
+		return -EINVAL;
+	}
+
+	/* User pointer buffers have no DMA file descriptors to hand to the display. */
+	if (opt->dma_export && cap->memory == V4L2_MEMORY_USERPTR)
+	{
+		LOGS_ERR("DMA export requires mmap or dmabuf buffers, %s selected", memory_name(cap->memory));
+		return -EINVAL;
+	}
+
+	/* Choose the format, frame size and interval closest to the user request. */
+	begin = startup_begin();
+	cached = negotiate_mode(cap->v4l2_fd, opt->dev_name, &request, opt->mode_cache, &cap->mode);
+	if (cached < 0) return cached;
+	ret = negotiate_apply(cap->v4l2_fd, &cap->mode, &fmt);
+
+	/* A cached mode may be stale after a driver or sensor change, enumerate again when it no longer applies. */
+	if (cached && (ret || fmt.fmt.pix_mp.width != cap->mode.width || fmt.fmt.pix_mp.height != cap->mode.height))
+	{
+		LOGS_WRN("Cached mode %ux%u rejected by %s, enumerating formats",
+			cap->mode.width, cap->mode.height, opt->dev_name);
+		negotiate_forget(cap->v4l2_fd, opt->dev_name, &request, opt->mode_cache);
+		ret = negotiate_mode(cap->v4l2_fd, opt->dev_name, &request, opt->mode_cache, &cap->mode);
+		if (ret < 0) return ret;
+		ret = negotiate_apply(cap->v4l2_fd, &cap->mode, &fmt);
+	}
+	if (ret) return ret;
+	startup_end(cached ? "negotiate cached" : "negotiate", begin);
 
 	/*
-	 * Framezises should be queried and a valid format chosen.
-	 * This application is forcing 1080p for the sensor and display.
+	 * Save the layout chosen by the driver, lines may be padded beyond the width
+	 * and user allocated buffers must be at least sizeimage large.
 	 */
-	fmt.type = cap->type;
-	fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12M;
-	fmt.fmt.pix_mp.num_planes = cap->num_planes;
-	fmt.fmt.pix_mp.width = 1920;
-	fmt.fmt.pix_mp.width = 1080;
-	ret = ioctl(cap->v4l2_fd, VIDIOC_S_FMT, &fmt);
-	if (ret < 0)
+	cap->mode.width = fmt.fmt.pix_mp.width;
+	cap->mode.height = fmt.fmt.pix_mp.height;
+	cap->num_planes = fmt.fmt.pix_mp.num_planes;
+	for (int p = 0; p < cap->num_planes; p++)
 	{
-		LOGS_ERR("Unable to set format %d", ret);
-		exit(-errno);
+		cap->bytesperline[p] = fmt.fmt.pix_mp.plane_fmt[p].bytesperline;
+		if (!cap->bytesperline[p]) cap->bytesperline[p] = cap->mode.width;
+		cap->plane_size[p] = fmt.fmt.pix_mp.plane_fmt[p].sizeimage;
 	}
 
 	/* Request the number of buffers indicated by the user options */
+	begin = startup_begin();
 	memset(&req, 0, sizeof(req));
 	req.count = opt->buffer_count;
 	req.type = cap->type;
@@ -427,8 +1534,11 @@ int capture_setup(struct capture_context *cap, struct options *opt)
 	ret = ioctl(cap->v4l2_fd, VIDIOC_REQBUFS, &req);
 	if (ret < 0)
 	{
-		LOGS_ERR("Unable to request user buffers %d", ret);
-		exit(-errno);
+		int err = errno;
+
+		/* Setup runs beside the display init, return so the caller joins and cleans up. */
+		LOGS_ERR("Unable to request %s buffers %d - %s", memory_name(cap->memory), err, strerror(err));
+		return -err;
 	}
 
 	/* Save the number of buffers actually allocated and set the DMA desciptors to invalid descriptors. */
@@ -437,16 +1547,36 @@ int capture_setup(struct capture_context *cap, struct options *opt)
 		for (int p = 0; p < cap->num_planes; p++)
 			cap->buffers[i].dma_buf_fd[p] = -1;
 
-	/* Memory map the buffers into user space */
-	ret = map_buffers(cap, opt->dma_export);
+	/* Memory map the driver buffers into user space or allocate the user pointer buffers */
+	if (cap->memory == V4L2_MEMORY_USERPTR)
+		ret = map_userptr_buffers(cap);
+	else if (cap->memory == V4L2_MEMORY_DMABUF)
+		ret = map_dmabuf_buffers(cap);
+	else
+		ret = map_buffers(cap, opt->dma_export);
 	if (ret) goto cleanup;
 
+	if (opt->measure_bandwidth) measure_read_bandwidth(cap);
+
+	/* Consumers share the buffers through frame handles, requeued when the last reference is put. */
+	init_frames(cap);
+
 	/* initialize capture by queueing aloctaed buffers before streaming is enabled */
 	ret = queue_buffers(cap->v4l2_fd, cap->num_buf, cap->buffers);
 	if (ret) goto cleanup;
+	cap->queued = cap->num_buf;
+	startup_end("buffers", begin);
+
+	/* Drops and jitter are judged against the negotiated interval, or the measured one without it. */
+	accounting_init(&cap->accounting, cap->mode.interval.denominator ?
+		cap->mode.interval.numerator * 1000000000ull / cap->mode.interval.denominator : 0);
+	for (int i = 0; i < LATENCY_STAGES; i++)
+		histogram_init(&cap->latency[i], latency_names[i]);
 
 	/* Start the video stream, this will setup initial settings on the subdevice. */
+	begin = startup_begin();
 	ret = start_stream(cap->v4l2_fd);
+	startup_end("stream on", begin);
 
 	return ret;
 cleanup:
@@ -484,9 +1614,16 @@ int test_pattern(struct capture_context *cap, int state)
 		cap->app.test_state = 0;
 		LOGS_INF("Live view");
 	}
+	if (cap->source)
+	{
+		ret = source_test_pattern(cap, cap->app.test_state);
+		PROBE2(test_pattern, cap->app.test_state, ret);
+		return ret;
+	}
 	ctrl.value = cap->app.test_state;
 	ctrl.id = V4L2_CID_TEST_PATTERN;
 	ret = ioctl(cap->v4l2_subdev_fd, VIDIOC_S_CTRL, &ctrl);
+	PROBE2(test_pattern, cap->app.test_state, ret);
 	return ret;
 }
 
@@ -503,6 +1640,12 @@ int focus_state(struct capture_context *cap, int new_state)
 {
 	struct v4l2_control ctrl;
 	int ret;
+
+	if (cap->source)
+	{
+		LOGS_INF("Emulated capture sources have no focus control");
+		return -ENOTTY;
+	}
 	switch (cap->app.focus_state)
 	{
 		/* Focus is reset to home position and no focus control is running. */
@@ -602,6 +1745,7 @@ int focus_state(struct capture_context *cap, int new_state)
 			break;
 	}
 	ret = ioctl(cap->v4l2_subdev_fd, VIDIOC_S_CTRL, &ctrl);
+	PROBE3(focus, cap->app.focus_state, ctrl.id, ret);
 	LOGS_DBG("Focus command result is %d", ret);
 	return ret;
 }
@@ -615,6 +1759,7 @@ void print_key_functions()
 	LOGS_INF("p - Hold focus at the point when the button is pressed.");
 	LOGS_INF("t - Cycle through three sensor test patterns.");
 	LOGS_INF("l - Select sensor live view.");
+	LOGS_INF("d - Dump the stage trace when tracing is enabled.");
 	LOGS_INF("h - Print this menu.");
 }
 
@@ -652,12 +1797,121 @@ void do_key_event(char keys[], int num_keys, struct display_context* disp)
 			case 'l':
 				test_pattern(cap, 0);
 				break;
+			case 'd':
+				if (g_trace.enabled) trace_dump();
+				break;
 			default:
 				break;
 		}
 	}
 }
 
+/**
+ * Capture device setup run while the display is initialized.
+ */
+struct capture_start {
+	/** Capture data management structure with V4L2 buffer mapping. */
+	struct capture_context *cap;
+	/** User selected program configuration options. */
+	struct options *opt;
+	/** Error status of the setup. Value 0 when the stream started. */
+	int ret;
+};
+
+/**
+ * Open an emulated capture source and queue its buffers, the counterpart of capture_setup() for V4L2.
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param opt User selected program configuration options.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+static int source_setup(struct capture_context *cap, struct options *opt)
+{
+	uint64_t begin;
+	int ret;
+
+	begin = startup_begin();
+	ret = source_open(cap, opt);
+	if (ret) return ret;
+	if (opt->measure_bandwidth) measure_read_bandwidth(cap);
+	init_frames(cap);
+	for (int i = 0; i < cap->num_buf; i++)
+	{
+		ret = capture_queue(cap, &cap->buffers[i].v4l2buf);
+		if (ret) return ret;
+	}
+	cap->queued = cap->num_buf;
+	startup_end("source", begin);
+
+	/* An unpaced source has no interval, drops and jitter are judged against the measured one. */
+	accounting_init(&cap->accounting, cap->mode.interval.denominator ?
+		cap->mode.interval.numerator * 1000000000ull / cap->mode.interval.denominator : 0);
+	for (int i = 0; i < LATENCY_STAGES; i++)
+		histogram_init(&cap->latency[i], latency_names[i]);
+	return 0;
+}
+
+/**
+ * Route the media pipeline, open the devices, negotiate the mode, allocate the buffers and start streaming.
+ * @param cap Capture data management structure with V4L2 buffer mapping.
+ * @param opt User selected program configuration options.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+static int capture_start(struct capture_context *cap, struct options *opt)
+{
+	uint64_t begin;
+	int ret;
+
+	cap->v4l2_fd = -1;
+	cap->v4l2_subdev_fd = -1;
+
+	/* A prefixed device such as file:PATH is emulated, there is no media graph or subdevice to open. */
+	if (source_find(opt->dev_name)) return source_setup(cap, opt);
+
+	/* Link and format the camera route so the video device offers the requested size. */
+	if (opt->pipeline_camera >= 0)
+	{
+		struct media_pipeline pipeline = {
+			.camera = opt->pipeline_camera,
+			.path = opt->pipeline_path,
+			.width = opt->width,
+			.height = opt->height };
+		begin = startup_begin();
+		ret = media_pipeline_setup(opt->media_dev, &pipeline);
+		if (ret) return ret;
+		startup_end("media pipeline", begin);
+		if (strcmp(pipeline.video_dev, opt->dev_name))
+			LOGS_WRN("Pipeline ends at %s, capturing from %s", pipeline.video_dev, opt->dev_name);
+		if (strcmp(pipeline.sensor_subdev, opt->subdev_name))
+			LOGS_WRN("Pipeline sensor is %s, controlling %s", pipeline.sensor_subdev, opt->subdev_name);
+	}
+
+	/* open the video device for capture. */
+	begin = startup_begin();
+	cap->v4l2_fd = get_device(opt->dev_name);
+	if (cap->v4l2_fd < 0) return -ENODEV;
+	/* open the camera sensor subdevice for controls. */
+	cap->v4l2_subdev_fd = get_subdevice(opt->subdev_name);
+	if (cap->v4l2_subdev_fd < 0) return -ENODEV;
+	startup_end("open devices", begin);
+
+	/* Setup the v4l2 device and start streaming. */
+	return capture_setup(cap, opt);
+}
+
+/**
+ * Capture setup thread.
+ * @param arg capture_start context, the error status is saved in it.
+ * @return NULL.
+ */
+static void *capture_start_thread(void *arg)
+{
+	struct capture_start *start = arg;
+
+	startup_thread_name("capture");
+	start->ret = capture_start(start->cap, start->opt);
+	return NULL;
+}
+
 /**
  * Setup V4L2 capture device, OpenGL display, and intitate video streaming.
  * The base function to perform the capture and display test program.
@@ -671,50 +1925,105 @@ int capture_and_display(void* cap_ctx, void* disp_ctx, struct options* opt)
 {
 		struct capture_context* cap = cap_ctx;
 		struct display_context* disp = disp_ctx;
-		struct sigaction sa;
+		struct capture_start start;
+		pthread_t start_thread;
+		uint64_t begin;
 		int ret;
 
 		/* initialize application state after STREAM_ON. */
 		cap->app.focus_state = AUTO_FOCUS_ENABLED;
 		cap->app.test_state = 0;
+		cap->threaded = opt->threaded;
+		cap->present_policy = opt->present_policy;
 
-		/* open the video device for capture. */
-		cap->v4l2_fd = get_device(opt->dev_name);
-		if (cap->v4l2_fd < 0) {
-			exit(1);
-		}
-		/* open the camera sensor subdevice for controls. */
-		cap->v4l2_subdev_fd = get_subdevice(opt->subdev_name);
-		if (cap->v4l2_subdev_fd < 0) {
-			exit(1);
+		/* The trace ring is allocated before capture starts so recording never allocates. */
+		if (opt->trace_file)
+		{
+			ret = trace_init(opt->trace_file);
+			if (ret) return ret;
 		}
 
-		/* Setup the v4l2 device and start streaming. */
-		ret = capture_setup(cap, opt);
+		/*
+		 * The capture device and the display do not depend on each other until the textures are sized.
+		 * The device is setup on its own thread while this thread creates the window, EGL context and shaders,
+		 * the EGL context stays current on this thread which renders every frame.
+		 */
+		startup_init();
+		startup_thread_name("display");
+		start.cap = cap;
+		start.opt = opt;
+		start.ret = 0;
+		ret = pthread_create(&start_thread, NULL, capture_start_thread, &start);
 		if (ret)
 		{
-			LOGS_ERR("Unable to start capture stream");
+			LOGS_ERR("Unable to start capture setup thread %d - %s", ret, strerror(ret));
+			return -ret;
+		}
+
+		disp->width = opt->width;
+		disp->height = opt->height;
+		disp->backend = opt->display_backend;
+		ret = display_init(disp);
+
+		begin = startup_begin();
+		pthread_join(start_thread, NULL);
+		startup_end("join", begin);
+		if (ret || start.ret)
+		{
+			if (ret)
+			{
+				LOGS_ERR("Error setting up display aborting capture");
+			}
+			else
+			{
+				display_close(disp);
+			}
+			if (start.ret) LOGS_ERR("Unable to start capture stream");
 			capture_shutdown(cap);
-			return ret;
+			return start.ret ? start.ret : -1;
 		}
 
-		/**
-		* Setup a signal handler to catch ctrl-c.
-		* unmap and free the kernel buffers to prevent a memory leak.
-		*/
-		sa.sa_handler = signal_exit;
-		sigemptyset (&sa.sa_mask);
-		sa.sa_flags = 0;
-		sigaction(SIGINT, &sa, NULL);
+		/* Publish live metrics for readers such as capstat, capture continues without them. */
+		if (opt->metrics_name && opt->metrics_name[0] &&
+			!metrics_open(opt->metrics_name, &cap->metrics))
+		{
+			cap->metrics->width = cap->mode.width;
+			cap->metrics->height = cap->mode.height;
+			cap->metrics->interval_ns = cap->accounting.interval_ns;
+			cap->metrics->start_ns = monotonic_ns();
+			metrics_publish(cap->metrics);
+		}
 
 		/* setup the display event callback functions and context */
 		disp->callbacks.key_event = do_key_event;
 		disp->callbacks.private_context = cap;
+		disp->render_method = opt->render_method;
+		disp->gpu_timing = opt->gpu_timing;
+		disp->watermark.enabled = opt->watermark;
 
 		/* Enter the capture display loop */
 		ret = capture_display_yuv(cap, disp);
+		if (cap->present_policy == PRESENT_MAILBOX)
+		{
+			LOGS_INF("Mailbox presentation dropped %llu stale frames",
+				(unsigned long long)cap->stale_frames);
+		}
+		accounting_summary(&cap->accounting);
+		metrics_close(opt->metrics_name, cap->metrics);
+		cap->metrics = NULL;
+		LOGS_INF("Frame latency since the start:");
+		for (int i = 0; i < LATENCY_STAGES; i++)
+			histogram_report(&cap->latency[i]);
+		if (disp->watermark.enabled) histogram_report(&disp->watermark.latency);
 		/* Cleanly release the buffers map and free them in the kernel on either error or exit request. */
 		capture_shutdown(cap);
+		dmabuf_pool_free(&cap->pool);
+
+		if (g_trace.enabled)
+		{
+			trace_dump();
+			trace_close();
+		}
 
 		return ret;
 }
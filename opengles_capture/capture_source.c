@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Frame sources emulating the V4L2 capture device.
+ * @file capture_source.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/timerfd.h>
+
+#include <linux/dma-buf.h>
+
+#include "options.h"
+#include "capture.h"
+#include "capture_source.h"
+#include "log.h"
+
+extern const struct capture_source file_source;
+extern const struct capture_source synthetic_source;
+
+/** Every available source, selected by the prefix of the capture device. */
+static const struct capture_source * const sources[] = {
+	&file_source,
+	&synthetic_source,
+};
+
+/**
+ * Read the monotonic clock.
+ * @return current monotonic time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+const struct capture_source *source_find(const char *device)
+{
+	for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++)
+		if (!strncmp(device, sources[i]->prefix, strlen(sources[i]->prefix))) return sources[i];
+	return NULL;
+}
+
+/**
+ * Arm the readiness timer.
+ * @param dev emulated device.
+ * @param due_ns monotonic time the timer expires, 1 for immediately, 0 to disarm it.
+ */
+static void arm_timer(struct source_device *dev, uint64_t due_ns)
+{
+	struct itimerspec spec = {
+		.it_value = { .tv_sec = due_ns / 1000000000ull, .tv_nsec = due_ns % 1000000000ull } };
+
+	if (timerfd_settime(dev->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+		LOGS_ERR("Unable to arm the source timer %d - %s", errno, strerror(errno));
+}
+
+/**
+ * Time a frame is due.
+ * @param dev emulated device, paced.
+ * @param frame frame number.
+ * @return monotonic due time in nanoseconds.
+ */
+static uint64_t frame_due_ns(const struct source_device *dev, uint64_t frame)
+{
+	if (!dev->timestamps) return dev->start_ns + frame * dev->interval_ns;
+	return dev->start_ns + (frame / dev->frames) * dev->loop_ns + dev->timestamps[frame % dev->frames];
+}
+
+/**
+ * Carve the planes of every buffer from the capture arena or take them from the DMA buffer pool.
+ * @param cap Capture data management structure with the plane layout set.
+ * @return error status of the allocation. Value 0 is returned on success.
+ */
+static int alloc_buffers(struct capture_context *cap)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t total = 0;
+	int ret;
+
+	if (cap->memory == V4L2_MEMORY_DMABUF)
+	{
+		ret = dmabuf_pool_alloc(&cap->pool, cap->num_buf, cap->num_planes, cap->plane_size);
+		if (ret) return ret;
+	}
+	else
+	{
+		for (int p = 0; p < cap->num_planes; p++)
+			total += cap->num_buf * ((cap->plane_size[p] + page_size - 1) & ~(page_size - 1));
+		ret = arena_create(&cap->arena, total);
+		if (ret) return ret;
+	}
+
+	for (int i = 0; i < cap->num_buf; i++)
+	{
+		struct v4l2_buffer *buf = &cap->buffers[i].v4l2buf;
+
+		memset(buf, 0, sizeof(*buf));
+		buf->m.planes = cap->buffers[i].v4l2planes;
+		buf->length = cap->num_planes;
+		buf->type = cap->type;
+		buf->memory = cap->memory;
+		buf->index = i;
+		for (int p = 0; p < cap->num_planes; p++)
+		{
+			if (cap->memory == V4L2_MEMORY_DMABUF)
+			{
+				cap->buffers[i].addr[p] = cap->pool.addr[i][p];
+				cap->buffers[i].dma_buf_fd[p] = cap->pool.fd[i][p];
+				buf->m.planes[p].m.fd = cap->pool.fd[i][p];
+			}
+			else
+			{
+				cap->buffers[i].addr[p] = arena_alloc(&cap->arena, cap->plane_size[p], page_size);
+				if (!cap->buffers[i].addr[p]) return -ENOMEM;
+				cap->buffers[i].dma_buf_fd[p] = -1;
+				buf->m.planes[p].m.userptr = (unsigned long)cap->buffers[i].addr[p];
+			}
+			cap->buffers[i].length[p] = cap->plane_size[p];
+			buf->m.planes[p].length = cap->plane_size[p];
+			buf->m.planes[p].bytesused = cap->plane_size[p];
+		}
+	}
+	return 0;
+}
+
+int source_open(struct capture_context *cap, struct options *opt)
+{
+	const struct capture_source *source = source_find(opt->dev_name);
+	struct source_device *dev;
+	int ret;
+
+	if (!source) return -ENODEV;
+	if (opt->render_method == RENDER_DMABUF_IMPORT && opt->memory != V4L2_MEMORY_DMABUF)
+	{
+		LOGS_ERR("DMA buffer import of a %s source requires dmabuf memory", source->prefix);
+		return -EINVAL;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev) return -ENOMEM;
+	dev->source = source;
+	dev->timer_fd = -1;
+	pthread_mutex_init(&dev->lock, NULL);
+	cap->source = dev;
+
+	ret = source->open(dev, opt->dev_name + strlen(source->prefix), opt);
+	if (ret) return ret;
+	if (!dev->width || !dev->height || dev->width % 2 || dev->height % 2)
+	{
+		LOGS_ERR("Source frame size %ux%u must be even", dev->width, dev->height);
+		return -EINVAL;
+	}
+
+	/* The timer reports the device readable, exactly like a V4L2 device with a filled buffer. */
+	dev->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (dev->timer_fd < 0)
+	{
+		LOGS_ERR("Unable to create the source timer %d - %s", errno, strerror(errno));
+		return -errno;
+	}
+	cap->v4l2_fd = dev->timer_fd;
+
+	/* Frames are NV12M, luma then interleaved CbCr at half the resolution, lines are not padded. */
+	cap->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	cap->memory = opt->memory == V4L2_MEMORY_DMABUF ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_USERPTR;
+	cap->mode.pixelformat = V4L2_PIX_FMT_NV12M;
+	cap->mode.width = dev->width;
+	cap->mode.height = dev->height;
+	cap->mode.interval.numerator = dev->timestamps ? 0 : dev->interval_ns;
+	cap->mode.interval.denominator = dev->timestamps || !dev->interval_ns ? 0 : 1000000000;
+	cap->num_planes = 2;
+	cap->bytesperline[0] = cap->bytesperline[1] = dev->width;
+	cap->plane_size[0] = dev->width * dev->height;
+	cap->plane_size[1] = dev->width * dev->height / 2;
+	cap->num_buf = opt->buffer_count < VIDEO_MAX_FRAME ? opt->buffer_count : VIDEO_MAX_FRAME;
+
+	ret = alloc_buffers(cap);
+	if (ret) return ret;
+
+	if (dev->timestamps)
+	{
+		LOGS_INF("Source %ux%u paced by recorded timestamps", dev->width, dev->height);
+	}
+	else if (dev->interval_ns)
+	{
+		LOGS_INF("Source %ux%u at %.3f fps", dev->width, dev->height, 1e9 / dev->interval_ns);
+	}
+	else
+	{
+		LOGS_INF("Source %ux%u unpaced", dev->width, dev->height);
+	}
+	return 0;
+}
+
+int source_dequeue(struct capture_context *cap, struct v4l2_buffer *buf)
+{
+	struct source_device *dev = cap->source;
+	struct video_buf_map *map;
+	struct v4l2_plane *planes = buf->m.planes;
+	uint64_t expirations;
+	uint64_t now;
+	uint64_t timestamp;
+	uint64_t frame;
+	int index;
+
+	pthread_mutex_lock(&dev->lock);
+	if (read(dev->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		LOGS_ERR("Source timer: %d - %s", errno, strerror(errno));
+	if (dev->head == dev->tail)
+	{
+		pthread_mutex_unlock(&dev->lock);
+		return -EAGAIN;
+	}
+
+	now = monotonic_ns();
+	if (!dev->start_ns) dev->start_ns = now;
+	timestamp = now;
+	if (dev->interval_ns || dev->timestamps)
+	{
+		timestamp = frame_due_ns(dev, dev->frame);
+		if (now < timestamp)
+		{
+			arm_timer(dev, timestamp);
+			pthread_mutex_unlock(&dev->lock);
+			return -EAGAIN;
+		}
+		/* The consumer missed the frames whose successor is already due. */
+		while (frame_due_ns(dev, dev->frame + 1) <= now)
+		{
+			dev->frame++;
+			dev->dropped++;
+		}
+		timestamp = frame_due_ns(dev, dev->frame);
+	}
+
+	index = dev->queue[dev->tail % VIDEO_MAX_FRAME];
+	dev->tail++;
+	frame = dev->frame++;
+	if (dev->head == dev->tail)
+		arm_timer(dev, 0);
+	else
+		arm_timer(dev, dev->interval_ns || dev->timestamps ? frame_due_ns(dev, dev->frame) : 1);
+	pthread_mutex_unlock(&dev->lock);
+
+	/* The buffer belongs to this thread until it is queued again, DMA buffers are written through the CPU cache. */
+	map = &cap->buffers[index];
+	for (int p = 0; p < cap->num_planes; p++)
+		if (map->dma_buf_fd[p] >= 0) dmabuf_sync(map->dma_buf_fd[p], DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+	dev->source->fill(dev, frame, map->addr[0], map->addr[1]);
+	for (int p = 0; p < cap->num_planes; p++)
+		if (map->dma_buf_fd[p] >= 0) dmabuf_sync(map->dma_buf_fd[p], DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+
+	*buf = map->v4l2buf;
+	buf->m.planes = planes;
+	memcpy(planes, map->v4l2planes, sizeof(planes[0]) * cap->num_planes);
+	buf->sequence = frame;
+	buf->field = V4L2_FIELD_NONE;
+	buf->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_TSTAMP_SRC_SOE;
+	buf->timestamp.tv_sec = timestamp / 1000000000ull;
+	buf->timestamp.tv_usec = timestamp % 1000000000ull / 1000;
+	return 0;
+}
+
+int source_queue(struct capture_context *cap, const struct v4l2_buffer *buf)
+{
+	struct source_device *dev = cap->source;
+
+	if (buf->index >= (uint32_t)cap->num_buf) return -EINVAL;
+	pthread_mutex_lock(&dev->lock);
+	if (dev->head - dev->tail >= VIDEO_MAX_FRAME)
+	{
+		pthread_mutex_unlock(&dev->lock);
+		return -EINVAL;
+	}
+	dev->queue[dev->head % VIDEO_MAX_FRAME] = buf->index;
+	dev->head++;
+	/* The dequeue decides whether a frame is due and arms the timer for the next one. */
+	if (dev->head - dev->tail == 1) arm_timer(dev, 1);
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+}
+
+int source_test_pattern(struct capture_context *cap, int pattern)
+{
+	struct source_device *dev = cap->source;
+
+	if (!dev->source->test_pattern)
+	{
+		LOGS_WRN("The %s source has no test pattern", dev->source->prefix);
+		return -ENOTTY;
+	}
+	return dev->source->test_pattern(dev, pattern);
+}
+
+void source_close(struct capture_context *cap)
+{
+	struct source_device *dev = cap->source;
+
+	if (!dev) return;
+	if (dev->dropped)
+		LOGS_INF("Source dropped %llu frames the consumer fell behind on", (unsigned long long)dev->dropped);
+	dev->source->close(dev);
+	if (dev->timer_fd >= 0) close(dev->timer_fd);
+	pthread_mutex_destroy(&dev->lock);
+	free(dev);
+	for (int i = 0; i < cap->num_buf; i++)
+		for (int p = 0; p < cap->num_planes; p++)
+		{
+			cap->buffers[i].addr[p] = NULL;
+			cap->buffers[i].dma_buf_fd[p] = -1;
+		}
+	arena_destroy(&cap->arena);
+	cap->source = NULL;
+	cap->v4l2_fd = -1;
+}
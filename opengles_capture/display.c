@@ -43,6 +43,9 @@
 
 #include "display.h"
 #include "gles_egl_util.h"
+#include "trace.h"
+#include "probes.h"
+#include "startup.h"
 #include "log.h"
 
 /**
@@ -203,6 +206,8 @@ int x11_close_display(struct display_context *disp)
 		if (win) XDestroyWindow(x11_disp, win);
 		XCloseDisplay(x11_disp);
 	}
+	disp->egl_native_display = NULL;
+	disp->egl_native_window = 0;
 
 	return 0;
 }
@@ -345,83 +350,238 @@ int egl_init(struct display_context *disp)
 	return 0;
 }
 
+int offscreen_init(struct display_context *disp)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = NULL;
+	const char *client_extensions;
+	const char *display_extensions;
+	EGLint major, minor;
+	EGLint num_configs;
+	EGLConfig config;
+	EGLContext context;
+	GLenum status;
+
+	/* Request an EGL v3.x context, there is no window system to negotiate a lower version with. */
+	EGLint context_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+	/* The pbuffer bit is only used when surfaceless contexts are not supported. */
+	EGLint config_attribs[] = {
+		EGL_RED_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+		EGL_NONE };
+	EGLint pbuffer_attribs[] = { EGL_WIDTH, disp->width, EGL_HEIGHT, disp->height, EGL_NONE };
+
+	/*
+	 * The surfaceless platform renders on the GPU without any display server.
+	 * Client extensions are queried without a display, the query returns NULL when there are none.
+	 */
+	client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (client_extensions && strstr(client_extensions, "EGL_MESA_platform_surfaceless"))
+		get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	disp->egl_display = EGL_NO_DISPLAY;
+	if (get_platform_display)
+		disp->egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (disp->egl_display == EGL_NO_DISPLAY)
+		disp->egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (disp->egl_display == EGL_NO_DISPLAY)
+	{
+		LOGS_ERR("Unable to get an offscreen EGL display");
+		return -1;
+	}
+	if (eglInitialize(disp->egl_display, &major, &minor) == EGL_FALSE)
+	{
+		LOGS_ERR("Unable to initialize egl %s", string_egl_error(eglGetError()));
+		disp->egl_display = EGL_NO_DISPLAY;
+		return -1;
+	}
+
+	if (eglBindAPI(EGL_OPENGL_ES_API) == EGL_FALSE)
+	{
+		LOGS_ERR("Unable to bind the OpenGL ES API %s", string_egl_error(eglGetError()));
+		return -1;
+	}
+	if (eglChooseConfig(disp->egl_display, config_attribs, &config, 1, &num_configs) == EGL_FALSE ||
+		num_configs < 1)
+	{
+		LOGS_ERR("Unable to select config %s", string_egl_error(eglGetError()));
+		return -1;
+	}
+	context = eglCreateContext(disp->egl_display, config, EGL_NO_CONTEXT, context_attribs);
+	if (context == EGL_NO_CONTEXT)
+	{
+		LOGS_ERR("Unable to create context %s", string_egl_error(eglGetError()));
+		return -1;
+	}
+
+	/*
+	 * Without surfaceless contexts the pbuffer is the render target, pbuffers are never presented.
+	 * A failed display extension query is treated as no surfaceless support.
+	 */
+	disp->egl_surface = EGL_NO_SURFACE;
+	display_extensions = eglQueryString(disp->egl_display, EGL_EXTENSIONS);
+	if (!display_extensions || !strstr(display_extensions, "EGL_KHR_surfaceless_context"))
+	{
+		disp->egl_surface = eglCreatePbufferSurface(disp->egl_display, config, pbuffer_attribs);
+		if (disp->egl_surface == EGL_NO_SURFACE)
+		{
+			LOGS_ERR("Unable to create a %dx%d pbuffer %s", disp->width, disp->height,
+				string_egl_error(eglGetError()));
+			return -1;
+		}
+	}
+	if (eglMakeCurrent(disp->egl_display, disp->egl_surface, disp->egl_surface, context) == EGL_FALSE)
+	{
+		LOGS_ERR("Unable to bind context %s", string_egl_error(eglGetError()));
+		return -1;
+	}
+
+	/* A surfaceless context has no default framebuffer, render into a framebuffer object instead. */
+	if (disp->egl_surface == EGL_NO_SURFACE)
+	{
+		glGenRenderbuffers(1, &disp->renderbuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, disp->renderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, disp->width, disp->height);
+		glGenFramebuffers(1, &disp->framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, disp->framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, disp->renderbuffer);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			LOGS_ERR("Offscreen framebuffer incomplete 0x%x", status);
+			return -1;
+		}
+	}
+	LOGS_INF("EGL %d.%d offscreen %dx%d %s on the %s display", major, minor, disp->width, disp->height,
+		disp->framebuffer ? "framebuffer object" : "pbuffer", get_platform_display ? "surfaceless" : "default");
+	return 0;
+}
+
+int offscreen_close(struct display_context *disp)
+{
+	if (disp->egl_display == EGL_NO_DISPLAY) return 0;
+	if (disp->framebuffer)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &disp->framebuffer);
+		glDeleteRenderbuffers(1, &disp->renderbuffer);
+		disp->framebuffer = disp->renderbuffer = 0;
+	}
+	/* Terminating the display releases the context and surface once they are no longer current. */
+	eglMakeCurrent(disp->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglTerminate(disp->egl_display);
+	disp->egl_display = EGL_NO_DISPLAY;
+	disp->egl_surface = EGL_NO_SURFACE;
+	return 0;
+}
+
 /**
- * Display event loop, check for occuring events and send callbacks based on the events.
+ * Send callbacks for a single event received from the native display.
  * @param disp Display Data management structure with GPU handles.
+ * @param event the event to handle.
  * @return Value 1 is returned if 'q' has been pressed indicating a request to quit the application.
  */
-int x11_process_pending_events(struct display_context *disp)
+static int x11_dispatch_event(struct display_context *disp, XEvent *event)
 {
-	Display *x11_disp = (Display*)disp->egl_native_display;
 	int quit = 0;
 	char text[11];
 	int keys = 0;
 	KeySym key_press;
+
+	switch (event->type)
+	{
+		case Expose:
+			/* Window resized/hidden/shown etc. */
+		break;
+		case KeyPress:
+			/* Keyboard events occured, get the key sequence, limit to 10 keys total. */
+			keys = XLookupString(&event->xkey, text, 10, &key_press, 0);
+			PROBE2(key, keys > 0 ? text[0] : 0, keys);
+			if (disp->callbacks.key_event != NULL)
+			{
+				/* send the events to the application */
+				disp->callbacks.key_event(text, keys, disp);
+			}
+			/* reserve the 'q' key to exit the display loop */
+			if (keys == 1 && text[0] == 'q') quit = true;
+			break;
+		default:
+			break;
+	}
+	return quit;
+}
+
+/**
+ * Display event loop, check for occuring events and send callbacks based on the events.
+ * @param disp Display Data management structure with GPU handles.
+ * @return Value 1 is returned if 'q' has been pressed indicating a request to quit the application.
+ */
+int x11_process_pending_events(struct display_context *disp)
+{
+	Display *x11_disp = (Display*)disp->egl_native_display;
+	int quit = 0;
 	XEvent event;
 
 	/* Process events, one at a time, until there are none remaining. */
 	while (XPending(x11_disp))
 	{
 		XNextEvent(x11_disp, &event);
-		switch (event.type)
-		{
-			case Expose:
-				/* Window resized/hidden/shown etc. */
-			break;
-			case KeyPress:
-				/* Keyboard events occured, get the key sequence, limit to 10 keys total. */
-				keys = XLookupString(&event.xkey, text, 10, &key_press, 0);
-				if (disp->callbacks.key_event != NULL)
-				{
-					/* send the events to the application */
-					disp->callbacks.key_event(text, keys, disp);
-				}
-				/* reserve the 'q' key to exit the display loop */
-				if (keys == 1 && text[0] == 'q') quit = true;
-				break;
-			default:
-				break;
-		}
+		quit |= x11_dispatch_event(disp, &event);
 	}
 	return quit;
 }
 
 /**
- * Render the next camera frame on the EGL surface using the NV12 shader program
- * Two buffers, seperate luma and chroma planes must be assigned in the disp->render_ctx
- * Setup a full screen window and utilize EGL and OpenGLES to setup the display_context.
- *
+ * Flush pending requests and handle events Xlib already read from the connection.
+ * Xlib may read events into its own queue during other calls such as eglSwapBuffers.
+ * Those events never make the connection readable again so they must be drained before waiting on it.
  * @param disp Display Data management structure with GPU handles.
- * @return error status of the setup. Value 0 is returned on success.
+ * @return Value 1 is returned if 'q' has been pressed indicating a request to quit the application.
  */
-int render_nv12m_subs_tex(struct display_context *disp)
+int x11_process_queued_events(struct display_context *disp)
 {
-	GLenum error = GL_NO_ERROR;
+	Display *x11_disp = (Display*)disp->egl_native_display;
 	int quit = 0;
-	EGLBoolean ret = 0;
+	XEvent event;
 
-	/*
-	 * Process any events such as window resize before rendering on the window
-	 * One or more resize events may occur on startup as the window is switched to full screen mode.
-	 */
-	quit = x11_process_pending_events(disp);
-	if (quit)
+	XFlush(x11_disp);
+	while (XEventsQueued(x11_disp, QueuedAlready))
 	{
-		x11_close_display(disp);
-		return 1;
+		XNextEvent(x11_disp, &event);
+		quit |= x11_dispatch_event(disp, &event);
 	}
+	return quit;
+}
 
-	/*
-	 * There must be valid YUV420 semi planar data in the render context.
-	 * The first buffer must contain luma data and the second must contain the chroma data.
-	 * This should be NV12 format with the chroma in CbCr order.
-	 */
-	if (disp->render_ctx.num_buffers < 2 ||
-		!disp->render_ctx.buffers[0] || !disp->render_ctx.buffers[1])
-	{
-		LOGS_ERR("Unable to continue no buffer address in display render_context\n");
-		return -1;
-	}
+/**
+ * File descriptor of the native display connection.
+ * @param disp Display Data management structure with GPU handles.
+ * @return file descriptor that becomes readable when the display sends events, -1 for the offscreen backend.
+ */
+int x11_connection_fd(struct display_context *disp)
+{
+	if (!disp->egl_native_display) return -1;
+	return ConnectionNumber((Display*)disp->egl_native_display);
+}
+
+/**
+ * Draw the luma and chroma textures on the EGL surface using the NV12 shader program.
+ * Shared by every render method once the frame planes are available as GPU textures.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @param luma texture handle holding the luma plane.
+ * @param chroma texture handle holding the chroma plane.
+ * @return error status of the draw. Value 0 is returned on success.
+ */
+static int draw_nv12_textures(struct display_context *disp, GLuint luma, GLuint chroma)
+{
+	GLenum error = GL_NO_ERROR;
+	EGLBoolean ret = 0;
+	uint64_t span;
+
+	/* Every render method reaches this point once the planes are uploaded or imported. */
+	disp->render_ctx.upload_ns = trace_now();
 
 	/*
 	 * Set the rendered surface to match the full window resolution.
@@ -445,21 +605,121 @@ int render_nv12m_subs_tex(struct display_context *disp)
 	/* Select the vertex array which includes the vertices and indices describing the window rectangle. */
 	glBindVertexArray(disp->vertex_array);
 
+	/* Indicate that GL_TEXTURE0 is s_luma_texture from previous lookup */
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, luma);
+	glUniform1i(disp->location[0], 0);
+
+	/* Indicate that GL_TEXTURE1 is s_chroma_texture from previous lookup */
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, chroma);
+	glUniform1i(disp->location[1], 1);
+
+	/*
+	 * Draw the two triangles from 6 indices to form a rectangle from the data in the vertex array.
+	 * The fourth parameter, indices value here is passed as null since the values are already
+	 * available in the GPU memory through the vertex array
+	 * GL_TRIANGLES - draw each set of three vertices as an individual trianvle.
+	 */
+	PROBE1(draw, disp->render_ctx.sequence);
+	span = trace_begin();
+	gpu_timer_begin(&disp->gpu_timer, GPU_DRAW);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	gpu_timer_end(&disp->gpu_timer);
+	trace_end("draw", span, disp->render_ctx.sequence);
+	/** Select the default vertex array, allowing the applications array to be unbound */
+	glBindVertexArray(0);
+	/* Queue the readback of the stamped corner before the swap leaves the back buffer undefined. */
+	watermark_readback(&disp->watermark, disp->render_ctx.sequence);
+
+	/*
+	 * display the new camera frame after render is complete at the next vertical sync
+	 * This is drawn on the EGL surface which matches the full screen native window.
+	 * The offscreen framebuffer object is never presented, the draw is only submitted to the GPU.
+	 */
+	PROBE1(swap_start, disp->render_ctx.sequence);
+	span = trace_begin();
+	if (disp->framebuffer)
+	{
+		glFlush();
+		ret = EGL_TRUE;
+	}
+	else
+	{
+		ret = eglSwapBuffers(disp->egl_display, disp->egl_surface);
+	}
+	disp->render_ctx.present_ns = trace_now();
+	watermark_presented(&disp->watermark, disp->render_ctx.present_ns);
+	PROBE1(swap_end, disp->render_ctx.sequence);
+	trace_end("swap", span, disp->render_ctx.sequence);
+	if (ret == EGL_FALSE)
+	{
+		LOGS_ERR("Unable to update surface %s", string_egl_error(eglGetError()));
+	}
+
+	return 0;
+}
+
+/**
+ * Check the render context holds both planes of an NV12 frame in memory.
+ * @param disp Display Data management structure with GPU handles.
+ * @return true when the luma and chroma planes are assigned.
+ */
+static bool has_nv12_planes(struct display_context *disp)
+{
+	/*
+	 * There must be valid YUV420 semi planar data in the render context.
+	 * The first buffer must contain luma data and the second must contain the chroma data.
+	 * This should be NV12 format with the chroma in CbCr order.
+	 */
+	if (disp->render_ctx.num_buffers < 2 ||
+		!disp->render_ctx.buffers[0] || !disp->render_ctx.buffers[1])
+	{
+		LOGS_ERR("Unable to continue no buffer address in display render_context\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Copy both planes of the frame into the luma and chroma textures.
+ * The source is client memory, or offsets in the bound pixel unpack buffer.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @param luma_format pixel format of the luma texture, one byte per texel.
+ * @param chroma_format pixel format of the chroma texture, two bytes per texel.
+ * @param luma luma plane address or offset.
+ * @param chroma chroma plane address or offset.
+ */
+static void upload_nv12_planes(struct display_context *disp, GLenum luma_format, GLenum chroma_format,
+	const void *luma, const void *chroma)
+{
+	GLenum error = GL_NO_ERROR;
+	uint64_t span;
 
 	/*
 	 * Copy the Luma data from plane 0 to the s_luma_texture texture in the GPU.
 	 * Each texture has four components, x,y,z,w alias r,g,b,a alias s,r,t,u.
 	 * Luma will be replicated in x, y, and z using type GL_LUMINCANCE. Component w is set to 1.0.
 	 * The resolution of the texture matches the number of active pixels.
+	 * Lines padded by the driver are skipped by setting the unpack row length to the stride.
 	 */
 	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, disp->texture[0]);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, disp->render_ctx.stride[0]);
+	PROBE1(upload_start, disp->render_ctx.sequence);
+	span = trace_begin();
+	gpu_timer_begin(&disp->gpu_timer, GPU_UPLOAD_LUMA);
 	glTexSubImage2D(GL_TEXTURE_2D, 0,
-		0, 0, disp->width, disp->height,
-		GL_LUMINANCE, GL_UNSIGNED_BYTE, disp->render_ctx.buffers[0]);
+		0, 0, disp->render_ctx.width, disp->render_ctx.height,
+		luma_format, GL_UNSIGNED_BYTE, luma);
+	gpu_timer_end(&disp->gpu_timer);
+	trace_end("upload luma", span, disp->render_ctx.sequence);
 	error = glGetError();
-	glBindTexture(GL_TEXTURE_2D, disp->texture[0]);
-	/* Indicate that GL_TEXTURE0 is s_luma_texture from previous lookup */
-	glUniform1i(disp->location[0], 0);
+	if (error != GL_NO_ERROR)
+	{
+		LOGS_ERR("Unable to update luma texture %s", string_gl_error(error));
+	}
 
 	/*
 	 * Copy the chroma data from plane 1 to the s_chroma_texture texture in the GPU.
@@ -471,50 +731,428 @@ int render_nv12m_subs_tex(struct display_context *disp)
 	 * The texture lookup will replicate the chroma values up to the total resolution.
 	 */
 	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, disp->texture[1]);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, disp->render_ctx.stride[1]/2);
+	span = trace_begin();
+	gpu_timer_begin(&disp->gpu_timer, GPU_UPLOAD_CHROMA);
 	glTexSubImage2D(GL_TEXTURE_2D, 0,
-		0, 0, disp->width/2, disp->height/2,
-		GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, disp->render_ctx.buffers[1]);
+		0, 0, disp->render_ctx.width/2, disp->render_ctx.height/2,
+		chroma_format, GL_UNSIGNED_BYTE, chroma);
+	gpu_timer_end(&disp->gpu_timer);
+	trace_end("upload chroma", span, disp->render_ctx.sequence);
+	PROBE1(upload_end, disp->render_ctx.sequence);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	error = glGetError();
-	glBindTexture(GL_TEXTURE_2D, disp->texture[1]);
-	/* Indicate that GL_TEXTURE1 is s_chroma_texture from previous lookup */
-	glUniform1i(disp->location[1], 1);
+	if (error != GL_NO_ERROR)
+	{
+		LOGS_ERR("Unable to update chroma texture %s", string_gl_error(error));
+	}
+}
 
-	/*
-	 * Draw the two triangles from 6 indices to form a rectangle from the data in the vertex array.
-	 * The fourth parameter, indices value here is passed as null since the values are already
-	 * available in the GPU memory through the vertex array
-	 * GL_TRIANGLES - draw each set of three vertices as an individual trianvle.
-	 */
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-	/** Select the default vertex array, allowing the applications array to be unbound */
-	glBindVertexArray(0);
+/**
+ * Render the next camera frame on the EGL surface using the NV12 shader program
+ * Two buffers, seperate luma and chroma planes must be assigned in the disp->render_ctx
+ * The planes are copied into the GPU textures created by the setup routine.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int render_nv12m_subs_tex(struct display_context *disp)
+{
+	if (!has_nv12_planes(disp)) return -1;
+
+	gpu_timer_frame(&disp->gpu_timer);
+	upload_nv12_planes(disp, GL_LUMINANCE, GL_LUMINANCE_ALPHA,
+		disp->render_ctx.buffers[0], disp->render_ctx.buffers[1]);
+	return draw_nv12_textures(disp, disp->texture[0], disp->texture[1]);
+}
+
+/**
+ * Render the next camera frame by copying the planes into immutable R8 and RG8 textures.
+ * The textures are allocated once with glTexStorage2D, the driver never checks for a redefinition.
+ * The chroma texture swizzles alpha from green so the NV12 shader reads Cb in x and Cr in w.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the render. Value 0 is returned on success.
+ */
+int render_nv12m_storage_tex(struct display_context *disp)
+{
+	if (!has_nv12_planes(disp)) return -1;
+
+	gpu_timer_frame(&disp->gpu_timer);
+	upload_nv12_planes(disp, GL_RED, GL_RG, disp->render_ctx.buffers[0], disp->render_ctx.buffers[1]);
+	return draw_nv12_textures(disp, disp->texture[0], disp->texture[1]);
+}
+
+/**
+ * Render the next camera frame through a ring of pixel unpack buffers.
+ * Both planes are copied into the next buffer of the ring, the textures are then updated from it.
+ * The GPU may still read the previous buffers while the CPU fills this one.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the render. Value 0 is returned on success.
+ */
+int render_nv12m_pbo_tex(struct display_context *disp)
+{
+	struct render_context *render_ctx = &disp->render_ctx;
+	GLsizeiptr luma_size = (GLsizeiptr)render_ctx->stride[0] * render_ctx->height;
+	GLsizeiptr chroma_size = (GLsizeiptr)render_ctx->stride[1] * (render_ctx->height / 2);
+	uint64_t span;
+	void *staging;
+
+	if (!has_nv12_planes(disp)) return -1;
+
+	/* The ring is sized by the first frame, planes never grow while streaming. */
+	if (disp->pbo_size < luma_size + chroma_size)
+	{
+		disp->pbo_size = luma_size + chroma_size;
+		for (int i = 0; i < DISPLAY_PBO_RING; i++)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, disp->pbo[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, disp->pbo_size, NULL, GL_STREAM_DRAW);
+		}
+	}
+
+	gpu_timer_frame(&disp->gpu_timer);
+	span = trace_begin();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, disp->pbo[disp->pbo_index]);
+	staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, luma_size + chroma_size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!staging)
+	{
+		LOGS_ERR("Unable to map pixel unpack buffer %s", string_gl_error(glGetError()));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return -1;
+	}
+	memcpy(staging, render_ctx->buffers[0], luma_size);
+	memcpy((uint8_t *)staging + luma_size, render_ctx->buffers[1], chroma_size);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	trace_end("stage", span, render_ctx->sequence);
+
+	upload_nv12_planes(disp, GL_LUMINANCE, GL_LUMINANCE_ALPHA, (const void *)0, (const void *)(uintptr_t)luma_size);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	disp->pbo_index = (disp->pbo_index + 1) % DISPLAY_PBO_RING;
+	return draw_nv12_textures(disp, disp->texture[0], disp->texture[1]);
+}
+
+/**
+ * Wrap the DMA buffer of one video plane in an EGL image and bind it to a new texture.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @param fd DMA buffer file descriptor exported from the V4L2 plane.
+ * @param fourcc DRM format describing the plane layout.
+ * @param width plane width in texels.
+ * @param height plane height in texels.
+ * @param offset offset in bytes of the plane within the DMA buffer.
+ * @param pitch distance in bytes between the start of each line.
+ * @param image returns the created EGL image.
+ * @param texture returns the texture bound to the image.
+ * @return error status of the import. Value 0 is returned on success.
+ */
+static int import_dmabuf_plane(struct display_context *disp, int fd, EGLint fourcc,
+	EGLint width, EGLint height, EGLint offset, EGLint pitch, EGLImageKHR *image, GLuint *texture)
+{
+	GLenum error = GL_NO_ERROR;
+	EGLint attribs[] = {
+		EGL_WIDTH, width,
+		EGL_HEIGHT, height,
+		EGL_LINUX_DRM_FOURCC_EXT, fourcc,
+		EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, offset,
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, pitch,
+		EGL_NONE };
+
+	/* The EGL image takes its own reference on the DMA buffer, the descriptor stays with capture. */
+	*image = disp->egl_create_image(disp->egl_display, EGL_NO_CONTEXT,
+		EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL, attribs);
+	if (*image == EGL_NO_IMAGE_KHR)
+	{
+		LOGS_ERR("Unable to import dma buffer %d %s", fd, string_egl_error(eglGetError()));
+		return -1;
+	}
+
+	glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_2D, *texture);
+	disp->gl_image_target_texture(GL_TEXTURE_2D, (GLeglImageOES)*image);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	error = glGetError();
+	if (error != GL_NO_ERROR)
+	{
+		LOGS_ERR("Unable to bind dma buffer texture %s", string_gl_error(error));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Import both NV12 planes of the current render buffer as EGL image textures.
+ * The luma plane is imported as R8 and the chroma plane as GR88 at half resolution.
+ * The chroma alpha channel is swizzled from green so the NV12 shader reads Cb in x and Cr in w,
+ * identical to the GL_LUMINANCE_ALPHA layout of the copy path.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @param import cache entry for the buffer index to fill.
+ * @return error status of the import. Value 0 is returned on success.
+ */
+static int import_nv12m_buffer(struct display_context *disp, struct dmabuf_import *import)
+{
+	struct render_context *render_ctx = &disp->render_ctx;
+	int ret;
+
+	ret = import_dmabuf_plane(disp, render_ctx->dma_buf_fd[0], DRM_FORMAT_R8,
+		render_ctx->width, render_ctx->height, render_ctx->offset[0], render_ctx->stride[0],
+		&import->image[0], &import->texture[0]);
+	if (ret) return ret;
+
+	ret = import_dmabuf_plane(disp, render_ctx->dma_buf_fd[1], DRM_FORMAT_GR88,
+		render_ctx->width/2, render_ctx->height/2, render_ctx->offset[1], render_ctx->stride[1],
+		&import->image[1], &import->texture[1]);
+	if (ret) return ret;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_GREEN);
+
+	LOGS_DBG("Imported buffer %d as textures %u %u",
+		render_ctx->index, import->texture[0], import->texture[1]);
+	return 0;
+}
+
+/**
+ * Release every imported EGL image and its texture.
+ * @param disp Display Data management structure with GPU handles.
+ */
+static void release_dmabuf_imports(struct display_context *disp)
+{
+	for (int i = 0; i < MAX_IMPORT_FRAMES; i++)
+	{
+		for (int p = 0; p < MAX_IMPORT_PLANES; p++)
+		{
+			struct dmabuf_import *import = &disp->imports[i];
+			if (import->texture[p])
+			{
+				glDeleteTextures(1, &import->texture[p]);
+				import->texture[p] = 0;
+			}
+			if (import->image[p] != EGL_NO_IMAGE_KHR)
+			{
+				disp->egl_destroy_image(disp->egl_display, import->image[p]);
+				import->image[p] = EGL_NO_IMAGE_KHR;
+			}
+		}
+	}
+}
+
+/**
+ * Render the next camera frame on the EGL surface using DMA buffer imports.
+ * The DMA file descriptors and buffer index of both planes must be assigned in the disp->render_ctx
+ * Each buffer index is imported once, later frames in the same buffer only bind the cached textures.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int render_nv12m_dmabuf_tex(struct display_context *disp)
+{
+	struct render_context *render_ctx = &disp->render_ctx;
+	struct dmabuf_import *import;
+	int ret;
+
+	if (render_ctx->num_buffers < 2 ||
+		render_ctx->dma_buf_fd[0] < 0 || render_ctx->dma_buf_fd[1] < 0)
+	{
+		LOGS_ERR("Unable to continue no dma buffer in display render_context");
+		return -1;
+	}
+	if (render_ctx->index < 0 || render_ctx->index >= MAX_IMPORT_FRAMES)
+	{
+		LOGS_ERR("Buffer index %d exceeds the import cache", render_ctx->index);
+		return -1;
+	}
+
+	gpu_timer_frame(&disp->gpu_timer);
+
+	/* Import the planes the first time this V4L2 buffer is displayed. */
+	import = &disp->imports[render_ctx->index];
+	if (!import->texture[0])
+	{
+		uint64_t span = trace_begin();
+		if (import_nv12m_buffer(disp, import)) return -1;
+		trace_end("import", span, render_ctx->sequence);
+	}
+
+	display_fence_wait(disp);
+	ret = draw_nv12_textures(disp, import->texture[0], import->texture[1]);
+	if (ret) return ret;
 
 	/*
-	 * display the new camera frame after render is complete at the next vertical sync
-	 * This is drawn on the EGL surface which matches the full screen native window.
+	 * The GPU still samples the buffer after the swap returns, the fence tells the caller when the
+	 * buffer may be queued to the driver again. Without fences the render waits for the GPU instead.
 	 */
-	ret = eglSwapBuffers(disp->egl_display, disp->egl_surface);
-	if (ret == EGL_FALSE)
+	if (disp->egl_create_sync)
+		disp->render_fence = disp->egl_create_sync(disp->egl_display, EGL_SYNC_FENCE_KHR, NULL);
+	if (disp->render_fence == EGL_NO_SYNC_KHR) glFinish();
+	return 0;
+}
+
+void display_fence_wait(struct display_context *disp)
+{
+	EGLint status;
+
+	if (disp->render_fence == EGL_NO_SYNC_KHR) return;
+	status = disp->egl_client_wait_sync(disp->egl_display, disp->render_fence,
+		EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+	if (status == EGL_FALSE)
 	{
-		LOGS_ERR("Unable to update surface %s", string_egl_error(eglGetError()));
+		LOGS_ERR("Unable to wait for the render fence %s", string_egl_error(eglGetError()));
+		glFinish();
 	}
+	disp->egl_destroy_sync(disp->egl_display, disp->render_fence);
+	disp->render_fence = EGL_NO_SYNC_KHR;
+}
+
+/**
+ * Release the GPU resources of the render path and close the native window.
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the shutdown. Value 0 is returned on success.
+ */
+int display_close(struct display_context *disp)
+{
+	display_frame_release(disp);
+	watermark_close(&disp->watermark);
+	if (disp->backend == DISPLAY_OFFSCREEN) return offscreen_close(disp);
+	return x11_close_display(disp);
+}
 
+/**
+ * Resolve the EGL and GLES entry points used by the DMA buffer import render path.
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the lookup. Value 0 is returned when all extensions are available.
+ */
+static int dmabuf_import_setup(struct display_context *disp)
+{
+	if (!egl_load_extension(disp->egl_display, "EGL_EXT_image_dma_buf_import", "eglCreateImageKHR"))
+	{
+		LOGS_ERR("EGL_EXT_image_dma_buf_import is not supported");
+		return -1;
+	}
+	disp->egl_create_image = (PFNEGLCREATEIMAGEKHRPROC)
+		egl_load_extension(disp->egl_display, "EGL_KHR_image_base", "eglCreateImageKHR");
+	disp->egl_destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+		egl_load_extension(disp->egl_display, "EGL_KHR_image_base", "eglDestroyImageKHR");
+	disp->gl_image_target_texture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+		gles_load_extension("GL_OES_EGL_image", "glEGLImageTargetTexture2DOES");
+	if (!disp->egl_create_image || !disp->egl_destroy_image || !disp->gl_image_target_texture)
+	{
+		LOGS_ERR("EGL image extensions are not supported");
+		return -1;
+	}
+
+	disp->render_fence = EGL_NO_SYNC_KHR;
+	disp->egl_create_sync = (PFNEGLCREATESYNCKHRPROC)
+		egl_load_extension(disp->egl_display, "EGL_KHR_fence_sync", "eglCreateSyncKHR");
+	disp->egl_client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)
+		egl_load_extension(disp->egl_display, "EGL_KHR_fence_sync", "eglClientWaitSyncKHR");
+	disp->egl_destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)
+		egl_load_extension(disp->egl_display, "EGL_KHR_fence_sync", "eglDestroySyncKHR");
+	if (!disp->egl_create_sync || !disp->egl_client_wait_sync || !disp->egl_destroy_sync)
+	{
+		LOGS_WRN("EGL_KHR_fence_sync is not supported, every frame waits for the GPU");
+		disp->egl_create_sync = NULL;
+	}
+
+	for (int i = 0; i < MAX_IMPORT_FRAMES; i++)
+		for (int p = 0; p < MAX_IMPORT_PLANES; p++)
+			disp->imports[i].image[p] = EGL_NO_IMAGE_KHR;
 	return 0;
 }
 
+void display_frame_release(struct display_context* disp)
+{
+	display_fence_wait(disp);
+	if (disp->egl_destroy_image) release_dmabuf_imports(disp);
+	if (disp->texture[0])
+	{
+		glDeleteTextures(2, disp->texture);
+		disp->texture[0] = disp->texture[1] = 0;
+	}
+	if (disp->pbo[0])
+	{
+		glDeleteBuffers(DISPLAY_PBO_RING, disp->pbo);
+		memset(disp->pbo, 0, sizeof(disp->pbo));
+		disp->pbo_size = 0;
+	}
+	gpu_timer_close(&disp->gpu_timer);
+}
+
 /**
- * Display and GPU setup for a YUV420 texture display.
- * Setup a full screen window and utilize EGL and OpenGLES to setup the display_context.
- * Compiles the shader program so that the application may render frames on the display surface.
+ * Create the window or the offscreen render target, initialize EGL and compile the shader program.
+ * Nothing here depends on the captured frames so it may overlap the capture device setup.
  *
  * @param disp Display Data management structure with GPU handles.
- * @param render_ctx contains display buffers that may be used for initial setup.
- * @note disp->render is assigned for the caller for the display render routine.
  * @return error status of the setup. Value 0 is returned on success.
  */
-int camera_nv12m_setup(struct display_context* disp, struct render_context *render_ctx)
+int display_init(struct display_context* disp)
 {
 	int ret;
+	uint64_t begin;
+
+	/* Headless nodes have no display server to connect to, render offscreen there. */
+	if (disp->backend == DISPLAY_AUTO)
+		disp->backend = getenv("DISPLAY") ? DISPLAY_X11 : DISPLAY_OFFSCREEN;
+
+	if (disp->backend == DISPLAY_OFFSCREEN)
+	{
+		begin = startup_begin();
+		ret = offscreen_init(disp);
+		if (ret < 0)
+		{
+			LOGS_ERR("Error during offscreen egl init");
+			goto cleanup;
+		}
+		startup_end("egl init", begin);
+	}
+	else
+	{
+		/* Create a window and get the native windows and display handles required for EGL init */
+		begin = startup_begin();
+		ret = x11_create_window(disp);
+		if (ret < 0){
+			LOGS_ERR("Unable to create x11 window");
+			goto cleanup;
+		}
+		startup_end("x11 window", begin);
+
+		/* Initialize the EGL buffer API with the native window and display */
+		begin = startup_begin();
+		ret = egl_init(disp);
+		if (ret < 0)
+		{
+			LOGS_ERR("Error during egl init");
+			goto cleanup;
+		}
+		startup_end("egl init", begin);
+		/* Process any pending events, this will draw the initial window on the screen */
+		x11_process_pending_events(disp);
+	}
+
+	begin = startup_begin();
+	ret = display_gl_setup(disp);
+	if (ret < 0) goto cleanup;
+	startup_end("shaders", begin);
+
+	return 0;
+cleanup:
+	if (disp->backend == DISPLAY_OFFSCREEN) offscreen_close(disp);
+	else x11_close_display(disp);
+	return -1;
+}
+
+/**
+ * Compile the shader program and create the vertex array of the full surface rectangle.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int display_gl_setup(struct display_context* disp)
+{
 	GLenum error = 0;
 	/**
 	 * The triangle vetices for the render target and the texture co-ordinates are interleaved.
@@ -544,29 +1182,6 @@ int camera_nv12m_setup(struct display_context* disp, struct render_context *rend
 	};
 	GLushort indices[] = {0, 1, 2, 0, 2, 3};
 
-	(void)render_ctx;
-
-	/* force full screen window sizing */
-	disp->width = 1920;
-	disp->height = 1080;
-
-	/* Create a window and get the native windows and display handles required for EGL init */
-	ret = x11_create_window(disp);
-	if (ret < 0){
-		LOGS_ERR("Unable to create x11 window");
-		goto cleanup;
-	}
-
-	/* Initialize the EGL buffer API with the native window and display */
-	ret = egl_init(disp);
-	if (ret < 0)
-	{
-		LOGS_ERR("Error during egl init");
-		goto cleanup;
-	}
-	/* Process any pending events, this will draw the initial window on the screen */
-	x11_process_pending_events(disp);
-
 	/*
 	 * Compile the shader program, consisting of both a vertex and fragment shader.
 	 * The vertex generates the positions for the current pixel and texture position.
@@ -578,7 +1193,7 @@ int camera_nv12m_setup(struct display_context* disp, struct render_context *rend
 	if (!disp->program)
 	{
 		LOGS_ERR("Unable to load program");
-		goto cleanup;
+		return -1;
 	}
 
 	/*
@@ -589,7 +1204,7 @@ int camera_nv12m_setup(struct display_context* disp, struct render_context *rend
 	if (disp->location[0] == -1)
 	{
 		LOGS_ERR("Unable to get location program %s", string_gl_error(glGetError()));
-		goto cleanup;
+		return -1;
 	}
 
 	/*
@@ -649,6 +1264,20 @@ int camera_nv12m_setup(struct display_context* disp, struct render_context *rend
 	/* Select the default vertex array, allowing the application's array to be unbound */
 	glBindVertexArray(0);
 
+	return 0;
+}
+
+/**
+ * Allocate the textures for the frame size and select the render function.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @param render_ctx contains display buffers that may be used for initial setup and the frame size.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int display_frame_setup(struct display_context* disp, struct render_context *render_ctx)
+{
+	GLenum error = 0;
+
 	/* Generate two textures, the first for luma data, the second for chroma data */
 	glGenTextures(2, disp->texture);
 	glBindTexture(GL_TEXTURE_2D, disp->texture[0]);
@@ -659,14 +1288,18 @@ int camera_nv12m_setup(struct display_context* disp, struct render_context *rend
 	 * Each texture has four components, x,y,z,w alias r,g,b,a alias s,r,t,u.
 	 * Luma will be replicated in x, y, and z using type GL_LUMINCANCE. Component w is set to 1.0.
 	 * The resolution of the texture matches the number of active pixels.
+	 * The storage render allocates an immutable R8 texture instead, the shader only reads x.
 	 */
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE,
-		disp->width, disp->height, 0,
-		 GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+	if (disp->render_method == RENDER_TEX_STORAGE)
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, render_ctx->width, render_ctx->height);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE,
+			render_ctx->width, render_ctx->height, 0,
+			 GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
 	error = glGetError();
 	if (error != GL_NO_ERROR) {
 		LOGS_ERR("Unable to generate texture %s", string_gl_error(error));
-		goto cleanup;
+		return -1;
 	}
 	/*
 	 * Select the nearest texture value when the location doesn't match the exact texture position
@@ -687,9 +1320,18 @@ int camera_nv12m_setup(struct display_context* disp, struct render_context *rend
 	 */
 	glBindTexture(GL_TEXTURE_2D, disp->texture[1]);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA,
-		disp->width/2, disp->height/2, 0,
-		 GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, NULL);
+	if (disp->render_method == RENDER_TEX_STORAGE)
+	{
+		/* Cb lands in red and Cr in green, alpha is swizzled from green like the DMA buffer import. */
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG8, render_ctx->width/2, render_ctx->height/2);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_GREEN);
+	}
+	else
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA,
+			render_ctx->width/2, render_ctx->height/2, 0,
+			 GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, NULL);
+	}
 	error = glGetError();
 	if (error != GL_NO_ERROR) {
 		LOGS_ERR("Unable to generate texture %s", string_gl_error(error));
@@ -710,10 +1352,41 @@ int camera_nv12m_setup(struct display_context* disp, struct render_context *rend
 	glClearColor ( 1.0f, 0.6f, 0.0f, 0.0f );
 
 	/* Finally save the pointer to the render function that will be used to update the surface */
-	disp->render_func = render_nv12m_subs_tex;
+	switch (disp->render_method)
+	{
+		case RENDER_DMABUF_IMPORT:
+			if (dmabuf_import_setup(disp)) return -1;
+			disp->render_func = render_nv12m_dmabuf_tex;
+			LOGS_INF("Render using DMA buffer EGL image import");
+			break;
+
+		case RENDER_PBO:
+			glGenBuffers(DISPLAY_PBO_RING, disp->pbo);
+			disp->pbo_size = 0;
+			disp->pbo_index = 0;
+			disp->render_func = render_nv12m_pbo_tex;
+			LOGS_INF("Render using a ring of %d pixel unpack buffers", DISPLAY_PBO_RING);
+			break;
+
+		case RENDER_TEX_STORAGE:
+			disp->render_func = render_nv12m_storage_tex;
+			LOGS_INF("Render using immutable R8 and RG8 textures");
+			break;
+
+		default:
+			disp->render_func = render_nv12m_subs_tex;
+			LOGS_INF("Render using texture copy");
+			break;
+	}
+
+	/* GPU timing is optional, rendering continues untimed without the extension. */
+	if (disp->gpu_timing && !gpu_timer_init(&disp->gpu_timer))
+		LOGS_INF("Timing render stages on the GPU");
+
+	/* The watermark was requested for a measurement, the render does not continue without it. */
+	if (disp->watermark.enabled && watermark_init(&disp->watermark,
+		render_ctx->width, render_ctx->height, disp->width, disp->height))
+		return -1;
 
 	return 0;
-cleanup:
-	x11_close_display(disp);
-	return -1;
 }
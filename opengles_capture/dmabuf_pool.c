@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Application owned pool of DMA buffers for V4L2_MEMORY_DMABUF capture.
+ * @file dmabuf_pool.c
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
+
+#include "dmabuf_pool.h"
+#include "log.h"
+
+/**
+ * DMA heaps tried in order, contiguous memory first since not every capture device has an IOMMU.
+ */
+static const char *heap_paths[] = {
+	"/dev/dma_heap/linux,cma",
+	"/dev/dma_heap/reserved",
+	"/dev/dma_heap/system",
+};
+
+/**
+ * Open the first available DMA heap.
+ * @return heap file descriptor or negative when no heap is available.
+ */
+static int open_heap(void)
+{
+	int fd;
+	for (unsigned int i = 0; i < sizeof(heap_paths) / sizeof(heap_paths[0]); i++)
+	{
+		fd = open(heap_paths[i], O_RDONLY | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			LOGS_INF("Allocating capture buffers from %s", heap_paths[i]);
+			return fd;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Allocate one buffer from a DMA heap.
+ * @param heap_fd heap file descriptor.
+ * @param size size in bytes.
+ * @return DMA buffer file descriptor or negative error.
+ */
+static int heap_alloc(int heap_fd, size_t size)
+{
+	struct dma_heap_allocation_data data;
+
+	memset(&data, 0, sizeof(data));
+	data.len = size;
+	data.fd_flags = O_RDWR | O_CLOEXEC;
+	if (ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data) < 0)
+	{
+		LOGS_ERR("Unable to allocate %zu bytes from dma heap %d - %s", size, errno, strerror(errno));
+		return -errno;
+	}
+	return data.fd;
+}
+
+/**
+ * Allocate one buffer from memfd memory and export it through udmabuf.
+ * @param udmabuf_fd /dev/udmabuf file descriptor.
+ * @param size size in bytes, must be a multiple of the page size.
+ * @return DMA buffer file descriptor or negative error.
+ */
+static int udmabuf_alloc(int udmabuf_fd, size_t size)
+{
+	struct udmabuf_create create;
+	int memfd;
+	int fd;
+
+	memfd = memfd_create("capture", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0)
+	{
+		LOGS_ERR("Unable to create memfd %d - %s", errno, strerror(errno));
+		return -errno;
+	}
+	/* udmabuf requires the memory to be sealed against shrinking. */
+	if (ftruncate(memfd, size) < 0 || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)
+	{
+		LOGS_ERR("Unable to size memfd %d - %s", errno, strerror(errno));
+		close(memfd);
+		return -errno;
+	}
+
+	memset(&create, 0, sizeof(create));
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = 0;
+	create.size = size;
+	fd = ioctl(udmabuf_fd, UDMABUF_CREATE, &create);
+	if (fd < 0)
+	{
+		LOGS_ERR("Unable to create udmabuf %d - %s", errno, strerror(errno));
+		fd = -errno;
+	}
+	/* The DMA buffer holds its own reference to the memfd pages. */
+	close(memfd);
+	return fd;
+}
+
+int dmabuf_pool_alloc(struct dmabuf_pool *pool, int count, int num_planes, const uint32_t size[])
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	int alloc_fd;
+	int ret = 0;
+	bool reuse;
+
+	/* Keep the existing buffers when they still fit the negotiated format. */
+	reuse = pool->source != DMABUF_SOURCE_NONE && pool->count == count && pool->num_planes == num_planes;
+	for (int p = 0; reuse && p < num_planes; p++)
+		reuse = pool->size[p] >= size[p];
+	if (reuse)
+	{
+		LOGS_DBG("Reusing dma buffer pool of %d frames", count);
+		return 0;
+	}
+	dmabuf_pool_free(pool);
+
+	if (count > VIDEO_MAX_FRAME || num_planes > VIDEO_MAX_PLANES) return -EINVAL;
+
+	alloc_fd = open_heap();
+	if (alloc_fd >= 0)
+	{
+		pool->source = DMABUF_SOURCE_HEAP;
+	}
+	else
+	{
+		alloc_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+		if (alloc_fd < 0)
+		{
+			LOGS_ERR("No dma heap or udmabuf device available %d - %s", errno, strerror(errno));
+			return -errno;
+		}
+		LOGS_INF("Allocating capture buffers from memfd through /dev/udmabuf");
+		pool->source = DMABUF_SOURCE_UDMABUF;
+	}
+
+	pool->count = count;
+	pool->num_planes = num_planes;
+	for (int p = 0; p < num_planes; p++)
+		pool->size[p] = (size[p] + page_size - 1) & ~(page_size - 1);
+	for (int i = 0; i < count; i++)
+	{
+		for (int p = 0; p < num_planes; p++)
+		{
+			pool->fd[i][p] = -1;
+			pool->addr[i][p] = NULL;
+		}
+	}
+
+	for (int i = 0; i < count && !ret; i++)
+	{
+		for (int p = 0; p < num_planes; p++)
+		{
+			if (pool->source == DMABUF_SOURCE_HEAP)
+				pool->fd[i][p] = heap_alloc(alloc_fd, pool->size[p]);
+			else
+				pool->fd[i][p] = udmabuf_alloc(alloc_fd, pool->size[p]);
+			if (pool->fd[i][p] < 0)
+			{
+				ret = pool->fd[i][p];
+				break;
+			}
+
+			pool->addr[i][p] = mmap(NULL, pool->size[p], PROT_READ | PROT_WRITE,
+				MAP_SHARED, pool->fd[i][p], 0);
+			if (pool->addr[i][p] == MAP_FAILED)
+			{
+				LOGS_ERR("Unable to map dma buffer %d - %s", errno, strerror(errno));
+				pool->addr[i][p] = NULL;
+				ret = -errno;
+				break;
+			}
+		}
+	}
+	close(alloc_fd);
+
+	if (ret) dmabuf_pool_free(pool);
+	return ret;
+}
+
+void dmabuf_pool_free(struct dmabuf_pool *pool)
+{
+	for (int i = 0; i < pool->count; i++)
+	{
+		for (int p = 0; p < pool->num_planes; p++)
+		{
+			if (pool->addr[i][p]) munmap(pool->addr[i][p], pool->size[p]);
+			if (pool->fd[i][p] >= 0) close(pool->fd[i][p]);
+		}
+	}
+	memset(pool, 0, sizeof(*pool));
+}
+
+int dmabuf_sync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = { .flags = flags };
+	int ret;
+
+	do {
+		ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+	return ret;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * epoll based event loop dispatching file descriptor events to handlers.
+ * @file event_loop.c
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "event_loop.h"
+#include "log.h"
+
+/** Number of ready events collected by a single epoll_wait call. */
+#define MAX_READY_EVENTS 8
+
+int event_loop_init(struct event_loop *loop)
+{
+	memset(loop, 0, sizeof(*loop));
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0)
+	{
+		LOGS_ERR("Unable to create epoll %d - %s", errno, strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+/**
+ * Register a file descriptor with the epoll instance.
+ * @param loop event loop.
+ * @param fd file descriptor to watch.
+ * @param owned close the file descriptor when the loop is closed.
+ * @param events epoll event flags to wait for.
+ * @param handler function called when the file descriptor is ready.
+ * @param context pointer passed to the handler.
+ * @return error status of the registration. Value 0 is returned on success.
+ */
+static int add_source(struct event_loop *loop, int fd, int owned, uint32_t events,
+	event_handler handler, void *context)
+{
+	struct epoll_event event;
+	struct event_source *source;
+
+	if (loop->num_sources >= MAX_EVENT_SOURCES)
+	{
+		LOGS_ERR("Unable to watch fd %d, event loop is full", fd);
+		return -ENOSPC;
+	}
+
+	source = &loop->sources[loop->num_sources];
+	source->fd = fd;
+	source->owned = owned;
+	source->handler = handler;
+	source->context = context;
+
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = source;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		LOGS_ERR("Unable to watch fd %d %d - %s", fd, errno, strerror(errno));
+		return -errno;
+	}
+	loop->num_sources++;
+	return 0;
+}
+
+int event_loop_add(struct event_loop *loop, int fd, uint32_t events, event_handler handler, void *context)
+{
+	return add_source(loop, fd, false, events, handler, context);
+}
+
+int event_loop_add_timer(struct event_loop *loop, int interval_ms, event_handler handler, void *context)
+{
+	struct itimerspec spec;
+	int fd;
+	int ret;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+	{
+		LOGS_ERR("Unable to create timer %d - %s", errno, strerror(errno));
+		return -errno;
+	}
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_interval.tv_sec = interval_ms / 1000;
+	spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+	spec.it_value = spec.it_interval;
+	if (timerfd_settime(fd, 0, &spec, NULL) < 0)
+	{
+		LOGS_ERR("Unable to start timer %d - %s", errno, strerror(errno));
+		close(fd);
+		return -errno;
+	}
+
+	ret = add_source(loop, fd, true, EPOLLIN, handler, context);
+	if (ret) close(fd);
+	return ret;
+}
+
+uint64_t event_loop_timer_read(int fd)
+{
+	uint64_t expirations = 0;
+	if (read(fd, &expirations, sizeof(expirations)) < 0) return 0;
+	return expirations;
+}
+
+int event_loop_add_signals(struct event_loop *loop, const sigset_t *signals, event_handler handler, void *context)
+{
+	int fd;
+	int ret;
+
+	/* Signals must be blocked or the default action runs before the signalfd is readable. */
+	ret = pthread_sigmask(SIG_BLOCK, signals, &loop->saved_signals);
+	if (ret)
+	{
+		LOGS_ERR("Unable to block signals %d - %s", ret, strerror(ret));
+		return -ret;
+	}
+	loop->signals_blocked = true;
+
+	fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0)
+	{
+		LOGS_ERR("Unable to create signalfd %d - %s", errno, strerror(errno));
+		return -errno;
+	}
+
+	ret = add_source(loop, fd, true, EPOLLIN, handler, context);
+	if (ret) close(fd);
+	return ret;
+}
+
+void event_loop_set_prepare(struct event_loop *loop, event_handler handler, void *context)
+{
+	loop->prepare = handler;
+	loop->prepare_context = context;
+}
+
+int event_loop_run(struct event_loop *loop)
+{
+	struct epoll_event events[MAX_READY_EVENTS];
+	int ret = 0;
+	int count;
+
+	while (!loop->stop)
+	{
+		if (loop->prepare)
+		{
+			ret = loop->prepare(-1, 0, loop->prepare_context);
+			if (ret) break;
+		}
+
+		count = epoll_wait(loop->epoll_fd, events, MAX_READY_EVENTS, -1);
+		if (count < 0)
+		{
+			if (errno == EINTR) continue;
+			LOGS_ERR("Event wait %d - %s", errno, strerror(errno));
+			ret = -errno;
+			break;
+		}
+
+		for (int i = 0; i < count && !loop->stop; i++)
+		{
+			struct event_source *source = events[i].data.ptr;
+			ret = source->handler(source->fd, events[i].events, source->context);
+			if (ret) goto exit;
+		}
+	}
+exit:
+	return ret;
+}
+
+void event_loop_stop(struct event_loop *loop)
+{
+	loop->stop = true;
+}
+
+void event_loop_close(struct event_loop *loop)
+{
+	for (int i = 0; i < loop->num_sources; i++)
+	{
+		if (loop->sources[i].owned) close(loop->sources[i].fd);
+	}
+	loop->num_sources = 0;
+	if (loop->epoll_fd >= 0) close(loop->epoll_fd);
+	loop->epoll_fd = -1;
+	if (loop->signals_blocked) pthread_sigmask(SIG_SETMASK, &loop->saved_signals, NULL);
+	loop->signals_blocked = false;
+}
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Replay of raw NV12 and Y4M files as an emulated capture device.
+ * @file file_source.c
+ *
+ * The file is mapped read-only and each frame is copied into the capture buffer when it is dequeued.
+ * Raw files hold back to back NV12 frames of the size requested with -S.
+ * Y4M files hold 4:2:0 planar frames, the chroma planes are interleaved into NV12 while copying.
+ * Frames are paced by a PATH.timestamps file when one exists, one presentation time in milliseconds
+ * per line as written by mkvextract timestamps_v2, otherwise by the Y4M frame rate or -F.
+ * -F max replays as fast as the buffers are returned.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "options.h"
+#include "capture_source.h"
+#include "pixel_kernels.h"
+#include "log.h"
+
+/** Suffix of the file holding the recorded presentation times of a replayed file. */
+#define TIMESTAMPS_SUFFIX ".timestamps"
+/** Largest Y4M stream header accepted. */
+#define Y4M_HEADER_MAX 256
+
+/**
+ * Replayed file.
+ */
+struct file_replay
+{
+	/** Read-only mapping of the whole file. */
+	const uint8_t *data;
+	/** Size of the file in bytes. */
+	size_t size;
+	/** Offset of the pixels of every frame. */
+	size_t *offsets;
+	/** Set when the frames are planar Y4M, clear for raw NV12. */
+	bool y4m;
+	/** Fastest I420 to NV12 conversion of this CPU, used for Y4M frames. */
+	const struct pixel_kernel *convert;
+	/** Recorded due time of every frame relative to the first one, NULL without a timestamps file. */
+	uint64_t *timestamps;
+};
+
+/**
+ * Parse the stream header of a Y4M file.
+ * Only progressive 4:2:0 streams are accepted, the C tag may be omitted.
+ * @param replay mapped file.
+ * @param dev receives the frame size and the frame interval.
+ * @param pos receives the offset of the first frame header.
+ * @return error status of the parse. Value 0 is returned on success.
+ */
+static int y4m_parse_header(const struct file_replay *replay, struct source_device *dev, size_t *pos)
+{
+	char header[Y4M_HEADER_MAX];
+	const uint8_t *end = memchr(replay->data, '\n', replay->size < Y4M_HEADER_MAX ? replay->size : Y4M_HEADER_MAX);
+	char *saveptr;
+	unsigned int num;
+	unsigned int den;
+
+	if (!end)
+	{
+		LOGS_ERR("Y4M stream header not terminated");
+		return -EINVAL;
+	}
+	memcpy(header, replay->data, end - replay->data);
+	header[end - replay->data] = '\0';
+	*pos = end - replay->data + 1;
+
+	strtok_r(header, " ", &saveptr);
+	for (char *tag = strtok_r(NULL, " ", &saveptr); tag; tag = strtok_r(NULL, " ", &saveptr))
+	{
+		switch (tag[0])
+		{
+			case 'W':
+				dev->width = strtoul(tag + 1, NULL, 10);
+				break;
+
+			case 'H':
+				dev->height = strtoul(tag + 1, NULL, 10);
+				break;
+
+			case 'F':
+				if (sscanf(tag + 1, "%u:%u", &num, &den) == 2 && num && den)
+					dev->interval_ns = den * 1000000000ull / num;
+				break;
+
+			case 'I':
+				if (tag[1] != 'p' && tag[1] != '?')
+				{
+					LOGS_ERR("Y4M interlacing %s is not supported", tag + 1);
+					return -EINVAL;
+				}
+				break;
+
+			case 'C':
+				if (strncmp(tag + 1, "420", 3))
+				{
+					LOGS_ERR("Y4M colorspace %s is not supported, only 4:2:0", tag + 1);
+					return -EINVAL;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Index the frames of a Y4M file.
+ * Each frame is a FRAME line, possibly with parameters, followed by the planar pixels.
+ * @param replay mapped file, receives the frame offsets.
+ * @param dev receives the number of frames.
+ * @param pos offset of the first frame header.
+ * @return error status of the scan. Value 0 is returned on success.
+ */
+static int y4m_index_frames(struct file_replay *replay, struct source_device *dev, size_t pos)
+{
+	size_t frame_size = dev->width * dev->height * 3 / 2;
+	size_t capacity = 0;
+	const uint8_t *end;
+
+	while (pos < replay->size)
+	{
+		if (replay->size - pos < 5 || memcmp(replay->data + pos, "FRAME", 5))
+		{
+			LOGS_ERR("Y4M frame %llu header missing at offset %zu", (unsigned long long)dev->frames, pos);
+			return -EINVAL;
+		}
+		end = memchr(replay->data + pos, '\n', replay->size - pos);
+		if (!end) break;
+		pos = end - replay->data + 1;
+		if (replay->size - pos < frame_size)
+		{
+			LOGS_WRN("Y4M frame %llu truncated, ignored", (unsigned long long)dev->frames);
+			break;
+		}
+
+		if (dev->frames == capacity)
+		{
+			size_t *offsets;
+			capacity = capacity ? capacity * 2 : 64;
+			offsets = realloc(replay->offsets, capacity * sizeof(*offsets));
+			if (!offsets) return -ENOMEM;
+			replay->offsets = offsets;
+		}
+		replay->offsets[dev->frames++] = pos;
+		pos += frame_size;
+	}
+	return 0;
+}
+
+/**
+ * Index the frames of a raw NV12 file sized by the requested capture size.
+ * @param replay mapped file, receives the frame offsets.
+ * @param dev frame size set, receives the number of frames.
+ * @return error status of the scan. Value 0 is returned on success.
+ */
+static int raw_index_frames(struct file_replay *replay, struct source_device *dev)
+{
+	size_t frame_size = dev->width * dev->height * 3 / 2;
+
+	dev->frames = replay->size / frame_size;
+	if (replay->size % frame_size)
+		LOGS_WRN("Raw NV12 file holds a partial %ux%u frame, ignored", dev->width, dev->height);
+	if (!dev->frames) return 0;
+
+	replay->offsets = malloc(dev->frames * sizeof(*replay->offsets));
+	if (!replay->offsets) return -ENOMEM;
+	for (uint64_t i = 0; i < dev->frames; i++)
+		replay->offsets[i] = i * frame_size;
+	return 0;
+}
+
+/**
+ * Load the recorded presentation times of the replayed frames when the file has them.
+ * Lines starting with '#' are comments, every other line holds one time in milliseconds.
+ * The loop lasts as long as the recording plus the last frame interval.
+ * @param replay replayed file, receives the timestamps.
+ * @param dev emulated device, receives the pacing.
+ * @param path replayed file path.
+ * @return error status of the load. Value 0 is returned on success or when there is no timestamps file.
+ */
+static int load_timestamps(struct file_replay *replay, struct source_device *dev, const char *path)
+{
+	char name[PATH_MAX];
+	char line[64];
+	double first = 0.0;
+	double ms;
+	uint64_t count = 0;
+	FILE *file;
+
+	snprintf(name, sizeof(name), "%s%s", path, TIMESTAMPS_SUFFIX);
+	file = fopen(name, "r");
+	if (!file) return 0;
+
+	replay->timestamps = malloc(dev->frames * sizeof(*replay->timestamps));
+	if (!replay->timestamps)
+	{
+		fclose(file);
+		return -ENOMEM;
+	}
+	while (count < dev->frames && fgets(line, sizeof(line), file))
+	{
+		if (line[0] == '#' || sscanf(line, "%lf", &ms) != 1) continue;
+		if (!count) first = ms;
+		if (ms < first || (count && (ms - first) * 1e6 < replay->timestamps[count - 1]))
+		{
+			LOGS_ERR("%s: timestamp %.3f ms goes backwards", name, ms);
+			fclose(file);
+			return -EINVAL;
+		}
+		replay->timestamps[count++] = (ms - first) * 1e6;
+	}
+	fclose(file);
+
+	if (count < dev->frames)
+	{
+		LOGS_ERR("%s holds %llu timestamps for %llu frames", name,
+			(unsigned long long)count, (unsigned long long)dev->frames);
+		return -EINVAL;
+	}
+	dev->loop_ns = replay->timestamps[count - 1];
+	if (count > 1)
+		dev->loop_ns += replay->timestamps[count - 1] - replay->timestamps[count - 2];
+	else
+		dev->loop_ns += dev->interval_ns;
+	if (!dev->loop_ns)
+	{
+		LOGS_ERR("%s does not advance in time", name);
+		return -EINVAL;
+	}
+	dev->timestamps = replay->timestamps;
+	return 0;
+}
+
+/**
+ * Map a raw NV12 or Y4M file, index its frames and choose the pacing.
+ * @param dev emulated device being opened.
+ * @param path file to replay, Y4M when it starts with the YUV4MPEG2 signature.
+ * @param opt User selected program configuration options.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+static int file_open(struct source_device *dev, const char *path, struct options *opt)
+{
+	struct file_replay *replay;
+	struct stat st;
+	size_t pos;
+	int ret;
+	int fd;
+
+	replay = calloc(1, sizeof(*replay));
+	if (!replay) return -ENOMEM;
+	dev->context = replay;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		LOGS_ERR("Unable to open %s: %s", path, strerror(errno));
+		return -errno;
+	}
+	if (fstat(fd, &st) < 0 || !st.st_size)
+	{
+		LOGS_ERR("Unable to size %s or it is empty", path);
+		close(fd);
+		return -EINVAL;
+	}
+	replay->size = st.st_size;
+	replay->data = mmap(NULL, replay->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (replay->data == MAP_FAILED)
+	{
+		replay->data = NULL;
+		LOGS_ERR("Unable to map %s: %s", path, strerror(errno));
+		return -errno;
+	}
+	madvise((void *)replay->data, replay->size, MADV_SEQUENTIAL);
+
+	replay->y4m = replay->size > 10 && !memcmp(replay->data, "YUV4MPEG2 ", 10);
+	if (replay->y4m)
+	{
+		ret = y4m_parse_header(replay, dev, &pos);
+		if (ret) return ret;
+		ret = y4m_index_frames(replay, dev, pos);
+		replay->convert = pixel_kernel_find("i420_to_nv12");
+	}
+	else
+	{
+		dev->width = opt->width;
+		dev->height = opt->height;
+		ret = raw_index_frames(replay, dev);
+	}
+	if (ret) return ret;
+	if (!dev->frames)
+	{
+		LOGS_ERR("%s holds no complete %ux%u frame", path, dev->width, dev->height);
+		return -EINVAL;
+	}
+	LOGS_INF("Replaying %llu %s frames from %s", (unsigned long long)dev->frames,
+		replay->y4m ? "Y4M" : "raw NV12", path);
+
+	/* Recorded times take precedence, then the Y4M rate, then the requested rate. -F max is never paced. */
+	if (!opt->fps)
+	{
+		dev->interval_ns = 0;
+		return 0;
+	}
+	if (!dev->interval_ns) dev->interval_ns = 1000000000ull / opt->fps;
+	return load_timestamps(replay, dev, path);
+}
+
+/**
+ * Copy a frame of the file into the planes of a buffer.
+ * @param dev emulated device.
+ * @param frame frame number, wraps over the frames of the file.
+ * @param luma luma plane of the buffer.
+ * @param chroma interleaved CbCr plane of the buffer.
+ */
+static void file_fill(struct source_device *dev, uint64_t frame, uint8_t *luma, uint8_t *chroma)
+{
+	const struct file_replay *replay = dev->context;
+	const uint8_t *src = replay->data + replay->offsets[frame % dev->frames];
+	size_t luma_size = dev->width * dev->height;
+	struct pixel_frame planar;
+	struct pixel_frame nv12;
+
+	if (!replay->y4m)
+	{
+		memcpy(luma, src, luma_size);
+		memcpy(chroma, src + luma_size, luma_size / 2);
+		return;
+	}
+
+	/* Planar Cb and Cr become the interleaved CbCr plane of NV12. */
+	pixel_frame_init(&planar, PIXEL_I420, dev->width, dev->height, (uint8_t *)src);
+	memset(&nv12, 0, sizeof(nv12));
+	nv12.plane[0] = luma;
+	nv12.plane[1] = chroma;
+	nv12.stride[0] = nv12.stride[1] = dev->width;
+	nv12.width = dev->width;
+	nv12.height = dev->height;
+	replay->convert->run(&planar, &nv12);
+}
+
+/**
+ * Unmap the file and free the frame index.
+ * @param dev emulated device.
+ */
+static void file_close(struct source_device *dev)
+{
+	struct file_replay *replay = dev->context;
+
+	if (!replay) return;
+	if (replay->data) munmap((void *)replay->data, replay->size);
+	free(replay->offsets);
+	free(replay->timestamps);
+	free(replay);
+	dev->context = NULL;
+	dev->timestamps = NULL;
+}
+
+/** Replay of a raw NV12 or Y4M file, selected with -d file:PATH. */
+const struct capture_source file_source = {
+	.prefix = "file:",
+	.open = file_open,
+	.fill = file_fill,
+	.test_pattern = NULL,
+	.close = file_close,
+};
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Reference counted capture frames shared by several consumers without copying.
+ * @file frame.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#include "frame.h"
+#include "log.h"
+
+/**
+ * Wake the side of a consumer queue waiting for the other one, if any.
+ * Called after a push, a pop or the close was made visible.
+ * @param consumer consumer queue.
+ */
+static void consumer_wake(struct frame_consumer *consumer)
+{
+	/* Ordered with the waiter count update, either the waiter sees the change or this sees the waiter. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&consumer->waiters, __ATOMIC_RELAXED)) return;
+	__atomic_add_fetch(&consumer->wake, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &consumer->wake, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Sleep until the other side of a consumer queue makes progress or the queue is closed.
+ * @param consumer consumer queue.
+ * @param room wait for room to push when true, for a frame to pop otherwise.
+ */
+static void consumer_wait(struct frame_consumer *consumer, bool room)
+{
+	uint32_t wake = __atomic_load_n(&consumer->wake, __ATOMIC_ACQUIRE);
+	uint32_t count;
+
+	__atomic_add_fetch(&consumer->waiters, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	count = spsc_ring_count(&consumer->ring);
+	if (!__atomic_load_n(&consumer->closed, __ATOMIC_ACQUIRE) && (room ? count >= consumer->depth : count == 0))
+		syscall(SYS_futex, &consumer->wake, FUTEX_WAIT_PRIVATE, wake, NULL, NULL, 0);
+	__atomic_sub_fetch(&consumer->waiters, 1, __ATOMIC_RELAXED);
+}
+
+int frame_consumer_init(struct frame_consumer *consumer, const char *name, int policy, uint32_t depth)
+{
+	memset(consumer, 0, sizeof(*consumer));
+	consumer->name = name;
+	consumer->policy = policy;
+	consumer->depth = depth < 1 ? 1 : depth > FRAME_QUEUE_SIZE ? FRAME_QUEUE_SIZE : depth;
+
+	/* One read per queued frame keeps the event readable while frames are waiting. */
+	consumer->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	if (consumer->event_fd < 0)
+	{
+		LOGS_ERR("Unable to create %s consumer event %d - %s", name, errno, strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+int frame_consumer_push(struct frame_consumer *consumer, struct frame *frame)
+{
+	struct spsc_ring *ring = &consumer->ring;
+	void *dropped;
+	uint64_t value = 1;
+
+	/* Only this thread pushes, the count can only drop while it is checked. */
+	if (consumer->policy == FRAME_BLOCK)
+	{
+		while (!__atomic_load_n(&consumer->closed, __ATOMIC_ACQUIRE) && spsc_ring_count(ring) >= consumer->depth)
+			consumer_wait(consumer, true);
+	}
+
+	if (__atomic_load_n(&consumer->closed, __ATOMIC_ACQUIRE)) return 1;
+	if (spsc_ring_count(ring) >= consumer->depth)
+	{
+		if (consumer->policy == FRAME_DROP_NEWEST)
+		{
+			__atomic_store_n(&consumer->dropped, consumer->dropped + 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+
+		/* The consumer may pop the oldest frame first, this then discards the next one or finds room. */
+		if (!spsc_ring_pop(ring, &dropped))
+		{
+			__atomic_store_n(&consumer->dropped, consumer->dropped + 1, __ATOMIC_RELAXED);
+			frame_put(dropped);
+		}
+	}
+
+	frame_get(frame);
+	spsc_ring_push(ring, frame);
+	consumer->received++;
+	consumer_wake(consumer);
+
+	if (write(consumer->event_fd, &value, sizeof(value)) < 0)
+		LOGS_ERR("Unable to signal %s consumer %d - %s", consumer->name, errno, strerror(errno));
+	return 0;
+}
+
+struct frame *frame_consumer_pop(struct frame_consumer *consumer, int wait)
+{
+	void *frame;
+
+	while (1)
+	{
+		if (__atomic_load_n(&consumer->closed, __ATOMIC_ACQUIRE)) return NULL;
+		if (!spsc_ring_pop(&consumer->ring, &frame)) break;
+		if (!wait) return NULL;
+		consumer_wait(consumer, false);
+	}
+	consumer_wake(consumer);
+	return frame;
+}
+
+void frame_consumer_close(struct frame_consumer *consumer)
+{
+	uint64_t value = 1;
+
+	__atomic_store_n(&consumer->closed, true, __ATOMIC_RELEASE);
+	consumer_wake(consumer);
+
+	/* Wake an event loop waiting on the consumer so it notices the close. */
+	if (consumer->event_fd >= 0 && write(consumer->event_fd, &value, sizeof(value)) < 0)
+		LOGS_ERR("Unable to signal %s consumer %d - %s", consumer->name, errno, strerror(errno));
+}
+
+void frame_consumer_destroy(struct frame_consumer *consumer)
+{
+	void *frame;
+
+	while (!spsc_ring_pop(&consumer->ring, &frame))
+		frame_put(frame);
+	if (consumer->event_fd >= 0) close(consumer->event_fd);
+	consumer->event_fd = -1;
+}
+
+int frame_fanout_add(struct frame_fanout *fanout, struct frame_consumer *consumer)
+{
+	if (fanout->count >= MAX_FRAME_CONSUMERS)
+	{
+		LOGS_ERR("Unable to add %s consumer, limit of %d reached", consumer->name, MAX_FRAME_CONSUMERS);
+		return -ENOSPC;
+	}
+	fanout->consumers[fanout->count++] = consumer;
+	return 0;
+}
+
+int frame_fanout_publish(struct frame_fanout *fanout, struct frame *frame)
+{
+	int accepted = 0;
+
+	/* The publisher holds a reference so an early consumer can't release the frame before the last push. */
+	frame->refs = 1;
+	for (int i = 0; i < fanout->count; i++)
+		if (!frame_consumer_push(fanout->consumers[i], frame)) accepted++;
+	frame_put(frame);
+	return accepted;
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Dropped frame accounting from V4L2 sequence numbers, buffer flags and timestamps.
+ * @file frame_accounting.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "frame_accounting.h"
+#include "log.h"
+
+/** Weight of a new interval in the measured average, as a power of two divisor. */
+#define INTERVAL_AVERAGE_SHIFT 4
+
+/**
+ * Publish a counter to reading threads.
+ * @param counter counter to update.
+ * @param value new value.
+ */
+static inline void publish(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Read a counter published by the accounting thread.
+ * @param counter counter to read.
+ * @return counter value.
+ */
+static inline uint64_t read_counter(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void accounting_init(struct frame_accounting *acc, uint64_t interval_ns)
+{
+	memset(acc, 0, sizeof(*acc));
+	acc->interval_ns = interval_ns;
+	acc->measure_interval = interval_ns == 0;
+}
+
+/**
+ * Close the current second when a timestamp falls past it.
+ * @param acc stream accounting.
+ * @param timestamp_ns timestamp of the new frame.
+ */
+static void next_second(struct frame_accounting *acc, uint64_t timestamp_ns)
+{
+	if (!acc->current.start_ns)
+	{
+		acc->current.start_ns = timestamp_ns;
+		return;
+	}
+	if (timestamp_ns - acc->current.start_ns < 1000000000ull) return;
+
+	acc->history[acc->history_count % ACCOUNTING_HISTORY] = acc->current;
+	acc->history_count++;
+	memset(&acc->current, 0, sizeof(acc->current));
+	acc->current.start_ns = timestamp_ns;
+}
+
+void accounting_frame(struct frame_accounting *acc, uint32_t sequence, uint64_t timestamp_ns, uint32_t flags)
+{
+	uint32_t missing = 0;
+
+	next_second(acc, timestamp_ns);
+
+	if (!acc->last_timestamp_ns)
+		publish(&acc->first_timestamp_ns, timestamp_ns);
+	else
+	{
+		uint32_t delta = sequence - acc->last_sequence;
+
+		/* A repeated or backwards sequence number is a driver restart, not a drop. */
+		if (delta == 0 || delta > INT32_MAX)
+		{
+			publish(&acc->resets, acc->resets + 1);
+		}
+		else
+		{
+			missing = delta - 1;
+			if (missing)
+			{
+				publish(&acc->dropped, acc->dropped + missing);
+				acc->current.dropped += missing;
+			}
+
+			/* Spread the interval over the missing frames so a drop doesn't also count as jitter. */
+			uint64_t interval = (timestamp_ns - acc->last_timestamp_ns) / delta;
+			if (acc->measure_interval)
+			{
+				if (!acc->interval_ns)
+					acc->interval_ns = interval;
+				else
+					acc->interval_ns += ((int64_t)interval - (int64_t)acc->interval_ns) >> INTERVAL_AVERAGE_SHIFT;
+			}
+			uint64_t jitter = interval > acc->interval_ns ? interval - acc->interval_ns : acc->interval_ns - interval;
+			publish(&acc->jitter_total_ns, acc->jitter_total_ns + jitter);
+			publish(&acc->intervals, acc->intervals + 1);
+			if (jitter > acc->jitter_max_ns) publish(&acc->jitter_max_ns, jitter);
+			if (jitter / 1000 > acc->current.max_jitter_us) acc->current.max_jitter_us = jitter / 1000;
+		}
+	}
+
+	if (flags & V4L2_BUF_FLAG_ERROR)
+	{
+		publish(&acc->errors, acc->errors + 1);
+		acc->current.errors++;
+	}
+	acc->current.frames++;
+	acc->last_sequence = sequence;
+	publish(&acc->last_timestamp_ns, timestamp_ns);
+	publish(&acc->frames, acc->frames + 1);
+}
+
+void accounting_report(struct frame_accounting *acc)
+{
+	uint64_t frames = read_counter(&acc->frames);
+	uint64_t dropped = read_counter(&acc->dropped);
+	uint64_t errors = read_counter(&acc->errors);
+	uint64_t timestamp_ns = read_counter(&acc->last_timestamp_ns);
+	uint64_t jitter_total_ns = read_counter(&acc->jitter_total_ns);
+	uint64_t intervals = read_counter(&acc->intervals);
+	uint64_t period_frames = frames - acc->reported.frames;
+	uint64_t period_dropped = dropped - acc->reported.dropped;
+	uint64_t period_intervals = intervals - acc->reported.intervals;
+	uint64_t since_ns = acc->reported.timestamp_ns;
+	uint64_t intervals_in_period = period_frames;
+	double fps = 0;
+
+	/* The first report counts intervals from the first frame. */
+	if (!since_ns)
+	{
+		since_ns = read_counter(&acc->first_timestamp_ns);
+		intervals_in_period = period_frames ? period_frames - 1 : 0;
+	}
+	if (since_ns && timestamp_ns > since_ns)
+		fps = intervals_in_period * 1e9 / (double)(timestamp_ns - since_ns);
+
+	LOGS_INF("Captured %llu frames at %.2f fps, %llu dropped (%.3f%%), %llu errors, jitter avg %.3f ms max %.3f ms",
+		(unsigned long long)period_frames, fps, (unsigned long long)period_dropped,
+		period_frames + period_dropped ? 100.0 * period_dropped / (period_frames + period_dropped) : 0.0,
+		(unsigned long long)(errors - acc->reported.errors),
+		period_intervals ? (jitter_total_ns - acc->reported.jitter_total_ns) / (double)period_intervals / 1e6 : 0.0,
+		read_counter(&acc->jitter_max_ns) / 1e6);
+
+	acc->reported.frames = frames;
+	acc->reported.dropped = dropped;
+	acc->reported.errors = errors;
+	acc->reported.timestamp_ns = timestamp_ns;
+	acc->reported.jitter_total_ns = jitter_total_ns;
+	acc->reported.intervals = intervals;
+}
+
+int accounting_history(const struct frame_accounting *acc, struct accounting_second *seconds, int max)
+{
+	uint32_t count = acc->history_count < ACCOUNTING_HISTORY ? acc->history_count : ACCOUNTING_HISTORY;
+	uint32_t first = acc->history_count - count;
+
+	if ((uint32_t)max < count)
+	{
+		first += count - max;
+		count = max;
+	}
+	for (uint32_t i = 0; i < count; i++)
+		seconds[i] = acc->history[(first + i) % ACCOUNTING_HISTORY];
+	return count;
+}
+
+void accounting_summary(const struct frame_accounting *acc)
+{
+	struct accounting_second seconds[ACCOUNTING_HISTORY];
+	int count = accounting_history(acc, seconds, ACCOUNTING_HISTORY);
+
+	LOGS_INF("Frame accounting: %llu frames, %llu dropped, %llu errors, %llu sequence resets, "
+		"interval %.3f ms, jitter avg %.3f ms max %.3f ms",
+		(unsigned long long)acc->frames, (unsigned long long)acc->dropped,
+		(unsigned long long)acc->errors, (unsigned long long)acc->resets, acc->interval_ns / 1e6,
+		acc->intervals ? acc->jitter_total_ns / (double)acc->intervals / 1e6 : 0.0, acc->jitter_max_ns / 1e6);
+	if (!count) return;
+
+	LOGS_INF("Last %d seconds: frames dropped errors max jitter", count);
+	for (int i = 0; i < count; i++)
+		LOGS_INF("\t%3d: %6u %7u %6u %8.3f ms", i - count, seconds[i].frames, seconds[i].dropped,
+			seconds[i].errors, seconds[i].max_jitter_us / 1e3);
+}
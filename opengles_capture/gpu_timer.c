@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * GPU time of the render stages measured with EXT_disjoint_timer_query.
+ * @file gpu_timer.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "gpu_timer.h"
+#include "gles_egl_util.h"
+#include "log.h"
+
+/** Name of each stage in the reports, indexed by enum gpu_stage. */
+static const char * const stage_names[GPU_STAGES] = {
+	"gpu upload luma",
+	"gpu upload chroma",
+	"gpu draw",
+};
+
+int gpu_timer_init(struct gpu_timer *timer)
+{
+	const char *extension = "GL_EXT_disjoint_timer_query";
+	GLint disjoint;
+
+	memset(timer, 0, sizeof(*timer));
+	timer->running = -1;
+	timer->gen_queries = gles_load_extension(extension, "glGenQueriesEXT");
+	timer->delete_queries = gles_load_extension(extension, "glDeleteQueriesEXT");
+	timer->begin_query = gles_load_extension(extension, "glBeginQueryEXT");
+	timer->end_query = gles_load_extension(extension, "glEndQueryEXT");
+	timer->get_query_uiv = gles_load_extension(extension, "glGetQueryObjectuivEXT");
+	timer->get_query_ui64v = gles_load_extension(extension, "glGetQueryObjectui64vEXT");
+	if (!timer->gen_queries || !timer->delete_queries || !timer->begin_query ||
+		!timer->end_query || !timer->get_query_uiv || !timer->get_query_ui64v)
+	{
+		LOGS_WRN("%s is not available, GPU timing disabled", extension);
+		return -1;
+	}
+
+	for (int i = 0; i < GPU_TIMER_RING; i++)
+		timer->gen_queries(GPU_STAGES, timer->ring[i].query);
+	if (glGetError() != GL_NO_ERROR)
+	{
+		LOGS_ERR("Unable to create timer queries");
+		gpu_timer_close(timer);
+		return -1;
+	}
+
+	/* Reading the disjoint state clears it, events before the first frame are ignored. */
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	timer->enabled = true;
+	return 0;
+}
+
+/**
+ * Check whether every query of a frame has its result.
+ * @param timer GPU timer.
+ * @param slot frame queries.
+ * @return true when all results may be read without waiting.
+ */
+static bool slot_available(struct gpu_timer *timer, struct gpu_timer_slot *slot)
+{
+	GLuint available;
+
+	for (int i = 0; i < GPU_STAGES; i++)
+	{
+		if (!(slot->used & (1u << i))) continue;
+		available = GL_FALSE;
+		timer->get_query_uiv(slot->query[i], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+		if (!available) return false;
+	}
+	return true;
+}
+
+/**
+ * Read the results of the oldest frames that completed on the GPU.
+ * @param timer GPU timer.
+ */
+static void collect(struct gpu_timer *timer)
+{
+	GLint disjoint;
+	GLuint64 elapsed;
+
+	while (timer->tail != timer->head)
+	{
+		struct gpu_timer_slot *slot = &timer->ring[timer->tail % GPU_TIMER_RING];
+		if (!slot_available(timer, slot)) break;
+
+		/* Times measured across a disjoint event are meaningless, drop every frame in flight. */
+		disjoint = 0;
+		glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+		if (disjoint)
+		{
+			timer->disjoint++;
+			timer->discarded += timer->head - timer->tail;
+			timer->tail = timer->head;
+			break;
+		}
+
+		for (int i = 0; i < GPU_STAGES; i++)
+		{
+			if (!(slot->used & (1u << i))) continue;
+			elapsed = 0;
+			timer->get_query_ui64v(slot->query[i], GL_QUERY_RESULT_EXT, &elapsed);
+			timer->count[i]++;
+			timer->total_ns[i] += elapsed;
+			if (elapsed > timer->max_ns[i]) timer->max_ns[i] = elapsed;
+		}
+		timer->tail++;
+	}
+}
+
+void gpu_timer_frame(struct gpu_timer *timer)
+{
+	if (!timer->enabled) return;
+
+	collect(timer);
+	if (timer->head - timer->tail >= GPU_TIMER_RING)
+	{
+		/* The GPU is more than a ring behind, skip this frame rather than wait for a result. */
+		timer->skipped++;
+		timer->active = NULL;
+		return;
+	}
+	timer->active = &timer->ring[timer->head % GPU_TIMER_RING];
+	timer->active->used = 0;
+	timer->head++;
+}
+
+void gpu_timer_begin(struct gpu_timer *timer, int stage)
+{
+	if (!timer->active || timer->running >= 0) return;
+	timer->begin_query(GL_TIME_ELAPSED_EXT, timer->active->query[stage]);
+	timer->active->used |= 1u << stage;
+	timer->running = stage;
+}
+
+void gpu_timer_end(struct gpu_timer *timer)
+{
+	if (!timer->active || timer->running < 0) return;
+	timer->end_query(GL_TIME_ELAPSED_EXT);
+	timer->running = -1;
+}
+
+void gpu_timer_report(struct gpu_timer *timer)
+{
+	if (!timer->enabled) return;
+
+	for (int i = 0; i < GPU_STAGES; i++)
+	{
+		if (!timer->count[i]) continue;
+		LOGS_INF("%-16s avg %8.3f ms max %8.3f ms over %lu frames", stage_names[i],
+			timer->total_ns[i] / (double)timer->count[i] / 1e6, timer->max_ns[i] / 1e6,
+			(unsigned long)timer->count[i]);
+		timer->count[i] = 0;
+		timer->total_ns[i] = 0;
+		timer->max_ns[i] = 0;
+	}
+	if (timer->disjoint || timer->skipped)
+	{
+		LOGS_WRN("GPU timing: %lu disjoint events discarded %lu frames, %lu frames skipped with every query in flight",
+			(unsigned long)timer->disjoint, (unsigned long)timer->discarded, (unsigned long)timer->skipped);
+		timer->disjoint = 0;
+		timer->discarded = 0;
+		timer->skipped = 0;
+	}
+}
+
+void gpu_timer_close(struct gpu_timer *timer)
+{
+	if (timer->delete_queries)
+	{
+		for (int i = 0; i < GPU_TIMER_RING; i++)
+			if (timer->ring[i].query[0]) timer->delete_queries(GPU_STAGES, timer->ring[i].query);
+	}
+	memset(timer, 0, sizeof(*timer));
+	timer->running = -1;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Log bucketed latency histograms with fixed memory in the style of HdrHistogram.
+ * @file histogram.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "log.h"
+
+/**
+ * Highest value counted in a bucket.
+ * @param bucket bucket index.
+ * @return largest value recorded in the bucket.
+ */
+static uint64_t bucket_highest(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < 2 * HISTOGRAM_SUB_BUCKETS) return bucket;
+	shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	return ((uint64_t)(bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+void histogram_init(struct histogram *hist, const char *name)
+{
+	memset(hist, 0, sizeof(*hist));
+	hist->name = name;
+}
+
+void histogram_snapshot(const struct histogram *hist, struct histogram *snapshot)
+{
+	snapshot->name = hist->name;
+	snapshot->total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+	snapshot->max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		snapshot->buckets[i] = __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+}
+
+void histogram_merge(struct histogram *dst, const struct histogram *src)
+{
+	dst->total += src->total;
+	if (src->max > dst->max) dst->max = src->max;
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+void histogram_interval(struct histogram *interval, const struct histogram *now, const struct histogram *before)
+{
+	uint64_t highest = 0;
+
+	interval->name = now->name;
+	interval->total = now->total - before->total;
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		interval->buckets[i] = now->buckets[i] - before->buckets[i];
+		if (interval->buckets[i]) highest = bucket_highest(i);
+	}
+	interval->max = highest < now->max ? highest : now->max;
+}
+
+uint64_t histogram_count(const struct histogram *hist)
+{
+	uint64_t count = 0;
+
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		count += hist->buckets[i];
+	return count;
+}
+
+uint64_t histogram_percentile(const struct histogram *hist, double percentile)
+{
+	uint64_t count = histogram_count(hist);
+	uint64_t target;
+	uint64_t seen = 0;
+
+	if (!count) return 0;
+	target = (uint64_t)(percentile / 100.0 * count + 0.5);
+	if (target < 1) target = 1;
+	if (target > count) target = count;
+
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += hist->buckets[i];
+		if (seen >= target)
+		{
+			uint64_t value = bucket_highest(i);
+			return value < hist->max ? value : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+void histogram_report(const struct histogram *hist)
+{
+	uint64_t count = histogram_count(hist);
+
+	if (!count) return;
+	LOGS_INF("%-20s p50 %8.3f p90 %8.3f p99 %8.3f p99.9 %8.3f max %8.3f ms over %llu frames", hist->name,
+		histogram_percentile(hist, 50.0) / 1e6, histogram_percentile(hist, 90.0) / 1e6,
+		histogram_percentile(hist, 99.0) / 1e6, histogram_percentile(hist, 99.9) / 1e6,
+		hist->max / 1e6, (unsigned long long)count);
+}
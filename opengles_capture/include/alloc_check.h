@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Allocation checks of the capture display loop.
+ * @file alloc_check.h
+ *
+ * Built with ALLOC_CHECK=1 the program interposes malloc, calloc, realloc, free, the aligned allocators,
+ * mmap, munmap and mremap. Every call is counted per thread and forwarded to the C library.
+ * Threads registered with alloc_check_thread() run the frame loop, once the loop is armed any call from
+ * them is checked. A call is attributed to the first frame of its backtrace outside the C library,
+ * resolved with dladdr(). Calls attributed to the executable are violations recorded with their backtrace.
+ * Calls attributed to a shared library, such as the GLES driver allocating inside a GL call the application
+ * can't avoid, are only counted per library and reported for information. The ALLOC_CHECK usage runs
+ * the loop for -n frames and fails when a violation was recorded.
+ *
+ * In other builds the functions below are empty and nothing is interposed.
+ */
+#ifndef ALLOC_CHECK_H__
+#define ALLOC_CHECK_H__
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef ALLOC_CHECK
+
+/** Maximum number of threads counted, later threads are counted together in the last slot. */
+#define ALLOC_CHECK_THREADS 32
+/** Maximum number of violations kept with their backtrace, later ones are only counted. */
+#define ALLOC_CHECK_VIOLATIONS 32
+/** Maximum depth of a recorded backtrace. */
+#define ALLOC_CHECK_FRAMES 24
+/** Maximum number of libraries counted separately, later ones are counted together in the last slot. */
+#define ALLOC_CHECK_LIBRARIES 16
+/** Longest library path kept for the report. */
+#define ALLOC_CHECK_PATH 128
+
+/**
+ * Start or stop flagging allocations of the registered threads.
+ * @param armed true once the frame loop reached its steady state, false when it ends.
+ */
+void alloc_check_arm(bool armed);
+
+/**
+ * Register the calling thread as part of the frame loop.
+ * @param name thread name in the report, must outlive the program.
+ */
+void alloc_check_thread(const char *name);
+
+/**
+ * Log the allocation counts of every thread and library and the backtrace of every violation.
+ * @return number of violations recorded, calls attributed to libraries are not violations.
+ */
+unsigned int alloc_check_report(void);
+
+#else
+
+static inline void alloc_check_arm(bool armed) { (void)armed; }
+static inline void alloc_check_thread(const char *name) { (void)name; }
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Contiguous memory arena for user allocated video buffers.
+ * @file arena.h
+ */
+#ifndef ARENA_H__
+#define ARENA_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of a huge page, the arena is sized and aligned to this boundary. */
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+/** Minimum alignment of every allocation, one cache line. */
+#define ARENA_CACHE_LINE 64
+
+/**
+ * Page backing that was obtained for the arena.
+ */
+enum arena_backing {
+	/** No memory is mapped. */
+	ARENA_NONE,
+	/** Explicit huge pages from the hugetlbfs pool with MAP_HUGETLB. */
+	ARENA_HUGETLB,
+	/** Regular mapping with transparent huge pages requested through madvise. */
+	ARENA_THP,
+};
+
+/**
+ * A single contiguous mapping that allocations are carved from.
+ * Memory is prefaulted and locked when the arena is created and only released as a whole.
+ */
+struct arena {
+	/** Start of the mapping. */
+	void *base;
+	/** Size of the mapping in bytes. */
+	size_t size;
+	/** Number of bytes handed out so far. */
+	size_t used;
+	/** Page backing of the mapping. */
+	enum arena_backing backing;
+	/** Set when the mapping is locked in memory. */
+	int locked;
+};
+
+/**
+ * Map, prefault and lock a new arena.
+ * MAP_HUGETLB is tried first, then a regular mapping with transparent huge pages.
+ * A failure to lock the memory is reported but not fatal.
+ *
+ * @param arena arena to create.
+ * @param size minimum number of bytes available for allocations.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int arena_create(struct arena *arena, size_t size);
+
+/**
+ * Carve an allocation from the arena.
+ * @param arena arena to allocate from.
+ * @param size number of bytes to allocate.
+ * @param align alignment of the allocation, raised to at least ARENA_CACHE_LINE, must be a power of two.
+ * @return address of the allocation or NULL if the arena is exhausted.
+ */
+void *arena_alloc(struct arena *arena, size_t size, size_t align);
+
+/**
+ * Unmap the arena, every allocation becomes invalid.
+ * @param arena arena to release.
+ */
+void arena_destroy(struct arena *arena);
+
+/**
+ * Name of the page backing of an arena for log messages.
+ * @param backing page backing.
+ * @return constant string naming the backing.
+ */
+const char *arena_backing_name(enum arena_backing backing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
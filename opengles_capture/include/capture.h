@@ -30,6 +30,15 @@
 #include <linux/videodev2.h>
 #include <linux/v4l2-controls.h>
 
+#include "arena.h"
+#include "dmabuf_pool.h"
+#include "negotiate.h"
+#include "frame.h"
+#include "frame_accounting.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "capture_source.h"
+
 /**
  * Hold refernces to the memory mapped buffers from V4L2.
  * Each instance of this structure represents one V4L2 buffer and all its planes.
@@ -63,6 +72,23 @@ enum
 	FOCUS_PAUSE,
 };
 
+/**
+ * Stages of the frame latency histograms.
+ */
+enum latency_stage
+{
+	/** Driver timestamp to the return of VIDIOC_DQBUF. */
+	LATENCY_DEQUEUE,
+	/** Return of VIDIOC_DQBUF to the planes available as textures. */
+	LATENCY_UPLOAD,
+	/** Textures available to the return of eglSwapBuffers. */
+	LATENCY_PRESENT,
+	/** Driver timestamp to the return of eglSwapBuffers. */
+	LATENCY_TOTAL,
+	/** Number of latency stages. */
+	LATENCY_STAGES,
+};
+
 /**
  * State information for video capture and associated callbacks.
  */
@@ -95,6 +121,40 @@ struct capture_context {
 	int v4l2_fd;
 	/** Video subdevice file descriptor used for  focus control, test patterns and other device options. */
 	int v4l2_subdev_fd;
+	/** Dequeue and requeue buffers on a dedicated capture thread while the caller renders. */
+	int threaded;
+	/** Selection of the next frame to display, see enum present_policy. */
+	int present_policy;
+	/** Number of stale frames requeued without display by the mailbox policy. */
+	uint64_t stale_frames;
+	/** Capture mode negotiated with the driver, width and height hold the size the driver applied. */
+	struct video_mode mode;
+	/** Distance in bytes between lines of each plane from the format negotiated with the driver. */
+	uint32_t bytesperline[VIDEO_MAX_PLANES];
+	/** Size in bytes of each plane from the format negotiated with the driver. */
+	uint32_t plane_size[VIDEO_MAX_PLANES];
+	/** Reference counted handle of each buffer, requeued when the last consumer puts it. */
+	struct frame frames[VIDEO_MAX_FRAME];
+	/** Number of buffers owned by the driver, modified atomically by every releasing thread. */
+	int queued;
+	/** eventfd signalled after a released frame is requeued, -1 when no thread waits for releases. */
+	int requeue_event;
+	/** Error status of the last failed requeue, read by the loops to stop capture. */
+	int requeue_error;
+	/** Sequence gaps, error flags, jitter and rate of the dequeued buffers. */
+	struct frame_accounting accounting;
+	/** Latency of every displayed frame per stage in nanoseconds, see enum latency_stage. */
+	struct histogram latency[LATENCY_STAGES];
+	/** Frames displayed after every buffer was displayed once before the loop stops, 0 runs until exit. */
+	uint64_t frame_limit;
+	/** Live metrics shared with readers such as capstat, NULL when not published. */
+	struct capture_metrics *metrics;
+	/** Memory backing every plane when buffers are allocated by the application. */
+	struct arena arena;
+	/** DMA buffers imported by the driver in dmabuf mode, kept across stream restarts. */
+	struct dmabuf_pool pool;
+	/** Emulated device producing the frames instead of V4L2, NULL when capturing from a V4L2 device. */
+	struct source_device *source;
 };
 
 
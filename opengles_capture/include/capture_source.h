@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Frame sources emulating the V4L2 capture device.
+ * @file capture_source.h
+ *
+ * A source is selected with a prefix on the capture device, such as -d file:clip.y4m.
+ * It produces NV12M frames into buffers laid out like the V4L2 buffer map, so the capture display loop
+ * consumes them unchanged: capture_context.v4l2_fd becomes readable when a frame is due and buffers are
+ * dequeued and queued through source_dequeue() and source_queue() instead of VIDIOC_DQBUF and VIDIOC_QBUF.
+ *
+ * The emulated device paces frames at a fixed interval or at recorded times, or delivers them as fast as
+ * buffers are returned. A frame is written into its buffer when it is dequeued and carries its due time
+ * as a monotonic timestamp. When a consumer falls more than a frame behind, the frames it missed are
+ * dropped and their sequence numbers skipped, like a sensor finding no free buffer.
+ */
+#ifndef CAPTURE_SOURCE_H__
+#define CAPTURE_SOURCE_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <linux/videodev2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct capture_context;
+struct options;
+struct source_device;
+
+/**
+ * Operations of one kind of source.
+ */
+struct capture_source
+{
+	/** Prefix of the capture device selecting the source, including the ':'. */
+	const char *prefix;
+	/**
+	 * Open the source and size its frames, called before the buffers are allocated.
+	 * Sets the frame size, the number of distinct frames and the pacing in the device.
+	 * @param dev emulated device being opened.
+	 * @param path capture device after the prefix.
+	 * @param opt User selected program configuration options.
+	 * @return error status of the setup. Value 0 is returned on success.
+	 */
+	int (*open)(struct source_device *dev, const char *path, struct options *opt);
+	/**
+	 * Write a frame into the planes of a buffer, called without any lock held.
+	 * @param dev emulated device.
+	 * @param frame frame number counted from the start of the stream, it keeps counting over loops.
+	 * @param luma luma plane of the buffer.
+	 * @param chroma interleaved CbCr plane of the buffer.
+	 */
+	void (*fill)(struct source_device *dev, uint64_t frame, uint8_t *luma, uint8_t *chroma);
+	/**
+	 * Select a test pattern, NULL when the source has none.
+	 * @param dev emulated device.
+	 * @param pattern 0 for the normal frames, 1 to 3 for the test patterns.
+	 * @return error status of the request. Value 0 is returned on success.
+	 */
+	int (*test_pattern)(struct source_device *dev, int pattern);
+	/**
+	 * Release what open() acquired.
+	 * @param dev emulated device.
+	 */
+	void (*close)(struct source_device *dev);
+};
+
+/**
+ * State of the emulated capture device.
+ */
+struct source_device
+{
+	/** Operations of the source. */
+	const struct capture_source *source;
+	/** State private to the source. */
+	void *context;
+	/** Frame width in pixels, even, set by open(). */
+	uint32_t width;
+	/** Frame height in pixels, even, set by open(). */
+	uint32_t height;
+	/** Number of distinct frames before the source loops, 0 when it never loops. Set by open(). */
+	uint64_t frames;
+	/** Time between frames in nanoseconds, 0 to deliver frames as fast as buffers are queued. Set by open(). */
+	uint64_t interval_ns;
+	/**
+	 * Due time of each of the first frames relative to the first one, NULL to pace at interval_ns.
+	 * Set by open() with frames entries, the pattern repeats every loop_ns.
+	 */
+	const uint64_t *timestamps;
+	/** Duration of one loop over recorded timestamps in nanoseconds. */
+	uint64_t loop_ns;
+	/** timerfd readable when a queued buffer may be dequeued, the capture context v4l2_fd. */
+	int timer_fd;
+	/** Protects the queue and the timer, buffers are queued and dequeued from different threads. */
+	pthread_mutex_t lock;
+	/** Indices of the queued buffers in queue order. */
+	int queue[VIDEO_MAX_FRAME];
+	/** Number of buffers ever queued. */
+	uint32_t head;
+	/** Number of buffers ever dequeued. */
+	uint32_t tail;
+	/** Monotonic time frame 0 is due, set by the first dequeue. */
+	uint64_t start_ns;
+	/** Number of the next frame produced. */
+	uint64_t frame;
+	/** Frames dropped because the consumer fell behind. */
+	uint64_t dropped;
+};
+
+/**
+ * Find the source selected by a capture device name.
+ * @param device capture device from the command line.
+ * @return source whose prefix starts the name, NULL for a V4L2 device.
+ */
+const struct capture_source *source_find(const char *device);
+
+/**
+ * Open the source selected by the capture device, allocate its buffers and create the readiness timer.
+ * Fills the mode, plane layout and buffer map of the capture context like capture_setup() does for V4L2.
+ * Buffers come from the DMA buffer pool with -M dmabuf, otherwise from the capture arena.
+ * @param cap Capture data management structure, v4l2_fd is set to the readiness timer.
+ * @param opt User selected program configuration options.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int source_open(struct capture_context *cap, struct options *opt);
+
+/**
+ * Dequeue the next due frame without waiting, the counterpart of VIDIOC_DQBUF.
+ * @param cap Capture data management structure.
+ * @param buf buffer to fill, m.planes must hold room for every plane.
+ * @return 0 on success, -EAGAIN when no frame is due or no buffer is queued.
+ */
+int source_dequeue(struct capture_context *cap, struct v4l2_buffer *buf);
+
+/**
+ * Give a buffer back to the source, the counterpart of VIDIOC_QBUF.
+ * @param cap Capture data management structure.
+ * @param buf buffer to queue, only the index is used.
+ * @return error status of the request. Value 0 is returned on success.
+ */
+int source_queue(struct capture_context *cap, const struct v4l2_buffer *buf);
+
+/**
+ * Select a test pattern of the source.
+ * @param cap Capture data management structure.
+ * @param pattern 0 for the normal frames, 1 to 3 for the test patterns.
+ * @return error status of the request, -ENOTTY when the source has no test pattern.
+ */
+int source_test_pattern(struct capture_context *cap, int pattern);
+
+/**
+ * Close the source, its timer and its arena. Buffers from the DMA buffer pool stay in the pool.
+ * @param cap Capture data management structure.
+ */
+void source_close(struct capture_context *cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
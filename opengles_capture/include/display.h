@@ -28,9 +28,14 @@
 #ifndef DISPLAY_H__
 #define DISPLAY_H__
 
+#include <stdint.h>
+
 #include "options.h"
+#include "gpu_timer.h"
+#include "watermark.h"
 
 #include <GLES3/gl3.h>
+#include <GLES3/gl2ext.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
@@ -43,6 +48,12 @@ struct display_context;
  * @note This value is not represetative of limits in OpenGL or the hardware.
  */
 #define MAX_DISPLAY_OBJECTS 16
+/** Maximum number of V4L2 buffer indices that can be imported as EGL images. */
+#define MAX_IMPORT_FRAMES 32
+/** Number of planes imported per buffer, NV12 has a luma and a chroma plane. */
+#define MAX_IMPORT_PLANES 2
+/** Number of pixel unpack buffers cycled by the PBO render, the CPU fills one while the GPU reads another. */
+#define DISPLAY_PBO_RING 3
 
 /**
  * Display event loop callbacks.
@@ -70,6 +81,36 @@ struct render_context
 	int num_buffers;
 	/** array of pointers to memory mapped video planes to display. */
 	void *buffers[MAX_RENDER_BUFFERS];
+	/** array of DMA file descriptors for each video plane, -1 when the plane was not exported. */
+	int dma_buf_fd[MAX_RENDER_BUFFERS];
+	/** V4L2 buffer index holding the planes, used to look up GPU resources cached per buffer. */
+	int index;
+	/** Frame width in pixels. */
+	int width;
+	/** Frame height in pixels. */
+	int height;
+	/** Distance in bytes between the start of each line of every plane. */
+	int stride[MAX_RENDER_BUFFERS];
+	/** Offset in bytes of every plane within its DMA buffer. */
+	int offset[MAX_RENDER_BUFFERS];
+	/** V4L2 sequence number of the frame, tags the trace spans of the render. */
+	uint32_t sequence;
+	/** Monotonic time in nanoseconds when the planes were available as textures, set by the render. */
+	uint64_t upload_ns;
+	/** Monotonic time in nanoseconds when eglSwapBuffers returned, set by the render. */
+	uint64_t present_ns;
+};
+
+/**
+ * GPU references for one video buffer imported through EGL_EXT_image_dma_buf_import.
+ * Each V4L2 buffer index is imported on first use and the textures are reused whenever it returns.
+ */
+struct dmabuf_import
+{
+	/** EGL image wrapping the DMA buffer of each plane. */
+	EGLImageKHR image[MAX_IMPORT_PLANES];
+	/** Texture bound to the EGL image of each plane. */
+	GLuint texture[MAX_IMPORT_PLANES];
 };
 
 /**
@@ -93,6 +134,12 @@ struct display_context
 	EGLSurface egl_surface;
 	/** handle to the display that will be drawn on for EGL API. */
 	EGLDisplay egl_display;
+	/** Render target, see enum display_backend, auto is resolved by display_init(). */
+	int backend;
+	/** Framebuffer object drawn on by the offscreen backend without an EGL surface, 0 otherwise. */
+	GLuint framebuffer;
+	/** Color attachment of the offscreen framebuffer object. */
+	GLuint renderbuffer;
 
 	/** Height of the surface to be drawn on. */
 	EGLint height;
@@ -110,6 +157,38 @@ struct display_context
 	/** The handle to the compiled shader program */
 	GLuint program;
 
+	/** Method used to move video planes into GPU textures, see enum render_method. */
+	int render_method;
+	/** Imported DMA buffer textures indexed by V4L2 buffer index. */
+	struct dmabuf_import imports[MAX_IMPORT_FRAMES];
+	/** Pixel unpack buffers of the PBO render, both planes of a frame are staged in one buffer. */
+	GLuint pbo[DISPLAY_PBO_RING];
+	/** Size in bytes of each pixel unpack buffer, 0 until the first frame. */
+	GLsizeiptr pbo_size;
+	/** Pixel unpack buffer filled by the next frame. */
+	int pbo_index;
+	/** EGL_KHR_image_base entry point to create an EGL image. */
+	PFNEGLCREATEIMAGEKHRPROC egl_create_image;
+	/** EGL_KHR_image_base entry point to destroy an EGL image. */
+	PFNEGLDESTROYIMAGEKHRPROC egl_destroy_image;
+	/** GL_OES_EGL_image entry point to bind an EGL image to a texture. */
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC gl_image_target_texture;
+	/** EGL_KHR_fence_sync entry point to create a fence, NULL when fences are not supported. */
+	PFNEGLCREATESYNCKHRPROC egl_create_sync;
+	/** EGL_KHR_fence_sync entry point to wait for a fence. */
+	PFNEGLCLIENTWAITSYNCKHRPROC egl_client_wait_sync;
+	/** EGL_KHR_fence_sync entry point to destroy a fence. */
+	PFNEGLDESTROYSYNCKHRPROC egl_destroy_sync;
+	/** Signaled when the GPU finished sampling the last imported buffer, EGL_NO_SYNC_KHR once waited. */
+	EGLSyncKHR render_fence;
+
+	/** Measure the GPU time of the render stages when the driver supports timer queries. */
+	int gpu_timing;
+	/** Timer queries of the render stages, disabled unless gpu_timing is set and supported. */
+	struct gpu_timer gpu_timer;
+	/** Frames stamped with a watermark decoded from the surface, enabled from the options. */
+	struct watermark watermark;
+
 	/** Functions pointers called by the display event loop or render functions. */
 	struct event_callbacks callbacks;
 
@@ -120,16 +199,43 @@ struct display_context
 };
 
 /**
- * Display and GPU setup for a YUV420 texture display.
- * Setup a full screen window and utilize EGL and OpenGLES to setup the display_context.
- * Compiles the shader program so that the application may render frames on the display surface.
+ * Display and GPU setup for a YUV420 texture display, independent of the captured frames.
+ * Creates the X11 window or the offscreen render target selected by disp->backend, initializes EGL
+ * and compiles the shader program. The offscreen target is sized by disp->width and disp->height.
+ * It may run while the capture device is being setup, the EGL context is current on the calling thread.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int display_init(struct display_context* disp);
+
+/**
+ * Texture setup for the captured frames, allocates the textures for the frame size and selects the render function.
+ * Must be called after display_init() on the thread that called it.
  *
  * @param disp Display Data management structure with GPU handles.
- * @param render_ctx contains display buffers that may be used for initial setup.
+ * @param render_ctx contains display buffers that may be used for initial setup and the frame size.
  * @note disp->render is assigned for the caller for the display render routine.
  * @return error status of the setup. Value 0 is returned on success.
  */
-int camera_nv12m_setup(struct display_context* disp, struct render_context *render_ctx);
+int display_frame_setup(struct display_context* disp, struct render_context *render_ctx);
+
+/**
+ * Compile the shader program and create the vertex array of the full surface rectangle.
+ * Part of display_init(), requires a current GLES context.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int display_gl_setup(struct display_context* disp);
+
+/**
+ * Release the textures, pixel unpack buffers and imported images allocated by display_frame_setup().
+ * The frame setup may run again afterwards, for another frame size or render method.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ */
+void display_frame_release(struct display_context* disp);
 
 
 /**
@@ -140,6 +246,23 @@ int camera_nv12m_setup(struct display_context* disp, struct render_context *rend
  */
 int egl_init(struct display_context *disp);
 
+/**
+ * Initialize EGL without a display server and create a render target sized by disp->width and disp->height.
+ * Uses the Mesa surfaceless platform when available with a framebuffer object as the target,
+ * or a pbuffer surface when the display does not support surfaceless contexts.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int offscreen_init(struct display_context *disp);
+
+/**
+ * Release the render target and the EGL display created by offscreen_init().
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the shutdown. Value 0 is returned on success.
+ */
+int offscreen_close(struct display_context *disp);
+
 /**
  * Display event loop, check for occuring events and send callbacks based on the events.
  * @param disp Display Data management structure with GPU handles.
@@ -147,6 +270,21 @@ int egl_init(struct display_context *disp);
  */
 int x11_process_pending_events(struct display_context *disp);
 
+/**
+ * Flush pending requests and handle events Xlib already read from the connection.
+ * Must be called before waiting on the connection file descriptor.
+ * @param disp Display Data management structure with GPU handles.
+ * @return Value 1 is returned if 'q' has been pressed indicating a request to quit the application.
+ */
+int x11_process_queued_events(struct display_context *disp);
+
+/**
+ * File descriptor of the native display connection.
+ * @param disp Display Data management structure with GPU handles.
+ * @return file descriptor that becomes readable when the display sends events, -1 for the offscreen backend.
+ */
+int x11_connection_fd(struct display_context *disp);
+
 /**
  * Create a full screen native window and setup events to watch.
  * @param disp Display Data management structure with GPU handles.
@@ -161,4 +299,20 @@ int x11_create_window(struct display_context *disp);
  */
 int x11_close_display(struct display_context *disp);
 
+/**
+ * Release the GPU resources of the render path and close the native window.
+ * @param disp Display Data management structure with GPU handles.
+ * @return error status of the shutdown. Value 0 is returned on success.
+ */
+int display_close(struct display_context *disp);
+
+/**
+ * Wait until the GPU no longer samples the DMA buffer imported by the last render.
+ * The buffer must not be queued to the capture driver before, the device would overwrite it while it is read.
+ * Returns immediately when the last render did not import a buffer or its fence was already waited.
+ *
+ * @param disp Display Data management structure with GPU handles.
+ */
+void display_fence_wait(struct display_context *disp);
+
 #endif
\ No newline at end of file
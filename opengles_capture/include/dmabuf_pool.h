@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Application owned pool of DMA buffers for V4L2_MEMORY_DMABUF capture.
+ * @file dmabuf_pool.h
+ */
+#ifndef DMABUF_POOL_H__
+#define DMABUF_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/videodev2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocator that provided the DMA buffers of a pool.
+ */
+enum dmabuf_source {
+	/** No buffers are allocated. */
+	DMABUF_SOURCE_NONE,
+	/** Allocated from a /dev/dma_heap heap. */
+	DMABUF_SOURCE_HEAP,
+	/** memfd memory wrapped by /dev/udmabuf. */
+	DMABUF_SOURCE_UDMABUF,
+};
+
+/**
+ * A set of DMA buffers, one per plane of each frame, mapped for CPU access.
+ * The pool is independent of the V4L2 stream so it can be shared and reused across restarts.
+ */
+struct dmabuf_pool {
+	/** Number of frames in the pool. */
+	int count;
+	/** Number of planes per frame. */
+	int num_planes;
+	/** Size of each plane in bytes, rounded up to the page size. */
+	size_t size[VIDEO_MAX_PLANES];
+	/** DMA buffer file descriptor of each plane. */
+	int fd[VIDEO_MAX_FRAME][VIDEO_MAX_PLANES];
+	/** CPU mapping of each plane. */
+	void *addr[VIDEO_MAX_FRAME][VIDEO_MAX_PLANES];
+	/** Allocator used for the buffers. */
+	enum dmabuf_source source;
+};
+
+/**
+ * Allocate and map the buffers of a pool.
+ * A pool that already holds the same number of frames with large enough planes is kept as is.
+ * A DMA heap is used when one is available, otherwise memfd memory is exported through udmabuf.
+ *
+ * @param pool pool to fill, zero initialized before the first call.
+ * @param count number of frames.
+ * @param num_planes number of planes per frame.
+ * @param size minimum size in bytes of each plane.
+ * @return error status of the allocation. Value 0 is returned on success.
+ */
+int dmabuf_pool_alloc(struct dmabuf_pool *pool, int count, int num_planes, const uint32_t size[]);
+
+/**
+ * Unmap and close every buffer of a pool.
+ * @param pool pool to release.
+ */
+void dmabuf_pool_free(struct dmabuf_pool *pool);
+
+/**
+ * Bracket CPU access to a DMA buffer for cache coherency with the device.
+ * @param fd DMA buffer file descriptor.
+ * @param flags DMA_BUF_SYNC_START or DMA_BUF_SYNC_END combined with the access direction.
+ * @return error status of the request. Value 0 is returned on success.
+ */
+int dmabuf_sync(int fd, uint64_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * epoll based event loop dispatching file descriptor events to handlers.
+ * @file event_loop.h
+ */
+#ifndef EVENT_LOOP_H__
+#define EVENT_LOOP_H__
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of file descriptors watched by one event loop. */
+#define MAX_EVENT_SOURCES 16
+
+/**
+ * Function called when a watched file descriptor is ready.
+ * @param fd the ready file descriptor.
+ * @param events epoll event flags reported for the file descriptor, 0 for the prepare call.
+ * @param context pointer registered with the handler.
+ * @return 0 to continue, positive to stop the loop normally, negative to stop on error.
+ */
+typedef int (*event_handler)(int fd, uint32_t events, void *context);
+
+/**
+ * A file descriptor watched by the event loop.
+ */
+struct event_source
+{
+	/** Watched file descriptor. */
+	int fd;
+	/** Close the file descriptor when the loop is closed, set for timer and signal sources. */
+	int owned;
+	/** Function called when the file descriptor is ready. */
+	event_handler handler;
+	/** Pointer passed to the handler. */
+	void *context;
+};
+
+/**
+ * Data management structure for the event loop.
+ */
+struct event_loop
+{
+	/** epoll instance watching every source. */
+	int epoll_fd;
+	/** Number of registered sources. */
+	int num_sources;
+	/** Registered sources, the epoll user data points at these entries. */
+	struct event_source sources[MAX_EVENT_SOURCES];
+	/** Optional handler called before each wait, used to drain events buffered in user space. */
+	event_handler prepare;
+	/** Pointer passed to the prepare handler. */
+	void *prepare_context;
+	/** Set to end the loop after the current dispatch. */
+	volatile int stop;
+	/** Signal mask of the process before event_loop_add_signals(), restored on close. */
+	sigset_t saved_signals;
+	/** Set when saved_signals must be restored. */
+	int signals_blocked;
+};
+
+/**
+ * Create the epoll instance of an event loop.
+ * @param loop event loop to initialize.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int event_loop_init(struct event_loop *loop);
+
+/**
+ * Watch a file descriptor and call a handler when it is ready.
+ * @param loop event loop.
+ * @param fd file descriptor to watch, remains owned by the caller.
+ * @param events epoll event flags to wait for, usually EPOLLIN.
+ * @param handler function called when the file descriptor is ready.
+ * @param context pointer passed to the handler.
+ * @return error status of the registration. Value 0 is returned on success.
+ */
+int event_loop_add(struct event_loop *loop, int fd, uint32_t events, event_handler handler, void *context);
+
+/**
+ * Call a handler periodically through a timerfd owned by the loop.
+ * The handler must read the timerfd to acknowledge the expiration, see event_loop_timer_read().
+ * @param loop event loop.
+ * @param interval_ms period of the timer in milliseconds.
+ * @param handler function called on each expiration.
+ * @param context pointer passed to the handler.
+ * @return error status of the registration. Value 0 is returned on success.
+ */
+int event_loop_add_timer(struct event_loop *loop, int interval_ms, event_handler handler, void *context);
+
+/**
+ * Acknowledge a timer source expiration.
+ * @param fd timer file descriptor passed to the handler.
+ * @return number of expirations since the last read.
+ */
+uint64_t event_loop_timer_read(int fd);
+
+/**
+ * Block a set of signals for the process and deliver them through a signalfd owned by the loop.
+ * Must be called before other threads are created so they inherit the blocked mask.
+ * The handler must read a struct signalfd_siginfo from the file descriptor.
+ * @param loop event loop.
+ * @param signals set of signals to receive.
+ * @param handler function called when a signal arrives.
+ * @param context pointer passed to the handler.
+ * @return error status of the registration. Value 0 is returned on success.
+ */
+int event_loop_add_signals(struct event_loop *loop, const sigset_t *signals, event_handler handler, void *context);
+
+/**
+ * Set a handler called before each wait for events.
+ * @param loop event loop.
+ * @param handler function called with fd -1 and events 0.
+ * @param context pointer passed to the handler.
+ */
+void event_loop_set_prepare(struct event_loop *loop, event_handler handler, void *context);
+
+/**
+ * Wait for events and dispatch them until a handler requests a stop or event_loop_stop() is called.
+ * @param loop event loop.
+ * @return the last non zero handler result, 0 when stopped by event_loop_stop().
+ */
+int event_loop_run(struct event_loop *loop);
+
+/**
+ * Request the event loop to return after the current dispatch.
+ * @param loop event loop.
+ */
+void event_loop_stop(struct event_loop *loop);
+
+/**
+ * Close the epoll instance and every file descriptor owned by the loop.
+ * Signals blocked by event_loop_add_signals() are unblocked again.
+ * @param loop event loop.
+ */
+void event_loop_close(struct event_loop *loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
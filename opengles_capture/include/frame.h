@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Reference counted capture frames shared by several consumers without copying.
+ * @file frame.h
+ *
+ * A frame wraps one V4L2 buffer index with the metadata of its last dequeue.
+ * The producer publishes each dequeued frame to every consumer of a fan-out,
+ * each consumer takes a reference and holds the planes zero-copy until it puts the frame.
+ * The buffer is returned to the driver when the last reference is put.
+ */
+#ifndef FRAME_H__
+#define FRAME_H__
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <linux/videodev2.h>
+
+#include "spsc_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of frames waiting in one consumer queue, at least VIDEO_MAX_FRAME and at most SPSC_RING_SIZE. */
+#define FRAME_QUEUE_SIZE 32
+/** Maximum number of consumers of one fan-out. */
+#define MAX_FRAME_CONSUMERS 4
+
+/**
+ * Behaviour of a consumer queue receiving a frame while it is full.
+ */
+enum frame_queue_policy {
+	/** Release the oldest waiting frame and queue the new one, the consumer sees the newest frames. */
+	FRAME_DROP_OLDEST,
+	/** Release the new frame, the consumer sees every frame up to the moment it fell behind. */
+	FRAME_DROP_NEWEST,
+	/** Wait in the producer until the consumer takes a frame, capture stalls with the consumer. */
+	FRAME_BLOCK,
+};
+
+struct frame;
+
+/**
+ * Function called when the last reference of a frame is put, returns the buffer to its owner.
+ * It may be called from any consumer thread.
+ * @param frame the released frame.
+ * @param context pointer registered with the frame.
+ */
+typedef void (*frame_release_function)(struct frame *frame, void *context);
+
+/**
+ * One captured buffer and the metadata of its last dequeue.
+ */
+struct frame {
+	/** V4L2 buffer index. */
+	int index;
+	/** Number of planes in the addr and dma_buf_fd arrays. */
+	int num_planes;
+	/** User space address of each plane, shared by every consumer. */
+	void *addr[VIDEO_MAX_PLANES];
+	/** DMA buffer file descriptor of each plane, -1 when not available. */
+	int dma_buf_fd[VIDEO_MAX_PLANES];
+	/** Frame sequence number from the driver. */
+	uint32_t sequence;
+	/** V4L2 buffer flags from the driver. */
+	uint32_t flags;
+	/** Capture timestamp from the driver. */
+	struct timeval timestamp;
+	/** Monotonic time when the buffer was dequeued in nanoseconds. */
+	uint64_t dequeue_ns;
+	/** Bytes of valid data in each plane. */
+	uint32_t bytesused[VIDEO_MAX_PLANES];
+	/** Number of references held, modified atomically. */
+	int refs;
+	/** Function returning the buffer to its owner when the last reference is put. */
+	frame_release_function release;
+	/** Pointer passed to the release function. */
+	void *release_context;
+};
+
+/**
+ * Bounded queue of frames waiting for one consumer.
+ * The producer and the consumer may run on different threads, frames move through a lock-free ring.
+ * A side only makes a system call to sleep when it must wait, the other side then wakes it.
+ */
+struct frame_consumer {
+	/** Name used in statistics. */
+	const char *name;
+	/** Behaviour when the queue is full, see enum frame_queue_policy. */
+	int policy;
+	/** Maximum number of waiting frames, at most FRAME_QUEUE_SIZE. */
+	uint32_t depth;
+	/** Waiting frames, each holds one reference. */
+	struct spsc_ring ring;
+	/** Futex incremented to wake the waiting side after a push, a pop or the close. */
+	uint32_t wake;
+	/** Number of sides sleeping on the wake futex, the producer waiting for room or the consumer for a frame. */
+	int waiters;
+	/** Semaphore eventfd readable while frames are waiting, for consumers running an event loop. */
+	int event_fd;
+	/** Set when no more frames will be pushed or popped. */
+	int closed;
+	/** Number of frames queued for the consumer. */
+	uint64_t received;
+	/** Number of frames released without reaching the consumer. */
+	uint64_t dropped;
+};
+
+/**
+ * Set of consumers receiving every published frame.
+ */
+struct frame_fanout {
+	/** Number of consumers. */
+	int count;
+	/** Consumers in the order frames are delivered. */
+	struct frame_consumer *consumers[MAX_FRAME_CONSUMERS];
+};
+
+/**
+ * Take an additional reference on a frame.
+ * @param frame frame to reference.
+ */
+static inline void frame_get(struct frame *frame)
+{
+	__atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Put a reference on a frame, the frame is released when this was the last reference.
+ * @param frame frame to put.
+ */
+static inline void frame_put(struct frame *frame)
+{
+	/* Release ordering makes every consumer access visible before the buffer is reused. */
+	if (__atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		frame->release(frame, frame->release_context);
+}
+
+/**
+ * Initialize a consumer queue.
+ * @param consumer consumer to initialize.
+ * @param name name used in statistics.
+ * @param policy behaviour when the queue is full, see enum frame_queue_policy.
+ * @param depth maximum number of waiting frames, limited to FRAME_QUEUE_SIZE.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+int frame_consumer_init(struct frame_consumer *consumer, const char *name, int policy, uint32_t depth);
+
+/**
+ * Queue a frame for a consumer, taking a reference when it is accepted.
+ * A full queue applies the consumer policy, the FRAME_BLOCK policy waits for the consumer.
+ * @param consumer consumer receiving the frame.
+ * @param frame frame to queue.
+ * @return 0 when the frame was queued, 1 when it was dropped or the consumer is closed.
+ */
+int frame_consumer_push(struct frame_consumer *consumer, struct frame *frame);
+
+/**
+ * Take the oldest waiting frame, the caller owns its reference and must put it.
+ * @param consumer consumer to read.
+ * @param wait wait for a frame when the queue is empty.
+ * @return the oldest frame, NULL when the queue is empty or closed.
+ */
+struct frame *frame_consumer_pop(struct frame_consumer *consumer, int wait);
+
+/**
+ * Close a consumer, waking every producer and consumer waiting on it.
+ * Waiting frames stay queued until frame_consumer_destroy().
+ * @param consumer consumer to close.
+ */
+void frame_consumer_close(struct frame_consumer *consumer);
+
+/**
+ * Put every waiting frame and free the consumer resources.
+ * @param consumer consumer to destroy.
+ */
+void frame_consumer_destroy(struct frame_consumer *consumer);
+
+/**
+ * Add a consumer to a fan-out.
+ * @param fanout fan-out receiving the consumer.
+ * @param consumer initialized consumer.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+int frame_fanout_add(struct frame_fanout *fanout, struct frame_consumer *consumer);
+
+/**
+ * Deliver a newly dequeued frame to every consumer of a fan-out.
+ * The frame must hold no reference, it is released right away when no consumer accepts it.
+ * @param fanout consumers receiving the frame.
+ * @param frame frame to deliver.
+ * @return number of consumers that queued the frame.
+ */
+int frame_fanout_publish(struct frame_fanout *fanout, struct frame *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Dropped frame accounting from V4L2 sequence numbers, buffer flags and timestamps.
+ * @file frame_accounting.h
+ *
+ * One thread records every dequeued buffer, any other thread may read the running counters.
+ * Counters are written with relaxed atomic stores so readers never see torn values.
+ */
+#ifndef FRAME_ACCOUNTING_H__
+#define FRAME_ACCOUNTING_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of one second periods kept in the history. */
+#define ACCOUNTING_HISTORY 60
+
+/**
+ * Counters of one second of capture, by driver timestamp.
+ */
+struct accounting_second {
+	/** Monotonic driver timestamp at the start of the second in nanoseconds. */
+	uint64_t start_ns;
+	/** Frames dequeued. */
+	uint32_t frames;
+	/** Frames missing from the sequence numbers. */
+	uint32_t dropped;
+	/** Buffers flagged with V4L2_BUF_FLAG_ERROR. */
+	uint32_t errors;
+	/** Largest deviation of a frame interval from the expected interval in microseconds. */
+	uint32_t max_jitter_us;
+};
+
+/**
+ * Running frame accounting of a capture stream.
+ */
+struct frame_accounting {
+	/** Expected time between frames, the negotiated interval or the measured average. */
+	uint64_t interval_ns;
+	/** The interval is measured because the device did not report one. */
+	int measure_interval;
+	/** Sequence number of the last buffer. */
+	uint32_t last_sequence;
+	/** Driver timestamp of the first buffer in nanoseconds. */
+	uint64_t first_timestamp_ns;
+	/** Driver timestamp of the last buffer in nanoseconds, 0 before the first buffer. */
+	uint64_t last_timestamp_ns;
+	/** Frames dequeued. */
+	uint64_t frames;
+	/** Frames missing from the sequence numbers. */
+	uint64_t dropped;
+	/** Buffers flagged with V4L2_BUF_FLAG_ERROR. */
+	uint64_t errors;
+	/** Sequence numbers that went backwards or repeated, the driver restarted counting. */
+	uint64_t resets;
+	/** Sum of the interval deviations in nanoseconds. */
+	uint64_t jitter_total_ns;
+	/** Largest interval deviation in nanoseconds. */
+	uint64_t jitter_max_ns;
+	/** Number of intervals measured. */
+	uint64_t intervals;
+	/** Second being accumulated. */
+	struct accounting_second current;
+	/** Completed seconds, oldest overwritten first. */
+	struct accounting_second history[ACCOUNTING_HISTORY];
+	/** Number of completed seconds since the start. */
+	uint32_t history_count;
+	/** Counters at the last report, the report shows the change since then. */
+	struct {
+		/** Frames at the last report. */
+		uint64_t frames;
+		/** Dropped frames at the last report. */
+		uint64_t dropped;
+		/** Errors at the last report. */
+		uint64_t errors;
+		/** Driver timestamp of the last frame at the last report. */
+		uint64_t timestamp_ns;
+		/** Sum of the interval deviations at the last report. */
+		uint64_t jitter_total_ns;
+		/** Intervals measured at the last report. */
+		uint64_t intervals;
+	} reported;
+};
+
+/**
+ * Start accounting a stream.
+ * @param acc accounting to initialize.
+ * @param interval_ns expected time between frames, 0 to measure it from the timestamps.
+ */
+void accounting_init(struct frame_accounting *acc, uint64_t interval_ns);
+
+/**
+ * Account one dequeued buffer, called by the dequeueing thread only.
+ * @param acc stream accounting.
+ * @param sequence V4L2 buffer sequence number.
+ * @param timestamp_ns V4L2 buffer timestamp in nanoseconds.
+ * @param flags V4L2 buffer flags.
+ */
+void accounting_frame(struct frame_accounting *acc, uint32_t sequence, uint64_t timestamp_ns, uint32_t flags);
+
+/**
+ * Log the frames, drops, errors, jitter and fps since the last report.
+ * @param acc stream accounting.
+ */
+void accounting_report(struct frame_accounting *acc);
+
+/**
+ * Copy the completed seconds, oldest first.
+ * Call once the dequeueing thread has stopped.
+ * @param acc stream accounting.
+ * @param seconds returns the completed seconds.
+ * @param max size of the seconds array.
+ * @return number of seconds copied.
+ */
+int accounting_history(const struct frame_accounting *acc, struct accounting_second *seconds, int max);
+
+/**
+ * Log the totals and the per second history.
+ * Call once the dequeueing thread has stopped.
+ * @param acc stream accounting.
+ */
+void accounting_summary(const struct frame_accounting *acc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
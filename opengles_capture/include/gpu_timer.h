@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * GPU time of the render stages measured with EXT_disjoint_timer_query.
+ * @file gpu_timer.h
+ *
+ * Each frame takes one slot of a ring of query objects, one query per stage.
+ * Results are collected frames later once the GPU made them available, the render never waits for them.
+ * A disjoint event, such as a GPU frequency change or a context switch, discards every result in flight.
+ */
+#ifndef GPU_TIMER_H__
+#define GPU_TIMER_H__
+
+#include <stdint.h>
+
+#include <GLES3/gl3.h>
+#include <GLES3/gl2ext.h>
+
+/** Number of frames whose queries may be in flight. */
+#define GPU_TIMER_RING 8
+
+/**
+ * Render stages timed on the GPU.
+ */
+enum gpu_stage
+{
+	/** Copy of the luma plane into its texture. */
+	GPU_UPLOAD_LUMA,
+	/** Copy of the chroma plane into its texture. */
+	GPU_UPLOAD_CHROMA,
+	/** Full screen draw of the textures. */
+	GPU_DRAW,
+	/** Number of timed stages. */
+	GPU_STAGES,
+};
+
+/**
+ * Queries of one frame.
+ */
+struct gpu_timer_slot
+{
+	/** Time elapsed query of each stage. */
+	GLuint query[GPU_STAGES];
+	/** Bit mask of the stages timed in this frame. */
+	uint32_t used;
+};
+
+/**
+ * Ring of timer queries and the GPU time collected from it.
+ */
+struct gpu_timer
+{
+	/** Queries are issued, the extension is available and timing was requested. */
+	int enabled;
+	/** EXT_disjoint_timer_query entry points. */
+	PFNGLGENQUERIESEXTPROC gen_queries;
+	PFNGLDELETEQUERIESEXTPROC delete_queries;
+	PFNGLBEGINQUERYEXTPROC begin_query;
+	PFNGLENDQUERYEXTPROC end_query;
+	PFNGLGETQUERYOBJECTUIVEXTPROC get_query_uiv;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_ui64v;
+	/** Query slots, frame N uses slot N % GPU_TIMER_RING. */
+	struct gpu_timer_slot ring[GPU_TIMER_RING];
+	/** Number of frames started. */
+	uint32_t head;
+	/** Number of frames collected or discarded. */
+	uint32_t tail;
+	/** Slot of the frame being rendered, NULL when the frame is not timed. */
+	struct gpu_timer_slot *active;
+	/** Stage running a query, -1 when none is running. */
+	int running;
+	/** Number of results per stage since the last report. */
+	uint64_t count[GPU_STAGES];
+	/** Sum of the stage times since the last report in nanoseconds. */
+	uint64_t total_ns[GPU_STAGES];
+	/** Longest stage time since the last report in nanoseconds. */
+	uint64_t max_ns[GPU_STAGES];
+	/** Disjoint events since the last report. */
+	uint64_t disjoint;
+	/** Frames whose results were discarded by a disjoint event since the last report. */
+	uint64_t discarded;
+	/** Frames not timed because every slot was still in flight since the last report. */
+	uint64_t skipped;
+};
+
+/**
+ * Load the extension and create the query ring, requires a current GLES context.
+ * @param timer timer to initialize, left disabled when the extension is not available.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int gpu_timer_init(struct gpu_timer *timer);
+
+/**
+ * Collect the available results and start timing a new frame.
+ * @param timer GPU timer.
+ */
+void gpu_timer_frame(struct gpu_timer *timer);
+
+/**
+ * Start the query of a stage of the current frame, stages may not overlap.
+ * @param timer GPU timer.
+ * @param stage stage starting, see enum gpu_stage.
+ */
+void gpu_timer_begin(struct gpu_timer *timer, int stage);
+
+/**
+ * End the query started by gpu_timer_begin().
+ * @param timer GPU timer.
+ */
+void gpu_timer_end(struct gpu_timer *timer);
+
+/**
+ * Log the average and maximum GPU time of each stage and the disjoint events, then start a new period.
+ * @param timer GPU timer.
+ */
+void gpu_timer_report(struct gpu_timer *timer);
+
+/**
+ * Delete the queries, requires the GLES context that created them.
+ * @param timer GPU timer.
+ */
+void gpu_timer_close(struct gpu_timer *timer);
+
+#endif
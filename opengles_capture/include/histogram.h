@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Log bucketed latency histograms with fixed memory in the style of HdrHistogram.
+ * @file histogram.h
+ *
+ * Values below HISTOGRAM_SUB_BUCKETS are counted exactly, larger values share buckets
+ * HISTOGRAM_SUB_BUCKETS to each power of two so every bucket is within 1/64 of its values.
+ * Any thread may record without locks, readers take a snapshot and compute percentiles from it.
+ * Snapshots merge by adding buckets and the change between two snapshots is an interval histogram.
+ */
+#ifndef HISTOGRAM_H__
+#define HISTOGRAM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of bits of each value resolved within a power of two. */
+#define HISTOGRAM_SUB_BITS 6
+/** Number of buckets per power of two. */
+#define HISTOGRAM_SUB_BUCKETS (1u << HISTOGRAM_SUB_BITS)
+/** Values from 2^HISTOGRAM_MAX_BITS are counted in the last bucket, about 18 minutes in nanoseconds. */
+#define HISTOGRAM_MAX_BITS 40
+/** Total number of buckets. */
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Distribution of recorded values.
+ */
+struct histogram {
+	/** Name used in reports. */
+	const char *name;
+	/** Sum of the recorded values. */
+	uint64_t total;
+	/** Largest recorded value. */
+	uint64_t max;
+	/** Number of values recorded in each bucket. */
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Bucket counting a value.
+ * @param value recorded value.
+ * @return bucket index.
+ */
+static inline unsigned int histogram_bucket(uint64_t value)
+{
+	unsigned int msb;
+
+	if (value < HISTOGRAM_SUB_BUCKETS) return value;
+	msb = 63 - __builtin_clzll(value);
+	if (msb >= HISTOGRAM_MAX_BITS) return HISTOGRAM_BUCKETS - 1;
+	return (msb - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_BUCKETS + (unsigned int)(value >> (msb - HISTOGRAM_SUB_BITS));
+}
+
+/**
+ * Record one value, safe to call from any thread.
+ * @param hist histogram to update.
+ * @param value value to record.
+ */
+static inline void histogram_record(struct histogram *hist, uint64_t value)
+{
+	uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&hist->buckets[histogram_bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->total, value, __ATOMIC_RELAXED);
+	while (value > max &&
+		!__atomic_compare_exchange_n(&hist->max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Clear a histogram.
+ * @param hist histogram to initialize.
+ * @param name name used in reports, must outlive the histogram.
+ */
+void histogram_init(struct histogram *hist, const char *name);
+
+/**
+ * Copy a histogram other threads may be recording to.
+ * Each bucket is read atomically, values recorded during the copy may be partly included.
+ * @param hist histogram to read.
+ * @param snapshot returns the copy.
+ */
+void histogram_snapshot(const struct histogram *hist, struct histogram *snapshot);
+
+/**
+ * Add the values of a snapshot to another.
+ * @param dst histogram receiving the values.
+ * @param src histogram to add.
+ */
+void histogram_merge(struct histogram *dst, const struct histogram *src);
+
+/**
+ * Histogram of the values recorded between two snapshots of the same histogram.
+ * The maximum is estimated from the highest bucket unless it is the overall maximum.
+ * @param interval returns the values recorded after the earlier snapshot.
+ * @param now later snapshot.
+ * @param before earlier snapshot.
+ */
+void histogram_interval(struct histogram *interval, const struct histogram *now, const struct histogram *before);
+
+/**
+ * Number of values in a snapshot.
+ * @param hist histogram snapshot.
+ * @return number of values recorded.
+ */
+uint64_t histogram_count(const struct histogram *hist);
+
+/**
+ * Value at a percentile of a snapshot.
+ * @param hist histogram snapshot.
+ * @param percentile percentile from 0 to 100.
+ * @return highest value counted in the bucket reaching the percentile, 0 when empty.
+ */
+uint64_t histogram_percentile(const struct histogram *hist, double percentile);
+
+/**
+ * Log p50, p90, p99, p99.9 and the maximum of a snapshot of nanosecond values in milliseconds.
+ * @param hist histogram snapshot.
+ */
+void histogram_report(const struct histogram *hist);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
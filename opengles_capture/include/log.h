@@ -23,6 +23,15 @@
 /**
  * Log capture macros.
  * @file log.h
+ *
+ * Messages are not formatted by the thread logging them.
+ * Each thread writes a fixed size binary record, the monotonic time, the format string pointer and the
+ * raw arguments, into its own lock-free ring. A background thread merges the rings in time order,
+ * formats the records and writes them to stdout, the exit path writes whatever is left.
+ * Logging never blocks, a record is dropped and counted when its ring is full. Only the record that
+ * makes a ring non empty makes a system call, to wake the writer which otherwise sleeps.
+ *
+ * Levels above LOG_LEVEL_MAX are removed at compile time, the Makefile strips debug logs in release builds.
  */
 #ifndef LOG_H__
 #define LOG_H__
@@ -46,6 +55,11 @@ extern "C" {
 
 #define LOG_ALL LOG_DEBUG
 
+/** Highest level compiled in, messages of higher levels cost nothing. */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_ALL
+#endif
+
 #define LOGS_DBG(fmt, ...) LOGS(LOG_DEBUG, "DEBUG: ", fmt, ##__VA_ARGS__)
 #define LOGS_INF(fmt, ...) LOGS(LOG_INFO, "INFO:  ", fmt, ##__VA_ARGS__)
 #define LOGS_WRN(fmt, ...) LOGS(LOG_WARNING, "WARN:  ", fmt, ##__VA_ARGS__)
@@ -54,15 +68,35 @@ extern "C" {
 extern int VERBOSE;
 
 #define LOGS(lvl, slvl, fmt, ...) { \
-	if (lvl <= VERBOSE) { \
-		struct timeval _tv; gettimeofday(&_tv, NULL); \
-		printf("[%-10lu.%06lu] " slvl, _tv.tv_sec, _tv.tv_usec); \
-		printf(fmt, ##__VA_ARGS__); \
-		printf("  [" __FILE__ " %s:%d]\n", __func__, __LINE__); \
+	if (lvl <= LOG_LEVEL_MAX && lvl <= VERBOSE) { \
+		log_record(slvl, __FILE__, __func__, __LINE__, fmt, ##__VA_ARGS__); \
 	}}
 
+/**
+ * Queue a message in the ring of the calling thread, use the LOGS macros instead.
+ * Arguments are copied by value, strings are copied up to their precision or the room left in the record.
+ * @param level level prefix, a string literal.
+ * @param file source file, a string literal.
+ * @param function calling function, must outlive the program.
+ * @param line source line.
+ * @param format printf format, a string literal.
+ */
+void log_record(const char *level, const char *file, const char *function, int line, const char *format, ...)
+	__attribute__((format(printf, 5, 6)));
+
+/**
+ * Create the ring of the calling thread now instead of on its first message.
+ * Threads that must not allocate once running call it when they start.
+ */
+void log_thread_init(void);
+
+/**
+ * Write every queued message now, called on exit and before output that must follow the logs.
+ */
+void log_flush(void);
+
 #ifdef __cplusplus
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
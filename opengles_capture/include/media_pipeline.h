@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Camera route and pad format setup through the media controller API.
+ * @file media_pipeline.h
+ *
+ * Replaces the media-ctl scripts in bin/ for the DragonBoard 410c camera subsystem.
+ * The route sensor -> msm_csiphyN -> msm_csidN -> msm_ispifN -> msm_vfe0_pix or msm_vfe0_rdiN
+ * is linked and every pad on it is set to the requested frame size.
+ */
+#ifndef MEDIA_PIPELINE_H__
+#define MEDIA_PIPELINE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum length of a device node path found in the media graph. */
+#define MEDIA_PATH_MAX 64
+
+/**
+ * Camera route to configure and the device nodes found at its ends.
+ */
+struct media_pipeline {
+	/** Camera index, selects msm_csiphyN and the sensor connected to it. */
+	int camera;
+	/** Route through the video front end, see enum pipeline_path. */
+	int path;
+	/** Frame width in pixels set on every pad. */
+	uint32_t width;
+	/** Frame height in pixels set on every pad. */
+	uint32_t height;
+	/** Returns the video capture node at the end of the route. */
+	char video_dev[MEDIA_PATH_MAX];
+	/** Returns the subdevice node of the sensor. */
+	char sensor_subdev[MEDIA_PATH_MAX];
+};
+
+/**
+ * Link the camera route and set its pad formats.
+ * Conflicting links are disabled first, the entities are found by name with MEDIA_IOC_G_TOPOLOGY.
+ * The time taken by each step is logged.
+ *
+ * @param media_dev media controller device path.
+ * @param pipeline route to configure, the device nodes are returned in it.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int media_pipeline_setup(const char *media_dev, struct media_pipeline *pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
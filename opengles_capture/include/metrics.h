@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Live capture metrics published in a POSIX shared memory segment.
+ * @file metrics.h
+ *
+ * The capture application owns the segment and is its only writer.
+ * Every update is bracketed by a sequence lock, the counter is odd while the block is written.
+ * Readers map the segment read-only, copy the block and retry when the counter changed or was odd,
+ * neither side makes a system call to publish or read a consistent copy.
+ * The layout only uses fixed width fields, readers check the magic, version and size before use.
+ */
+#ifndef METRICS_H__
+#define METRICS_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Identifies a capture metrics segment, "CAPM". */
+#define METRICS_MAGIC 0x4d504143
+/** Layout version, incremented whenever a field changes meaning or position. */
+#define METRICS_VERSION 1
+/** Number of latency stages, in the order of enum latency_stage. */
+#define METRICS_LATENCY_STAGES 4
+/** Attempts of a reader to copy the block while the writer keeps updating it. */
+#define METRICS_READ_RETRIES 1000
+
+/**
+ * Latency of one frame stage in nanoseconds.
+ */
+struct metrics_latency {
+	/** Latency of the last displayed frame. */
+	uint64_t last_ns;
+	/** Median over the last stats period. */
+	uint64_t p50_ns;
+	/** 99th percentile over the last stats period. */
+	uint64_t p99_ns;
+	/** Maximum over the last stats period. */
+	uint64_t max_ns;
+};
+
+/**
+ * Metrics block shared with the readers.
+ */
+struct capture_metrics {
+	/** METRICS_MAGIC once the block is initialized. */
+	uint32_t magic;
+	/** METRICS_VERSION of the writer. */
+	uint32_t version;
+	/** Size in bytes of the block written by the writer. */
+	uint32_t size;
+	/** Process ID of the writer. */
+	uint32_t pid;
+	/** Sequence lock, odd while the writer updates the block. */
+	uint32_t lock;
+	/** Negotiated frame width in pixels. */
+	uint32_t width;
+	/** Negotiated frame height in pixels. */
+	uint32_t height;
+	/** V4L2 sequence number of the last displayed frame. */
+	uint32_t last_sequence;
+	/** Buffers owned by the driver. */
+	uint32_t driver_queued;
+	/** Frames waiting for display. */
+	uint32_t display_queued;
+	/** Negotiated time between frames in nanoseconds, 0 when unknown. */
+	uint64_t interval_ns;
+	/** Monotonic time when capture started in nanoseconds. */
+	uint64_t start_ns;
+	/** Monotonic time of the last update in nanoseconds. */
+	uint64_t update_ns;
+	/** Frames dequeued from the driver. */
+	uint64_t captured;
+	/** Frames displayed. */
+	uint64_t displayed;
+	/** Frames missing from the driver sequence numbers. */
+	uint64_t dropped;
+	/** Buffers flagged with errors by the driver. */
+	uint64_t errors;
+	/** Frames released without display by the present policy. */
+	uint64_t stale;
+	/** Displayed frames per second over the last stats period, times 1000. */
+	uint64_t fps_milli;
+	/** Latency of each stage, see enum latency_stage. */
+	struct metrics_latency latency[METRICS_LATENCY_STAGES];
+};
+
+/**
+ * Start an update, readers retry until metrics_write_end().
+ * @param metrics shared block, only written by one thread.
+ */
+static inline void metrics_write_begin(struct capture_metrics *metrics)
+{
+	__atomic_store_n(&metrics->lock, metrics->lock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Complete an update started with metrics_write_begin().
+ * @param metrics shared block.
+ */
+static inline void metrics_write_end(struct capture_metrics *metrics)
+{
+	__atomic_store_n(&metrics->lock, metrics->lock + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy a consistent view of the shared block.
+ * @param metrics shared block, may be mapped read-only.
+ * @param copy returns the copy.
+ * @return 0 on success, -EAGAIN when the writer kept updating the block.
+ */
+static inline int metrics_read(const struct capture_metrics *metrics, struct capture_metrics *copy)
+{
+	uint32_t before;
+
+	for (int i = 0; i < METRICS_READ_RETRIES; i++)
+	{
+		before = __atomic_load_n(&metrics->lock, __ATOMIC_ACQUIRE);
+		if (before & 1) continue;
+		memcpy(copy, (const void*)metrics, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&metrics->lock, __ATOMIC_RELAXED) == before) return 0;
+	}
+	return -EAGAIN;
+}
+
+/**
+ * Create the shared segment and map it for writing.
+ * A segment already behind the name is only replaced when the process that wrote it is gone.
+ * @param name POSIX shared memory name starting with '/'.
+ * @param metrics returns the zeroed block, its magic is set by metrics_publish().
+ * @return error status of the function. Value 0 is returned on success, -EBUSY when a live process owns the name.
+ */
+int metrics_open(const char *name, struct capture_metrics **metrics);
+
+/**
+ * Mark an opened block as initialized once its static fields are written.
+ * @param metrics shared block.
+ */
+void metrics_publish(struct capture_metrics *metrics);
+
+/**
+ * Unmap the block and remove the segment, readers still mapping it keep the last values.
+ * The name is left alone when it now refers to the segment of another process.
+ * @param name name passed to metrics_open().
+ * @param metrics shared block, may be NULL.
+ */
+void metrics_close(const char *name, struct capture_metrics *metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * V4L2 format, frame size and frame interval negotiation.
+ * @file negotiate.h
+ */
+#ifndef NEGOTIATE_H__
+#define NEGOTIATE_H__
+
+#include <stdint.h>
+
+#include <linux/videodev2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Capture mode requested by the user.
+ */
+struct mode_request {
+	/** Requested frame width in pixels. */
+	uint32_t width;
+	/** Requested frame height in pixels. */
+	uint32_t height;
+	/** Requested frames per second. */
+	uint32_t fps;
+	/** Acceptable pixel formats, see enum format_policy. */
+	int policy;
+};
+
+/**
+ * Capture mode chosen for a device.
+ */
+struct video_mode {
+	/** V4L2 pixel format fourcc. */
+	uint32_t pixelformat;
+	/** Frame width in pixels. */
+	uint32_t width;
+	/** Frame height in pixels. */
+	uint32_t height;
+	/** Time between frames, the inverse of the frame rate. Zero when the device has no interval control. */
+	struct v4l2_fract interval;
+};
+
+/**
+ * Choose the best mode of a device for a request.
+ * The chosen mode is read from the cache file when an entry for the device and request exists.
+ * Otherwise the device is enumerated with VIDIOC_ENUM_FMT, VIDIOC_ENUM_FRAMESIZES and
+ * VIDIOC_ENUM_FRAMEINTERVALS and the result is added to the cache.
+ *
+ * Frame sizes whose fastest interval reaches the requested rate are preferred over the others.
+ * Then frame sizes at least as large as the request are preferred, the smallest of those wins.
+ * Among equal sizes the format earlier in the policy order wins.
+ * The slowest frame rate reaching the requested rate is chosen, or the fastest available.
+ *
+ * @param fd V4L2 capture device.
+ * @param device path of the capture device, part of the cache key.
+ * @param request requested mode.
+ * @param cache_path file holding previously chosen modes, NULL or empty to always enumerate.
+ * @param mode returns the chosen mode.
+ * @return 1 when the mode came from the cache, 0 when enumerated, negative on error.
+ */
+int negotiate_mode(int fd, const char *device, const struct mode_request *request,
+	const char *cache_path, struct video_mode *mode);
+
+/**
+ * Forget the cached mode of a device and request, used when the cached mode is rejected.
+ * @param fd V4L2 capture device.
+ * @param device path of the capture device.
+ * @param request requested mode.
+ * @param cache_path file holding previously chosen modes.
+ */
+void negotiate_forget(int fd, const char *device, const struct mode_request *request,
+	const char *cache_path);
+
+/**
+ * Set a mode on a multiple plane capture device.
+ * The driver may adjust the format, the applied values including bytesperline and
+ * sizeimage of every plane are returned in fmt.
+ *
+ * @param fd V4L2 capture device.
+ * @param mode mode to set.
+ * @param fmt returns the format applied by the driver.
+ * @return error status of the request. Value 0 is returned on success.
+ */
+int negotiate_apply(int fd, const struct video_mode *mode, struct v4l2_format *fmt);
+
+/**
+ * Number of memory planes used by a supported pixel format.
+ * @param pixelformat V4L2 pixel format fourcc.
+ * @return number of planes, 0 for unsupported formats.
+ */
+int negotiate_num_planes(uint32_t pixelformat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -41,11 +41,97 @@ extern "C" {
 #define DEFAULT_DEVICE "/dev/video3"
 #define DEFAULT_BUFFER_COUNT 4
 #define DEFAULT_SUBDEVICE "/dev/v4l-subdev10"
+#define DEFAULT_RENDER RENDER_COPY
+#define DEFAULT_PRESENT PRESENT_FIFO
+#define DEFAULT_BACKEND DISPLAY_AUTO
+#define DEFAULT_MEMORY V4L2_MEMORY_MMAP
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_FPS 30
+#define DEFAULT_FORMAT FORMAT_AUTO
+#define DEFAULT_MODE_CACHE "/var/tmp/opengles_capture_modes"
+#define DEFAULT_MEDIA_DEVICE "/dev/media1"
+#define DEFAULT_METRICS "/opengles_capture"
 
 #define CAPTURE_DEV		'd'
 #define CAPTURE_SUBDEV	's'
 #define CAPTURE_COUNT	'n'
 #define PROGRAM_USE 	'u'
+#define DISPLAY_RENDER	'r'
+#define CAPTURE_THREAD	't'
+#define DISPLAY_PRESENT	'm'
+#define CAPTURE_MEMORY	'M'
+#define CAPTURE_BANDWIDTH	'b'
+#define CAPTURE_SIZE	'S'
+#define CAPTURE_FPS		'F'
+#define CAPTURE_FORMAT	'f'
+#define CAPTURE_MODE_CACHE	'c'
+#define MEDIA_PIPELINE	'P'
+#define MEDIA_DEVICE	'D'
+#define CAPTURE_TRACE	'T'
+#define CAPTURE_METRICS	'x'
+#define DISPLAY_GPU_TIMING	'g'
+#define DISPLAY_WATERMARK	'w'
+#define REPORT_JSON		'J'
+#define DISPLAY_BACKEND	'B'
+
+/**
+ * Methods for moving captured video planes into GPU textures.
+ */
+enum render_method {
+	/** Copy each plane into GPU textures with glTexSubImage2D every frame. */
+	RENDER_COPY,
+	/** Import the DMA buffer of each plane once as an EGLImage texture, no per frame copy. */
+	RENDER_DMABUF_IMPORT,
+	/** Copy each plane into a ring of pixel unpack buffers, textures are updated from the buffers. */
+	RENDER_PBO,
+	/** Copy each plane into immutable R8 and RG8 textures allocated with glTexStorage2D. */
+	RENDER_TEX_STORAGE,
+};
+
+/**
+ * Render targets of the display, chosen when the display is initialized.
+ */
+enum display_backend {
+	/** X11 when the DISPLAY environment variable is set, offscreen otherwise. */
+	DISPLAY_AUTO,
+	/** Full screen X11 window presented at vsync. */
+	DISPLAY_X11,
+	/** Framebuffer object or pbuffer without a display server, frames are not throttled by vsync. */
+	DISPLAY_OFFSCREEN,
+};
+
+/**
+ * Policies for choosing which captured frame is displayed next.
+ */
+enum present_policy {
+	/** Display every frame in the order it was dequeued. */
+	PRESENT_FIFO,
+	/** Display only the newest ready frame, older ready frames are requeued without display. */
+	PRESENT_MAILBOX,
+};
+
+/**
+ * Pixel formats accepted when negotiating the capture mode.
+ */
+enum format_policy {
+	/** Prefer two plane NV12M, accept single plane NV12. */
+	FORMAT_AUTO,
+	/** Only two plane NV12M. */
+	FORMAT_NV12M,
+	/** Only single plane NV12. */
+	FORMAT_NV12,
+};
+
+/**
+ * Routes through the video front end configured by the media pipeline setup.
+ */
+enum pipeline_path {
+	/** Pixel interface, converts the sensor UYVY to NV12. */
+	PIPELINE_PIX,
+	/** Raw dump interface, passes the sensor UYVY through unchanged. */
+	PIPELINE_RDI,
+};
 
 struct options;
 /**
@@ -77,6 +163,44 @@ struct options {
 	int buffer_count;
 	/** Export DMA file descriptor for each v4l2 plane. */
 	int dma_export;
+	/** Method used to move video planes into GPU textures, see enum render_method. */
+	int render_method;
+	/** Render target of the display, see enum display_backend. */
+	int display_backend;
+	/** Run V4L2 dequeue and requeue on a dedicated capture thread. */
+	int threaded;
+	/** Selection of the next frame to display, see enum present_policy. */
+	int present_policy;
+	/** V4L2 buffer memory type, V4L2_MEMORY_MMAP, V4L2_MEMORY_USERPTR or V4L2_MEMORY_DMABUF. */
+	int memory;
+	/** Measure the CPU read bandwidth of the capture buffers at startup. */
+	int measure_bandwidth;
+	/** Requested capture width in pixels. */
+	unsigned int width;
+	/** Requested capture height in pixels. */
+	unsigned int height;
+	/** Requested capture frames per second. */
+	int fps;
+	/** Acceptable capture pixel formats, see enum format_policy. */
+	int format_policy;
+	/** File caching the negotiated mode of each device, empty to always enumerate. */
+	char* mode_cache;
+	/** Camera routed by the media pipeline setup, -1 to leave the media graph unchanged. */
+	int pipeline_camera;
+	/** Route through the video front end, see enum pipeline_path. */
+	int pipeline_path;
+	/** Media controller device path. */
+	char* media_dev;
+	/** Chrome trace event file written on exit or key press, NULL to disable tracing. */
+	char* trace_file;
+	/** POSIX shared memory name of the live metrics block, empty to disable. */
+	char* metrics_name;
+	/** Measure the GPU time of the texture uploads and the draw with timer queries. */
+	int gpu_timing;
+	/** Stamp a watermark into each frame and decode it from the surface to measure capture to display latency. */
+	int watermark;
+	/** File receiving the JSON report of a benchmark usage, "-" for stdout, NULL for no report. */
+	char* json_file;
 	/** V4L2 capture device path. */
 	char* dev_name;
 	/** V4L2 camera subdevice path. */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * CPU pixel kernels with scalar and SIMD variants.
+ * @file pixel_kernels.h
+ *
+ * Every kernel has a portable C variant and, where it pays off, SSE2, AVX2 or NEON variants producing
+ * identical output. The table lists every variant built for the target, pixel_kernel_find() selects
+ * the fastest one the running CPU supports. pixbench times each of them, see the bench make target.
+ */
+#ifndef PIXEL_KERNELS_H__
+#define PIXEL_KERNELS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of planes of a frame. */
+#define PIXEL_MAX_PLANES 3
+
+/**
+ * Memory layouts of the frames read and written by the kernels.
+ */
+enum pixel_layout
+{
+	/** Luma plane followed by the interleaved CbCr plane at half resolution. */
+	PIXEL_NV12,
+	/** Luma plane followed by the Cb and Cr planes at half resolution, the Y4M 4:2:0 layout. */
+	PIXEL_I420,
+	/** Luma plane only. */
+	PIXEL_Y,
+	/** One plane of 4 bytes per pixel, red first and alpha last. */
+	PIXEL_RGBA,
+};
+
+/**
+ * Planes of one frame, the planes need not be contiguous.
+ */
+struct pixel_frame
+{
+	/** First byte of each plane. */
+	uint8_t *plane[PIXEL_MAX_PLANES];
+	/** Distance in bytes between the start of each line of each plane. */
+	int stride[PIXEL_MAX_PLANES];
+	/** Frame width in pixels, even. */
+	int width;
+	/** Frame height in pixels, even. */
+	int height;
+};
+
+/**
+ * Process one frame.
+ * @param src input frame in the input layout of the kernel.
+ * @param dst output frame in the output layout of the kernel.
+ */
+typedef void (*pixel_kernel_func)(const struct pixel_frame *src, struct pixel_frame *dst);
+
+/**
+ * One variant of a kernel.
+ */
+struct pixel_kernel
+{
+	/** Name of the kernel, shared by all its variants. */
+	const char *name;
+	/** Instruction set of the variant: scalar, sse2, avx2 or neon. */
+	const char *variant;
+	/** Layout of the input frame. */
+	enum pixel_layout input;
+	/** Layout of the output frame. */
+	enum pixel_layout output;
+	/** The output frame is downscaled by 2 to the power of this value in both directions. */
+	int output_shift;
+	/** Check whether the running CPU supports the variant, NULL when every CPU of the target does. */
+	bool (*supported)(void);
+	/** Kernel entry point. */
+	pixel_kernel_func run;
+};
+
+/** Every kernel variant built for the target, variants of a kernel are listed slowest first. */
+extern const struct pixel_kernel pixel_kernels[];
+/** Number of entries in pixel_kernels. */
+extern const int pixel_kernel_count;
+
+/**
+ * Check whether the running CPU supports a kernel variant.
+ * @param kernel kernel variant.
+ * @return true when the variant may run.
+ */
+bool pixel_kernel_supported(const struct pixel_kernel *kernel);
+
+/**
+ * Select the fastest supported variant of a kernel.
+ * @param name kernel name.
+ * @return kernel variant, NULL when the kernel does not exist.
+ */
+const struct pixel_kernel *pixel_kernel_find(const char *name);
+
+/**
+ * Size of a frame in a layout with packed lines and planes.
+ * @param layout frame layout.
+ * @param width frame width in pixels.
+ * @param height frame height in pixels.
+ * @return size in bytes.
+ */
+size_t pixel_layout_size(enum pixel_layout layout, int width, int height);
+
+/**
+ * Describe a frame stored in one block of memory with packed lines and planes.
+ * @param frame frame to fill.
+ * @param layout frame layout.
+ * @param width frame width in pixels.
+ * @param height frame height in pixels.
+ * @param memory block of pixel_layout_size() bytes.
+ */
+void pixel_frame_init(struct pixel_frame *frame, enum pixel_layout layout, int width, int height, uint8_t *memory);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * USDT static tracepoints of the capture and render path.
+ * @file probes.h
+ *
+ * Built with USDT set in the Makefile the probes expand to the sys/sdt.h markers of the
+ * "opengles_capture" provider, each one a single nop until perf or bpftrace attaches to it.
+ * Without it the probes and their arguments compile to nothing and sys/sdt.h is not needed.
+ *
+ * Probes and arguments:
+ * - dqbuf: buffer index, sequence, driver timestamp in nanoseconds.
+ * - qbuf: buffer index, sequence.
+ * - upload_start, upload_end: sequence.
+ * - draw: sequence.
+ * - swap_start, swap_end: sequence.
+ * - test_pattern: test pattern number, result of the control write.
+ * - focus: focus state, control ID, result of the control write.
+ * - key: first key of the key press, number of keys.
+ */
+#ifndef PROBES_H__
+#define PROBES_H__
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+/** Probe without arguments. */
+#define PROBE0(name) DTRACE_PROBE(opengles_capture, name)
+/** Probe with one argument. */
+#define PROBE1(name, a) DTRACE_PROBE1(opengles_capture, name, a)
+/** Probe with two arguments. */
+#define PROBE2(name, a, b) DTRACE_PROBE2(opengles_capture, name, a, b)
+/** Probe with three arguments. */
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(opengles_capture, name, a, b, c)
+#else
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
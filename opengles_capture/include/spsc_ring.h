@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Bounded single producer, single consumer lock-free ring of pointers.
+ * @file spsc_ring.h
+ *
+ * One thread may push and one other thread may pop without locks.
+ * The producer only writes head, acquire/release ordering publishes the slot contents between the two threads.
+ * The tail is advanced with a compare and swap so the producer may also pop, to discard the oldest value
+ * of a full ring, while the consumer pops. Each value is then returned to exactly one of them.
+ */
+#ifndef SPSC_RING_H__
+#define SPSC_RING_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of slots in the ring, must be a power of two and at least VIDEO_MAX_FRAME. */
+#define SPSC_RING_SIZE 64
+/** Cache line size used to keep the producer and consumer indices from false sharing. */
+#define SPSC_CACHE_LINE 64
+
+/**
+ * Ring storage, zero initialize before use.
+ */
+struct spsc_ring {
+	/** Next slot to write, only modified by the producer. */
+	uint32_t head __attribute__((aligned(SPSC_CACHE_LINE)));
+	/** Next slot to read, modified by the consumer and by a producer discarding a value. */
+	uint32_t tail __attribute__((aligned(SPSC_CACHE_LINE)));
+	/** Stored values. */
+	void *slots[SPSC_RING_SIZE] __attribute__((aligned(SPSC_CACHE_LINE)));
+};
+
+/**
+ * Add a value to the ring, called only by the producer thread.
+ * @param ring ring storage.
+ * @param value value to add.
+ * @return 0 on success, -1 if the ring is full.
+ */
+static inline int spsc_ring_push(struct spsc_ring *ring, void *value)
+{
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= SPSC_RING_SIZE) return -1;
+	__atomic_store_n(&ring->slots[head & (SPSC_RING_SIZE - 1)], value, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Remove the oldest value from the ring, called by the consumer thread or by the producer to discard it.
+ * @param ring ring storage.
+ * @param value returns the removed value.
+ * @return 0 on success, -1 if the ring is empty.
+ */
+static inline int spsc_ring_pop(struct spsc_ring *ring, void **value)
+{
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	uint32_t head;
+
+	do
+	{
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (head == tail) return -1;
+		/* A slot read with a stale tail may be rewritten by the producer, the swap then fails. */
+		*value = __atomic_load_n(&ring->slots[tail & (SPSC_RING_SIZE - 1)], __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return 0;
+}
+
+/**
+ * Number of values waiting in the ring, approximate when read by a third thread.
+ * @param ring ring storage.
+ * @return number of values in the ring.
+ */
+static inline uint32_t spsc_ring_count(struct spsc_ring *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Time to first frame broken down by startup phase.
+ * @file startup.h
+ *
+ * Capture and display setup run on different threads, each phase is recorded with the monotonic
+ * time it started and ended and the thread that ran it. The report shows how the phases overlap
+ * between the process start and the first presented frame.
+ *
+ * @note Example of a recorded phase
+ * uint64_t begin = startup_begin();
+ * egl_init(disp);
+ * startup_end("egl init", begin);
+ */
+#ifndef STARTUP_H__
+#define STARTUP_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of recorded phases. */
+#define STARTUP_PHASES 24
+
+/**
+ * One completed startup phase.
+ */
+struct startup_phase {
+	/** Phase name, a string literal. */
+	const char *name;
+	/** Name of the thread that ran the phase. */
+	const char *thread;
+	/** Monotonic time the phase started in nanoseconds. */
+	uint64_t begin_ns;
+	/** Monotonic time the phase ended in nanoseconds. */
+	uint64_t end_ns;
+};
+
+/**
+ * Phases recorded since startup_init().
+ */
+struct startup_timing {
+	/** Monotonic time the process was started, estimated from /proc in scheduler ticks. */
+	uint64_t process_ns;
+	/** Monotonic time startup_init() was called. */
+	uint64_t origin_ns;
+	/** Number of phases claimed, may exceed STARTUP_PHASES when phases were lost. */
+	uint32_t count;
+	/** Recorded phases in completion order. */
+	struct startup_phase phases[STARTUP_PHASES];
+	/** The first frame was reported. */
+	int reported;
+};
+
+extern struct startup_timing g_startup;
+
+/**
+ * Start recording the startup phases, the report is relative to this point.
+ */
+void startup_init(void);
+
+/**
+ * Name the calling thread in the report.
+ * @param name thread name, must outlive the report.
+ */
+void startup_thread_name(const char *name);
+
+/**
+ * Start a phase.
+ * @return monotonic time in nanoseconds, passed to startup_end().
+ */
+uint64_t startup_begin(void);
+
+/**
+ * Record a completed phase, safe to call from any thread.
+ * @param name phase name, a string literal.
+ * @param begin_ns value returned by startup_begin().
+ */
+void startup_end(const char *name, uint64_t begin_ns);
+
+/**
+ * Log the time to first frame and every phase, only the first call logs.
+ * @param first_frame_ns monotonic time the first frame was presented.
+ */
+void startup_report(uint64_t first_frame_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Low overhead stage tracing exported as Chrome trace event JSON.
+ * @file trace.h
+ *
+ * Completed spans are written to a preallocated ring shared by every thread, nothing is written to
+ * disk until trace_dump() is called. When tracing is disabled each span costs one predictable branch.
+ *
+ * @note Example of a traced stage
+ * uint64_t begin = trace_begin();
+ * ioctl(fd, VIDIOC_QBUF, &buf);
+ * trace_end("qbuf", begin, buf.sequence);
+ */
+#ifndef TRACE_H__
+#define TRACE_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of spans kept in the ring, must be a power of two. The oldest spans are overwritten. */
+#define TRACE_EVENTS 65536
+/** Sequence number of spans not tied to a frame. */
+#define TRACE_NO_SEQUENCE UINT32_MAX
+/** Maximum number of named threads in a trace. */
+#define TRACE_THREADS 8
+
+/**
+ * One completed span.
+ */
+struct trace_event {
+	/** Stage name, a string literal. NULL while the slot is being written. */
+	const char *name;
+	/** V4L2 sequence number of the frame, TRACE_NO_SEQUENCE when not tied to a frame. */
+	uint32_t sequence;
+	/** Kernel thread id of the recording thread. */
+	uint32_t tid;
+	/** Monotonic time the span started in nanoseconds. */
+	uint64_t begin_ns;
+	/** Monotonic time the span ended in nanoseconds. */
+	uint64_t end_ns;
+};
+
+/**
+ * Trace ring shared by every thread.
+ */
+struct trace_buffer {
+	/** Spans are only recorded while set. */
+	int enabled;
+	/** Number of spans recorded since the start, the next slot is next modulo TRACE_EVENTS. */
+	uint64_t next;
+	/** Ring of TRACE_EVENTS spans. */
+	struct trace_event *events;
+	/** File written by trace_dump(). */
+	const char *path;
+	/** Number of named threads. */
+	int num_threads;
+	/** Kernel thread id of each named thread. */
+	uint32_t thread_ids[TRACE_THREADS];
+	/** Name of each named thread. */
+	const char *thread_names[TRACE_THREADS];
+};
+
+extern struct trace_buffer g_trace;
+extern __thread uint32_t g_trace_tid;
+
+/**
+ * Kernel thread id of the calling thread, cached after the first call.
+ * @return thread id.
+ */
+uint32_t trace_thread_id(void);
+
+/**
+ * Read the trace clock.
+ * @return current monotonic time in nanoseconds.
+ */
+static inline uint64_t trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Add a completed span to the ring, safe to call from any thread.
+ * @param name stage name, must be a string literal or otherwise outlive the trace.
+ * @param begin_ns monotonic time the stage started.
+ * @param end_ns monotonic time the stage ended.
+ * @param sequence V4L2 sequence number of the frame, TRACE_NO_SEQUENCE when not tied to a frame.
+ */
+static inline void trace_record(const char *name, uint64_t begin_ns, uint64_t end_ns, uint32_t sequence)
+{
+	uint64_t slot = __atomic_fetch_add(&g_trace.next, 1, __ATOMIC_RELAXED);
+	struct trace_event *event = &g_trace.events[slot & (TRACE_EVENTS - 1)];
+
+	__atomic_store_n(&event->name, NULL, __ATOMIC_RELAXED);
+	event->sequence = sequence;
+	event->tid = g_trace_tid ? g_trace_tid : trace_thread_id();
+	event->begin_ns = begin_ns;
+	event->end_ns = end_ns;
+	/* The name is published last, the dump skips slots still being written. */
+	__atomic_store_n(&event->name, name, __ATOMIC_RELEASE);
+}
+
+/**
+ * Start a span.
+ * @return start time to pass to trace_end(), 0 when tracing is disabled.
+ */
+static inline uint64_t trace_begin(void)
+{
+	return g_trace.enabled ? trace_now() : 0;
+}
+
+/**
+ * Complete a span started with trace_begin().
+ * @param name stage name, must be a string literal or otherwise outlive the trace.
+ * @param begin_ns value returned by trace_begin().
+ * @param sequence V4L2 sequence number of the frame, TRACE_NO_SEQUENCE when not tied to a frame.
+ */
+static inline void trace_end(const char *name, uint64_t begin_ns, uint32_t sequence)
+{
+	if (begin_ns) trace_record(name, begin_ns, trace_now(), sequence);
+}
+
+/**
+ * Allocate the ring and enable tracing.
+ * @param path file written by trace_dump().
+ * @return error status of the function. Value 0 is returned on success.
+ */
+int trace_init(const char *path);
+
+/**
+ * Name the calling thread in the trace.
+ * @param name thread name, must be a string literal or otherwise outlive the trace.
+ */
+void trace_thread_name(const char *name);
+
+/**
+ * Write the spans in the ring to the trace file as Chrome trace event JSON.
+ * The file opens in Perfetto and chrome://tracing. Recording continues during the dump.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+int trace_dump(void);
+
+/**
+ * Disable tracing and free the ring.
+ */
+void trace_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Capture to display latency measured through a watermark embedded in the frames.
+ * @file watermark.h
+ *
+ * Before upload the display thread stamps a grid of black and white blocks into the top left corner of the
+ * luma plane, the chroma under it is set neutral. The 128 bits of the grid hold a magic number, the frame
+ * sequence, its monotonic capture time and a CRC. After the draw the stamped corner of the surface is read
+ * into a pixel buffer object, frames later when its fence signalled the buffer is mapped and decoded.
+ * The latency of each presented frame is the swap time minus the decoded capture time, sequences that
+ * repeat or jump show frames presented twice or never.
+ *
+ * Only the pixels actually drawn are decoded, the measurement covers the whole upload and render path.
+ */
+#ifndef WATERMARK_H__
+#define WATERMARK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <GLES3/gl3.h>
+
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Blocks per row of the grid. */
+#define WATERMARK_COLUMNS 32
+/** Rows of the grid. */
+#define WATERMARK_ROWS 4
+/** Largest block side in frame pixels, smaller frames use smaller blocks. */
+#define WATERMARK_BLOCK 16
+/** Number of frames whose readback may be in flight. */
+#define WATERMARK_RING 4
+
+/**
+ * Readback of one presented frame.
+ */
+struct watermark_slot
+{
+	/** Pixel buffer object receiving the stamped corner of the surface. */
+	GLuint pbo;
+	/** Signalled when the GPU wrote the pixel buffer object. */
+	GLsync fence;
+	/** Sequence of the frame rendered, the decoded sequence may differ. */
+	uint32_t sequence;
+	/** Monotonic time eglSwapBuffers returned for this frame. */
+	uint64_t present_ns;
+};
+
+/**
+ * Watermark readback ring and the latency decoded from it.
+ */
+struct watermark
+{
+	/** Frames are stamped and read back, set from the options before display_frame_setup(). */
+	int enabled;
+	/** Block side in frame pixels, even so blocks cover whole chroma samples. */
+	int block;
+	/** Frame size the grid is stamped into. */
+	int frame_width;
+	int frame_height;
+	/** Surface size the frame is scaled to. */
+	int surface_width;
+	int surface_height;
+	/** Rectangle of the surface read back, in GL coordinates with the origin at the bottom left. */
+	GLint x;
+	GLint y;
+	GLsizei width;
+	GLsizei height;
+	/** Readback slots, frame N uses slot N % WATERMARK_RING. */
+	struct watermark_slot ring[WATERMARK_RING];
+	/** Number of readbacks started. */
+	uint32_t head;
+	/** Number of readbacks decoded. */
+	uint32_t tail;
+	/** Slot of the frame being rendered, NULL when the frame is not read back. */
+	struct watermark_slot *active;
+	/** A sequence was decoded before. */
+	bool has_last;
+	/** Last sequence decoded. */
+	uint32_t last_sequence;
+	/** Frames decoded since the last report. */
+	uint64_t decoded;
+	/** Frames decoded with the sequence of the previous frame since the last report. */
+	uint64_t repeated;
+	/** Sequences missing between decoded frames since the last report. */
+	uint64_t skipped;
+	/** Frames whose decoded sequence differs from the frame rendered since the last report. */
+	uint64_t mismatched;
+	/** Readbacks without a valid watermark since the last report. */
+	uint64_t failed;
+	/** Frames not read back because every slot was in flight since the last report. */
+	uint64_t overrun;
+	/** Capture to present latency of every decoded frame since the start. */
+	struct histogram latency;
+	/** Snapshot of latency at the last report. */
+	struct histogram reported;
+};
+
+/**
+ * Stamp the watermark of a frame into its planes, the CPU must be allowed to write them.
+ * @param luma first byte of the luma plane.
+ * @param luma_stride distance in bytes between luma lines.
+ * @param chroma first byte of the interleaved CbCr plane.
+ * @param chroma_stride distance in bytes between chroma lines.
+ * @param width frame width in pixels.
+ * @param height frame height in pixels.
+ * @param sequence frame sequence.
+ * @param capture_ns monotonic capture time of the frame.
+ */
+void watermark_stamp(uint8_t *luma, int luma_stride, uint8_t *chroma, int chroma_stride,
+	int width, int height, uint32_t sequence, uint64_t capture_ns);
+
+/**
+ * Size the grid and create the readback ring, requires a current GLES context.
+ * @param wm watermark with enabled set.
+ * @param frame_width frame width in pixels.
+ * @param frame_height frame height in pixels.
+ * @param surface_width surface width in pixels.
+ * @param surface_height surface height in pixels.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+int watermark_init(struct watermark *wm, int frame_width, int frame_height, int surface_width, int surface_height);
+
+/**
+ * Decode the completed readbacks and read the stamped corner of the frame just drawn.
+ * Call after the draw and before eglSwapBuffers(), it never waits for the GPU.
+ * @param wm watermark.
+ * @param sequence sequence of the frame drawn.
+ */
+void watermark_readback(struct watermark *wm, uint32_t sequence);
+
+/**
+ * Record when the frame read back by the last watermark_readback() was presented.
+ * @param wm watermark.
+ * @param present_ns monotonic time eglSwapBuffers() returned.
+ */
+void watermark_presented(struct watermark *wm, uint64_t present_ns);
+
+/**
+ * Log the latency percentiles and the frame counts since the last report, then start a new period.
+ * @param wm watermark.
+ */
+void watermark_report(struct watermark *wm);
+
+/**
+ * Delete the readback ring, requires the GLES context that created it. The latency is kept.
+ * @param wm watermark.
+ */
+void watermark_close(struct watermark *wm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
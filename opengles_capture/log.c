@@ -0,0 +1,551 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Binary ring buffer logger behind the LOGS macros.
+ * @file log.c
+ *
+ * Each logging thread owns a single producer single consumer ring of fixed size records.
+ * The format is walked once when logging to copy each argument by its conversion type,
+ * the writer walks it again to print every conversion with its own copied argument.
+ * The writer sleeps on an eventfd signaled when a ring goes from empty to non empty.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "log.h"
+
+/** Size in bytes of one record. */
+#define LOG_RECORD_SIZE 256
+/** Records per thread ring, a power of two. */
+#define LOG_RING_RECORDS 1024
+/** Longest conversion specification copied for printing. */
+#define LOG_SPEC_SIZE 32
+
+/** Size of the record fields ahead of the arguments. */
+#define LOG_HEADER_SIZE (sizeof(uint64_t) + 4 * sizeof(const char*) + 2 * sizeof(uint32_t))
+
+/**
+ * One message waiting to be formatted.
+ */
+struct log_entry {
+	/** Monotonic time of the message in nanoseconds. */
+	uint64_t timestamp_ns;
+	/** Level prefix. */
+	const char *level;
+	/** Source file. */
+	const char *file;
+	/** Calling function. */
+	const char *function;
+	/** printf format. */
+	const char *format;
+	/** Source line. */
+	uint32_t line;
+	/** Bytes of arguments copied, arguments of conversions beyond it did not fit. */
+	uint32_t size;
+	/** Arguments in conversion order, each value aligned on 8 bytes, strings copied in place. */
+	unsigned char args[LOG_RECORD_SIZE - LOG_HEADER_SIZE];
+};
+
+/**
+ * Ring of records written by one thread.
+ */
+struct log_ring {
+	/** Records, slot N % LOG_RING_RECORDS holds record N. */
+	struct log_entry entries[LOG_RING_RECORDS];
+	/** Records written by the owning thread. */
+	uint32_t head;
+	/** Records printed by the writer. */
+	uint32_t tail;
+	/** Records dropped because the ring was full. */
+	uint32_t dropped;
+	/** Dropped records already reported by the writer. */
+	uint32_t dropped_reported;
+	/** Next ring of the list, rings are never freed. */
+	struct log_ring *next;
+};
+
+/** Every ring created, newest first. */
+static struct log_ring *g_rings;
+/** Ring of the calling thread, created by its first message. */
+static __thread struct log_ring *t_ring;
+/** Starts the writer once. */
+static pthread_once_t g_log_once = PTHREAD_ONCE_INIT;
+/** Serializes the writer thread and log_flush(). */
+static pthread_mutex_t g_write_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Wakes the writer, -1 when the writer is not running. */
+static int g_wake_fd = -1;
+/** Wall clock time minus the monotonic time, printed timestamps are wall clock like before. */
+static int64_t g_realtime_offset_ns;
+
+/**
+ * Read a clock.
+ * @param clock clock to read.
+ * @return time in nanoseconds.
+ */
+static inline uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Background writer, prints the queued records each time a thread starts filling its ring.
+ * @param arg unused.
+ * @return never returns.
+ */
+static void *log_writer(void *arg)
+{
+	uint64_t count;
+	(void)arg;
+
+	while (1)
+	{
+		if (read(g_wake_fd, &count, sizeof(count)) < 0) continue;
+		log_flush();
+	}
+	return NULL;
+}
+
+/**
+ * Start the background writer and flush on exit, once per process.
+ */
+static void log_start(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all;
+	sigset_t saved;
+
+	g_realtime_offset_ns = (int64_t)(clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC));
+	atexit(log_flush);
+
+	g_wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (g_wake_fd < 0)
+	{
+		fprintf(stderr, "Unable to start the log writer, messages are written on exit\n");
+		return;
+	}
+
+	/* The writer inherits a full mask so process directed signals such as SIGINT
+	 * never land on it and reach the thread that waits for them on a signalfd. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, log_writer, NULL))
+	{
+		fprintf(stderr, "Unable to start the log writer, messages are written on exit\n");
+		close(g_wake_fd);
+		g_wake_fd = -1;
+	}
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+/**
+ * Ring of the calling thread, created on first use.
+ * @return ring of the thread, NULL when out of memory.
+ */
+static struct log_ring *thread_ring(void)
+{
+	struct log_ring *ring = t_ring;
+
+	if (ring) return ring;
+	pthread_once(&g_log_once, log_start);
+	ring = calloc(1, sizeof(*ring));
+	if (!ring) return NULL;
+	ring->next = __atomic_load_n(&g_rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&g_rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	t_ring = ring;
+	return ring;
+}
+
+/**
+ * Parsed printf conversion specification.
+ */
+struct log_spec {
+	/** Length of the specification including the '%'. */
+	int length;
+	/** Conversion character. */
+	char conversion;
+	/** Length modifier, 'H' for hh and 'q' for ll. */
+	char modifier;
+	/** Number of '*' width or precision arguments. */
+	int stars;
+	/** Precision written in the format, -1 when absent or given by an argument. */
+	int precision;
+};
+
+/**
+ * Parse the conversion specification starting at a '%'.
+ * @param format position of the '%'.
+ * @param spec returns the parsed specification.
+ */
+static void parse_spec(const char *format, struct log_spec *spec)
+{
+	const char *p = format + 1;
+
+	memset(spec, 0, sizeof(*spec));
+	spec->precision = -1;
+	while (*p && strchr("-+ #0'", *p)) p++;
+	if (*p == '*') { spec->stars++; p++; }
+	while (*p >= '0' && *p <= '9') p++;
+	if (*p == '.')
+	{
+		p++;
+		if (*p == '*') { spec->stars++; p++; }
+		else spec->precision = atoi(p);
+		while (*p >= '0' && *p <= '9') p++;
+	}
+	if (p[0] == 'h' && p[1] == 'h') { spec->modifier = 'H'; p += 2; }
+	else if (p[0] == 'l' && p[1] == 'l') { spec->modifier = 'q'; p += 2; }
+	else if (*p && strchr("hlLjzt", *p)) spec->modifier = *p++;
+	spec->conversion = *p;
+	spec->length = p - format + (*p ? 1 : 0);
+}
+
+/**
+ * Size of the integer argument of a conversion.
+ * @param spec parsed specification.
+ * @return argument size in bytes.
+ */
+static size_t integer_size(const struct log_spec *spec)
+{
+	switch (spec->modifier)
+	{
+		case 'l': return sizeof(long);
+		case 'q': return sizeof(long long);
+		case 'j': return sizeof(intmax_t);
+		case 'z': return sizeof(size_t);
+		case 't': return sizeof(ptrdiff_t);
+		default: return sizeof(int);
+	}
+}
+
+/**
+ * Room left for an argument, aligned on 8 bytes.
+ * @param entry record being filled.
+ * @param size bytes needed.
+ * @return destination of the argument, NULL when it does not fit.
+ */
+static unsigned char *reserve(struct log_entry *entry, size_t size)
+{
+	size_t offset = (entry->size + 7) & ~7u;
+	if (offset + size > sizeof(entry->args)) return NULL;
+	entry->size = offset + size;
+	return entry->args + offset;
+}
+
+/**
+ * Copy the arguments of every conversion into a record.
+ * @param entry record being filled.
+ * @param format printf format.
+ * @param args arguments of the format.
+ */
+static void copy_args(struct log_entry *entry, const char *format, va_list args)
+{
+	struct log_spec spec;
+	unsigned char *dst;
+
+	for (const char *p = strchr(format, '%'); p; p = strchr(p, '%'))
+	{
+		parse_spec(p, &spec);
+		p += spec.length;
+		if (spec.conversion == '%' || !spec.conversion) continue;
+
+		for (int i = 0; i < spec.stars; i++)
+		{
+			int star = va_arg(args, int);
+			if (!(dst = reserve(entry, sizeof(star)))) return;
+			memcpy(dst, &star, sizeof(star));
+		}
+
+		switch (spec.conversion)
+		{
+			case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+			{
+				long long value;
+				size_t size = integer_size(&spec);
+				if (size == sizeof(long long)) value = va_arg(args, long long);
+				else if (size == sizeof(long)) value = va_arg(args, long);
+				else value = va_arg(args, int);
+				if (!(dst = reserve(entry, sizeof(value)))) return;
+				memcpy(dst, &value, sizeof(value));
+				break;
+			}
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+				if (spec.modifier == 'L')
+				{
+					long double value = va_arg(args, long double);
+					if (!(dst = reserve(entry, sizeof(value)))) return;
+					memcpy(dst, &value, sizeof(value));
+				}
+				else
+				{
+					double value = va_arg(args, double);
+					if (!(dst = reserve(entry, sizeof(value)))) return;
+					memcpy(dst, &value, sizeof(value));
+				}
+				break;
+			case 's':
+			{
+				const char *value = va_arg(args, const char*);
+				size_t length;
+				if (!value) value = "(null)";
+				/* A precision bounds strings that are not terminated, such as fourcc codes. */
+				length = spec.precision >= 0 ? strnlen(value, spec.precision) : strlen(value);
+				if (!(dst = reserve(entry, 1))) return;
+				if (length > sizeof(entry->args) - entry->size)
+					length = sizeof(entry->args) - entry->size;
+				memcpy(dst, value, length);
+				dst[length] = '\0';
+				entry->size += length;
+				break;
+			}
+			default:
+			{
+				/* Pointers and anything else are printed as the pointer value. */
+				void *value = va_arg(args, void*);
+				if (!(dst = reserve(entry, sizeof(value)))) return;
+				memcpy(dst, &value, sizeof(value));
+				break;
+			}
+		}
+	}
+}
+
+void log_record(const char *level, const char *file, const char *function, int line, const char *format, ...)
+{
+	struct log_ring *ring = thread_ring();
+	struct log_entry *entry;
+	uint32_t head;
+	va_list args;
+
+	if (!ring) return;
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_RECORDS)
+	{
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	entry = &ring->entries[head % LOG_RING_RECORDS];
+	entry->timestamp_ns = clock_ns(CLOCK_MONOTONIC);
+	entry->level = level;
+	entry->file = file;
+	entry->function = function;
+	entry->format = format;
+	entry->line = line;
+	entry->size = 0;
+	va_start(args, format);
+	copy_args(entry, format, args);
+	va_end(args);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+	/* Only the record that makes the ring non empty wakes the writer, it prints until every ring is empty. */
+	if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head && g_wake_fd >= 0)
+	{
+		uint64_t one = 1;
+		if (write(g_wake_fd, &one, sizeof(one)) < 0) return;
+	}
+}
+
+/**
+ * Read an argument copied by copy_args().
+ * @param entry record.
+ * @param offset read position, advanced past the argument.
+ * @param size argument size.
+ * @return argument address, NULL when the argument did not fit in the record.
+ */
+static const unsigned char *next_arg(const struct log_entry *entry, size_t *offset, size_t size)
+{
+	size_t start = (*offset + 7) & ~7u;
+	if (start + size > entry->size) return NULL;
+	*offset = start + size;
+	return entry->args + start;
+}
+
+/**
+ * Print one conversion with its copied argument.
+ * @param out output stream.
+ * @param spec conversion specification text, not terminated.
+ * @param parsed parsed specification.
+ * @param entry record.
+ * @param offset read position of the arguments.
+ * @return false when the argument did not fit in the record.
+ */
+static bool print_conversion(FILE *out, const char *spec, const struct log_spec *parsed,
+	const struct log_entry *entry, size_t *offset)
+{
+	char format[LOG_SPEC_SIZE];
+	const unsigned char *arg;
+	int star[2] = { 0, 0 };
+
+	if (parsed->length >= LOG_SPEC_SIZE) return false;
+	memcpy(format, spec, parsed->length);
+	format[parsed->length] = '\0';
+
+	for (int i = 0; i < parsed->stars; i++)
+	{
+		if (!(arg = next_arg(entry, offset, sizeof(int)))) return false;
+		memcpy(&star[i], arg, sizeof(int));
+	}
+
+/* Print a value with the '*' arguments of the specification. */
+#define PRINT_VALUE(value) \
+	(parsed->stars == 2 ? fprintf(out, format, star[0], star[1], value) : \
+	 parsed->stars == 1 ? fprintf(out, format, star[0], value) : fprintf(out, format, value))
+
+	switch (parsed->conversion)
+	{
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		{
+			long long value;
+			size_t size = integer_size(parsed);
+			if (!(arg = next_arg(entry, offset, sizeof(value)))) return false;
+			memcpy(&value, arg, sizeof(value));
+			if (size == sizeof(long long)) PRINT_VALUE(value);
+			else if (size == sizeof(long)) PRINT_VALUE((long)value);
+			else PRINT_VALUE((int)value);
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			if (parsed->modifier == 'L')
+			{
+				long double value;
+				if (!(arg = next_arg(entry, offset, sizeof(value)))) return false;
+				memcpy(&value, arg, sizeof(value));
+				PRINT_VALUE(value);
+			}
+			else
+			{
+				double value;
+				if (!(arg = next_arg(entry, offset, sizeof(value)))) return false;
+				memcpy(&value, arg, sizeof(value));
+				PRINT_VALUE(value);
+			}
+			break;
+		case 's':
+		{
+			const char *value;
+			if (!(arg = next_arg(entry, offset, 1))) return false;
+			value = (const char*)arg;
+			*offset += strlen(value);
+			PRINT_VALUE(value);
+			break;
+		}
+		default:
+		{
+			void *value;
+			if (!(arg = next_arg(entry, offset, sizeof(value)))) return false;
+			memcpy(&value, arg, sizeof(value));
+			PRINT_VALUE(value);
+			break;
+		}
+	}
+#undef PRINT_VALUE
+	return true;
+}
+
+/**
+ * Format one record like the former printf based macro.
+ * @param out output stream.
+ * @param entry record.
+ */
+static void print_entry(FILE *out, const struct log_entry *entry)
+{
+	uint64_t wall_ns = entry->timestamp_ns + g_realtime_offset_ns;
+	const char *text = entry->format;
+	struct log_spec spec;
+	size_t offset = 0;
+	const char *p;
+
+	fprintf(out, "[%-10lu.%06lu] %s", (unsigned long)(wall_ns / 1000000000ull),
+		(unsigned long)(wall_ns % 1000000000ull / 1000), entry->level);
+	while ((p = strchr(text, '%')))
+	{
+		fwrite(text, 1, p - text, out);
+		parse_spec(p, &spec);
+		if (spec.conversion == '%') fputc('%', out);
+		else if (spec.conversion && !print_conversion(out, p, &spec, entry, &offset))
+		{
+			fputs("...", out);
+			text = "";
+			break;
+		}
+		text = p + spec.length;
+	}
+	fputs(text, out);
+	fprintf(out, "  [%s %s:%u]\n", entry->file, entry->function, entry->line);
+}
+
+void log_thread_init(void)
+{
+	thread_ring();
+}
+
+void log_flush(void)
+{
+	struct log_ring *oldest;
+	uint32_t dropped;
+
+	pthread_mutex_lock(&g_write_lock);
+	while (1)
+	{
+		/* Merge the rings by timestamp so the output keeps the order messages were logged in. */
+		oldest = NULL;
+		for (struct log_ring *ring = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+		{
+			if (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST)) continue;
+			if (!oldest || ring->entries[ring->tail % LOG_RING_RECORDS].timestamp_ns <
+				oldest->entries[oldest->tail % LOG_RING_RECORDS].timestamp_ns)
+				oldest = ring;
+		}
+		if (!oldest) break;
+		print_entry(stdout, &oldest->entries[oldest->tail % LOG_RING_RECORDS]);
+		/* Ordered with the next head load so either this pass sees a new record or its thread sees the ring empty. */
+		__atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_SEQ_CST);
+	}
+
+	for (struct log_ring *ring = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+	{
+		dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped == ring->dropped_reported) continue;
+		fprintf(stdout, "WARN:  %u log messages dropped, the log ring was full\n", dropped - ring->dropped_reported);
+		ring->dropped_reported = dropped;
+	}
+	fflush(stdout);
+	pthread_mutex_unlock(&g_write_lock);
+}
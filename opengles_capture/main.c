@@ -83,8 +83,48 @@ void usage(char * const argv[])
 {
 	printf("%s - V4L2 capture, OpenGL Display and test\n", argv[0]);
 	printf("-d <device>, --device v4l2 device for streaming\n");
+	printf("\tfile:PATH - replay a raw NV12 file sized by -S or a 4:2:0 Y4M file, paced by PATH.timestamps when present\n");
+	printf("\tsynthetic:CONTENT - generate gradient, noise, bars, rolling or squares frames at -S and -F\n");
 	printf("-s <sub-device>, --subdevice v4l2 subdevice device for options\n");
 	printf("-p #,  --test-pattern # test pattern to capture instead of live video\n");
+	printf("-r METHOD,  --render METHOD texture update method for display\n");
+	printf("\tcopy - copy planes to textures each frame (default)\n");
+	printf("\tdmabuf - import V4L2 DMA buffers as EGLImage textures\n");
+	printf("\tpbo - copy planes through a ring of pixel unpack buffers\n");
+	printf("\tstorage - copy planes to immutable R8 and RG8 textures\n");
+	printf("-M TYPE,  --memory TYPE capture buffer allocation\n");
+	printf("\tmmap - buffers allocated by the driver and memory mapped (default)\n");
+	printf("\tuserptr - buffers allocated from a locked huge page arena\n");
+	printf("\tdmabuf - application owned dma-heap or udmabuf buffers\n");
+	printf("-b, --bandwidth measure the CPU read bandwidth of the capture buffers\n");
+	printf("-S WxH,  --size WxH requested capture size (default %dx%d)\n", DEFAULT_WIDTH, DEFAULT_HEIGHT);
+	printf("-F #,  --fps # requested capture frame rate (default %d)\n", DEFAULT_FPS);
+	printf("\tmax - replay or generate frames as fast as buffers are returned\n");
+	printf("-f FORMAT,  --format FORMAT accepted capture pixel formats\n");
+	printf("\tauto - NV12M, or NV12 when NV12M is not available (default)\n");
+	printf("\tnv12m - two plane NV12M only\n");
+	printf("\tnv12 - single plane NV12 only\n");
+	printf("-c FILE,  --mode-cache FILE negotiated mode cache, empty to disable (default %s)\n",
+		DEFAULT_MODE_CACHE);
+	printf("-P CAMERA:PATH,  --pipeline CAMERA:PATH link and format the camera route before capture\n");
+	printf("\tCAMERA - cam0 or cam1\n");
+	printf("\tPATH - pix for NV12 output, rdi is not supported as its UYVY output is not renderable\n");
+	printf("-D <device>,  --media-device <device> media controller for the pipeline (default %s)\n",
+		DEFAULT_MEDIA_DEVICE);
+	printf("-T FILE,  --trace FILE record per frame stage spans, written as Chrome trace JSON on exit or 'd'\n");
+	printf("-x NAME,  --metrics NAME shared memory segment of the live metrics read by capstat, empty to disable (default %s)\n",
+		DEFAULT_METRICS);
+	printf("-m POLICY,  --present POLICY choice of the next frame to display\n");
+	printf("\tfifo - display every frame in capture order (default)\n");
+	printf("\tmailbox - display only the newest frame, drop stale frames\n");
+	printf("-B BACKEND,  --backend BACKEND render target of the display\n");
+	printf("\tauto - x11 when DISPLAY is set, offscreen otherwise (default)\n");
+	printf("\tx11 - full screen X11 window presented at vsync\n");
+	printf("\toffscreen - EGL surfaceless framebuffer object or pbuffer, no display server or vsync\n");
+	printf("-g, --gpu-timing measure GPU time of the uploads and draw with EXT_disjoint_timer_query\n");
+	printf("-w, --watermark stamp each frame and decode it from the surface to measure capture to display latency\n");
+	printf("-J FILE,  --json FILE write the report of a benchmark usage as JSON, '-' for stdout\n");
+	printf("-t, --threaded dequeue and requeue buffers on a separate capture thread\n");
 	printf("-u TYPE,  --usage TYPE program use to return\n");
 	printf("\tSupport values:\n");
 	struct usage *usage;
@@ -105,6 +145,25 @@ void set_default_options(struct options *opt)
 	opt->buffer_count = DEFAULT_BUFFER_COUNT;
 	opt->program_use = opt->default_usage;
 	opt->dma_export = false;
+	opt->render_method = DEFAULT_RENDER;
+	opt->threaded = false;
+	opt->present_policy = DEFAULT_PRESENT;
+	opt->display_backend = DEFAULT_BACKEND;
+	opt->memory = DEFAULT_MEMORY;
+	opt->measure_bandwidth = false;
+	opt->width = DEFAULT_WIDTH;
+	opt->height = DEFAULT_HEIGHT;
+	opt->fps = DEFAULT_FPS;
+	opt->format_policy = DEFAULT_FORMAT;
+	opt->mode_cache = (char*)DEFAULT_MODE_CACHE;
+	opt->pipeline_camera = -1;
+	opt->pipeline_path = PIPELINE_PIX;
+	opt->media_dev = (char*)DEFAULT_MEDIA_DEVICE;
+	opt->trace_file = NULL;
+	opt->metrics_name = (char*)DEFAULT_METRICS;
+	opt->gpu_timing = false;
+	opt->watermark = false;
+	opt->json_file = NULL;
 }
 
 
@@ -119,12 +178,30 @@ int get_options(struct options *opt, int argc, char * const argv[])
 {
 	int o;
 	int found = false;
+	char path[8];
 	struct usage *program_use;
 	static struct option long_options[] = {
 		{"device", 			required_argument, 	0, CAPTURE_DEV  },
 		{"subdevice", 		required_argument, 	0, CAPTURE_SUBDEV  },
 		{"count", 			required_argument,	0, CAPTURE_COUNT },
 		{"usage",			required_argument,	0, PROGRAM_USE },
+		{"render",			required_argument,	0, DISPLAY_RENDER },
+		{"threaded",		no_argument,		0, CAPTURE_THREAD },
+		{"present",			required_argument,	0, DISPLAY_PRESENT },
+		{"backend",			required_argument,	0, DISPLAY_BACKEND },
+		{"memory",			required_argument,	0, CAPTURE_MEMORY },
+		{"bandwidth",		no_argument,		0, CAPTURE_BANDWIDTH },
+		{"size",			required_argument,	0, CAPTURE_SIZE },
+		{"fps",				required_argument,	0, CAPTURE_FPS },
+		{"format",			required_argument,	0, CAPTURE_FORMAT },
+		{"mode-cache",		required_argument,	0, CAPTURE_MODE_CACHE },
+		{"pipeline",		required_argument,	0, MEDIA_PIPELINE },
+		{"media-device",	required_argument,	0, MEDIA_DEVICE },
+		{"trace",			required_argument,	0, CAPTURE_TRACE },
+		{"metrics",			required_argument,	0, CAPTURE_METRICS },
+		{"gpu-timing",		no_argument,		0, DISPLAY_GPU_TIMING },
+		{"watermark",		no_argument,		0, DISPLAY_WATERMARK },
+		{"json",			required_argument,	0, REPORT_JSON },
 		{"help",			no_argument, 		0, 'h'},
 		{"verbose",			optional_argument,	0, 'v'},
 		{0},
@@ -134,7 +211,7 @@ int get_options(struct options *opt, int argc, char * const argv[])
 
 	while(1)
 	{
-		o = getopt_long(argc, argv, "d:s:p:n:u:hv", long_options, NULL);
+		o = getopt_long(argc, argv, "d:s:p:n:u:r:tm:M:bS:F:f:c:P:D:T:x:gwJ:B:hv", long_options, NULL);
 		if (o == -1) break;
 
 		switch (o)
@@ -179,6 +256,203 @@ int get_options(struct options *opt, int argc, char * const argv[])
 				}
 				break;
 
+			case DISPLAY_RENDER:
+				/*
+				 * The DMA import path requires an exported file descriptor for every plane.
+				 * Enable the exports here so the capture setup creates them for the display.
+				 */
+				if (strcmp(optarg, "copy") == 0)
+				{
+					opt->render_method = RENDER_COPY;
+				}
+				else if (strcmp(optarg, "dmabuf") == 0)
+				{
+					opt->render_method = RENDER_DMABUF_IMPORT;
+					opt->dma_export = true;
+				}
+				else if (strcmp(optarg, "pbo") == 0)
+				{
+					opt->render_method = RENDER_PBO;
+				}
+				else if (strcmp(optarg, "storage") == 0)
+				{
+					opt->render_method = RENDER_TEX_STORAGE;
+				}
+				else
+				{
+					printf("unknown render method %s\n", optarg);
+					usage(argv);
+					return -1;
+				}
+				break;
+
+			case CAPTURE_THREAD:
+				opt->threaded = true;
+				break;
+
+			case DISPLAY_PRESENT:
+				if (strcmp(optarg, "fifo") == 0)
+				{
+					opt->present_policy = PRESENT_FIFO;
+				}
+				else if (strcmp(optarg, "mailbox") == 0)
+				{
+					opt->present_policy = PRESENT_MAILBOX;
+				}
+				else
+				{
+					printf("unknown presentation policy %s\n", optarg);
+					usage(argv);
+					return -1;
+				}
+				break;
+
+			case DISPLAY_BACKEND:
+				if (strcmp(optarg, "auto") == 0)
+				{
+					opt->display_backend = DISPLAY_AUTO;
+				}
+				else if (strcmp(optarg, "x11") == 0)
+				{
+					opt->display_backend = DISPLAY_X11;
+				}
+				else if (strcmp(optarg, "offscreen") == 0)
+				{
+					opt->display_backend = DISPLAY_OFFSCREEN;
+				}
+				else
+				{
+					printf("unknown display backend %s\n", optarg);
+					usage(argv);
+					return -1;
+				}
+				break;
+
+			case CAPTURE_MEMORY:
+				if (strcmp(optarg, "mmap") == 0)
+				{
+					opt->memory = V4L2_MEMORY_MMAP;
+				}
+				else if (strcmp(optarg, "userptr") == 0)
+				{
+					opt->memory = V4L2_MEMORY_USERPTR;
+				}
+				else if (strcmp(optarg, "dmabuf") == 0)
+				{
+					opt->memory = V4L2_MEMORY_DMABUF;
+				}
+				else
+				{
+					printf("unknown memory type %s\n", optarg);
+					usage(argv);
+					return -1;
+				}
+				break;
+
+			case CAPTURE_BANDWIDTH:
+				opt->measure_bandwidth = true;
+				break;
+
+			case CAPTURE_SIZE:
+				if (sscanf(optarg, "%ux%u", &opt->width, &opt->height) != 2 ||
+					!opt->width || !opt->height)
+				{
+					printf("unknown capture size %s\n", optarg);
+					usage(argv);
+					return -1;
+				}
+				break;
+
+			case CAPTURE_FPS:
+				if (!strcmp(optarg, "max"))
+				{
+					opt->fps = 0;
+					break;
+				}
+				opt->fps = atoi(optarg);
+				if (opt->fps <= 0)
+				{
+					LOGS_ERR("Unable to set frame rate to %s using default %d", optarg, DEFAULT_FPS);
+					opt->fps = DEFAULT_FPS;
+				}
+				break;
+
+			case CAPTURE_FORMAT:
+				if (strcmp(optarg, "auto") == 0)
+				{
+					opt->format_policy = FORMAT_AUTO;
+				}
+				else if (strcmp(optarg, "nv12m") == 0)
+				{
+					opt->format_policy = FORMAT_NV12M;
+				}
+				else if (strcmp(optarg, "nv12") == 0)
+				{
+					opt->format_policy = FORMAT_NV12;
+				}
+				else
+				{
+					printf("unknown capture format %s\n", optarg);
+					usage(argv);
+					return -1;
+				}
+				break;
+
+			case CAPTURE_MODE_CACHE:
+				opt->mode_cache = optarg;
+				break;
+
+			case MEDIA_PIPELINE:
+				if (sscanf(optarg, "cam%d:%7s", &opt->pipeline_camera, path) != 2 ||
+					opt->pipeline_camera < 0 || opt->pipeline_camera > 1)
+				{
+					printf("unknown pipeline %s\n", optarg);
+					usage(argv);
+					return -1;
+				}
+				if (strcmp(path, "pix") == 0)
+				{
+					opt->pipeline_path = PIPELINE_PIX;
+				}
+				else if (strcmp(path, "rdi") == 0)
+				{
+					/* the display only imports NV12, the raw UYVY would fail negotiation */
+					printf("pipeline path rdi is not supported, its UYVY output is not renderable, use pix\n");
+					usage(argv);
+					return -1;
+				}
+				else
+				{
+					printf("unknown pipeline path %s\n", path);
+					usage(argv);
+					return -1;
+				}
+				break;
+
+			case MEDIA_DEVICE:
+				opt->media_dev = optarg;
+				break;
+
+			case CAPTURE_TRACE:
+				opt->trace_file = optarg;
+				break;
+
+			case CAPTURE_METRICS:
+				opt->metrics_name = optarg;
+				break;
+
+			case DISPLAY_GPU_TIMING:
+				opt->gpu_timing = true;
+				break;
+
+			case DISPLAY_WATERMARK:
+				opt->watermark = true;
+				break;
+
+			case REPORT_JSON:
+				opt->json_file = optarg;
+				break;
+
 			case 'v':
 				if (optarg) VERBOSE = atoi(optarg);
 				else   		VERBOSE = LOG_ALL;
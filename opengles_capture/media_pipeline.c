@@ -0,0 +1,548 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Camera route and pad format setup through the media controller API.
+ * @file media_pipeline.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+
+#include <linux/media.h>
+#include <linux/media-bus-format.h>
+#include <linux/v4l2-subdev.h>
+
+#include "options.h"
+#include "media_pipeline.h"
+#include "log.h"
+
+/** Number of pads with a format on every route, sensor, csiphy, csid, ispif and vfe. */
+#define ROUTE_PADS 5
+
+/**
+ * Media graph read with MEDIA_IOC_G_TOPOLOGY.
+ */
+struct media_graph {
+	/** media controller file descriptor. */
+	int fd;
+	/** Media API version, tells whether pads report their index. */
+	uint32_t media_version;
+	/** Topology counts and arrays. */
+	struct media_v2_topology topology;
+	/** Entities of the graph. */
+	struct media_v2_entity *entities;
+	/** Device node interfaces of the graph. */
+	struct media_v2_interface *interfaces;
+	/** Pads of every entity. */
+	struct media_v2_pad *pads;
+	/** Data and interface links. */
+	struct media_v2_link *links;
+};
+
+/**
+ * One pad of the route and the media bus format it carries.
+ */
+struct route_pad {
+	/** Entity owning the pad. */
+	const struct media_v2_entity *entity;
+	/** Pad index within the entity. */
+	uint32_t pad;
+	/** Media bus format code. */
+	uint32_t code;
+};
+
+/**
+ * Read the monotonic clock.
+ * @return current monotonic time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Log the duration of a setup step and start timing the next one.
+ * @param step name of the completed step.
+ * @param start monotonic time the step started, updated to now.
+ */
+static void step_done(const char *step, uint64_t *start)
+{
+	uint64_t now = monotonic_ns();
+	LOGS_INF("Media pipeline %-14s %8.3f ms", step, (now - *start) / 1e6);
+	*start = now;
+}
+
+/**
+ * Free the topology arrays.
+ * @param graph media graph.
+ */
+static void graph_free(struct media_graph *graph)
+{
+	free(graph->entities);
+	free(graph->interfaces);
+	free(graph->pads);
+	free(graph->links);
+	graph->entities = NULL;
+	graph->interfaces = NULL;
+	graph->pads = NULL;
+	graph->links = NULL;
+}
+
+/**
+ * Read the entities, interfaces, pads and links of the media graph.
+ * The counts are read first, the read is repeated if the graph changes in between.
+ * @param graph media graph with an open file descriptor.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int graph_read(struct media_graph *graph)
+{
+	struct media_device_info info;
+	struct media_v2_topology *topology = &graph->topology;
+	uint64_t version;
+
+	memset(&info, 0, sizeof(info));
+	if (ioctl(graph->fd, MEDIA_IOC_DEVICE_INFO, &info) < 0)
+	{
+		LOGS_ERR("MEDIA_IOC_DEVICE_INFO: %d - %s", errno, strerror(errno));
+		return -errno;
+	}
+	graph->media_version = info.media_version;
+
+	do
+	{
+		graph_free(graph);
+		memset(topology, 0, sizeof(*topology));
+		if (ioctl(graph->fd, MEDIA_IOC_G_TOPOLOGY, topology) < 0)
+		{
+			LOGS_ERR("MEDIA_IOC_G_TOPOLOGY: %d - %s", errno, strerror(errno));
+			return -errno;
+		}
+		version = topology->topology_version;
+
+		graph->entities = calloc(topology->num_entities + 1, sizeof(*graph->entities));
+		graph->interfaces = calloc(topology->num_interfaces + 1, sizeof(*graph->interfaces));
+		graph->pads = calloc(topology->num_pads + 1, sizeof(*graph->pads));
+		graph->links = calloc(topology->num_links + 1, sizeof(*graph->links));
+		if (!graph->entities || !graph->interfaces || !graph->pads || !graph->links)
+		{
+			graph_free(graph);
+			return -ENOMEM;
+		}
+		topology->ptr_entities = (uintptr_t)graph->entities;
+		topology->ptr_interfaces = (uintptr_t)graph->interfaces;
+		topology->ptr_pads = (uintptr_t)graph->pads;
+		topology->ptr_links = (uintptr_t)graph->links;
+		if (ioctl(graph->fd, MEDIA_IOC_G_TOPOLOGY, topology) < 0)
+		{
+			LOGS_ERR("MEDIA_IOC_G_TOPOLOGY: %d - %s", errno, strerror(errno));
+			graph_free(graph);
+			return -errno;
+		}
+	} while (topology->topology_version != version);
+
+	LOGS_DBG("Media graph %s: %u entities, %u interfaces, %u pads, %u links", info.model,
+		topology->num_entities, topology->num_interfaces, topology->num_pads, topology->num_links);
+	return 0;
+}
+
+/**
+ * Find an entity by name.
+ * @param graph media graph.
+ * @param name entity name.
+ * @return the entity, NULL when not found.
+ */
+static const struct media_v2_entity *find_entity(const struct media_graph *graph, const char *name)
+{
+	for (uint32_t i = 0; i < graph->topology.num_entities; i++)
+		if (strcmp(graph->entities[i].name, name) == 0) return &graph->entities[i];
+	LOGS_ERR("Media entity %s not found", name);
+	return NULL;
+}
+
+/**
+ * Find an entity by id.
+ * @param graph media graph.
+ * @param id entity id.
+ * @return the entity, NULL when not found.
+ */
+static const struct media_v2_entity *entity_by_id(const struct media_graph *graph, uint32_t id)
+{
+	for (uint32_t i = 0; i < graph->topology.num_entities; i++)
+		if (graph->entities[i].id == id) return &graph->entities[i];
+	return NULL;
+}
+
+/**
+ * Index of a pad within its entity.
+ * Kernels before media API 4.19 don't report the index, pads are listed in index order there.
+ * @param graph media graph.
+ * @param pad pad of the graph.
+ * @return pad index.
+ */
+static uint32_t pad_index(const struct media_graph *graph, const struct media_v2_pad *pad)
+{
+	uint32_t index = 0;
+
+	if (MEDIA_V2_PAD_HAS_INDEX(graph->media_version)) return pad->index;
+	for (const struct media_v2_pad *p = graph->pads; p < pad; p++)
+		if (p->entity_id == pad->entity_id) index++;
+	return index;
+}
+
+/**
+ * Find a pad by id.
+ * @param graph media graph.
+ * @param id pad id.
+ * @return the pad, NULL when not found.
+ */
+static const struct media_v2_pad *pad_by_id(const struct media_graph *graph, uint32_t id)
+{
+	for (uint32_t i = 0; i < graph->topology.num_pads; i++)
+		if (graph->pads[i].id == id) return &graph->pads[i];
+	return NULL;
+}
+
+/**
+ * Find the pad of an entity with an index.
+ * @param graph media graph.
+ * @param entity entity owning the pad.
+ * @param index pad index.
+ * @return the pad, NULL when not found.
+ */
+static const struct media_v2_pad *find_pad(const struct media_graph *graph,
+	const struct media_v2_entity *entity, uint32_t index)
+{
+	for (uint32_t i = 0; i < graph->topology.num_pads; i++)
+	{
+		const struct media_v2_pad *pad = &graph->pads[i];
+		if (pad->entity_id == entity->id && pad_index(graph, pad) == index) return pad;
+	}
+	return NULL;
+}
+
+/**
+ * Device node path of an entity from its interface link.
+ * The node name is read from sysfs by the device number, udev names the node after it.
+ * @param graph media graph.
+ * @param entity entity with a device node.
+ * @param path returns the device node path.
+ * @param size size of the path buffer.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int entity_devnode(const struct media_graph *graph, const struct media_v2_entity *entity,
+	char *path, size_t size)
+{
+	char sys_path[MEDIA_PATH_MAX];
+	char target[256];
+	ssize_t len;
+
+	for (uint32_t l = 0; l < graph->topology.num_links; l++)
+	{
+		const struct media_v2_link *link = &graph->links[l];
+		if ((link->flags & MEDIA_LNK_FL_LINK_TYPE) != MEDIA_LNK_FL_INTERFACE_LINK ||
+			link->sink_id != entity->id)
+			continue;
+
+		for (uint32_t i = 0; i < graph->topology.num_interfaces; i++)
+		{
+			const struct media_v2_interface *intf = &graph->interfaces[i];
+			if (intf->id != link->source_id) continue;
+
+			snprintf(sys_path, sizeof(sys_path), "/sys/dev/char/%u:%u",
+				intf->devnode.major, intf->devnode.minor);
+			len = readlink(sys_path, target, sizeof(target) - 1);
+			if (len < 0)
+			{
+				LOGS_ERR("Unable to read %s: %s", sys_path, strerror(errno));
+				return -errno;
+			}
+			target[len] = '\0';
+			snprintf(path, size, "/dev/%s", basename(target));
+			return 0;
+		}
+	}
+	LOGS_ERR("Media entity %s has no device node", entity->name);
+	return -ENODEV;
+}
+
+/**
+ * Enable or disable the data link between two pads.
+ * @param graph media graph.
+ * @param source source entity.
+ * @param source_pad source pad index.
+ * @param sink sink entity.
+ * @param sink_pad sink pad index.
+ * @param enable true to enable the link, false to disable it.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int setup_link(const struct media_graph *graph, const struct media_v2_entity *source, uint32_t source_pad,
+	const struct media_v2_entity *sink, uint32_t sink_pad, bool enable)
+{
+	struct media_link_desc link;
+
+	memset(&link, 0, sizeof(link));
+	link.source.entity = source->id;
+	link.source.index = source_pad;
+	link.sink.entity = sink->id;
+	link.sink.index = sink_pad;
+	link.flags = enable ? MEDIA_LNK_FL_ENABLED : 0;
+	if (ioctl(graph->fd, MEDIA_IOC_SETUP_LINK, &link) < 0)
+	{
+		LOGS_ERR("Unable to %s link %s:%u -> %s:%u: %d - %s", enable ? "enable" : "disable",
+			source->name, source_pad, sink->name, sink_pad, errno, strerror(errno));
+		return -errno;
+	}
+	LOGS_DBG("%s link %s:%u -> %s:%u", enable ? "Enabled" : "Disabled",
+		source->name, source_pad, sink->name, sink_pad);
+	return 0;
+}
+
+/**
+ * Disable every enabled data link leaving a source pad or entering a sink pad.
+ * Immutable links are left alone.
+ * @param graph media graph.
+ * @param pad pad whose links are disabled.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int disable_pad_links(const struct media_graph *graph, const struct media_v2_pad *pad)
+{
+	int ret;
+
+	if (!pad) return -ENOENT;
+	for (uint32_t l = 0; l < graph->topology.num_links; l++)
+	{
+		const struct media_v2_link *link = &graph->links[l];
+		if ((link->flags & MEDIA_LNK_FL_LINK_TYPE) != MEDIA_LNK_FL_DATA_LINK ||
+			!(link->flags & MEDIA_LNK_FL_ENABLED) || (link->flags & MEDIA_LNK_FL_IMMUTABLE) ||
+			(link->source_id != pad->id && link->sink_id != pad->id))
+			continue;
+
+		const struct media_v2_pad *source = pad_by_id(graph, link->source_id);
+		const struct media_v2_pad *sink = pad_by_id(graph, link->sink_id);
+		if (!source || !sink) continue;
+		ret = setup_link(graph, entity_by_id(graph, source->entity_id), pad_index(graph, source),
+			entity_by_id(graph, sink->entity_id), pad_index(graph, sink), false);
+		if (ret) return ret;
+	}
+	return 0;
+}
+
+/**
+ * Find the entity feeding a sink pad through an enabled or immutable data link.
+ * @param graph media graph.
+ * @param entity sink entity.
+ * @param index sink pad index.
+ * @return the source entity, NULL when not found.
+ */
+static const struct media_v2_entity *linked_source(const struct media_graph *graph,
+	const struct media_v2_entity *entity, uint32_t index)
+{
+	const struct media_v2_pad *pad = find_pad(graph, entity, index);
+
+	for (uint32_t l = 0; pad && l < graph->topology.num_links; l++)
+	{
+		const struct media_v2_link *link = &graph->links[l];
+		if ((link->flags & MEDIA_LNK_FL_LINK_TYPE) == MEDIA_LNK_FL_DATA_LINK && link->sink_id == pad->id)
+		{
+			const struct media_v2_pad *source = pad_by_id(graph, link->source_id);
+			if (source) return entity_by_id(graph, source->entity_id);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Find the entity fed by a source pad, the video capture node at the end of a route.
+ * @param graph media graph.
+ * @param entity source entity.
+ * @param index source pad index.
+ * @return the sink entity, NULL when not found.
+ */
+static const struct media_v2_entity *linked_sink(const struct media_graph *graph,
+	const struct media_v2_entity *entity, uint32_t index)
+{
+	const struct media_v2_pad *pad = find_pad(graph, entity, index);
+
+	for (uint32_t l = 0; pad && l < graph->topology.num_links; l++)
+	{
+		const struct media_v2_link *link = &graph->links[l];
+		if ((link->flags & MEDIA_LNK_FL_LINK_TYPE) == MEDIA_LNK_FL_DATA_LINK && link->source_id == pad->id)
+		{
+			const struct media_v2_pad *sink = pad_by_id(graph, link->sink_id);
+			if (sink) return entity_by_id(graph, sink->entity_id);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Set the active format of a subdevice pad.
+ * @param graph media graph.
+ * @param route_pad pad and media bus code to set.
+ * @param width frame width in pixels.
+ * @param height frame height in pixels.
+ * @return error status of the function. Value 0 is returned on success.
+ */
+static int set_pad_format(const struct media_graph *graph, const struct route_pad *route_pad,
+	uint32_t width, uint32_t height)
+{
+	struct v4l2_subdev_format fmt;
+	char path[MEDIA_PATH_MAX];
+	int fd;
+	int ret;
+
+	ret = entity_devnode(graph, route_pad->entity, path, sizeof(path));
+	if (ret) return ret;
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+	{
+		LOGS_ERR("Unable to open %s for %s: %s", path, route_pad->entity->name, strerror(errno));
+		return -errno;
+	}
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+	fmt.pad = route_pad->pad;
+	fmt.format.width = width;
+	fmt.format.height = height;
+	fmt.format.code = route_pad->code;
+	fmt.format.field = V4L2_FIELD_NONE;
+	if (ioctl(fd, VIDIOC_SUBDEV_S_FMT, &fmt) < 0)
+	{
+		LOGS_ERR("Unable to set %s:%u format: %d - %s", route_pad->entity->name, route_pad->pad,
+			errno, strerror(errno));
+		ret = -errno;
+	}
+	else if (fmt.format.width != width || fmt.format.height != height || fmt.format.code != route_pad->code)
+	{
+		LOGS_WRN("%s:%u adjusted format to %04x/%ux%u", route_pad->entity->name, route_pad->pad,
+			fmt.format.code, fmt.format.width, fmt.format.height);
+	}
+	else
+	{
+		LOGS_DBG("%s:%u format %04x/%ux%u", route_pad->entity->name, route_pad->pad,
+			fmt.format.code, fmt.format.width, fmt.format.height);
+	}
+	close(fd);
+	return ret;
+}
+
+int media_pipeline_setup(const char *media_dev, struct media_pipeline *pipeline)
+{
+	struct media_graph graph;
+	const struct media_v2_entity *sensor, *csiphy, *csid, *ispif, *vfe, *video;
+	struct route_pad route[ROUTE_PADS];
+	char name[32];
+	uint64_t total = monotonic_ns();
+	uint64_t start = total;
+	int ret;
+
+	memset(&graph, 0, sizeof(graph));
+	graph.fd = open(media_dev, O_RDWR);
+	if (graph.fd < 0)
+	{
+		LOGS_ERR("Unable to open media device %s: %s", media_dev, strerror(errno));
+		return -errno;
+	}
+	step_done("open", &start);
+
+	ret = graph_read(&graph);
+	if (ret) goto cleanup;
+	step_done("topology", &start);
+
+	/* Every entity of the route is found by the name the msm camera drivers register. */
+	ret = -ENOENT;
+	snprintf(name, sizeof(name), "msm_csiphy%d", pipeline->camera);
+	if (!(csiphy = find_entity(&graph, name))) goto cleanup;
+	snprintf(name, sizeof(name), "msm_csid%d", pipeline->camera);
+	if (!(csid = find_entity(&graph, name))) goto cleanup;
+	snprintf(name, sizeof(name), "msm_ispif%d", pipeline->camera);
+	if (!(ispif = find_entity(&graph, name))) goto cleanup;
+	if (pipeline->path == PIPELINE_PIX)
+		snprintf(name, sizeof(name), "msm_vfe0_pix");
+	else
+		snprintf(name, sizeof(name), "msm_vfe0_rdi%d", pipeline->camera);
+	if (!(vfe = find_entity(&graph, name))) goto cleanup;
+
+	/* The sensor is whichever entity feeds the csiphy, its name carries the I2C address. */
+	sensor = linked_source(&graph, csiphy, 0);
+	video = linked_sink(&graph, vfe, 1);
+	if (!sensor || !video)
+	{
+		LOGS_ERR("No %s connected to %s", sensor ? "video node" : "sensor", sensor ? vfe->name : csiphy->name);
+		goto cleanup;
+	}
+	ret = entity_devnode(&graph, video, pipeline->video_dev, sizeof(pipeline->video_dev));
+	if (!ret) ret = entity_devnode(&graph, sensor, pipeline->sensor_subdev, sizeof(pipeline->sensor_subdev));
+	if (ret) goto cleanup;
+	step_done("lookup", &start);
+
+	/*
+	 * Disable the links of this camera and any other camera routed into the same video front end input.
+	 * Links of a camera streaming through another input are left alone.
+	 */
+	ret = disable_pad_links(&graph, find_pad(&graph, csiphy, 1));
+	if (!ret) ret = disable_pad_links(&graph, find_pad(&graph, csid, 1));
+	if (!ret) ret = disable_pad_links(&graph, find_pad(&graph, ispif, 1));
+	if (!ret) ret = disable_pad_links(&graph, find_pad(&graph, vfe, 0));
+	if (ret) goto cleanup;
+	step_done("reset links", &start);
+
+	ret = setup_link(&graph, csiphy, 1, csid, 0, true);
+	if (!ret) ret = setup_link(&graph, csid, 1, ispif, 0, true);
+	if (!ret) ret = setup_link(&graph, ispif, 1, vfe, 0, true);
+	if (ret) goto cleanup;
+	step_done("enable links", &start);
+
+	/* The sensor sends UYVY, the pix interface converts it to the 1.5 bytes per pixel NV12 layout. */
+	route[0] = (struct route_pad){ sensor, 0, MEDIA_BUS_FMT_UYVY8_2X8 };
+	route[1] = (struct route_pad){ csiphy, 0, MEDIA_BUS_FMT_UYVY8_2X8 };
+	route[2] = (struct route_pad){ csid, 0, MEDIA_BUS_FMT_UYVY8_2X8 };
+	route[3] = (struct route_pad){ ispif, 0, MEDIA_BUS_FMT_UYVY8_2X8 };
+	route[4] = (struct route_pad){ vfe, 0,
+		pipeline->path == PIPELINE_PIX ? MEDIA_BUS_FMT_YUYV8_1_5X8 : MEDIA_BUS_FMT_UYVY8_2X8 };
+	for (int i = 0; i < ROUTE_PADS && !ret; i++)
+		ret = set_pad_format(&graph, &route[i], pipeline->width, pipeline->height);
+	if (ret) goto cleanup;
+	step_done("pad formats", &start);
+
+	LOGS_INF("Media pipeline %s -> %s ready in %.3f ms, capture from %s", sensor->name, vfe->name,
+		(monotonic_ns() - total) / 1e6, pipeline->video_dev);
+
+cleanup:
+	graph_free(&graph);
+	close(graph.fd);
+	return ret;
+}
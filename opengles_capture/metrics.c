@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Live capture metrics published in a POSIX shared memory segment.
+ * @file metrics.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metrics.h"
+#include "log.h"
+
+/**
+ * Read the writer process ID of the segment currently behind a name.
+ * @param name POSIX shared memory name.
+ * @return process ID of the writer, 0 when the segment has none yet, negative errno when it can't be read.
+ */
+static int64_t segment_pid(const char *name)
+{
+	uint32_t pid = 0;
+	ssize_t size;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) return -errno;
+	size = pread(fd, &pid, sizeof(pid), offsetof(struct capture_metrics, pid));
+	close(fd);
+	if (size < 0) return -errno;
+	return size == sizeof(pid) ? pid : 0;
+}
+
+/**
+ * Check whether a process still runs.
+ * @param pid process ID.
+ * @return false when no process has the ID.
+ */
+static bool process_alive(uint32_t pid)
+{
+	return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+}
+
+int metrics_open(const char *name, struct capture_metrics **metrics)
+{
+	int64_t pid;
+	void *addr;
+	int fd;
+	int err;
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+	if (fd < 0 && errno == EEXIST)
+	{
+		/* Another instance may publish under the name, only a segment left behind by a dead writer is replaced. */
+		pid = segment_pid(name);
+		if (pid > 0 && process_alive(pid))
+		{
+			LOGS_ERR("Metrics segment %s is published by process %u, choose another name with -x",
+				name, (unsigned int)pid);
+			return -EBUSY;
+		}
+		shm_unlink(name);
+		fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+	}
+	if (fd < 0)
+	{
+		err = -errno;
+		LOGS_ERR("Unable to create metrics segment %s: %d - %s", name, -err, strerror(-err));
+		return err;
+	}
+	if (ftruncate(fd, sizeof(**metrics)) < 0)
+	{
+		err = -errno;
+		LOGS_ERR("Unable to size metrics segment %s: %d - %s", name, -err, strerror(-err));
+		close(fd);
+		shm_unlink(name);
+		return err;
+	}
+
+	addr = mmap(NULL, sizeof(**metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = -errno;
+	close(fd);
+	if (addr == MAP_FAILED)
+	{
+		LOGS_ERR("Unable to map metrics segment %s: %d - %s", name, -err, strerror(-err));
+		shm_unlink(name);
+		return err;
+	}
+
+	*metrics = addr;
+	(*metrics)->version = METRICS_VERSION;
+	(*metrics)->size = sizeof(**metrics);
+	(*metrics)->pid = getpid();
+	LOGS_INF("Publishing metrics in shared memory %s", name);
+	return 0;
+}
+
+void metrics_publish(struct capture_metrics *metrics)
+{
+	__atomic_store_n(&metrics->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+}
+
+void metrics_close(const char *name, struct capture_metrics *metrics)
+{
+	if (!metrics) return;
+	munmap(metrics, sizeof(*metrics));
+
+	/* The name may already belong to another instance that replaced this segment. */
+	if (segment_pid(name) == getpid()) shm_unlink(name);
+}
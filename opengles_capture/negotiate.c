@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * V4L2 format, frame size and frame interval negotiation.
+ * @file negotiate.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+
+#include <linux/videodev2.h>
+
+#include "options.h"
+#include "negotiate.h"
+#include "log.h"
+
+/** Maximum number of entries kept in the mode cache file. */
+#define MODE_CACHE_ENTRIES 64
+/** Maximum length of one mode cache line. */
+#define MODE_CACHE_LINE 512
+/** Cost added to frame sizes smaller than the request so any larger size is preferred. */
+#define UNDERSIZE_COST (1ull << 48)
+/** Cost added to frame sizes too slow for the requested rate so any size reaching it is preferred. */
+#define SLOW_RATE_COST (1ull << 56)
+
+/** Formats accepted by FORMAT_AUTO in order of preference. */
+static const uint32_t auto_formats[] = { V4L2_PIX_FMT_NV12M, V4L2_PIX_FMT_NV12, 0 };
+/** Formats accepted by FORMAT_NV12M. */
+static const uint32_t nv12m_formats[] = { V4L2_PIX_FMT_NV12M, 0 };
+/** Formats accepted by FORMAT_NV12. */
+static const uint32_t nv12_formats[] = { V4L2_PIX_FMT_NV12, 0 };
+
+/**
+ * Zero terminated list of formats accepted by a policy in order of preference.
+ * @param policy format policy, see enum format_policy.
+ * @return list of V4L2 pixel formats.
+ */
+static const uint32_t *policy_formats(int policy)
+{
+	switch (policy)
+	{
+		case FORMAT_NV12M: return nv12m_formats;
+		case FORMAT_NV12: return nv12_formats;
+		default: return auto_formats;
+	}
+}
+
+int negotiate_num_planes(uint32_t pixelformat)
+{
+	switch (pixelformat)
+	{
+		case V4L2_PIX_FMT_NV12M: return 2;
+		case V4L2_PIX_FMT_NV12: return 1;
+		default: return 0;
+	}
+}
+
+/**
+ * Cost of a frame size compared to the requested size, lower is better.
+ * @param width candidate width.
+ * @param height candidate height.
+ * @param request requested mode.
+ * @return cost of the candidate.
+ */
+static uint64_t size_cost(uint32_t width, uint32_t height, const struct mode_request *request)
+{
+	uint64_t area = (uint64_t)width * height;
+	uint64_t requested = (uint64_t)request->width * request->height;
+
+	if (width >= request->width && height >= request->height)
+		return area - requested;
+
+	/* Too small in at least one dimension, prefer the size covering most of the request. */
+	uint64_t covered = (uint64_t)(width < request->width ? width : request->width) *
+		(height < request->height ? height : request->height);
+	return UNDERSIZE_COST + (requested - covered);
+}
+
+/**
+ * Clamp a requested value to a stepwise range.
+ * @param value requested value.
+ * @param min smallest value.
+ * @param max largest value.
+ * @param step distance between valid values.
+ * @return nearest valid value not below the request where possible.
+ */
+static uint32_t clamp_step(uint32_t value, uint32_t min, uint32_t max, uint32_t step)
+{
+	if (value <= min) return min;
+	if (value >= max) return max;
+	if (step > 1) value = min + ((value - min + step - 1) / step) * step;
+	return value > max ? max : value;
+}
+
+/**
+ * Choose the best frame interval of a format and size.
+ * @param fd V4L2 capture device.
+ * @param mode format and size, the interval is filled in.
+ * @param fps requested frames per second.
+ * @return frames per second of the chosen interval, 0 when the device lists no interval.
+ */
+static double choose_interval(int fd, struct video_mode *mode, uint32_t fps)
+{
+	struct v4l2_frmivalenum ival;
+	double best_rate = 0;
+	bool best_reaches = false;
+
+	mode->interval.numerator = 0;
+	mode->interval.denominator = 0;
+
+	memset(&ival, 0, sizeof(ival));
+	ival.pixel_format = mode->pixelformat;
+	ival.width = mode->width;
+	ival.height = mode->height;
+	while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0)
+	{
+		if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+		{
+			double rate = ival.discrete.denominator / (double)ival.discrete.numerator;
+			bool reaches = rate >= fps;
+			LOGS_DBG("\t\t%u/%u s (%.2f fps)", ival.discrete.numerator, ival.discrete.denominator, rate);
+
+			/* Keep the slowest rate reaching the request, or the fastest one if none does. */
+			if (!mode->interval.denominator ||
+				(reaches && (!best_reaches || rate < best_rate)) ||
+				(!reaches && !best_reaches && rate > best_rate))
+			{
+				mode->interval = ival.discrete;
+				best_rate = rate;
+				best_reaches = reaches;
+			}
+			ival.index++;
+		}
+		else
+		{
+			/* Continuous or stepwise intervals, clamp the requested interval to the range. */
+			double min = ival.stepwise.min.numerator / (double)ival.stepwise.min.denominator;
+			double max = ival.stepwise.max.numerator / (double)ival.stepwise.max.denominator;
+			double want = 1.0 / fps;
+			if (want < min) mode->interval = ival.stepwise.min;
+			else if (want > max) mode->interval = ival.stepwise.max;
+			else
+			{
+				mode->interval.numerator = 1;
+				mode->interval.denominator = fps;
+			}
+			best_rate = mode->interval.denominator / (double)mode->interval.numerator;
+			break;
+		}
+	}
+	return best_rate;
+}
+
+/**
+ * Enumerate the device and choose the best mode for a request.
+ * @param fd V4L2 capture device.
+ * @param request requested mode.
+ * @param mode returns the chosen mode.
+ * @return error status of the enumeration. Value 0 is returned on success.
+ */
+static int enumerate_mode(int fd, const struct mode_request *request, struct video_mode *mode)
+{
+	const uint32_t *formats = policy_formats(request->policy);
+	struct v4l2_fmtdesc desc;
+	struct v4l2_frmsizeenum size;
+	struct video_mode candidate;
+	uint64_t best_cost = UINT64_MAX;
+	uint64_t cost;
+	double rate;
+	bool supported;
+
+	memset(mode, 0, sizeof(*mode));
+
+	for (int f = 0; formats[f]; f++)
+	{
+		/* Only consider formats the device lists. */
+		supported = false;
+		memset(&desc, 0, sizeof(desc));
+		desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		while (ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0)
+		{
+			if (desc.pixelformat == formats[f]) supported = true;
+			desc.index++;
+		}
+		if (!supported) continue;
+		LOGS_DBG("Format %.4s", (char*)&formats[f]);
+
+		memset(&size, 0, sizeof(size));
+		size.pixel_format = formats[f];
+		if (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size) < 0)
+		{
+			/* No size enumeration, let the driver adjust the requested size. */
+			cost = 0;
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				mode->pixelformat = formats[f];
+				mode->width = request->width;
+				mode->height = request->height;
+				choose_interval(fd, mode, request->fps);
+			}
+			continue;
+		}
+
+		do
+		{
+			uint32_t width;
+			uint32_t height;
+			if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+			{
+				width = size.discrete.width;
+				height = size.discrete.height;
+			}
+			else
+			{
+				width = clamp_step(request->width, size.stepwise.min_width,
+					size.stepwise.max_width, size.stepwise.step_width);
+				height = clamp_step(request->height, size.stepwise.min_height,
+					size.stepwise.max_height, size.stepwise.step_height);
+			}
+			LOGS_DBG("\t%ux%u", width, height);
+
+			/* Intervals depend on the size, a size that can't reach the requested rate loses to one that can. */
+			candidate.pixelformat = formats[f];
+			candidate.width = width;
+			candidate.height = height;
+			rate = choose_interval(fd, &candidate, request->fps);
+			cost = size_cost(width, height, request);
+			if (rate > 0 && rate < request->fps) cost += SLOW_RATE_COST;
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				*mode = candidate;
+			}
+			size.index++;
+		} while (size.type == V4L2_FRMSIZE_TYPE_DISCRETE &&
+			ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0);
+	}
+
+	if (!mode->pixelformat)
+	{
+		LOGS_ERR("Device has no format supported by the display");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * Build the cache key of a device and request.
+ * The bus information identifies the hardware behind a device node that may be renumbered.
+ * @param fd V4L2 capture device.
+ * @param device path of the capture device.
+ * @param request requested mode.
+ * @param key returns the key.
+ * @param size size of the key buffer.
+ */
+static void cache_key(int fd, const char *device, const struct mode_request *request, char *key, size_t size)
+{
+	struct v4l2_capability caps;
+
+	memset(&caps, 0, sizeof(caps));
+	ioctl(fd, VIDIOC_QUERYCAP, &caps);
+	snprintf(key, size, "%s,%.32s,%ux%u@%u,%d", device, (char*)caps.bus_info,
+		request->width, request->height, request->fps, request->policy);
+	/* Keys are whitespace separated from the values in the cache file. */
+	for (char *c = key; *c; c++)
+		if (*c == ' ' || *c == '\t') *c = '_';
+}
+
+/**
+ * Look up a mode in the cache file.
+ * @param cache_path cache file.
+ * @param key cache key.
+ * @param mode returns the cached mode.
+ * @return true when the key was found.
+ */
+static bool cache_read(const char *cache_path, const char *key, struct video_mode *mode)
+{
+	char line[MODE_CACHE_LINE];
+	char line_key[MODE_CACHE_LINE];
+	bool found = false;
+	FILE *file;
+
+	file = fopen(cache_path, "r");
+	if (!file) return false;
+	while (!found && fgets(line, sizeof(line), file))
+	{
+		if (sscanf(line, "%511s %x %u %u %u %u", line_key, &mode->pixelformat,
+			&mode->width, &mode->height,
+			&mode->interval.numerator, &mode->interval.denominator) == 6)
+		{
+			found = strcmp(line_key, key) == 0;
+		}
+	}
+	fclose(file);
+	return found;
+}
+
+/**
+ * Replace or remove the cache entry of a key.
+ * @param cache_path cache file.
+ * @param key cache key.
+ * @param mode mode to store, NULL to remove the entry.
+ */
+static void cache_write(const char *cache_path, const char *key, const struct video_mode *mode)
+{
+	static char lines[MODE_CACHE_ENTRIES][MODE_CACHE_LINE];
+	char line_key[MODE_CACHE_LINE];
+	char tmp_path[MODE_CACHE_LINE];
+	int count = 0;
+	FILE *file;
+
+	/* Keep every other entry, dropping the oldest when the cache is full. */
+	file = fopen(cache_path, "r");
+	if (file)
+	{
+		while (fgets(lines[count % MODE_CACHE_ENTRIES], MODE_CACHE_LINE, file))
+		{
+			if (sscanf(lines[count % MODE_CACHE_ENTRIES], "%511s", line_key) == 1 &&
+				strcmp(line_key, key) != 0)
+				count++;
+		}
+		fclose(file);
+	}
+
+	/* Write a new file and rename it so a crash never leaves a truncated cache. */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+	file = fopen(tmp_path, "w");
+	if (!file)
+	{
+		LOGS_WRN("Unable to write mode cache %s: %s", tmp_path, strerror(errno));
+		return;
+	}
+	int first = count > MODE_CACHE_ENTRIES - 1 ? count - (MODE_CACHE_ENTRIES - 1) : 0;
+	for (int i = first; i < count; i++)
+		fputs(lines[i % MODE_CACHE_ENTRIES], file);
+	if (mode)
+		fprintf(file, "%s %08x %u %u %u %u\n", key, mode->pixelformat, mode->width, mode->height,
+			mode->interval.numerator, mode->interval.denominator);
+	fclose(file);
+	if (rename(tmp_path, cache_path) < 0)
+		LOGS_WRN("Unable to update mode cache %s: %s", cache_path, strerror(errno));
+}
+
+int negotiate_mode(int fd, const char *device, const struct mode_request *request,
+	const char *cache_path, struct video_mode *mode)
+{
+	char key[MODE_CACHE_LINE];
+	int ret;
+
+	if (cache_path && cache_path[0])
+	{
+		cache_key(fd, device, request, key, sizeof(key));
+		if (cache_read(cache_path, key, mode) && negotiate_num_planes(mode->pixelformat))
+		{
+			LOGS_DBG("Mode for %s read from cache %s", key, cache_path);
+			return 1;
+		}
+	}
+
+	ret = enumerate_mode(fd, request, mode);
+	if (ret) return ret;
+
+	if (cache_path && cache_path[0]) cache_write(cache_path, key, mode);
+	return 0;
+}
+
+void negotiate_forget(int fd, const char *device, const struct mode_request *request,
+	const char *cache_path)
+{
+	char key[MODE_CACHE_LINE];
+
+	if (!cache_path || !cache_path[0]) return;
+	cache_key(fd, device, request, key, sizeof(key));
+	cache_write(cache_path, key, NULL);
+}
+
+int negotiate_apply(int fd, const struct video_mode *mode, struct v4l2_format *fmt)
+{
+	struct v4l2_streamparm parm;
+
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	fmt->fmt.pix_mp.pixelformat = mode->pixelformat;
+	fmt->fmt.pix_mp.width = mode->width;
+	fmt->fmt.pix_mp.height = mode->height;
+	fmt->fmt.pix_mp.num_planes = negotiate_num_planes(mode->pixelformat);
+	fmt->fmt.pix_mp.field = V4L2_FIELD_NONE;
+	if (ioctl(fd, VIDIOC_S_FMT, fmt) < 0)
+	{
+		LOGS_ERR("Unable to set format %.4s %ux%u %d - %s", (char*)&mode->pixelformat,
+			mode->width, mode->height, errno, strerror(errno));
+		return -errno;
+	}
+	if (fmt->fmt.pix_mp.pixelformat != mode->pixelformat)
+	{
+		LOGS_ERR("Driver replaced format %.4s with %.4s", (char*)&mode->pixelformat,
+			(char*)&fmt->fmt.pix_mp.pixelformat);
+		return -EINVAL;
+	}
+
+	/* The frame rate is optional, many capture nodes leave it to the sensor subdevice. */
+	if (mode->interval.numerator && mode->interval.denominator)
+	{
+		memset(&parm, 0, sizeof(parm));
+		parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		parm.parm.capture.timeperframe = mode->interval;
+		if (ioctl(fd, VIDIOC_S_PARM, &parm) < 0)
+			LOGS_WRN("Unable to set frame interval %u/%u: %s", mode->interval.numerator,
+				mode->interval.denominator, strerror(errno));
+	}
+
+	LOGS_INF("Capture format %.4s %ux%u, interval %u/%u", (char*)&fmt->fmt.pix_mp.pixelformat,
+		fmt->fmt.pix_mp.width, fmt->fmt.pix_mp.height,
+		mode->interval.numerator, mode->interval.denominator);
+	for (int p = 0; p < fmt->fmt.pix_mp.num_planes; p++)
+		LOGS_DBG("\tplane %d bytesperline %u sizeimage %u", p,
+			fmt->fmt.pix_mp.plane_fmt[p].bytesperline, fmt->fmt.pix_mp.plane_fmt[p].sizeimage);
+	return 0;
+}
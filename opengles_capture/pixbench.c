@@ -0,0 +1,552 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Microbenchmarks of the CPU pixel kernels.
+ * @file pixbench.c
+ *
+ * Every variant of every kernel is timed at each frame size on one pinned CPU. A run repeats the kernel
+ * for at least the minimum run time, the report gives the mean, minimum and standard deviation of the
+ * frame time across runs with the cycles per pixel and the bytes read and written per second.
+ * Cycles come from the perf CPU cycle counter, or the time stamp counter when perf is not permitted.
+ * Each output is compared with the scalar variant so a faster but wrong variant does not go unnoticed.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "pixel_kernels.h"
+
+/** Number of timed runs of each kernel variant and size. */
+#define DEFAULT_RUNS 15
+/** Minimum time of one run in milliseconds, the number of frames per run is sized to reach it. */
+#define DEFAULT_RUN_MS 20
+/** Maximum number of kernels or frame sizes on the command line. */
+#define MAX_SELECTED 16
+
+/** Frame sizes measured when none is given. */
+static const int default_sizes[][2] = {
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+	{ 3840, 2160 },
+};
+
+/**
+ * Source of the cycle counts.
+ */
+enum cycle_source
+{
+	/** No cycle counter, cycles per pixel are not reported. */
+	CYCLES_NONE,
+	/** perf hardware CPU cycles of this thread. */
+	CYCLES_PERF,
+	/** x86 time stamp counter, constant rate reference cycles rather than core cycles. */
+	CYCLES_TSC,
+};
+
+static const char * const cycle_source_names[] = { "none", "perf", "tsc" };
+
+/**
+ * Cycle counter of the benchmark thread.
+ */
+struct cycle_counter
+{
+	/** Counter used. */
+	enum cycle_source source;
+	/** perf event file descriptor, -1 when perf is not used. */
+	int fd;
+};
+
+/**
+ * Measurement of one kernel variant at one frame size.
+ */
+struct bench_result
+{
+	/** Kernel variant measured. */
+	const struct pixel_kernel *kernel;
+	/** Frame width in pixels. */
+	int width;
+	/** Frame height in pixels. */
+	int height;
+	/** The running CPU supports the variant, nothing else is set otherwise. */
+	bool supported;
+	/** Output identical to the scalar variant. */
+	bool match;
+	/** Frames processed per run. */
+	int frames;
+	/** Mean frame time across runs in nanoseconds. */
+	double ns_mean;
+	/** Shortest frame time of a run in nanoseconds. */
+	double ns_min;
+	/** Standard deviation of the frame time across runs in nanoseconds. */
+	double ns_stddev;
+	/** Mean cycles per pixel, negative without a cycle counter. */
+	double cycles_per_pixel;
+	/** Bytes read and written per second in GB/s at the mean frame time. */
+	double gb_per_s;
+	/** Mean frame time of the scalar variant divided by the mean frame time of this variant. */
+	double speedup;
+};
+
+/**
+ * Read the monotonic clock.
+ * @return current monotonic time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Open the best cycle counter available to this thread.
+ * @param counter counter to open.
+ */
+static void cycles_open(struct cycle_counter *counter)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	counter->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (counter->fd >= 0)
+	{
+		counter->source = CYCLES_PERF;
+		return;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	counter->source = CYCLES_TSC;
+#else
+	counter->source = CYCLES_NONE;
+#endif
+}
+
+/**
+ * Read the cycle counter.
+ * @param counter open counter.
+ * @return cycles counted so far, 0 without a counter.
+ */
+static uint64_t cycles_read(const struct cycle_counter *counter)
+{
+	uint64_t value = 0;
+
+	switch (counter->source)
+	{
+		case CYCLES_PERF:
+			if (read(counter->fd, &value, sizeof(value)) != sizeof(value)) value = 0;
+			break;
+		case CYCLES_TSC:
+#if defined(__x86_64__) || defined(__i386__)
+			value = __rdtsc();
+#endif
+			break;
+		case CYCLES_NONE:
+			break;
+	}
+	return value;
+}
+
+/**
+ * Fill memory with pseudo random bytes, the kernels see no content dependent shortcuts.
+ * @param memory memory to fill.
+ * @param size number of bytes.
+ */
+static void fill_random(uint8_t *memory, size_t size)
+{
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		memory[i] = state >> 56;
+	}
+}
+
+/**
+ * Allocate page aligned memory, so SIMD variants are measured on aligned lines.
+ * @param size number of bytes.
+ * @return memory, NULL when out of memory.
+ */
+static uint8_t *alloc_frame(size_t size)
+{
+	void *memory;
+
+	if (posix_memalign(&memory, 4096, size)) return NULL;
+	return memory;
+}
+
+/**
+ * Time one kernel variant at one frame size.
+ * @param kernel kernel variant.
+ * @param src input frame in the input layout of the kernel.
+ * @param dst output frame in the output layout of the kernel.
+ * @param runs number of timed runs.
+ * @param run_ns minimum time of one run in nanoseconds.
+ * @param counter cycle counter.
+ * @param result measurement filled in.
+ */
+static void bench_kernel(const struct pixel_kernel *kernel, const struct pixel_frame *src, struct pixel_frame *dst,
+	int runs, uint64_t run_ns, const struct cycle_counter *counter, struct bench_result *result)
+{
+	uint64_t pixels = (uint64_t)src->width * src->height;
+	size_t bytes = pixel_layout_size(kernel->input, src->width, src->height) +
+		pixel_layout_size(kernel->output, dst->width, dst->height);
+	double sum = 0.0, sum_squares = 0.0, cycles = 0.0;
+	uint64_t begin, elapsed;
+	int frames;
+
+	/* The first frame warms the caches and sizes the runs. */
+	begin = monotonic_ns();
+	kernel->run(src, dst);
+	elapsed = monotonic_ns() - begin;
+	frames = elapsed ? (int)(run_ns / elapsed) + 1 : 1000;
+
+	result->ns_min = 0.0;
+	for (int run = 0; run < runs; run++)
+	{
+		uint64_t cycles_begin = cycles_read(counter);
+		double ns;
+
+		begin = monotonic_ns();
+		for (int i = 0; i < frames; i++)
+			kernel->run(src, dst);
+		elapsed = monotonic_ns() - begin;
+		cycles += (double)(cycles_read(counter) - cycles_begin) / frames;
+
+		ns = (double)elapsed / frames;
+		sum += ns;
+		sum_squares += ns * ns;
+		if (!run || ns < result->ns_min) result->ns_min = ns;
+	}
+
+	result->frames = frames;
+	result->ns_mean = sum / runs;
+	result->ns_stddev = runs > 1 ? sqrt(fmax(0.0, (sum_squares - sum * sum / runs) / (runs - 1))) : 0.0;
+	result->cycles_per_pixel = counter->source == CYCLES_NONE ? -1.0 : cycles / runs / pixels;
+	result->gb_per_s = bytes / result->ns_mean;
+}
+
+/**
+ * Print the measurements as a table.
+ * @param file output stream.
+ * @param results measurements.
+ * @param num_results number of measurements.
+ */
+static void print_table(FILE *file, const struct bench_result *results, int num_results)
+{
+	fprintf(file, "%-13s %-7s %-10s %10s %8s %9s %7s %8s %s\n",
+		"kernel", "variant", "size", "us/frame", "cv %", "cyc/px", "GB/s", "speedup", "output");
+	for (int i = 0; i < num_results; i++)
+	{
+		const struct bench_result *r = &results[i];
+		char size[24];
+
+		snprintf(size, sizeof(size), "%dx%d", r->width, r->height);
+		fprintf(file, "%-13s %-7s %-10s ", r->kernel->name, r->kernel->variant, size);
+		if (!r->supported)
+		{
+			fprintf(file, "%10s\n", "unsupported");
+			continue;
+		}
+		fprintf(file, "%10.1f %8.2f ", r->ns_mean / 1e3, 100.0 * r->ns_stddev / r->ns_mean);
+		if (r->cycles_per_pixel < 0) fprintf(file, "%9s ", "-");
+		else                         fprintf(file, "%9.3f ", r->cycles_per_pixel);
+		fprintf(file, "%7.2f %7.2fx %s\n", r->gb_per_s, r->speedup, r->match ? "ok" : "MISMATCH");
+	}
+}
+
+/**
+ * Write the measurements as JSON.
+ * @param path file to write, "-" for stdout.
+ * @param cpu CPU the benchmark is pinned to, -1 when not pinned.
+ * @param counter cycle counter.
+ * @param runs number of runs per measurement.
+ * @param results measurements.
+ * @param num_results number of measurements.
+ * @return error status of the write. Value 0 is returned on success.
+ */
+static int write_json(const char *path, int cpu, const struct cycle_counter *counter, int runs,
+	const struct bench_result *results, int num_results)
+{
+	FILE *file = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	struct utsname name;
+
+	if (!file)
+	{
+		fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	if (uname(&name)) strcpy(name.machine, "unknown");
+
+	fprintf(file, "{\"machine\": \"%s\", \"cpu\": %d, \"cycle_source\": \"%s\", \"runs\": %d, \"results\": [\n",
+		name.machine, cpu, cycle_source_names[counter->source], runs);
+	for (int i = 0; i < num_results; i++)
+	{
+		const struct bench_result *r = &results[i];
+
+		fprintf(file, "  {\"kernel\": \"%s\", \"variant\": \"%s\", \"width\": %d, \"height\": %d, \"supported\": %s",
+			r->kernel->name, r->kernel->variant, r->width, r->height, r->supported ? "true" : "false");
+		if (r->supported)
+		{
+			fprintf(file, ", \"match\": %s, \"frames_per_run\": %d, \"ns_mean\": %.1f, \"ns_min\": %.1f, "
+				"\"ns_stddev\": %.1f, \"cycles_per_pixel\": ",
+				r->match ? "true" : "false", r->frames, r->ns_mean, r->ns_min, r->ns_stddev);
+			if (r->cycles_per_pixel < 0) fprintf(file, "null");
+			else                         fprintf(file, "%.4f", r->cycles_per_pixel);
+			fprintf(file, ", \"gb_per_s\": %.3f, \"speedup\": %.3f", r->gb_per_s, r->speedup);
+		}
+		fprintf(file, "}%s\n", i + 1 < num_results ? "," : "");
+	}
+	fprintf(file, "]}\n");
+	if (file != stdout) fclose(file);
+	else fflush(file);
+	return 0;
+}
+
+/**
+ * Print the command line options.
+ * @param argv command line arguments.
+ */
+static void usage(char * const argv[])
+{
+	printf("Usage: %s [options]\n", argv[0]);
+	printf("-k NAME,  --kernel NAME only measure this kernel, may be repeated\n");
+	for (int i = 0; i < pixel_kernel_count; i++)
+		if (!i || strcmp(pixel_kernels[i].name, pixel_kernels[i - 1].name))
+			printf("\t%s\n", pixel_kernels[i].name);
+	printf("-S WxH,  --size WxH frame size to measure, may be repeated (default 640x480 to 3840x2160)\n");
+	printf("-r #,  --runs # timed runs per measurement (default %d)\n", DEFAULT_RUNS);
+	printf("-t MS,  --run-time MS minimum time of one run (default %d)\n", DEFAULT_RUN_MS);
+	printf("-c CPU,  --cpu CPU pin to this CPU, -1 to not pin (default the starting CPU)\n");
+	printf("-o FILE,  --output FILE write the results as JSON, '-' for stdout\n");
+	printf("-h, --help\n");
+}
+
+int main(int argc, char * const argv[])
+{
+	static struct option long_options[] = {
+		{"kernel",		required_argument,	0, 'k' },
+		{"size",		required_argument,	0, 'S' },
+		{"runs",		required_argument,	0, 'r' },
+		{"run-time",	required_argument,	0, 't' },
+		{"cpu",			required_argument,	0, 'c' },
+		{"output",		required_argument,	0, 'o' },
+		{"help",		no_argument,		0, 'h' },
+		{0},
+	};
+	const char *kernels[MAX_SELECTED];
+	int width[MAX_SELECTED], height[MAX_SELECTED];
+	int num_kernels = 0, num_sizes = 0;
+	int runs = DEFAULT_RUNS, run_ms = DEFAULT_RUN_MS;
+	int cpu = sched_getcpu();
+	const char *output = NULL;
+	struct cycle_counter counter;
+	struct bench_result *results;
+	int num_results = 0;
+	int ret = 0;
+	int o;
+
+	while ((o = getopt_long(argc, argv, "k:S:r:t:c:o:h", long_options, NULL)) != -1)
+	{
+		switch (o)
+		{
+			case 'k':
+				if (num_kernels == MAX_SELECTED || !pixel_kernel_find(optarg))
+				{
+					printf("unknown kernel %s\n", optarg);
+					usage(argv);
+					return 1;
+				}
+				kernels[num_kernels++] = optarg;
+				break;
+			case 'S':
+				if (num_sizes == MAX_SELECTED ||
+					sscanf(optarg, "%dx%d", &width[num_sizes], &height[num_sizes]) != 2 ||
+					width[num_sizes] < 2 || height[num_sizes] < 2 ||
+					width[num_sizes] % 2 || height[num_sizes] % 2)
+				{
+					printf("unknown size %s, even width and height required\n", optarg);
+					usage(argv);
+					return 1;
+				}
+				num_sizes++;
+				break;
+			case 'r':
+				runs = atoi(optarg);
+				if (runs <= 0)
+				{
+					printf("unknown run count %s\n", optarg);
+					usage(argv);
+					return 1;
+				}
+				break;
+			case 't':
+				run_ms = atoi(optarg);
+				if (run_ms <= 0)
+				{
+					printf("unknown run time %s\n", optarg);
+					usage(argv);
+					return 1;
+				}
+				break;
+			case 'c':
+				cpu = atoi(optarg);
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'h':
+				usage(argv);
+				return 0;
+			default:
+				usage(argv);
+				return 1;
+		}
+	}
+	if (!num_sizes)
+	{
+		for (unsigned int i = 0; i < sizeof(default_sizes) / sizeof(default_sizes[0]); i++)
+		{
+			width[num_sizes] = default_sizes[i][0];
+			height[num_sizes] = default_sizes[i][1];
+			num_sizes++;
+		}
+	}
+
+	/* Pinned before the counter is opened so every run is counted on the same core. */
+	if (cpu >= 0)
+	{
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set))
+		{
+			fprintf(stderr, "Unable to pin to CPU %d: %s\n", cpu, strerror(errno));
+			return 1;
+		}
+	}
+	cycles_open(&counter);
+
+	results = calloc(num_sizes * pixel_kernel_count, sizeof(*results));
+	if (!results) return 1;
+
+	for (int s = 0; s < num_sizes && !ret; s++)
+	{
+		size_t input_size = pixel_layout_size(PIXEL_NV12, width[s], height[s]);
+		size_t output_size = pixel_layout_size(PIXEL_RGBA, width[s], height[s]);
+		uint8_t *nv12 = alloc_frame(input_size);
+		uint8_t *i420 = alloc_frame(input_size);
+		uint8_t *out = alloc_frame(output_size);
+		uint8_t *reference = alloc_frame(output_size);
+		double scalar_ns = 0.0;
+
+		if (!nv12 || !i420 || !out || !reference)
+		{
+			fprintf(stderr, "Unable to allocate %dx%d frames\n", width[s], height[s]);
+			ret = 1;
+		}
+		else
+		{
+			fill_random(nv12, input_size);
+			fill_random(i420, input_size);
+		}
+
+		for (int k = 0; k < pixel_kernel_count && !ret; k++)
+		{
+			const struct pixel_kernel *kernel = &pixel_kernels[k];
+			struct bench_result *result;
+			struct pixel_frame src, dst;
+			int selected = !num_kernels;
+			size_t size;
+
+			for (int i = 0; i < num_kernels; i++)
+				if (!strcmp(kernels[i], kernel->name)) selected = true;
+			if (!selected) continue;
+
+			result = &results[num_results++];
+			result->kernel = kernel;
+			result->width = width[s];
+			result->height = height[s];
+			if (!pixel_kernel_supported(kernel)) continue;
+			result->supported = true;
+
+			pixel_frame_init(&src, kernel->input, width[s], height[s], kernel->input == PIXEL_I420 ? i420 : nv12);
+			pixel_frame_init(&dst, kernel->output, width[s] >> kernel->output_shift,
+				height[s] >> kernel->output_shift, out);
+			size = pixel_layout_size(kernel->output, dst.width, dst.height);
+
+			/* Scalar variants come first and produce the reference output of the kernel. */
+			if (!strcmp(kernel->variant, "scalar"))
+			{
+				struct pixel_frame ref;
+				pixel_frame_init(&ref, kernel->output, dst.width, dst.height, reference);
+				kernel->run(&src, &ref);
+			}
+			memset(out, 0, size);
+			kernel->run(&src, &dst);
+			result->match = !memcmp(out, reference, size);
+
+			bench_kernel(kernel, &src, &dst, runs, run_ms * 1000000ull, &counter, result);
+			if (!strcmp(kernel->variant, "scalar")) scalar_ns = result->ns_mean;
+			result->speedup = scalar_ns / result->ns_mean;
+		}
+		free(nv12);
+		free(i420);
+		free(out);
+		free(reference);
+	}
+
+	if (!output || strcmp(output, "-")) print_table(stdout, results, num_results);
+	if (output && write_json(output, cpu, &counter, runs, results, num_results)) ret = 1;
+	for (int i = 0; i < num_results; i++)
+		if (results[i].supported && !results[i].match) ret = 1;
+	free(results);
+	if (counter.fd >= 0) close(counter.fd);
+	return ret;
+}
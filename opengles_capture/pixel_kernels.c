@@ -0,0 +1,681 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * CPU pixel kernels with scalar and SIMD variants.
+ * @file pixel_kernels.c
+ *
+ * Kernels are built from row functions, a SIMD row processes whole vectors and finishes the line
+ * with the scalar row so any even width is accepted. x86 variants are compiled with target attributes
+ * and selected at run time, NEON variants are built when the target always has NEON.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pixel_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#define PIXEL_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * BT.601 limited range to RGB in 6 fractional bits, small enough for 16 bit lanes.
+ * Only the blue sum may exceed 16 bits, SIMD variants saturate it to a value clamped to 255 anyway.
+ */
+#define RGB_Y_OFFSET 16
+#define RGB_Y_SCALE 74
+#define RGB_R_V 102
+#define RGB_G_U 25
+#define RGB_G_V 52
+#define RGB_B_U 129
+#define RGB_ROUND 32
+#define RGB_SHIFT 6
+
+/** Copy one line of bytes. */
+typedef void (*copy_row_func)(uint8_t *dst, const uint8_t *src, int bytes);
+/** Interleave count Cb and Cr samples into CbCr pairs. */
+typedef void (*interleave_row_func)(uint8_t *dst, const uint8_t *cb, const uint8_t *cr, int count);
+/** Average 2x2 blocks of two lines into count output pixels. */
+typedef void (*downscale_row_func)(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int count);
+/** Convert one line of width NV12 pixels to RGBA. */
+typedef void (*rgba_row_func)(uint8_t *dst, const uint8_t *luma, const uint8_t *chroma, int width);
+
+static void copy_row_scalar(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	memcpy(dst, src, bytes);
+}
+
+static void interleave_tail(uint8_t *dst, const uint8_t *cb, const uint8_t *cr, int x, int count)
+{
+	for (; x < count; x++)
+	{
+		dst[2 * x] = cb[x];
+		dst[2 * x + 1] = cr[x];
+	}
+}
+
+static void interleave_row_scalar(uint8_t *dst, const uint8_t *cb, const uint8_t *cr, int count)
+{
+	interleave_tail(dst, cb, cr, 0, count);
+}
+
+static void downscale_tail(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int x, int count)
+{
+	/* Vertical then horizontal rounding average, the order of the SIMD average instructions. */
+	for (; x < count; x++)
+	{
+		int left = (row0[2 * x] + row1[2 * x] + 1) >> 1;
+		int right = (row0[2 * x + 1] + row1[2 * x + 1] + 1) >> 1;
+		dst[x] = (left + right + 1) >> 1;
+	}
+}
+
+static void downscale_row_scalar(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int count)
+{
+	downscale_tail(dst, row0, row1, 0, count);
+}
+
+static inline uint8_t clamp_u8(int value)
+{
+	return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static void rgba_tail(uint8_t *dst, const uint8_t *luma, const uint8_t *chroma, int x, int width)
+{
+	for (; x < width; x++)
+	{
+		int y = (luma[x] - RGB_Y_OFFSET) * RGB_Y_SCALE + RGB_ROUND;
+		int u = chroma[x & ~1] - 128;
+		int v = chroma[(x & ~1) + 1] - 128;
+
+		dst[4 * x] = clamp_u8((y + RGB_R_V * v) >> RGB_SHIFT);
+		dst[4 * x + 1] = clamp_u8((y - RGB_G_U * u - RGB_G_V * v) >> RGB_SHIFT);
+		dst[4 * x + 2] = clamp_u8((y + RGB_B_U * u) >> RGB_SHIFT);
+		dst[4 * x + 3] = 255;
+	}
+}
+
+static void rgba_row_scalar(uint8_t *dst, const uint8_t *luma, const uint8_t *chroma, int width)
+{
+	rgba_tail(dst, luma, chroma, 0, width);
+}
+
+/**
+ * Copy both planes of an NV12 frame.
+ * @param src input frame.
+ * @param dst output frame.
+ * @param row line copy.
+ */
+static void copy_frame(const struct pixel_frame *src, struct pixel_frame *dst, copy_row_func row)
+{
+	for (int y = 0; y < src->height; y++)
+		row(dst->plane[0] + y * dst->stride[0], src->plane[0] + y * src->stride[0], src->width);
+	for (int y = 0; y < src->height / 2; y++)
+		row(dst->plane[1] + y * dst->stride[1], src->plane[1] + y * src->stride[1], src->width);
+}
+
+/**
+ * Convert an I420 frame to NV12, the luma plane is copied.
+ * @param src input frame.
+ * @param dst output frame.
+ * @param row chroma interleave.
+ */
+static void i420_to_nv12_frame(const struct pixel_frame *src, struct pixel_frame *dst, interleave_row_func row)
+{
+	for (int y = 0; y < src->height; y++)
+		memcpy(dst->plane[0] + y * dst->stride[0], src->plane[0] + y * src->stride[0], src->width);
+	for (int y = 0; y < src->height / 2; y++)
+		row(dst->plane[1] + y * dst->stride[1], src->plane[1] + y * src->stride[1],
+			src->plane[2] + y * src->stride[2], src->width / 2);
+}
+
+/**
+ * Downscale a luma plane by 2 in both directions.
+ * @param src input frame.
+ * @param dst output frame.
+ * @param row 2x2 block average.
+ */
+static void downscale_frame(const struct pixel_frame *src, struct pixel_frame *dst, downscale_row_func row)
+{
+	for (int y = 0; y < src->height / 2; y++)
+	{
+		const uint8_t *row0 = src->plane[0] + 2 * y * src->stride[0];
+		row(dst->plane[0] + y * dst->stride[0], row0, row0 + src->stride[0], src->width / 2);
+	}
+}
+
+/**
+ * Convert an NV12 frame to RGBA, each chroma sample covers 2x2 pixels.
+ * @param src input frame.
+ * @param dst output frame.
+ * @param row line conversion.
+ */
+static void rgba_frame(const struct pixel_frame *src, struct pixel_frame *dst, rgba_row_func row)
+{
+	for (int y = 0; y < src->height; y++)
+		row(dst->plane[0] + y * dst->stride[0], src->plane[0] + y * src->stride[0],
+			src->plane[1] + (y / 2) * src->stride[1], src->width);
+}
+
+static void copy_scalar(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	copy_frame(src, dst, copy_row_scalar);
+}
+
+static void i420_to_nv12_scalar(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	i420_to_nv12_frame(src, dst, interleave_row_scalar);
+}
+
+static void downscale_scalar(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	downscale_frame(src, dst, downscale_row_scalar);
+}
+
+static void rgba_scalar(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	rgba_frame(src, dst, rgba_row_scalar);
+}
+
+#ifdef PIXEL_X86
+static bool cpu_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool cpu_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/* Non-temporal stores keep a frame copied out of the capture buffers from evicting the caches. */
+__attribute__((target("sse2")))
+static void copy_row_sse2(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	int x = 0;
+
+	if (!((uintptr_t)dst & 15))
+	{
+		for (; x + 64 <= bytes; x += 64)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+			__m128i b = _mm_loadu_si128((const __m128i *)(src + x + 16));
+			__m128i c = _mm_loadu_si128((const __m128i *)(src + x + 32));
+			__m128i d = _mm_loadu_si128((const __m128i *)(src + x + 48));
+			_mm_stream_si128((__m128i *)(dst + x), a);
+			_mm_stream_si128((__m128i *)(dst + x + 16), b);
+			_mm_stream_si128((__m128i *)(dst + x + 32), c);
+			_mm_stream_si128((__m128i *)(dst + x + 48), d);
+		}
+	}
+	memcpy(dst + x, src + x, bytes - x);
+}
+
+__attribute__((target("sse2")))
+static void copy_sse2(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	copy_frame(src, dst, copy_row_sse2);
+	_mm_sfence();
+}
+
+__attribute__((target("sse2")))
+static void interleave_row_sse2(uint8_t *dst, const uint8_t *cb, const uint8_t *cr, int count)
+{
+	int x = 0;
+
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i u = _mm_loadu_si128((const __m128i *)(cb + x));
+		__m128i v = _mm_loadu_si128((const __m128i *)(cr + x));
+		_mm_storeu_si128((__m128i *)(dst + 2 * x), _mm_unpacklo_epi8(u, v));
+		_mm_storeu_si128((__m128i *)(dst + 2 * x + 16), _mm_unpackhi_epi8(u, v));
+	}
+	interleave_tail(dst, cb, cr, x, count);
+}
+
+__attribute__((target("sse2")))
+static void i420_to_nv12_sse2(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	i420_to_nv12_frame(src, dst, interleave_row_sse2);
+}
+
+__attribute__((target("sse2")))
+static void downscale_row_sse2(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int count)
+{
+	const __m128i even = _mm_set1_epi16(0xff);
+	int x = 0;
+
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i a = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(row0 + 2 * x)),
+			_mm_loadu_si128((const __m128i *)(row1 + 2 * x)));
+		__m128i b = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(row0 + 2 * x + 16)),
+			_mm_loadu_si128((const __m128i *)(row1 + 2 * x + 16)));
+		a = _mm_avg_epu16(_mm_and_si128(a, even), _mm_srli_epi16(a, 8));
+		b = _mm_avg_epu16(_mm_and_si128(b, even), _mm_srli_epi16(b, 8));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(a, b));
+	}
+	downscale_tail(dst, row0, row1, x, count);
+}
+
+__attribute__((target("sse2")))
+static void downscale_sse2(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	downscale_frame(src, dst, downscale_row_sse2);
+}
+
+__attribute__((target("sse2")))
+static void rgba_row_sse2(uint8_t *dst, const uint8_t *luma, const uint8_t *chroma, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi8(-1);
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i l = _mm_loadu_si128((const __m128i *)(luma + x));
+		__m128i c = _mm_loadu_si128((const __m128i *)(chroma + x));
+		__m128i y_lo = _mm_unpacklo_epi8(l, zero);
+		__m128i y_hi = _mm_unpackhi_epi8(l, zero);
+		__m128i u = _mm_sub_epi16(_mm_and_si128(c, _mm_set1_epi16(0xff)), _mm_set1_epi16(128));
+		__m128i v = _mm_sub_epi16(_mm_srli_epi16(c, 8), _mm_set1_epi16(128));
+		__m128i rv = _mm_mullo_epi16(v, _mm_set1_epi16(RGB_R_V));
+		__m128i guv = _mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(RGB_G_U)),
+			_mm_mullo_epi16(v, _mm_set1_epi16(RGB_G_V)));
+		__m128i bu = _mm_mullo_epi16(u, _mm_set1_epi16(RGB_B_U));
+		__m128i r, g, b, rg, ba;
+
+		y_lo = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y_lo, _mm_set1_epi16(RGB_Y_OFFSET)),
+			_mm_set1_epi16(RGB_Y_SCALE)), _mm_set1_epi16(RGB_ROUND));
+		y_hi = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y_hi, _mm_set1_epi16(RGB_Y_OFFSET)),
+			_mm_set1_epi16(RGB_Y_SCALE)), _mm_set1_epi16(RGB_ROUND));
+
+		/* Each chroma term is duplicated for the two pixels of its pair. */
+		r = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(rv, rv)), RGB_SHIFT),
+			_mm_srai_epi16(_mm_adds_epi16(y_hi, _mm_unpackhi_epi16(rv, rv)), RGB_SHIFT));
+		g = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_subs_epi16(y_lo, _mm_unpacklo_epi16(guv, guv)), RGB_SHIFT),
+			_mm_srai_epi16(_mm_subs_epi16(y_hi, _mm_unpackhi_epi16(guv, guv)), RGB_SHIFT));
+		b = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(bu, bu)), RGB_SHIFT),
+			_mm_srai_epi16(_mm_adds_epi16(y_hi, _mm_unpackhi_epi16(bu, bu)), RGB_SHIFT));
+
+		rg = _mm_unpacklo_epi8(r, g);
+		ba = _mm_unpacklo_epi8(b, alpha);
+		_mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i *)(dst + 4 * x + 16), _mm_unpackhi_epi16(rg, ba));
+		rg = _mm_unpackhi_epi8(r, g);
+		ba = _mm_unpackhi_epi8(b, alpha);
+		_mm_storeu_si128((__m128i *)(dst + 4 * x + 32), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i *)(dst + 4 * x + 48), _mm_unpackhi_epi16(rg, ba));
+	}
+	rgba_tail(dst, luma, chroma, x, width);
+}
+
+__attribute__((target("sse2")))
+static void rgba_sse2(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	rgba_frame(src, dst, rgba_row_sse2);
+}
+
+__attribute__((target("avx2")))
+static void copy_row_avx2(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	int x = 0;
+
+	if (!((uintptr_t)dst & 31))
+	{
+		for (; x + 64 <= bytes; x += 64)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i *)(src + x));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(src + x + 32));
+			_mm256_stream_si256((__m256i *)(dst + x), a);
+			_mm256_stream_si256((__m256i *)(dst + x + 32), b);
+		}
+	}
+	memcpy(dst + x, src + x, bytes - x);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	copy_frame(src, dst, copy_row_avx2);
+	_mm_sfence();
+}
+
+/*
+ * AVX2 unpack and pack instructions work within 128 bit lanes,
+ * a 64 bit permute or a lane permute restores the pixel order before storing.
+ */
+__attribute__((target("avx2")))
+static void interleave_row_avx2(uint8_t *dst, const uint8_t *cb, const uint8_t *cr, int count)
+{
+	int x = 0;
+
+	for (; x + 32 <= count; x += 32)
+	{
+		__m256i u = _mm256_loadu_si256((const __m256i *)(cb + x));
+		__m256i v = _mm256_loadu_si256((const __m256i *)(cr + x));
+		__m256i lo = _mm256_unpacklo_epi8(u, v);
+		__m256i hi = _mm256_unpackhi_epi8(u, v);
+		_mm256_storeu_si256((__m256i *)(dst + 2 * x), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + 2 * x + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	interleave_tail(dst, cb, cr, x, count);
+}
+
+__attribute__((target("avx2")))
+static void i420_to_nv12_avx2(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	i420_to_nv12_frame(src, dst, interleave_row_avx2);
+}
+
+__attribute__((target("avx2")))
+static void downscale_row_avx2(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int count)
+{
+	const __m256i even = _mm256_set1_epi16(0xff);
+	int x = 0;
+
+	for (; x + 32 <= count; x += 32)
+	{
+		__m256i a = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(row0 + 2 * x)),
+			_mm256_loadu_si256((const __m256i *)(row1 + 2 * x)));
+		__m256i b = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(row0 + 2 * x + 32)),
+			_mm256_loadu_si256((const __m256i *)(row1 + 2 * x + 32)));
+		a = _mm256_avg_epu16(_mm256_and_si256(a, even), _mm256_srli_epi16(a, 8));
+		b = _mm256_avg_epu16(_mm256_and_si256(b, even), _mm256_srli_epi16(b, 8));
+		_mm256_storeu_si256((__m256i *)(dst + x),
+			_mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+	}
+	downscale_tail(dst, row0, row1, x, count);
+}
+
+__attribute__((target("avx2")))
+static void downscale_avx2(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	downscale_frame(src, dst, downscale_row_avx2);
+}
+
+__attribute__((target("avx2")))
+static void rgba_row_avx2(uint8_t *dst, const uint8_t *luma, const uint8_t *chroma, int width)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alpha = _mm256_set1_epi8(-1);
+	int x = 0;
+
+	for (; x + 32 <= width; x += 32)
+	{
+		/* Pixels 0-7 and 16-23 are in y_lo, their chroma pairs in the low half of each lane. */
+		__m256i l = _mm256_loadu_si256((const __m256i *)(luma + x));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(chroma + x));
+		__m256i y_lo = _mm256_unpacklo_epi8(l, zero);
+		__m256i y_hi = _mm256_unpackhi_epi8(l, zero);
+		__m256i u = _mm256_sub_epi16(_mm256_and_si256(c, _mm256_set1_epi16(0xff)), _mm256_set1_epi16(128));
+		__m256i v = _mm256_sub_epi16(_mm256_srli_epi16(c, 8), _mm256_set1_epi16(128));
+		__m256i rv = _mm256_mullo_epi16(v, _mm256_set1_epi16(RGB_R_V));
+		__m256i guv = _mm256_add_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(RGB_G_U)),
+			_mm256_mullo_epi16(v, _mm256_set1_epi16(RGB_G_V)));
+		__m256i bu = _mm256_mullo_epi16(u, _mm256_set1_epi16(RGB_B_U));
+		__m256i r, g, b, rg, ba, q0, q1, q2, q3;
+
+		y_lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y_lo, _mm256_set1_epi16(RGB_Y_OFFSET)),
+			_mm256_set1_epi16(RGB_Y_SCALE)), _mm256_set1_epi16(RGB_ROUND));
+		y_hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y_hi, _mm256_set1_epi16(RGB_Y_OFFSET)),
+			_mm256_set1_epi16(RGB_Y_SCALE)), _mm256_set1_epi16(RGB_ROUND));
+
+		r = _mm256_packus_epi16(
+			_mm256_srai_epi16(_mm256_adds_epi16(y_lo, _mm256_unpacklo_epi16(rv, rv)), RGB_SHIFT),
+			_mm256_srai_epi16(_mm256_adds_epi16(y_hi, _mm256_unpackhi_epi16(rv, rv)), RGB_SHIFT));
+		g = _mm256_packus_epi16(
+			_mm256_srai_epi16(_mm256_subs_epi16(y_lo, _mm256_unpacklo_epi16(guv, guv)), RGB_SHIFT),
+			_mm256_srai_epi16(_mm256_subs_epi16(y_hi, _mm256_unpackhi_epi16(guv, guv)), RGB_SHIFT));
+		b = _mm256_packus_epi16(
+			_mm256_srai_epi16(_mm256_adds_epi16(y_lo, _mm256_unpacklo_epi16(bu, bu)), RGB_SHIFT),
+			_mm256_srai_epi16(_mm256_adds_epi16(y_hi, _mm256_unpackhi_epi16(bu, bu)), RGB_SHIFT));
+
+		rg = _mm256_unpacklo_epi8(r, g);
+		ba = _mm256_unpacklo_epi8(b, alpha);
+		q0 = _mm256_unpacklo_epi16(rg, ba);
+		q1 = _mm256_unpackhi_epi16(rg, ba);
+		rg = _mm256_unpackhi_epi8(r, g);
+		ba = _mm256_unpackhi_epi8(b, alpha);
+		q2 = _mm256_unpacklo_epi16(rg, ba);
+		q3 = _mm256_unpackhi_epi16(rg, ba);
+		_mm256_storeu_si256((__m256i *)(dst + 4 * x), _mm256_permute2x128_si256(q0, q1, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + 4 * x + 32), _mm256_permute2x128_si256(q2, q3, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + 4 * x + 64), _mm256_permute2x128_si256(q0, q1, 0x31));
+		_mm256_storeu_si256((__m256i *)(dst + 4 * x + 96), _mm256_permute2x128_si256(q2, q3, 0x31));
+	}
+	rgba_tail(dst, luma, chroma, x, width);
+}
+
+__attribute__((target("avx2")))
+static void rgba_avx2(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	rgba_frame(src, dst, rgba_row_avx2);
+}
+#endif
+
+#ifdef PIXEL_NEON
+static void copy_row_neon(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	int x = 0;
+
+	for (; x + 64 <= bytes; x += 64)
+	{
+		uint8x16_t a = vld1q_u8(src + x);
+		uint8x16_t b = vld1q_u8(src + x + 16);
+		uint8x16_t c = vld1q_u8(src + x + 32);
+		uint8x16_t d = vld1q_u8(src + x + 48);
+		vst1q_u8(dst + x, a);
+		vst1q_u8(dst + x + 16, b);
+		vst1q_u8(dst + x + 32, c);
+		vst1q_u8(dst + x + 48, d);
+	}
+	memcpy(dst + x, src + x, bytes - x);
+}
+
+static void copy_neon(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	copy_frame(src, dst, copy_row_neon);
+}
+
+static void interleave_row_neon(uint8_t *dst, const uint8_t *cb, const uint8_t *cr, int count)
+{
+	int x = 0;
+
+	for (; x + 16 <= count; x += 16)
+	{
+		uint8x16x2_t uv;
+		uv.val[0] = vld1q_u8(cb + x);
+		uv.val[1] = vld1q_u8(cr + x);
+		vst2q_u8(dst + 2 * x, uv);
+	}
+	interleave_tail(dst, cb, cr, x, count);
+}
+
+static void i420_to_nv12_neon(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	i420_to_nv12_frame(src, dst, interleave_row_neon);
+}
+
+static void downscale_row_neon(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int count)
+{
+	int x = 0;
+
+	for (; x + 16 <= count; x += 16)
+	{
+		/* The structure load splits the even and odd pixels of each line. */
+		uint8x16x2_t a = vld2q_u8(row0 + 2 * x);
+		uint8x16x2_t b = vld2q_u8(row1 + 2 * x);
+		uint8x16_t left = vrhaddq_u8(a.val[0], b.val[0]);
+		uint8x16_t right = vrhaddq_u8(a.val[1], b.val[1]);
+		vst1q_u8(dst + x, vrhaddq_u8(left, right));
+	}
+	downscale_tail(dst, row0, row1, x, count);
+}
+
+static void downscale_neon(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	downscale_frame(src, dst, downscale_row_neon);
+}
+
+static void rgba_row_neon(uint8_t *dst, const uint8_t *luma, const uint8_t *chroma, int width)
+{
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		uint8x16_t l = vld1q_u8(luma + x);
+		uint8x8x2_t c = vld2_u8(chroma + x);
+		int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(c.val[0])), vdupq_n_s16(128));
+		int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(c.val[1])), vdupq_n_s16(128));
+		int16x8_t y_lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(l)));
+		int16x8_t y_hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(l)));
+		int16x8x2_t rv = vzipq_s16(vmulq_n_s16(v, RGB_R_V), vmulq_n_s16(v, RGB_R_V));
+		int16x8_t guv_half = vmlaq_n_s16(vmulq_n_s16(u, RGB_G_U), v, RGB_G_V);
+		int16x8x2_t guv = vzipq_s16(guv_half, guv_half);
+		int16x8x2_t bu = vzipq_s16(vmulq_n_s16(u, RGB_B_U), vmulq_n_s16(u, RGB_B_U));
+		uint8x16x4_t rgba;
+
+		y_lo = vaddq_s16(vmulq_n_s16(vsubq_s16(y_lo, vdupq_n_s16(RGB_Y_OFFSET)), RGB_Y_SCALE),
+			vdupq_n_s16(RGB_ROUND));
+		y_hi = vaddq_s16(vmulq_n_s16(vsubq_s16(y_hi, vdupq_n_s16(RGB_Y_OFFSET)), RGB_Y_SCALE),
+			vdupq_n_s16(RGB_ROUND));
+
+		rgba.val[0] = vcombine_u8(vqmovun_s16(vshrq_n_s16(vqaddq_s16(y_lo, rv.val[0]), RGB_SHIFT)),
+			vqmovun_s16(vshrq_n_s16(vqaddq_s16(y_hi, rv.val[1]), RGB_SHIFT)));
+		rgba.val[1] = vcombine_u8(vqmovun_s16(vshrq_n_s16(vqsubq_s16(y_lo, guv.val[0]), RGB_SHIFT)),
+			vqmovun_s16(vshrq_n_s16(vqsubq_s16(y_hi, guv.val[1]), RGB_SHIFT)));
+		rgba.val[2] = vcombine_u8(vqmovun_s16(vshrq_n_s16(vqaddq_s16(y_lo, bu.val[0]), RGB_SHIFT)),
+			vqmovun_s16(vshrq_n_s16(vqaddq_s16(y_hi, bu.val[1]), RGB_SHIFT)));
+		rgba.val[3] = vdupq_n_u8(255);
+		vst4q_u8(dst + 4 * x, rgba);
+	}
+	rgba_tail(dst, luma, chroma, x, width);
+}
+
+static void rgba_neon(const struct pixel_frame *src, struct pixel_frame *dst)
+{
+	rgba_frame(src, dst, rgba_row_neon);
+}
+#endif
+
+const struct pixel_kernel pixel_kernels[] = {
+	{ "copy", "scalar", PIXEL_NV12, PIXEL_NV12, 0, NULL, copy_scalar },
+#ifdef PIXEL_X86
+	{ "copy", "sse2", PIXEL_NV12, PIXEL_NV12, 0, cpu_sse2, copy_sse2 },
+	{ "copy", "avx2", PIXEL_NV12, PIXEL_NV12, 0, cpu_avx2, copy_avx2 },
+#endif
+#ifdef PIXEL_NEON
+	{ "copy", "neon", PIXEL_NV12, PIXEL_NV12, 0, NULL, copy_neon },
+#endif
+	{ "i420_to_nv12", "scalar", PIXEL_I420, PIXEL_NV12, 0, NULL, i420_to_nv12_scalar },
+#ifdef PIXEL_X86
+	{ "i420_to_nv12", "sse2", PIXEL_I420, PIXEL_NV12, 0, cpu_sse2, i420_to_nv12_sse2 },
+	{ "i420_to_nv12", "avx2", PIXEL_I420, PIXEL_NV12, 0, cpu_avx2, i420_to_nv12_avx2 },
+#endif
+#ifdef PIXEL_NEON
+	{ "i420_to_nv12", "neon", PIXEL_I420, PIXEL_NV12, 0, NULL, i420_to_nv12_neon },
+#endif
+	{ "downscale_2x", "scalar", PIXEL_Y, PIXEL_Y, 1, NULL, downscale_scalar },
+#ifdef PIXEL_X86
+	{ "downscale_2x", "sse2", PIXEL_Y, PIXEL_Y, 1, cpu_sse2, downscale_sse2 },
+	{ "downscale_2x", "avx2", PIXEL_Y, PIXEL_Y, 1, cpu_avx2, downscale_avx2 },
+#endif
+#ifdef PIXEL_NEON
+	{ "downscale_2x", "neon", PIXEL_Y, PIXEL_Y, 1, NULL, downscale_neon },
+#endif
+	{ "nv12_to_rgba", "scalar", PIXEL_NV12, PIXEL_RGBA, 0, NULL, rgba_scalar },
+#ifdef PIXEL_X86
+	{ "nv12_to_rgba", "sse2", PIXEL_NV12, PIXEL_RGBA, 0, cpu_sse2, rgba_sse2 },
+	{ "nv12_to_rgba", "avx2", PIXEL_NV12, PIXEL_RGBA, 0, cpu_avx2, rgba_avx2 },
+#endif
+#ifdef PIXEL_NEON
+	{ "nv12_to_rgba", "neon", PIXEL_NV12, PIXEL_RGBA, 0, NULL, rgba_neon },
+#endif
+};
+
+const int pixel_kernel_count = sizeof(pixel_kernels) / sizeof(pixel_kernels[0]);
+
+bool pixel_kernel_supported(const struct pixel_kernel *kernel)
+{
+	return !kernel->supported || kernel->supported();
+}
+
+const struct pixel_kernel *pixel_kernel_find(const char *name)
+{
+	const struct pixel_kernel *found = NULL;
+
+	for (int i = 0; i < pixel_kernel_count; i++)
+		if (!strcmp(pixel_kernels[i].name, name) && pixel_kernel_supported(&pixel_kernels[i]))
+			found = &pixel_kernels[i];
+	return found;
+}
+
+size_t pixel_layout_size(enum pixel_layout layout, int width, int height)
+{
+	size_t luma = (size_t)width * height;
+
+	switch (layout)
+	{
+		case PIXEL_NV12:
+		case PIXEL_I420:
+			return luma + luma / 2;
+		case PIXEL_Y:
+			return luma;
+		case PIXEL_RGBA:
+			return 4 * luma;
+	}
+	return 0;
+}
+
+void pixel_frame_init(struct pixel_frame *frame, enum pixel_layout layout, int width, int height, uint8_t *memory)
+{
+	size_t luma = (size_t)width * height;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->width = width;
+	frame->height = height;
+	frame->plane[0] = memory;
+	frame->stride[0] = layout == PIXEL_RGBA ? 4 * width : width;
+	if (layout == PIXEL_NV12)
+	{
+		frame->plane[1] = memory + luma;
+		frame->stride[1] = width;
+	}
+	else if (layout == PIXEL_I420)
+	{
+		frame->plane[1] = memory + luma;
+		frame->plane[2] = memory + luma + luma / 4;
+		frame->stride[1] = frame->stride[2] = width / 2;
+	}
+}
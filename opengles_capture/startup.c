@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Time to first frame broken down by startup phase.
+ * @file startup.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "startup.h"
+#include "log.h"
+
+struct startup_timing g_startup = {0};
+
+/** Name of the calling thread in the report. */
+static __thread const char *t_thread_name = "main";
+
+/**
+ * Read a clock.
+ * @param clock clock to read.
+ * @return time in nanoseconds.
+ */
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Estimate when the process started on the monotonic clock.
+ * The start time in /proc is counted in scheduler ticks since boot, on the boot time clock.
+ * @param now_ns current monotonic time.
+ * @return monotonic process start time in nanoseconds, 0 when unknown.
+ */
+static uint64_t process_start_ns(uint64_t now_ns)
+{
+	char stat[1024];
+	unsigned long long start_ticks;
+	uint64_t boot_ns = clock_ns(CLOCK_BOOTTIME);
+	uint64_t start_ns;
+	long hz = sysconf(_SC_CLK_TCK);
+	const char *fields;
+	FILE *file;
+	size_t size;
+
+	file = fopen("/proc/self/stat", "r");
+	if (!file) return 0;
+	size = fread(stat, 1, sizeof(stat) - 1, file);
+	fclose(file);
+	stat[size] = '\0';
+
+	/* The command name may hold spaces, fields are counted after its closing parenthesis. */
+	fields = strrchr(stat, ')');
+	if (!fields || hz <= 0 || sscanf(fields + 2,
+		"%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+		&start_ticks) != 1)
+		return 0;
+
+	start_ns = start_ticks * (1000000000ull / hz);
+	if (start_ns > boot_ns || boot_ns - start_ns > now_ns) return 0;
+	return now_ns - (boot_ns - start_ns);
+}
+
+void startup_init(void)
+{
+	memset(&g_startup, 0, sizeof(g_startup));
+	g_startup.origin_ns = clock_ns(CLOCK_MONOTONIC);
+	g_startup.process_ns = process_start_ns(g_startup.origin_ns);
+}
+
+void startup_thread_name(const char *name)
+{
+	t_thread_name = name;
+}
+
+uint64_t startup_begin(void)
+{
+	return clock_ns(CLOCK_MONOTONIC);
+}
+
+void startup_end(const char *name, uint64_t begin_ns)
+{
+	uint64_t end_ns = clock_ns(CLOCK_MONOTONIC);
+	uint32_t slot = __atomic_fetch_add(&g_startup.count, 1, __ATOMIC_RELAXED);
+	struct startup_phase *phase;
+
+	if (slot >= STARTUP_PHASES) return;
+	phase = &g_startup.phases[slot];
+	phase->thread = t_thread_name;
+	phase->begin_ns = begin_ns;
+	phase->end_ns = end_ns;
+	__atomic_store_n(&phase->name, name, __ATOMIC_RELEASE);
+}
+
+/**
+ * Order phases by start time.
+ * @param a first phase.
+ * @param b second phase.
+ * @return comparison result for qsort.
+ */
+static int compare_phases(const void *a, const void *b)
+{
+	const struct startup_phase *pa = a;
+	const struct startup_phase *pb = b;
+	return pa->begin_ns < pb->begin_ns ? -1 : pa->begin_ns > pb->begin_ns;
+}
+
+void startup_report(uint64_t first_frame_ns)
+{
+	struct startup_phase phases[STARTUP_PHASES];
+	uint64_t origin = g_startup.origin_ns;
+	uint64_t serial = 0;
+	int count = 0;
+
+	if (g_startup.reported || !origin) return;
+	g_startup.reported = 1;
+
+	for (uint32_t i = 0; i < STARTUP_PHASES && i < __atomic_load_n(&g_startup.count, __ATOMIC_RELAXED); i++)
+	{
+		if (!__atomic_load_n(&g_startup.phases[i].name, __ATOMIC_ACQUIRE)) continue;
+		phases[count] = g_startup.phases[i];
+		serial += phases[count].end_ns - phases[count].begin_ns;
+		count++;
+	}
+	qsort(phases, count, sizeof(phases[0]), compare_phases);
+
+	LOGS_INF("Time to first frame %.3f ms from setup, the phases add up to %.3f ms run one after another",
+		(first_frame_ns - origin) / 1e6, serial / 1e6);
+	if (g_startup.process_ns)
+		LOGS_INF("Time to first frame %.0f ms from process start", (first_frame_ns - g_startup.process_ns) / 1e6);
+	for (int i = 0; i < count; i++)
+	{
+		LOGS_INF("\t%-22s %-8s start %9.3f ms end %9.3f ms duration %9.3f ms", phases[i].name,
+			phases[i].thread, ((int64_t)(phases[i].begin_ns - origin)) / 1e6,
+			((int64_t)(phases[i].end_ns - origin)) / 1e6, (phases[i].end_ns - phases[i].begin_ns) / 1e6);
+	}
+}
@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Procedurally generated NV12 frames as an emulated capture device.
+ * @file synthetic_source.c
+ *
+ * Selected with -d synthetic:CONTENT at the size of -S and the rate of -F, -F max generates as fast as
+ * buffers are returned. CONTENT is one of:
+ * - gradient, diagonal luma and chroma ramps moving every frame (default).
+ * - noise, pseudo random pixels seeded by the frame number, the worst case for caches and compression.
+ * - bars, rolling, squares, the color bars, color bars with a rolling bar and color squares of the
+ *   sensor test patterns, also selected at run time through test_pattern().
+ *
+ * Every frame is deterministic in its frame number. Rows are built with GCC vector extensions, 16 bytes
+ * per operation on NEON or SSE2, or copied from rows prepared at open, so generating a frame costs about
+ * as much as writing it and does not distort what is measured downstream.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "options.h"
+#include "capture_source.h"
+#include "log.h"
+
+/** 16 unsigned bytes, loads and stores may be unaligned. */
+typedef uint8_t v16u8 __attribute__((vector_size(16), aligned(1)));
+/** 2 unsigned 64 bit words, loads and stores may be unaligned. */
+typedef uint64_t v2u64 __attribute__((vector_size(16), aligned(1)));
+
+/** Number of bars or squares across the frame, as many as colors. */
+#define SYNTHETIC_COLORS 8
+/** Luma rows the gradient moves per frame. */
+#define GRADIENT_SPEED 2
+/** Fraction of the frame height covered by the rolling bar. */
+#define ROLLING_BAR_FRACTION 16
+/** Rows the rolling bar moves per frame. */
+#define ROLLING_BAR_SPEED 4
+
+/**
+ * Content of the generated frames.
+ */
+enum synthetic_content
+{
+	/** Moving diagonal luma and chroma ramps. */
+	SYNTHETIC_GRADIENT,
+	/** Pseudo random pixels. */
+	SYNTHETIC_NOISE,
+	/** Vertical color bars, test pattern 1. */
+	SYNTHETIC_BARS,
+	/** Color bars crossed by a moving white bar, test pattern 2. */
+	SYNTHETIC_ROLLING,
+	/** Color squares, test pattern 3. */
+	SYNTHETIC_SQUARES,
+};
+
+/** Name of each content on the command line. */
+static const char * const content_names[] = {
+	[SYNTHETIC_GRADIENT] = "gradient",
+	[SYNTHETIC_NOISE] = "noise",
+	[SYNTHETIC_BARS] = "bars",
+	[SYNTHETIC_ROLLING] = "rolling",
+	[SYNTHETIC_SQUARES] = "squares",
+};
+
+/** 75% color bars in limited range BT.601, white, yellow, cyan, green, magenta, red, blue and black. */
+static const uint8_t bar_colors[SYNTHETIC_COLORS][3] = {
+	{ 180, 128, 128 }, { 162, 44, 142 }, { 131, 156, 44 }, { 112, 72, 58 },
+	{ 84, 184, 198 }, { 65, 100, 212 }, { 35, 212, 114 }, { 16, 128, 128 },
+};
+
+/**
+ * Generator state.
+ */
+struct synthetic
+{
+	/** Content generated when no test pattern is selected. */
+	enum synthetic_content content;
+	/** Test pattern selected at run time, 0 for content, written by the display thread. */
+	int pattern;
+	/** Horizontal luma ramp of one row. */
+	uint8_t *ramp_luma;
+	/** Horizontal Cb ramp interleaved with a falling Cr ramp, one chroma row. */
+	uint8_t *ramp_chroma;
+	/** Luma of one row of color bars. */
+	uint8_t *bars_luma;
+	/** Chroma of one row of color bars. */
+	uint8_t *bars_chroma;
+	/** Luma of two rows of color squares, each band of squares starts further into it. */
+	uint8_t *squares_luma;
+	/** Chroma of two rows of color squares. */
+	uint8_t *squares_chroma;
+	/** Width in pixels of one bar or square. */
+	uint32_t square;
+};
+
+/**
+ * Add a value to every byte of a row, wrapping around.
+ * @param dst destination row.
+ * @param src source row.
+ * @param add value added to each byte, pairs of bytes alternate between the low and high byte.
+ * @param size row length in bytes.
+ */
+static void row_add(uint8_t *dst, const uint8_t *src, uint16_t add, size_t size)
+{
+	v16u8 offset;
+	size_t x = 0;
+
+	for (int i = 0; i < 16; i++)
+		offset[i] = i & 1 ? add >> 8 : add & 0xff;
+	for (; x + 16 <= size; x += 16)
+		*(v16u8 *)(dst + x) = *(const v16u8 *)(src + x) + offset;
+	for (; x < size; x++)
+		dst[x] = src[x] + (x & 1 ? add >> 8 : add & 0xff);
+}
+
+/**
+ * Fill a plane with xorshift128+ noise, two generators run in the vector lanes.
+ * @param dst plane to fill.
+ * @param size plane size in bytes.
+ * @param seed seed of the generators.
+ */
+static void plane_noise(uint8_t *dst, size_t size, uint64_t seed)
+{
+	v2u64 s0 = { seed * 0x9e3779b97f4a7c15ull + 1, seed ^ 0xbf58476d1ce4e5b9ull };
+	v2u64 s1 = { ~seed * 0x94d049bb133111ebull, seed + 0x632be59bd9b4e5bbull };
+	v2u64 x;
+	v2u64 y;
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		x = s0;
+		y = s1;
+		s0 = y;
+		x ^= x << 23;
+		s1 = x ^ y ^ (x >> 17) ^ (y >> 26);
+		*(v2u64 *)(dst + i) = s1 + y;
+	}
+	for (; i < size; i++)
+		dst[i] = (s1[0] + s0[1]) >> ((i & 7) * 8);
+}
+
+/**
+ * Generate the moving gradient.
+ * @param ctx generator state.
+ * @param dev emulated device.
+ * @param frame frame number.
+ * @param luma luma plane.
+ * @param chroma interleaved CbCr plane.
+ */
+static void fill_gradient(const struct synthetic *ctx, const struct source_device *dev, uint64_t frame,
+	uint8_t *luma, uint8_t *chroma)
+{
+	for (uint32_t y = 0; y < dev->height; y++)
+		row_add(luma + y * dev->width, ctx->ramp_luma, (uint8_t)(y + frame * GRADIENT_SPEED) * 0x101, dev->width);
+	for (uint32_t y = 0; y < dev->height / 2; y++)
+	{
+		uint8_t cb = frame;
+		uint8_t cr = y * 256 / (dev->height / 2);
+		row_add(chroma + y * dev->width, ctx->ramp_chroma, cr << 8 | cb, dev->width);
+	}
+}
+
+/**
+ * Generate color bars, optionally crossed by the rolling bar.
+ * @param ctx generator state.
+ * @param dev emulated device.
+ * @param frame frame number, moves the rolling bar.
+ * @param luma luma plane.
+ * @param chroma interleaved CbCr plane.
+ * @param rolling draw the rolling bar.
+ */
+static void fill_bars(const struct synthetic *ctx, const struct source_device *dev, uint64_t frame,
+	uint8_t *luma, uint8_t *chroma, bool rolling)
+{
+	uint32_t bar = dev->height / ROLLING_BAR_FRACTION;
+	uint32_t top = frame * ROLLING_BAR_SPEED % dev->height;
+
+	for (uint32_t y = 0; y < dev->height; y++)
+	{
+		if (rolling && (y + dev->height - top) % dev->height < bar)
+			memset(luma + y * dev->width, 235, dev->width);
+		else
+			memcpy(luma + y * dev->width, ctx->bars_luma, dev->width);
+	}
+	for (uint32_t y = 0; y < dev->height / 2; y++)
+	{
+		if (rolling && (y * 2 + dev->height - top) % dev->height < bar)
+			memset(chroma + y * dev->width, 128, dev->width);
+		else
+			memcpy(chroma + y * dev->width, ctx->bars_chroma, dev->width);
+	}
+}
+
+/**
+ * Generate color squares, each band of squares shifted by one color from the band above.
+ * @param ctx generator state.
+ * @param dev emulated device.
+ * @param luma luma plane.
+ * @param chroma interleaved CbCr plane.
+ */
+static void fill_squares(const struct synthetic *ctx, const struct source_device *dev, uint8_t *luma, uint8_t *chroma)
+{
+	for (uint32_t y = 0; y < dev->height; y++)
+	{
+		uint32_t shift = y / ctx->square % SYNTHETIC_COLORS * ctx->square;
+		memcpy(luma + y * dev->width, ctx->squares_luma + shift, dev->width);
+	}
+	for (uint32_t y = 0; y < dev->height / 2; y++)
+	{
+		uint32_t shift = y * 2 / ctx->square % SYNTHETIC_COLORS * ctx->square;
+		memcpy(chroma + y * dev->width, ctx->squares_chroma + shift, dev->width);
+	}
+}
+
+/**
+ * Generate a frame of the selected test pattern or content.
+ * @param dev emulated device.
+ * @param frame frame number.
+ * @param luma luma plane of the buffer.
+ * @param chroma interleaved CbCr plane of the buffer.
+ */
+static void synthetic_fill(struct source_device *dev, uint64_t frame, uint8_t *luma, uint8_t *chroma)
+{
+	const struct synthetic *ctx = dev->context;
+	int pattern = __atomic_load_n(&ctx->pattern, __ATOMIC_RELAXED);
+	enum synthetic_content content = pattern ? (enum synthetic_content)(SYNTHETIC_BARS + pattern - 1) : ctx->content;
+
+	switch (content)
+	{
+		case SYNTHETIC_GRADIENT:
+			fill_gradient(ctx, dev, frame, luma, chroma);
+			break;
+
+		case SYNTHETIC_NOISE:
+			plane_noise(luma, dev->width * dev->height, frame);
+			plane_noise(chroma, dev->width * dev->height / 2, ~frame);
+			break;
+
+		case SYNTHETIC_BARS:
+		case SYNTHETIC_ROLLING:
+			fill_bars(ctx, dev, frame, luma, chroma, content == SYNTHETIC_ROLLING);
+			break;
+
+		case SYNTHETIC_SQUARES:
+			fill_squares(ctx, dev, luma, chroma);
+			break;
+	}
+}
+
+/**
+ * Select a sensor test pattern or go back to the generated content.
+ * @param dev emulated device.
+ * @param pattern 0 for the content, 1 for color bars, 2 for rolling bar and 3 for color squares.
+ * @return error status of the request. Value 0 is returned on success.
+ */
+static int synthetic_test_pattern(struct source_device *dev, int pattern)
+{
+	struct synthetic *ctx = dev->context;
+
+	if (pattern < 0 || pattern > SYNTHETIC_SQUARES - SYNTHETIC_BARS + 1) return -EINVAL;
+	__atomic_store_n(&ctx->pattern, pattern, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**
+ * Release the prepared rows.
+ * @param dev emulated device.
+ */
+static void synthetic_close(struct source_device *dev)
+{
+	struct synthetic *ctx = dev->context;
+
+	if (!ctx) return;
+	free(ctx->ramp_luma);
+	free(ctx->ramp_chroma);
+	free(ctx->bars_luma);
+	free(ctx->bars_chroma);
+	free(ctx->squares_luma);
+	free(ctx->squares_chroma);
+	free(ctx);
+	dev->context = NULL;
+}
+
+/**
+ * Choose the content and prepare the rows every frame is built from.
+ * @param dev emulated device being opened.
+ * @param path name of the content, empty for the gradient.
+ * @param opt User selected program configuration options.
+ * @return error status of the setup. Value 0 is returned on success.
+ */
+static int synthetic_open(struct source_device *dev, const char *path, struct options *opt)
+{
+	struct synthetic *ctx;
+	uint32_t width = opt->width;
+	int content = -1;
+
+	for (int i = 0; i < (int)(sizeof(content_names) / sizeof(content_names[0])); i++)
+		if (!strcmp(path, content_names[i])) content = i;
+	if (!path[0]) content = SYNTHETIC_GRADIENT;
+	if (content < 0)
+	{
+		LOGS_ERR("Unknown synthetic content %s, use gradient, noise, bars, rolling or squares", path);
+		return -EINVAL;
+	}
+	if (width < SYNTHETIC_COLORS * 2)
+	{
+		LOGS_ERR("Synthetic frames must be at least %d pixels wide", SYNTHETIC_COLORS * 2);
+		return -EINVAL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) return -ENOMEM;
+	dev->context = ctx;
+	ctx->content = content;
+	ctx->ramp_luma = malloc(width);
+	ctx->ramp_chroma = malloc(width);
+	ctx->bars_luma = malloc(width);
+	ctx->bars_chroma = malloc(width);
+	ctx->squares_luma = malloc(width * 2);
+	ctx->squares_chroma = malloc(width * 2);
+	if (!ctx->ramp_luma || !ctx->ramp_chroma || !ctx->bars_luma || !ctx->bars_chroma ||
+		!ctx->squares_luma || !ctx->squares_chroma)
+		return -ENOMEM;
+
+	/* Squares are as wide as the bars and rounded to whole chroma samples. */
+	ctx->square = width / SYNTHETIC_COLORS & ~1u;
+	for (uint32_t x = 0; x < width; x++)
+	{
+		const uint8_t *bar = bar_colors[x * SYNTHETIC_COLORS / width];
+		ctx->ramp_luma[x] = x * 256 / width;
+		ctx->ramp_chroma[x] = x & 1 ? 255 - (x & ~1u) * 256 / width : x * 256 / width;
+		ctx->bars_luma[x] = bar[0];
+		ctx->bars_chroma[x] = bar[1 + (x & 1)];
+	}
+	for (uint32_t x = 0; x < width * 2; x++)
+	{
+		const uint8_t *square = bar_colors[x / ctx->square % SYNTHETIC_COLORS];
+		ctx->squares_luma[x] = square[0];
+		ctx->squares_chroma[x] = square[1 + (x & 1)];
+	}
+
+	dev->width = width;
+	dev->height = opt->height;
+	dev->frames = 0;
+	dev->interval_ns = opt->fps ? 1000000000ull / opt->fps : 0;
+	LOGS_INF("Generating %s frames", content_names[content]);
+	return 0;
+}
+
+/** Procedurally generated frames, selected with -d synthetic:CONTENT. */
+const struct capture_source synthetic_source = {
+	.prefix = "synthetic:",
+	.open = synthetic_open,
+	.fill = synthetic_fill,
+	.test_pattern = synthetic_test_pattern,
+	.close = synthetic_close,
+};
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Low overhead stage tracing exported as Chrome trace event JSON.
+ * @file trace.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "log.h"
+
+struct trace_buffer g_trace = {0};
+__thread uint32_t g_trace_tid = 0;
+
+uint32_t trace_thread_id(void)
+{
+	if (!g_trace_tid) g_trace_tid = syscall(SYS_gettid);
+	return g_trace_tid;
+}
+
+int trace_init(const char *path)
+{
+	size_t size = sizeof(struct trace_event) * TRACE_EVENTS;
+
+	g_trace.events = malloc(size);
+	if (!g_trace.events)
+	{
+		LOGS_ERR("Unable to allocate %zu byte trace buffer", size);
+		return -ENOMEM;
+	}
+	/* Touch every page now so recording never takes a page fault. */
+	memset(g_trace.events, 0, size);
+	g_trace.path = path;
+	g_trace.next = 0;
+	g_trace.num_threads = 0;
+	__atomic_store_n(&g_trace.enabled, true, __ATOMIC_RELEASE);
+	LOGS_INF("Tracing %d spans to %s", TRACE_EVENTS, path);
+	return 0;
+}
+
+void trace_thread_name(const char *name)
+{
+	uint32_t tid = trace_thread_id();
+
+	if (!g_trace.enabled) return;
+	for (int i = 0; i < g_trace.num_threads; i++)
+	{
+		if (g_trace.thread_ids[i] == tid)
+		{
+			g_trace.thread_names[i] = name;
+			return;
+		}
+	}
+	if (g_trace.num_threads < TRACE_THREADS)
+	{
+		g_trace.thread_ids[g_trace.num_threads] = tid;
+		g_trace.thread_names[g_trace.num_threads] = name;
+		g_trace.num_threads++;
+	}
+}
+
+int trace_dump(void)
+{
+	uint64_t next = __atomic_load_n(&g_trace.next, __ATOMIC_ACQUIRE);
+	uint64_t first = next > TRACE_EVENTS ? next - TRACE_EVENTS : 0;
+	const char *separator = "";
+	int pid = getpid();
+	int count = 0;
+	FILE *file;
+
+	if (!g_trace.events) return -EINVAL;
+	file = fopen(g_trace.path, "w");
+	if (!file)
+	{
+		LOGS_ERR("Unable to write trace %s: %s", g_trace.path, strerror(errno));
+		return -errno;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (int i = 0; i < g_trace.num_threads; i++)
+	{
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+			separator, pid, g_trace.thread_ids[i], g_trace.thread_names[i]);
+		separator = ",";
+	}
+
+	/* Complete events in microseconds, the sequence number links the stages of one frame across threads. */
+	for (uint64_t slot = first; slot < next; slot++)
+	{
+		struct trace_event event = g_trace.events[slot & (TRACE_EVENTS - 1)];
+		event.name = __atomic_load_n(&g_trace.events[slot & (TRACE_EVENTS - 1)].name, __ATOMIC_ACQUIRE);
+		if (!event.name) continue;
+
+		fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+			separator, event.name, pid, event.tid, event.begin_ns / 1e3, (event.end_ns - event.begin_ns) / 1e3);
+		if (event.sequence != TRACE_NO_SEQUENCE)
+			fprintf(file, ",\"args\":{\"sequence\":%u}", event.sequence);
+		fputc('}', file);
+		separator = ",";
+		count++;
+	}
+	fprintf(file, "\n]}\n");
+
+	if (fclose(file))
+	{
+		LOGS_ERR("Unable to write trace %s: %s", g_trace.path, strerror(errno));
+		return -errno;
+	}
+	LOGS_INF("Wrote %d trace spans to %s", count, g_trace.path);
+	return 0;
+}
+
+void trace_close(void)
+{
+	__atomic_store_n(&g_trace.enabled, false, __ATOMIC_RELEASE);
+	free(g_trace.events);
+	g_trace.events = NULL;
+}
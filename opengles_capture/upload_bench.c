@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Offscreen benchmark of the texture upload render methods.
+ * @file upload_bench.c
+ *
+ * Every render method uploads and draws the same NV12 frames on the offscreen display backend
+ * at each frame size, without a window or a capture device.
+ * Methods the driver does not support are reported as such.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <linux/dma-buf.h>
+
+#include "options.h"
+#include "display.h"
+#include "dmabuf_pool.h"
+#include "log.h"
+
+/** Frames rendered before the measurement starts, sizes the buffers and imports every frame. */
+#define BENCH_WARMUP_FRAMES 16
+/** Minimum number of measured frames, -n selects more. */
+#define BENCH_MIN_FRAMES 100
+/** Number of distinct NV12 frames cycled through, like the buffers of a capture device. */
+#define BENCH_BUFFERS 4
+
+/** Frame sizes measured by default, the -S size is added when it is not one of them. */
+static const struct {
+	int width;
+	int height;
+} bench_sizes[] = {
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+	{ 3840, 2160 },
+};
+
+/** Render methods compared at every size. */
+static const struct {
+	int method;
+	const char *name;
+} bench_methods[] = {
+	{ RENDER_COPY, "copy" },
+	{ RENDER_PBO, "pbo" },
+	{ RENDER_TEX_STORAGE, "storage" },
+	{ RENDER_DMABUF_IMPORT, "dmabuf" },
+};
+
+/**
+ * NV12 frames uploaded by the benchmark.
+ */
+struct bench_frames
+{
+	/** DMA buffers of the frames, count is 0 when the frames live in plain memory. */
+	struct dmabuf_pool pool;
+	/** Luma and chroma plane of each frame. */
+	void *plane[BENCH_BUFFERS][2];
+	/** Frame width in pixels. */
+	int width;
+	/** Frame height in pixels. */
+	int height;
+};
+
+/**
+ * Measurement of one render method at one frame size.
+ */
+struct bench_result
+{
+	/** Frame width in pixels. */
+	int width;
+	/** Frame height in pixels. */
+	int height;
+	/** Name of the render method. */
+	const char *method;
+	/** The render method could be setup on this driver and frame memory. */
+	bool supported;
+	/** Number of measured frames. */
+	int frames;
+	/** NV12 frame bytes made available as textures per second of wall time. */
+	double mb_per_s;
+	/** Average wall time per frame including the GPU work in microseconds. */
+	double wall_us;
+	/** Average CPU time of the rendering thread per frame in microseconds. */
+	double cpu_us;
+	/** Average GPU time of the uploads and draw per frame in microseconds, negative when not measured. */
+	double gpu_us;
+};
+
+/**
+ * Read a clock.
+ * @param clock clock to read.
+ * @return time in nanoseconds.
+ */
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Allocate and fill the NV12 frames of one size.
+ * DMA buffers are used when available so the import method can be measured, plain memory otherwise.
+ * @param frames frames to allocate, zero initialized.
+ * @param width frame width in pixels.
+ * @param height frame height in pixels.
+ * @return error status of the allocation. Value 0 is returned on success.
+ */
+static int bench_frames_alloc(struct bench_frames *frames, int width, int height)
+{
+	uint32_t size[2] = { (uint32_t)width * height, (uint32_t)width * height / 2 };
+
+	frames->width = width;
+	frames->height = height;
+	if (!dmabuf_pool_alloc(&frames->pool, BENCH_BUFFERS, 2, size))
+	{
+		for (int i = 0; i < BENCH_BUFFERS; i++)
+			for (int p = 0; p < 2; p++)
+				frames->plane[i][p] = frames->pool.addr[i][p];
+	}
+	else
+	{
+		LOGS_WRN("DMA buffers are not available, the dmabuf method is skipped");
+		for (int i = 0; i < BENCH_BUFFERS; i++)
+		{
+			for (int p = 0; p < 2; p++)
+			{
+				if (posix_memalign(&frames->plane[i][p], 4096, size[p])) return -ENOMEM;
+			}
+		}
+	}
+
+	/* A different gray per frame, the upload cost does not depend on the content. */
+	for (int i = 0; i < BENCH_BUFFERS; i++)
+	{
+		for (int p = 0; p < 2; p++)
+		{
+			if (frames->pool.count) dmabuf_sync(frames->pool.fd[i][p], DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+			memset(frames->plane[i][p], p ? 128 : 64 + 32 * i, size[p]);
+			if (frames->pool.count) dmabuf_sync(frames->pool.fd[i][p], DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Release the frames allocated by bench_frames_alloc().
+ * @param frames frames to release.
+ */
+static void bench_frames_free(struct bench_frames *frames)
+{
+	if (frames->pool.count)
+	{
+		dmabuf_pool_free(&frames->pool);
+	}
+	else
+	{
+		for (int i = 0; i < BENCH_BUFFERS; i++)
+			for (int p = 0; p < 2; p++)
+				free(frames->plane[i][p]);
+	}
+	memset(frames, 0, sizeof(*frames));
+}
+
+/**
+ * Point the render context at one of the frames and render it.
+ * @param disp Display Data management structure with GPU handles.
+ * @param frames frames being uploaded.
+ * @param sequence frame number, selects the frame.
+ * @return error status of the render. Value 0 is returned on success.
+ */
+static int bench_render(struct display_context *disp, struct bench_frames *frames, uint32_t sequence)
+{
+	struct render_context *render_ctx = &disp->render_ctx;
+	int index = sequence % BENCH_BUFFERS;
+
+	render_ctx->index = index;
+	render_ctx->sequence = sequence;
+	for (int p = 0; p < 2; p++)
+	{
+		render_ctx->buffers[p] = frames->plane[index][p];
+		render_ctx->dma_buf_fd[p] = frames->pool.count ? frames->pool.fd[index][p] : -1;
+	}
+	return disp->render_func(disp);
+}
+
+/**
+ * Collect the GPU time of every frame rendered so far.
+ * @param disp Display Data management structure with GPU handles.
+ * @return sum of the stage times in nanoseconds, the frame count is returned in count.
+ */
+static uint64_t bench_gpu_total(struct display_context *disp, uint64_t *count)
+{
+	uint64_t total = 0;
+
+	/* Every query is complete after glFinish(), starting a frame collects them. */
+	glFinish();
+	gpu_timer_frame(&disp->gpu_timer);
+	for (int stage = 0; stage < GPU_STAGES; stage++)
+		total += disp->gpu_timer.total_ns[stage];
+	*count = disp->gpu_timer.count[GPU_DRAW];
+	return total;
+}
+
+/**
+ * Measure one render method with the frames of one size.
+ * @param disp Display Data management structure with GPU handles, the offscreen target is current.
+ * @param frames frames to upload.
+ * @param method render method, see enum render_method.
+ * @param count number of measured frames.
+ * @param result measurement filled in, supported is false when the method can not be setup.
+ * @return error status of the measurement. Value 0 is returned on success or an unsupported method.
+ */
+static int bench_method(struct display_context *disp, struct bench_frames *frames, int method, int count,
+	struct bench_result *result)
+{
+	struct render_context *render_ctx = &disp->render_ctx;
+	uint64_t gpu_begin, gpu_end, gpu_frames_begin, gpu_frames_end;
+	uint64_t wall_begin, wall_end, cpu_begin, cpu_end;
+	int ret = 0;
+
+	if (method == RENDER_DMABUF_IMPORT && !frames->pool.count) return 0;
+
+	memset(render_ctx, 0, sizeof(*render_ctx));
+	render_ctx->num_buffers = 2;
+	render_ctx->width = frames->width;
+	render_ctx->height = frames->height;
+	render_ctx->stride[0] = render_ctx->stride[1] = frames->width;
+	disp->render_method = method;
+	disp->gpu_timing = true;
+	if (display_frame_setup(disp, render_ctx))
+	{
+		display_frame_release(disp);
+		while (glGetError() != GL_NO_ERROR);
+		return 0;
+	}
+	result->supported = true;
+	result->frames = count;
+
+	for (int i = 0; i < BENCH_WARMUP_FRAMES && !ret; i++)
+		ret = bench_render(disp, frames, i);
+	gpu_begin = bench_gpu_total(disp, &gpu_frames_begin);
+
+	wall_begin = clock_ns(CLOCK_MONOTONIC);
+	cpu_begin = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	for (int i = 0; i < count && !ret; i++)
+		ret = bench_render(disp, frames, BENCH_WARMUP_FRAMES + i);
+	glFinish();
+	cpu_end = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	wall_end = clock_ns(CLOCK_MONOTONIC);
+	gpu_end = bench_gpu_total(disp, &gpu_frames_end);
+
+	result->wall_us = (wall_end - wall_begin) / 1e3 / count;
+	result->cpu_us = (cpu_end - cpu_begin) / 1e3 / count;
+	result->mb_per_s = (double)frames->width * frames->height * 3 / 2 / result->wall_us;
+	result->gpu_us = -1.0;
+	if (disp->gpu_timer.enabled && gpu_frames_end > gpu_frames_begin)
+		result->gpu_us = (gpu_end - gpu_begin) / 1e3 / (gpu_frames_end - gpu_frames_begin);
+
+	display_frame_release(disp);
+	if (ret) LOGS_ERR("Render %s failed at %dx%d", result->method, frames->width, frames->height);
+	return ret;
+}
+
+/**
+ * Print the measurements as a table.
+ * @param results measurements.
+ * @param num_results number of measurements.
+ */
+static void bench_print(const struct bench_result *results, int num_results)
+{
+	printf("%-11s %-8s %8s %10s %10s %10s %10s\n",
+		"size", "method", "frames", "MB/s", "wall us", "cpu us", "gpu us");
+	for (int i = 0; i < num_results; i++)
+	{
+		const struct bench_result *r = &results[i];
+		char size[24];
+
+		snprintf(size, sizeof(size), "%dx%d", r->width, r->height);
+		if (!r->supported)
+		{
+			printf("%-11s %-8s %8s\n", size, r->method, "unsupported");
+			continue;
+		}
+		printf("%-11s %-8s %8d %10.1f %10.1f %10.1f ", size, r->method, r->frames,
+			r->mb_per_s, r->wall_us, r->cpu_us);
+		if (r->gpu_us < 0) printf("%10s\n", "-");
+		else               printf("%10.1f\n", r->gpu_us);
+	}
+}
+
+/**
+ * Write the measurements as JSON.
+ * @param path file to write, "-" for stdout.
+ * @param results measurements.
+ * @param num_results number of measurements.
+ * @return error status of the write. Value 0 is returned on success.
+ */
+static int bench_write_json(const char *path, const struct bench_result *results, int num_results)
+{
+	FILE *file = strcmp(path, "-") ? fopen(path, "w") : stdout;
+
+	if (!file)
+	{
+		LOGS_ERR("Unable to open %s: %s", path, strerror(errno));
+		return -errno;
+	}
+	fprintf(file, "{\"results\": [\n");
+	for (int i = 0; i < num_results; i++)
+	{
+		const struct bench_result *r = &results[i];
+
+		fprintf(file, "  {\"width\": %d, \"height\": %d, \"method\": \"%s\", \"supported\": %s",
+			r->width, r->height, r->method, r->supported ? "true" : "false");
+		if (r->supported)
+		{
+			fprintf(file, ", \"frames\": %d, \"mb_per_s\": %.3f, \"wall_us\": %.3f, \"cpu_us\": %.3f, \"gpu_us\": ",
+				r->frames, r->mb_per_s, r->wall_us, r->cpu_us);
+			if (r->gpu_us < 0) fprintf(file, "null");
+			else               fprintf(file, "%.3f", r->gpu_us);
+		}
+		fprintf(file, "}%s\n", i + 1 < num_results ? "," : "");
+	}
+	fprintf(file, "]}\n");
+	if (file != stdout) fclose(file);
+	else fflush(file);
+	return 0;
+}
+
+/**
+ * Measure every render method at every frame size and report the results.
+ * @param cap_ctx unused, no capture device is opened.
+ * @param disp_ctx Display data management sturcture with OpenGL refernces.
+ * @param opt User selected progam configuration options.
+ * @return 0 when every supported method was measured, negative on error.
+ */
+static int upload_bench(void *cap_ctx, void *disp_ctx, struct options *opt)
+{
+	const int num_methods = sizeof(bench_methods) / sizeof(bench_methods[0]);
+	const int num_sizes = sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+	struct bench_result results[(sizeof(bench_sizes) / sizeof(bench_sizes[0]) + 1) *
+		(sizeof(bench_methods) / sizeof(bench_methods[0]))];
+	struct display_context *disp = disp_ctx;
+	int count = opt->capture_count > BENCH_MIN_FRAMES ? opt->capture_count : BENCH_MIN_FRAMES;
+	int width[num_sizes + 1], height[num_sizes + 1];
+	int sizes = 0, num_results = 0, ret = 0;
+	bool listed = false;
+
+	(void)cap_ctx;
+	memset(results, 0, sizeof(results));
+	for (int s = 0; s < num_sizes; s++)
+	{
+		width[sizes] = bench_sizes[s].width;
+		height[sizes] = bench_sizes[s].height;
+		if (width[sizes] == (int)opt->width && height[sizes] == (int)opt->height) listed = true;
+		sizes++;
+	}
+	if (!listed && opt->width && opt->height)
+	{
+		width[sizes] = opt->width;
+		height[sizes] = opt->height;
+		sizes++;
+	}
+
+	for (int s = 0; s < sizes && !ret; s++)
+	{
+		struct bench_frames frames;
+
+		/* The render target of the offscreen display is sized by the frame. */
+		memset(disp, 0, sizeof(*disp));
+		disp->backend = DISPLAY_OFFSCREEN;
+		disp->width = width[s];
+		disp->height = height[s];
+		if (display_init(disp)) continue;
+		memset(&frames, 0, sizeof(frames));
+		ret = bench_frames_alloc(&frames, width[s], height[s]);
+		for (int m = 0; m < num_methods && !ret; m++)
+		{
+			struct bench_result *result = &results[num_results++];
+
+			result->width = width[s];
+			result->height = height[s];
+			result->method = bench_methods[m].name;
+			ret = bench_method(disp, &frames, bench_methods[m].method, count, result);
+		}
+		bench_frames_free(&frames);
+		display_close(disp);
+	}
+
+	bench_print(results, num_results);
+	if (opt->json_file && bench_write_json(opt->json_file, results, num_results)) ret = -1;
+	return ret;
+}
+
+static struct usage upload_bench_usage = {
+	.name = "UPLOAD_BENCH",
+	.description = "Render -n frames offscreen per texture upload method and frame size, report with -J",
+	.function = upload_bench,
+};
+
+/**
+ * Add the upload benchmark usage.
+ * @note The contstructor attribute is a GCC extension.
+ */
+__attribute__((constructor (PRIORITY_NEW_USAGE))) void add_upload_bench_usage(void)
+{
+	insert_usage(&upload_bench_usage, false);
+}
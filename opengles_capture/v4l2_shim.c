@@ -0,0 +1,889 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Preloadable emulation of a V4L2 MPLANE NV12 capture device.
+ * @file v4l2_shim.c
+ *
+ * Built as libv4l2shim.so with make shim and run as LD_PRELOAD=./libv4l2shim.so ./capture.
+ * open(), ioctl() and mmap() are intercepted on the emulated video and subdevice paths so the
+ * unmodified V4L2 paths of the application, negotiation, buffer mapping, queueing and the capture
+ * loops, run on a machine without a camera. Every other file descriptor goes to the C library.
+ *
+ * The video device file descriptor is a timerfd armed for the next completed buffer, poll, select
+ * and epoll see it become readable exactly like a driver with a filled buffer, without interception.
+ * Frames complete at the configured rate, each takes the oldest queued buffer and is delivered after
+ * a random delay. A frame due while no buffer is queued is lost and its sequence number skipped,
+ * like a sensor overrun behind a slow consumer. The shim does not write pixels, like a DMA engine
+ * it costs the CPU nothing per frame, mmap buffers are initialized once to mid gray.
+ *
+ * Configuration from the environment:
+ * - V4L2_SHIM_DEVICE video device path, /dev/video3 by default.
+ * - V4L2_SHIM_SUBDEVICE sensor subdevice path accepting any control, /dev/v4l-subdev10 by default.
+ * - V4L2_SHIM_FPS frame rate, 30 by default.
+ * - V4L2_SHIM_MAX_SIZE largest frame size, 3840x2160 by default.
+ * - V4L2_SHIM_ALIGN alignment in bytes of each line, 64 by default.
+ * - V4L2_SHIM_JITTER_US largest random delay between a frame completing and its buffer being dequeueable.
+ * - V4L2_SHIM_EAGAIN probability from 0 to 1 of a spurious EAGAIN from VIDIOC_DQBUF.
+ * - V4L2_SHIM_EIO probability from 0 to 1 of a DMA error, the buffer is dequeued with V4L2_BUF_FLAG_ERROR.
+ * - V4L2_SHIM_SEED seed of the injected faults and delays.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include <linux/videodev2.h>
+
+/** Smallest emulated frame size in pixels. */
+#define SHIM_MIN_SIZE 64
+/** Mid gray of both planes of the initial buffers. */
+#define SHIM_GRAY 128
+
+/**
+ * Emulated buffer.
+ */
+struct shim_buffer
+{
+	/** Set while the buffer is owned by the device, queued or completed. */
+	bool owned;
+	/** Monotonic time the buffer was queued. */
+	uint64_t queued_ns;
+	/** Monotonic time the completed buffer may be dequeued. */
+	uint64_t ready_ns;
+	/** Frame number of the completed buffer. */
+	uint32_t sequence;
+	/** Monotonic time the frame of the completed buffer started. */
+	uint64_t timestamp_ns;
+	/** Planes as last queued, user pointers and DMA buffer descriptors are returned unchanged. */
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+};
+
+/**
+ * Emulated capture device, one per process.
+ */
+struct shim_device
+{
+	/** Video device path. */
+	const char *path;
+	/** Sensor subdevice path. */
+	const char *subdev_path;
+	/** File descriptor of the open video device, the readiness timerfd, -1 when closed. */
+	int fd;
+	/** Set when the video device was opened non-blocking. */
+	bool nonblock;
+	/** File descriptor of the open subdevice, -1 when closed. */
+	int subdev_fd;
+	/** Protects the device, buffers are queued and dequeued from different threads. */
+	pthread_mutex_t lock;
+
+	/** Frame rate. */
+	uint32_t fps;
+	/** Largest frame width. */
+	uint32_t max_width;
+	/** Largest frame height. */
+	uint32_t max_height;
+	/** Line alignment in bytes. */
+	uint32_t align;
+	/** Largest delivery delay in nanoseconds. */
+	uint64_t jitter_ns;
+	/** Probability of a spurious EAGAIN. */
+	double eagain;
+	/** Probability of a DMA error reported with V4L2_BUF_FLAG_ERROR. */
+	double eio;
+	/** State of the random generator. */
+	uint64_t random;
+
+	/** Negotiated format. */
+	struct v4l2_pix_format_mplane format;
+	/** Memory type of the allocated buffers. */
+	enum v4l2_memory memory;
+	/** Number of allocated buffers. */
+	uint32_t count;
+	/** memfd backing the mmap buffers, -1 without mmap buffers. */
+	int memfd;
+	/** Offset of every plane of buffer 0 in the memfd, buffers follow each other. */
+	uint32_t plane_offset[VIDEO_MAX_PLANES];
+	/** Size of one buffer in the memfd. */
+	uint32_t buffer_size;
+	/** Emulated buffers. */
+	struct shim_buffer buffers[VIDEO_MAX_FRAME];
+	/** Indices of the queued buffers in queue order. */
+	uint32_t queue[VIDEO_MAX_FRAME];
+	/** Number of buffers ever queued. */
+	uint32_t queue_head;
+	/** Number of buffers ever taken by a frame. */
+	uint32_t queue_tail;
+	/** Indices of the completed buffers in completion order. */
+	uint32_t done[VIDEO_MAX_FRAME];
+	/** Number of buffers ever completed. */
+	uint32_t done_head;
+	/** Number of buffers ever dequeued. */
+	uint32_t done_tail;
+
+	/** Set while streaming. */
+	bool streaming;
+	/** Monotonic time the stream started. */
+	uint64_t start_ns;
+	/** Number of the next frame. */
+	uint64_t frame;
+	/** Frames completed into a buffer. */
+	uint64_t completed;
+	/** Frames lost without a queued buffer. */
+	uint64_t overruns;
+	/** Injected EAGAIN errors. */
+	uint64_t eagains;
+	/** Buffers dequeued with an injected V4L2_BUF_FLAG_ERROR. */
+	uint64_t eios;
+};
+
+static struct shim_device g_shim = {
+	.fd = -1,
+	.subdev_fd = -1,
+	.memfd = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int (*real_open)(const char *path, int flags, ...);
+static int (*real_openat)(int dirfd, const char *path, int flags, ...);
+static int (*real_close)(int fd);
+static int (*real_ioctl)(int fd, unsigned long request, ...);
+static void *(*real_mmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+
+/**
+ * Read the monotonic clock.
+ * @return current monotonic time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Next value of the xorshift64* generator.
+ * @param dev emulated device holding the state.
+ * @return uniform value between 0 and 1.
+ */
+static double shim_random(struct shim_device *dev)
+{
+	dev->random ^= dev->random >> 12;
+	dev->random ^= dev->random << 25;
+	dev->random ^= dev->random >> 27;
+	return (dev->random * 0x2545f4914f6cdd1dull >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Read a number from the environment.
+ * @param name variable name.
+ * @param fallback value when the variable is not set.
+ * @return value of the variable.
+ */
+static double env_number(const char *name, double fallback)
+{
+	const char *value = getenv(name);
+	return value && value[0] ? atof(value) : fallback;
+}
+
+/**
+ * Resolve the intercepted C library functions.
+ * Also called by the wrappers, constructors of other libraries may run before the shim constructor.
+ */
+static void shim_resolve(void)
+{
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+}
+
+/**
+ * Resolve the C library functions and read the configuration.
+ */
+__attribute__((constructor)) static void shim_init(void)
+{
+	const char *size = getenv("V4L2_SHIM_MAX_SIZE");
+	struct shim_device *dev = &g_shim;
+
+	shim_resolve();
+	dev->path = getenv("V4L2_SHIM_DEVICE") ? getenv("V4L2_SHIM_DEVICE") : "/dev/video3";
+	dev->subdev_path = getenv("V4L2_SHIM_SUBDEVICE") ? getenv("V4L2_SHIM_SUBDEVICE") : "/dev/v4l-subdev10";
+	dev->fps = env_number("V4L2_SHIM_FPS", 30);
+	if (!dev->fps) dev->fps = 30;
+	dev->max_width = 3840;
+	dev->max_height = 2160;
+	if (size && sscanf(size, "%ux%u", &dev->max_width, &dev->max_height) != 2)
+		fprintf(stderr, "v4l2_shim: V4L2_SHIM_MAX_SIZE %s is not WxH\n", size);
+	dev->align = env_number("V4L2_SHIM_ALIGN", 64);
+	if (!dev->align || dev->align & (dev->align - 1)) dev->align = 64;
+	dev->jitter_ns = env_number("V4L2_SHIM_JITTER_US", 0) * 1000;
+	dev->eagain = env_number("V4L2_SHIM_EAGAIN", 0);
+	dev->eio = env_number("V4L2_SHIM_EIO", 0);
+	dev->random = env_number("V4L2_SHIM_SEED", 1);
+	if (!dev->random) dev->random = 1;
+}
+
+/**
+ * Fill the line and plane sizes of a format, clamping the size to what the device supports.
+ * @param dev emulated device.
+ * @param pix format to adjust.
+ */
+static void shim_try_format(const struct shim_device *dev, struct v4l2_pix_format_mplane *pix)
+{
+	uint32_t bytesperline;
+
+	if (pix->pixelformat != V4L2_PIX_FMT_NV12M && pix->pixelformat != V4L2_PIX_FMT_NV12)
+		pix->pixelformat = V4L2_PIX_FMT_NV12M;
+	if (pix->width < SHIM_MIN_SIZE) pix->width = SHIM_MIN_SIZE;
+	if (pix->width > dev->max_width) pix->width = dev->max_width;
+	if (pix->height < SHIM_MIN_SIZE) pix->height = SHIM_MIN_SIZE;
+	if (pix->height > dev->max_height) pix->height = dev->max_height;
+	pix->width &= ~1u;
+	pix->height &= ~1u;
+	pix->field = V4L2_FIELD_NONE;
+	pix->colorspace = V4L2_COLORSPACE_SMPTE170M;
+
+	bytesperline = (pix->width + dev->align - 1) & ~(dev->align - 1);
+	memset(pix->plane_fmt, 0, sizeof(pix->plane_fmt));
+	if (pix->pixelformat == V4L2_PIX_FMT_NV12M)
+	{
+		pix->num_planes = 2;
+		pix->plane_fmt[0].bytesperline = bytesperline;
+		pix->plane_fmt[0].sizeimage = bytesperline * pix->height;
+		pix->plane_fmt[1].bytesperline = bytesperline;
+		pix->plane_fmt[1].sizeimage = bytesperline * pix->height / 2;
+	}
+	else
+	{
+		pix->num_planes = 1;
+		pix->plane_fmt[0].bytesperline = bytesperline;
+		pix->plane_fmt[0].sizeimage = bytesperline * pix->height * 3 / 2;
+	}
+}
+
+/**
+ * Monotonic time a frame starts.
+ * @param dev emulated device, streaming.
+ * @param frame frame number.
+ * @return start time in nanoseconds, the first frame starts one interval after stream on.
+ */
+static uint64_t frame_due_ns(const struct shim_device *dev, uint64_t frame)
+{
+	return dev->start_ns + (frame + 1) * 1000000000ull / dev->fps;
+}
+
+/**
+ * Complete every frame due by now into the oldest buffer queued before it started.
+ * @param dev emulated device, locked.
+ * @param now_ns current monotonic time.
+ */
+static void shim_advance(struct shim_device *dev, uint64_t now_ns)
+{
+	uint64_t due;
+
+	while (dev->streaming && (due = frame_due_ns(dev, dev->frame)) <= now_ns)
+	{
+		struct shim_buffer *buf = NULL;
+
+		if (dev->queue_head != dev->queue_tail)
+			buf = &dev->buffers[dev->queue[dev->queue_tail % VIDEO_MAX_FRAME]];
+		if (buf && buf->queued_ns <= due)
+		{
+			dev->done[dev->done_head++ % VIDEO_MAX_FRAME] = dev->queue[dev->queue_tail++ % VIDEO_MAX_FRAME];
+			buf->sequence = dev->frame;
+			buf->timestamp_ns = due;
+			buf->ready_ns = due + (uint64_t)(shim_random(dev) * dev->jitter_ns);
+			dev->completed++;
+		}
+		else
+		{
+			dev->overruns++;
+		}
+		dev->frame++;
+	}
+}
+
+/**
+ * Clear the readiness of the device and arm it for the next completed buffer.
+ * @param dev emulated device, locked.
+ * @param now_ns current monotonic time.
+ */
+static void shim_arm(struct shim_device *dev, uint64_t now_ns)
+{
+	struct itimerspec spec;
+	uint64_t expirations;
+	uint64_t next = 0;
+
+	memset(&spec, 0, sizeof(spec));
+	if (read(dev->fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "v4l2_shim: timer read %s\n", strerror(errno));
+
+	/* A completed buffer becomes ready, or a queued buffer is completed by the next frame. */
+	if (dev->done_head != dev->done_tail)
+		next = dev->buffers[dev->done[dev->done_tail % VIDEO_MAX_FRAME]].ready_ns;
+	else if (dev->streaming && dev->queue_head != dev->queue_tail)
+		next = frame_due_ns(dev, dev->frame);
+	if (next && next <= now_ns) next = 1;
+
+	spec.it_value.tv_sec = next / 1000000000ull;
+	spec.it_value.tv_nsec = next % 1000000000ull;
+	if (timerfd_settime(dev->fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+		fprintf(stderr, "v4l2_shim: timer arm %s\n", strerror(errno));
+}
+
+/**
+ * Release the buffers and the memfd backing them.
+ * @param dev emulated device, locked.
+ */
+static void shim_free_buffers(struct shim_device *dev)
+{
+	if (dev->memfd >= 0) real_close(dev->memfd);
+	dev->memfd = -1;
+	dev->count = 0;
+	memset(dev->buffers, 0, sizeof(dev->buffers));
+	dev->queue_head = dev->queue_tail = 0;
+	dev->done_head = dev->done_tail = 0;
+}
+
+/**
+ * Print the frame statistics of a stream.
+ * @param dev emulated device.
+ */
+static void shim_report(const struct shim_device *dev)
+{
+	fprintf(stderr, "v4l2_shim: %llu frames, %llu completed, %llu overruns, %llu EAGAIN and %llu buffer errors injected\n",
+		(unsigned long long)dev->frame, (unsigned long long)dev->completed,
+		(unsigned long long)dev->overruns, (unsigned long long)dev->eagains, (unsigned long long)dev->eios);
+}
+
+/**
+ * VIDIOC_REQBUFS, mmap buffers are backed by one memfd initialized to mid gray.
+ * @param dev emulated device, locked.
+ * @param req request, the count is adjusted.
+ * @return 0 on success, negative errno on failure.
+ */
+static int shim_reqbufs(struct shim_device *dev, struct v4l2_requestbuffers *req)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	void *addr;
+
+	if (req->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) return -EINVAL;
+	if (req->memory != V4L2_MEMORY_MMAP && req->memory != V4L2_MEMORY_USERPTR &&
+		req->memory != V4L2_MEMORY_DMABUF)
+		return -EINVAL;
+	if (dev->streaming) return -EBUSY;
+	shim_free_buffers(dev);
+	if (!req->count) return 0;
+
+	if (req->count > VIDEO_MAX_FRAME) req->count = VIDEO_MAX_FRAME;
+	dev->memory = req->memory;
+	dev->count = req->count;
+	if (dev->memory == V4L2_MEMORY_MMAP)
+	{
+		dev->buffer_size = 0;
+		for (uint32_t p = 0; p < dev->format.num_planes; p++)
+		{
+			dev->plane_offset[p] = dev->buffer_size;
+			dev->buffer_size += (dev->format.plane_fmt[p].sizeimage + page_size - 1) & ~(page_size - 1);
+		}
+		dev->memfd = memfd_create("v4l2_shim", MFD_CLOEXEC);
+		if (dev->memfd < 0) return -errno;
+		if (ftruncate(dev->memfd, (off_t)dev->buffer_size * dev->count) < 0) return -errno;
+		addr = real_mmap(NULL, (size_t)dev->buffer_size * dev->count, PROT_WRITE, MAP_SHARED, dev->memfd, 0);
+		if (addr == MAP_FAILED) return -errno;
+		memset(addr, SHIM_GRAY, (size_t)dev->buffer_size * dev->count);
+		munmap(addr, (size_t)dev->buffer_size * dev->count);
+	}
+	return 0;
+}
+
+/**
+ * Describe the planes of a buffer as a driver does.
+ * @param dev emulated device, locked.
+ * @param buf buffer to fill, the index is set and m.planes holds room for every plane.
+ * @return 0 on success, negative errno on failure.
+ */
+static int shim_describe(const struct shim_device *dev, struct v4l2_buffer *buf)
+{
+	const struct shim_buffer *shim = &dev->buffers[buf->index];
+
+	if (!buf->m.planes || buf->length < dev->format.num_planes) return -EINVAL;
+	buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	buf->memory = dev->memory;
+	buf->length = dev->format.num_planes;
+	buf->field = V4L2_FIELD_NONE;
+	buf->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_TSTAMP_SRC_SOE;
+	if (shim->owned) buf->flags |= V4L2_BUF_FLAG_QUEUED;
+	for (uint32_t p = 0; p < dev->format.num_planes; p++)
+	{
+		struct v4l2_plane *plane = &buf->m.planes[p];
+		plane->length = dev->format.plane_fmt[p].sizeimage;
+		plane->bytesused = plane->length;
+		plane->data_offset = 0;
+		if (dev->memory == V4L2_MEMORY_MMAP)
+			plane->m.mem_offset = buf->index * dev->buffer_size + dev->plane_offset[p];
+		else
+			plane->m = shim->planes[p].m;
+	}
+	return 0;
+}
+
+/**
+ * VIDIOC_QBUF, the buffer waits for the next frame to start.
+ * @param dev emulated device, locked.
+ * @param buf buffer to queue.
+ * @param now_ns current monotonic time.
+ * @return 0 on success, negative errno on failure.
+ */
+static int shim_qbuf(struct shim_device *dev, struct v4l2_buffer *buf, uint64_t now_ns)
+{
+	struct shim_buffer *shim;
+
+	if (buf->index >= dev->count || buf->memory != dev->memory || !buf->m.planes) return -EINVAL;
+	shim = &dev->buffers[buf->index];
+	if (shim->owned) return -EINVAL;
+	for (uint32_t p = 0; p < dev->format.num_planes && dev->memory != V4L2_MEMORY_MMAP; p++)
+	{
+		if (buf->m.planes[p].length < dev->format.plane_fmt[p].sizeimage) return -EINVAL;
+		shim->planes[p] = buf->m.planes[p];
+	}
+
+	shim_advance(dev, now_ns);
+	shim->owned = true;
+	shim->queued_ns = now_ns;
+	dev->queue[dev->queue_head++ % VIDEO_MAX_FRAME] = buf->index;
+	shim_arm(dev, now_ns);
+	return shim_describe(dev, buf);
+}
+
+/**
+ * VIDIOC_DQBUF, return the oldest ready buffer or inject a fault.
+ * A DMA error is reported like vb2 drivers do, the buffer is dequeued with V4L2_BUF_FLAG_ERROR.
+ * @param dev emulated device, locked.
+ * @param buf buffer to fill.
+ * @param now_ns current monotonic time.
+ * @return 0 on success, -EAGAIN when no buffer is ready, negative errno on failure.
+ */
+static int shim_dqbuf(struct shim_device *dev, struct v4l2_buffer *buf, uint64_t now_ns)
+{
+	struct shim_buffer *shim;
+	uint32_t index;
+	int ret = 0;
+
+	if (!dev->streaming) return -EINVAL;
+	shim_advance(dev, now_ns);
+	if (dev->done_head == dev->done_tail ||
+		dev->buffers[dev->done[dev->done_tail % VIDEO_MAX_FRAME]].ready_ns > now_ns)
+	{
+		ret = -EAGAIN;
+	}
+	else if (dev->eagain > 0 && shim_random(dev) < dev->eagain)
+	{
+		dev->eagains++;
+		ret = -EAGAIN;
+	}
+	else
+	{
+		index = dev->done[dev->done_tail++ % VIDEO_MAX_FRAME];
+		shim = &dev->buffers[index];
+		shim->owned = false;
+		buf->index = index;
+		ret = shim_describe(dev, buf);
+		buf->sequence = shim->sequence;
+		buf->timestamp.tv_sec = shim->timestamp_ns / 1000000000ull;
+		buf->timestamp.tv_usec = shim->timestamp_ns % 1000000000ull / 1000;
+		/* The frame content is unreliable, the application requeues the buffer. */
+		if (dev->eio > 0 && shim_random(dev) < dev->eio)
+		{
+			buf->flags |= V4L2_BUF_FLAG_ERROR;
+			dev->eios++;
+		}
+	}
+	shim_arm(dev, now_ns);
+	return ret;
+}
+
+/**
+ * Emulate an ioctl of the video device.
+ * @param dev emulated device.
+ * @param request ioctl request.
+ * @param arg ioctl argument.
+ * @return 0 on success, negative errno on failure.
+ */
+static int shim_video_ioctl(struct shim_device *dev, unsigned long request, void *arg)
+{
+	uint64_t now_ns = monotonic_ns();
+	int ret = 0;
+
+	pthread_mutex_lock(&dev->lock);
+	switch (request)
+	{
+		case VIDIOC_QUERYCAP:
+		{
+			struct v4l2_capability *cap = arg;
+			memset(cap, 0, sizeof(*cap));
+			snprintf((char *)cap->driver, sizeof(cap->driver), "v4l2_shim");
+			snprintf((char *)cap->card, sizeof(cap->card), "Emulated NV12 capture");
+			snprintf((char *)cap->bus_info, sizeof(cap->bus_info), "platform:v4l2_shim");
+			cap->device_caps = V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_STREAMING;
+			cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+			break;
+		}
+
+		case VIDIOC_ENUM_FMT:
+		{
+			struct v4l2_fmtdesc *desc = arg;
+			static const uint32_t formats[] = { V4L2_PIX_FMT_NV12M, V4L2_PIX_FMT_NV12 };
+			if (desc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE || desc->index >= 2)
+			{
+				ret = -EINVAL;
+				break;
+			}
+			desc->flags = 0;
+			desc->pixelformat = formats[desc->index];
+			snprintf((char *)desc->description, sizeof(desc->description),
+				desc->index ? "Y/CbCr 4:2:0" : "Y/CbCr 4:2:0 (N-C)");
+			break;
+		}
+
+		case VIDIOC_ENUM_FRAMESIZES:
+		{
+			struct v4l2_frmsizeenum *size = arg;
+			if (size->index || (size->pixel_format != V4L2_PIX_FMT_NV12M && size->pixel_format != V4L2_PIX_FMT_NV12))
+			{
+				ret = -EINVAL;
+				break;
+			}
+			size->type = V4L2_FRMSIZE_TYPE_STEPWISE;
+			size->stepwise.min_width = SHIM_MIN_SIZE;
+			size->stepwise.max_width = dev->max_width;
+			size->stepwise.step_width = 2;
+			size->stepwise.min_height = SHIM_MIN_SIZE;
+			size->stepwise.max_height = dev->max_height;
+			size->stepwise.step_height = 2;
+			break;
+		}
+
+		case VIDIOC_ENUM_FRAMEINTERVALS:
+		{
+			struct v4l2_frmivalenum *ival = arg;
+			if (ival->index)
+			{
+				ret = -EINVAL;
+				break;
+			}
+			ival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+			ival->discrete.numerator = 1;
+			ival->discrete.denominator = dev->fps;
+			break;
+		}
+
+		case VIDIOC_G_FMT:
+		case VIDIOC_S_FMT:
+		case VIDIOC_TRY_FMT:
+		{
+			struct v4l2_format *fmt = arg;
+			if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+			{
+				ret = -EINVAL;
+				break;
+			}
+			if (request == VIDIOC_G_FMT)
+			{
+				fmt->fmt.pix_mp = dev->format;
+				break;
+			}
+			if (request == VIDIOC_S_FMT && dev->count)
+			{
+				ret = -EBUSY;
+				break;
+			}
+			shim_try_format(dev, &fmt->fmt.pix_mp);
+			if (request == VIDIOC_S_FMT) dev->format = fmt->fmt.pix_mp;
+			break;
+		}
+
+		case VIDIOC_G_PARM:
+		case VIDIOC_S_PARM:
+		{
+			struct v4l2_streamparm *parm = arg;
+			if (parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+			{
+				ret = -EINVAL;
+				break;
+			}
+			memset(&parm->parm, 0, sizeof(parm->parm));
+			parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+			parm->parm.capture.timeperframe.numerator = 1;
+			parm->parm.capture.timeperframe.denominator = dev->fps;
+			break;
+		}
+
+		case VIDIOC_REQBUFS:
+			ret = shim_reqbufs(dev, arg);
+			break;
+
+		case VIDIOC_QUERYBUF:
+		{
+			struct v4l2_buffer *buf = arg;
+			if (buf->index >= dev->count)
+			{
+				ret = -EINVAL;
+				break;
+			}
+			ret = shim_describe(dev, buf);
+			break;
+		}
+
+		case VIDIOC_QBUF:
+			ret = shim_qbuf(dev, arg, now_ns);
+			break;
+
+		case VIDIOC_DQBUF:
+			ret = shim_dqbuf(dev, arg, now_ns);
+			break;
+
+		case VIDIOC_STREAMON:
+			if (!dev->count)
+			{
+				ret = -EINVAL;
+				break;
+			}
+			if (dev->streaming) break;
+			dev->streaming = true;
+			dev->start_ns = now_ns;
+			dev->frame = dev->completed = dev->overruns = dev->eagains = dev->eios = 0;
+			shim_arm(dev, now_ns);
+			break;
+
+		case VIDIOC_STREAMOFF:
+			if (!dev->streaming) break;
+			shim_advance(dev, now_ns);
+			dev->streaming = false;
+			shim_report(dev);
+			/* Every buffer returns to the application. */
+			for (uint32_t i = 0; i < dev->count; i++)
+				dev->buffers[i].owned = false;
+			dev->queue_head = dev->queue_tail = 0;
+			dev->done_head = dev->done_tail = 0;
+			shim_arm(dev, now_ns);
+			break;
+
+		default:
+			ret = -ENOTTY;
+			break;
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return ret;
+}
+
+/**
+ * Emulate an ioctl of the sensor subdevice, every control is accepted.
+ * @param request ioctl request.
+ * @return 0 on success, negative errno on failure.
+ */
+static int shim_subdev_ioctl(unsigned long request)
+{
+	if (request == VIDIOC_S_CTRL || request == VIDIOC_G_CTRL) return 0;
+	return -ENOTTY;
+}
+
+/**
+ * Open the emulated device or subdevice when the path names one.
+ * @param path path being opened.
+ * @param flags open flags.
+ * @return file descriptor, -1 with errno set on failure, -2 when the path is not emulated.
+ */
+static int shim_open(const char *path, int flags)
+{
+	struct shim_device *dev = &g_shim;
+	int fd = -2;
+
+	if (!path || !dev->path) return -2;
+	pthread_mutex_lock(&dev->lock);
+	if (!strcmp(path, dev->path))
+	{
+		if (dev->fd >= 0)
+		{
+			errno = EBUSY;
+			fd = -1;
+		}
+		else
+		{
+			fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | (flags & O_CLOEXEC ? TFD_CLOEXEC : 0));
+			dev->fd = fd;
+			dev->nonblock = flags & O_NONBLOCK;
+			dev->format.width = dev->max_width < 1920 ? dev->max_width : 1920;
+			dev->format.height = dev->max_height < 1080 ? dev->max_height : 1080;
+			dev->format.pixelformat = V4L2_PIX_FMT_NV12M;
+			shim_try_format(dev, &dev->format);
+			fprintf(stderr, "v4l2_shim: %s at %u fps up to %ux%u, jitter %llu us, EAGAIN %.3f, buffer error %.3f\n",
+				dev->path, dev->fps, dev->max_width, dev->max_height,
+				(unsigned long long)dev->jitter_ns / 1000, dev->eagain, dev->eio);
+		}
+	}
+	else if (!strcmp(path, dev->subdev_path))
+	{
+		fd = real_open("/dev/null", O_RDWR | (flags & O_CLOEXEC));
+		if (fd >= 0) dev->subdev_fd = fd;
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list args;
+	int fd;
+
+	if (!real_open) shim_resolve();
+	fd = shim_open(path, flags);
+	if (fd != -2) return fd;
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...) __attribute__((alias("open")));
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list args;
+	int fd;
+
+	if (!real_open) shim_resolve();
+	fd = shim_open(path, flags);
+	if (fd != -2) return fd;
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return real_openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...) __attribute__((alias("openat")));
+
+int close(int fd)
+{
+	struct shim_device *dev = &g_shim;
+
+	if (!real_close) shim_resolve();
+
+	pthread_mutex_lock(&dev->lock);
+	if (fd >= 0 && fd == dev->fd)
+	{
+		if (dev->streaming) shim_report(dev);
+		dev->streaming = false;
+		shim_free_buffers(dev);
+		dev->fd = -1;
+	}
+	else if (fd >= 0 && fd == dev->subdev_fd)
+	{
+		dev->subdev_fd = -1;
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct shim_device *dev = &g_shim;
+	struct pollfd pfd;
+	va_list args;
+	void *arg;
+	int ret;
+
+	va_start(args, request);
+	arg = va_arg(args, void *);
+	va_end(args);
+	if (!real_ioctl) shim_resolve();
+
+	if (fd < 0 || (fd != dev->fd && fd != dev->subdev_fd)) return real_ioctl(fd, request, arg);
+
+	if (fd == dev->subdev_fd)
+	{
+		ret = shim_subdev_ioctl(request);
+	}
+	else
+	{
+		ret = shim_video_ioctl(dev, request, arg);
+		/* A blocking device waits for the readiness timer instead of failing with EAGAIN. */
+		while (ret == -EAGAIN && request == VIDIOC_DQBUF && !dev->nonblock)
+		{
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return -1;
+			ret = shim_video_ioctl(dev, request, arg);
+		}
+	}
+	if (ret < 0)
+	{
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	struct shim_device *dev = &g_shim;
+
+	if (!real_mmap) shim_resolve();
+
+	/* Buffers of the video device are mapped from the memfd backing them. */
+	if (fd >= 0 && fd == dev->fd)
+	{
+		if (dev->memfd < 0)
+		{
+			errno = EINVAL;
+			return MAP_FAILED;
+		}
+		fd = dev->memfd;
+	}
+	return real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off_t offset) __attribute__((alias("mmap")));
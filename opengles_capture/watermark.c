@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2017 D3 Engineering
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ /**
+ * Capture to display latency measured through a watermark embedded in the frames.
+ * @file watermark.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "watermark.h"
+#include "gles_egl_util.h"
+#include "log.h"
+
+/** Identifies a decoded grid as a watermark, "WM". */
+#define WATERMARK_MAGIC 0x574d
+/** Bytes encoded by the grid: magic, sequence, capture time and CRC. */
+#define WATERMARK_BYTES (WATERMARK_COLUMNS * WATERMARK_ROWS / 8)
+/** Luma of the blocks holding 0 and 1 bits, the nominal black and white levels. */
+#define WATERMARK_LUMA_0 16
+#define WATERMARK_LUMA_1 235
+/** Chroma of the stamped area, no color so the displayed blocks are gray levels. */
+#define WATERMARK_CHROMA 128
+
+/**
+ * CRC-16/CCITT of the watermark fields.
+ * @param data bytes to check.
+ * @param size number of bytes.
+ * @return CRC of the bytes.
+ */
+static uint16_t crc16(const uint8_t *data, size_t size)
+{
+	uint16_t crc = 0xffff;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+		for (int bit = 0; bit < 8; bit++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+/**
+ * Block side fitting the grid in a frame.
+ * @param width frame width in pixels.
+ * @param height frame height in pixels.
+ * @return even block side in pixels, 0 when the frame is too small.
+ */
+static int block_size(int width, int height)
+{
+	int block = WATERMARK_BLOCK;
+
+	if (width / WATERMARK_COLUMNS < block) block = width / WATERMARK_COLUMNS;
+	if (height / WATERMARK_ROWS < block) block = height / WATERMARK_ROWS;
+	return block & ~1;
+}
+
+void watermark_stamp(uint8_t *luma, int luma_stride, uint8_t *chroma, int chroma_stride,
+	int width, int height, uint32_t sequence, uint64_t capture_ns)
+{
+	int block = block_size(width, height);
+	uint8_t data[WATERMARK_BYTES];
+	uint16_t crc;
+
+	if (!block) return;
+
+	/* Fields are big endian so the grid reads in order from the top left. */
+	data[0] = WATERMARK_MAGIC >> 8;
+	data[1] = WATERMARK_MAGIC & 0xff;
+	for (int i = 0; i < 4; i++)
+		data[2 + i] = sequence >> (24 - 8 * i);
+	for (int i = 0; i < 8; i++)
+		data[6 + i] = capture_ns >> (56 - 8 * i);
+	crc = crc16(data, WATERMARK_BYTES - 2);
+	data[WATERMARK_BYTES - 2] = crc >> 8;
+	data[WATERMARK_BYTES - 1] = crc & 0xff;
+
+	for (int row = 0; row < WATERMARK_ROWS * block; row++)
+	{
+		uint8_t *line = luma + row * luma_stride;
+		for (int column = 0; column < WATERMARK_COLUMNS; column++)
+		{
+			int bit = (row / block) * WATERMARK_COLUMNS + column;
+			int value = data[bit / 8] & (0x80 >> (bit % 8)) ? WATERMARK_LUMA_1 : WATERMARK_LUMA_0;
+			memset(line + column * block, value, block);
+		}
+	}
+
+	/* Each interleaved CbCr pair covers two luma pixels on two lines. */
+	for (int row = 0; row < WATERMARK_ROWS * block / 2; row++)
+		memset(chroma + row * chroma_stride, WATERMARK_CHROMA, WATERMARK_COLUMNS * block);
+}
+
+int watermark_init(struct watermark *wm, int frame_width, int frame_height, int surface_width, int surface_height)
+{
+	int block = block_size(frame_width, frame_height);
+	GLsizeiptr size;
+
+	memset(wm->ring, 0, sizeof(wm->ring));
+	wm->head = wm->tail = 0;
+	wm->active = NULL;
+	wm->has_last = false;
+	wm->block = block;
+	wm->frame_width = frame_width;
+	wm->frame_height = frame_height;
+	wm->surface_width = surface_width;
+	wm->surface_height = surface_height;
+	histogram_init(&wm->latency, "watermark latency");
+	histogram_init(&wm->reported, "watermark latency");
+
+	/* Nearest sampling keeps the blocks sharp as long as each one covers a couple of surface pixels. */
+	if (!block || block * surface_width / frame_width < 2 || block * surface_height / frame_height < 2)
+	{
+		LOGS_ERR("Frame %dx%d on surface %dx%d is too small for the watermark",
+			frame_width, frame_height, surface_width, surface_height);
+		return -1;
+	}
+
+	/* The grid is at the top of the frame, the top of the surface in GL coordinates is the last row. */
+	wm->x = 0;
+	wm->width = (WATERMARK_COLUMNS * block * surface_width + frame_width - 1) / frame_width;
+	wm->height = (WATERMARK_ROWS * block * surface_height + frame_height - 1) / frame_height;
+	if (wm->width > surface_width) wm->width = surface_width;
+	if (wm->height > surface_height) wm->height = surface_height;
+	wm->y = surface_height - wm->height;
+
+	size = (GLsizeiptr)wm->width * wm->height * 4;
+	for (int i = 0; i < WATERMARK_RING; i++)
+	{
+		glGenBuffers(1, &wm->ring[i].pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, wm->ring[i].pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (glGetError() != GL_NO_ERROR)
+	{
+		LOGS_ERR("Unable to create the watermark pixel buffers");
+		watermark_close(wm);
+		return -1;
+	}
+	LOGS_INF("Watermark of %dx%d blocks of %d pixels, read back %dx%d pixels per frame",
+		WATERMARK_COLUMNS, WATERMARK_ROWS, block, wm->width, wm->height);
+	return 0;
+}
+
+/**
+ * Decode the grid from the stamped corner of the surface.
+ * @param wm watermark.
+ * @param pixels RGBA pixels of the readback rectangle, bottom row first.
+ * @param sequence returns the frame sequence.
+ * @param capture_ns returns the frame capture time.
+ * @return true when a valid watermark was decoded.
+ */
+static bool decode(const struct watermark *wm, const uint8_t *pixels, uint32_t *sequence, uint64_t *capture_ns)
+{
+	uint8_t data[WATERMARK_BYTES] = {0};
+
+	for (int bit = 0; bit < WATERMARK_COLUMNS * WATERMARK_ROWS; bit++)
+	{
+		/* Sample the surface pixel at the center of the block. */
+		int fx = (bit % WATERMARK_COLUMNS) * wm->block + wm->block / 2;
+		int fy = (bit / WATERMARK_COLUMNS) * wm->block + wm->block / 2;
+		int sx = fx * wm->surface_width / wm->frame_width;
+		int sy = wm->surface_height - 1 - fy * wm->surface_height / wm->frame_height - wm->y;
+		const uint8_t *rgba;
+
+		if (sx >= wm->width || sy < 0 || sy >= wm->height) return false;
+		rgba = pixels + ((size_t)sy * wm->width + sx) * 4;
+		if (rgba[0] + rgba[1] + rgba[2] >= 3 * 128) data[bit / 8] |= 0x80 >> (bit % 8);
+	}
+
+	if (data[0] != WATERMARK_MAGIC >> 8 || data[1] != (WATERMARK_MAGIC & 0xff)) return false;
+	if (crc16(data, WATERMARK_BYTES - 2) != (data[WATERMARK_BYTES - 2] << 8 | data[WATERMARK_BYTES - 1]))
+		return false;
+
+	*sequence = 0;
+	for (int i = 0; i < 4; i++)
+		*sequence = *sequence << 8 | data[2 + i];
+	*capture_ns = 0;
+	for (int i = 0; i < 8; i++)
+		*capture_ns = *capture_ns << 8 | data[6 + i];
+	return true;
+}
+
+/**
+ * Record the latency of a decoded frame and check its sequence against the previous one.
+ * @param wm watermark.
+ * @param slot readback of the frame.
+ * @param sequence decoded sequence.
+ * @param capture_ns decoded capture time.
+ */
+static void record(struct watermark *wm, const struct watermark_slot *slot, uint32_t sequence, uint64_t capture_ns)
+{
+	int32_t step;
+
+	wm->decoded++;
+	if (slot->present_ns >= capture_ns) histogram_record(&wm->latency, slot->present_ns - capture_ns);
+	if (sequence != slot->sequence) wm->mismatched++;
+
+	/* Sequences wrap, the signed step tells a repeat, a jump ahead or an older frame apart. */
+	if (wm->has_last)
+	{
+		step = (int32_t)(sequence - wm->last_sequence);
+		if (step == 0) wm->repeated++;
+		else if (step > 1) wm->skipped += step - 1;
+	}
+	wm->has_last = true;
+	wm->last_sequence = sequence;
+}
+
+/**
+ * Decode the oldest readbacks the GPU completed.
+ * @param wm watermark.
+ */
+static void collect(struct watermark *wm)
+{
+	GLsizeiptr size = (GLsizeiptr)wm->width * wm->height * 4;
+	uint32_t sequence;
+	uint64_t capture_ns;
+	GLenum status;
+	void *pixels;
+
+	while (wm->tail != wm->head)
+	{
+		struct watermark_slot *slot = &wm->ring[wm->tail % WATERMARK_RING];
+
+		/* A zero timeout only polls the fence, the render never waits for a readback. */
+		status = glClientWaitSync(slot->fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+		glDeleteSync(slot->fence);
+		slot->fence = 0;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+		pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (pixels && decode(wm, pixels, &sequence, &capture_ns))
+			record(wm, slot, sequence, capture_ns);
+		else
+			wm->failed++;
+		if (pixels) glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		wm->tail++;
+	}
+}
+
+void watermark_readback(struct watermark *wm, uint32_t sequence)
+{
+	wm->active = NULL;
+	if (!wm->enabled) return;
+
+	collect(wm);
+	if (wm->head - wm->tail >= WATERMARK_RING)
+	{
+		/* The GPU is a ring behind, skip this frame rather than wait for a readback. */
+		wm->overrun++;
+		return;
+	}
+
+	/* The read is queued behind the draw, the pixels land in the buffer object asynchronously. */
+	wm->active = &wm->ring[wm->head % WATERMARK_RING];
+	wm->active->sequence = sequence;
+	wm->active->present_ns = 0;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, wm->active->pbo);
+	glReadPixels(wm->x, wm->y, wm->width, wm->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	wm->active->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	wm->head++;
+}
+
+void watermark_presented(struct watermark *wm, uint64_t present_ns)
+{
+	if (wm->active) wm->active->present_ns = present_ns;
+}
+
+void watermark_report(struct watermark *wm)
+{
+	struct histogram now;
+	struct histogram interval;
+
+	if (!wm->enabled) return;
+
+	histogram_snapshot(&wm->latency, &now);
+	histogram_interval(&interval, &now, &wm->reported);
+	histogram_report(&interval);
+	wm->reported = now;
+	if (wm->repeated || wm->skipped || wm->mismatched || wm->failed || wm->overrun)
+	{
+		LOGS_WRN("Watermark: %llu decoded, %llu repeated, %llu skipped, %llu not the frame rendered, %llu undecodable, %llu not read back",
+			(unsigned long long)wm->decoded, (unsigned long long)wm->repeated, (unsigned long long)wm->skipped,
+			(unsigned long long)wm->mismatched, (unsigned long long)wm->failed, (unsigned long long)wm->overrun);
+	}
+	wm->decoded = 0;
+	wm->repeated = 0;
+	wm->skipped = 0;
+	wm->mismatched = 0;
+	wm->failed = 0;
+	wm->overrun = 0;
+}
+
+void watermark_close(struct watermark *wm)
+{
+	for (int i = 0; i < WATERMARK_RING; i++)
+	{
+		if (wm->ring[i].fence) glDeleteSync(wm->ring[i].fence);
+		if (wm->ring[i].pbo) glDeleteBuffers(1, &wm->ring[i].pbo);
+	}
+	memset(wm->ring, 0, sizeof(wm->ring));
+	wm->head = wm->tail = 0;
+	wm->active = NULL;
+}